@@ -0,0 +1,571 @@
+/*
+ * Driver for /dev/crypto device (aka CryptoDev)
+ *
+ * This file is part of linux cryptodev.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/* Bignum operations of CIOCKEY. Modular exponentiation is mapped onto
+ * the raw RSA primitive of the kernel's "rsa" akcipher, so whichever
+ * software or hardware implementation has the highest priority does
+ * the work: CRK_MOD_EXP loads the modulus and exponent as an RSA public
+ * key and CRK_MOD_EXP_CRT the CRT parameters as a private one, and the
+ * base becomes the message. The parameters are little endian numbers,
+ * as in OpenBSD; the akcipher wants big endian ones and DER encoded
+ * keys.
+ *
+ * A private key of the kernel also carries n, e and d. OpenBSD's
+ * CRK_MOD_EXP_CRT passes p, q, x, dp, dq and qinv only, so e follows
+ * them here; n is pq and d is rebuilt as the inverse of e modulo
+ * (p-1)(q-1), which is all the bignum arithmetic done in this file.
+ *
+ * Parameters are read in and results stored apart from the operation,
+ * which the async queue runs in a worker, outside of the caller's
+ * address space.
+ */
+
+#include <linux/slab.h>
+#include <linux/uaccess.h>
+#include <asm/div64.h>
+#include <crypto/cryptodev.h>
+#include "cryptodev_int.h"
+#include "cryptlib.h"
+#include "asym.h"
+
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(4, 8, 0))
+
+/* largest parameter accepted */
+#define CRK_MAX_BITS	8192
+
+/* modulus sizes that the kernel's generic rsa takes, see
+ * rsa_check_key_length(); drivers take these too, if not more */
+static const unsigned int crk_rsa_bits[] = {
+	512, 1024, 1536, 2048, 3072, 4096
+};
+
+static void crk_strip(struct crk_num *num)
+{
+	while (num->len > 1 && num->p[0] == 0) {
+		num->p++;
+		num->len--;
+	}
+}
+
+static int crk_get_param(const struct crparam *param, struct crk_num *num)
+{
+	unsigned int i, len = DIV_ROUND_UP(param->crp_nbits, 8);
+	uint8_t tmp;
+
+	if (unlikely(!len || param->crp_nbits > CRK_MAX_BITS)) {
+		derr(1, "invalid parameter size of %u bits", param->crp_nbits);
+		return -EINVAL;
+	}
+
+	num->buf = kmalloc(len, GFP_KERNEL);
+	if (unlikely(!num->buf))
+		return -ENOMEM;
+	if (unlikely(copy_from_user(num->buf, param->crp_p, len)))
+		return -EFAULT;
+
+	for (i = 0; i < len / 2; i++) {
+		tmp = num->buf[i];
+		num->buf[i] = num->buf[len - 1 - i];
+		num->buf[len - 1 - i] = tmp;
+	}
+
+	num->p = num->buf;
+	num->len = len;
+	crk_strip(num);
+	return 0;
+}
+
+/* store the big endian number in buf as the little endian param */
+static int crk_put_param(const struct crparam *param, const uint8_t *buf,
+		unsigned int len)
+{
+	unsigned int i, size = DIV_ROUND_UP(param->crp_nbits, 8);
+	uint8_t *out;
+	int ret = 0;
+
+	while (len > 0 && buf[0] == 0) {
+		buf++;
+		len--;
+	}
+	if (unlikely(len > size)) {
+		derr(1, "%u bytes of result do not fit in %u", len, size);
+		return -EOVERFLOW;
+	}
+
+	out = kzalloc(size, GFP_KERNEL);
+	if (unlikely(!out))
+		return -ENOMEM;
+	for (i = 0; i < len; i++)
+		out[i] = buf[len - 1 - i];
+
+	if (unlikely(copy_to_user(param->crp_p, out, size)))
+		ret = -EFAULT;
+	kzfree(out);
+	return ret;
+}
+
+static unsigned int der_int_len(const struct crk_num *num)
+{
+	/* DER integers are signed */
+	return num->len + ((num->p[0] & 0x80) ? 1 : 0);
+}
+
+static unsigned int der_hdr_len(unsigned int len)
+{
+	return 2 + (len >= 0x80) + (len >= 0x100) + (len >= 0x10000);
+}
+
+static uint8_t *der_put_hdr(uint8_t *p, uint8_t tag, unsigned int len)
+{
+	*p++ = tag;
+	if (len < 0x80) {
+		*p++ = len;
+	} else if (len < 0x100) {
+		*p++ = 0x81;
+		*p++ = len;
+	} else if (len < 0x10000) {
+		*p++ = 0x82;
+		*p++ = len >> 8;
+		*p++ = len;
+	} else {
+		*p++ = 0x83;
+		*p++ = len >> 16;
+		*p++ = len >> 8;
+		*p++ = len;
+	}
+	return p;
+}
+
+/* DER encode a SEQUENCE of the count integers, which is what the RSA
+ * keys of the kernel are: (n, e) public and (0, n, e, d, p, q, dp, dq,
+ * qinv) private */
+static uint8_t *crk_rsa_key(const struct crk_num **ints, unsigned int count,
+		unsigned int *keylen)
+{
+	unsigned int i, len, seqlen = 0;
+	uint8_t *key, *p;
+
+	for (i = 0; i < count; i++) {
+		len = der_int_len(ints[i]);
+		seqlen += der_hdr_len(len) + len;
+	}
+	*keylen = der_hdr_len(seqlen) + seqlen;
+
+	key = kmalloc(*keylen, GFP_KERNEL);
+	if (unlikely(!key))
+		return NULL;
+
+	p = der_put_hdr(key, 0x30, seqlen);
+	for (i = 0; i < count; i++) {
+		len = der_int_len(ints[i]);
+		p = der_put_hdr(p, 0x02, len);
+		if (len != ints[i]->len)
+			*p++ = 0;
+		memcpy(p, ints[i]->p, ints[i]->len);
+		p += ints[i]->len;
+	}
+
+	return key;
+}
+
+/* the modulus is one of crk_rsa_bits, as rsa_check_key_length() sees it */
+static int crk_check_modulus(const struct crk_num *n)
+{
+	unsigned int i, bits = n->len * 8;
+
+	for (i = 0; i < ARRAY_SIZE(crk_rsa_bits); i++)
+		if (bits == crk_rsa_bits[i])
+			return 0;
+
+	derr(1, "%u bit moduli are not supported by the kernel's rsa", bits);
+	return -EOPNOTSUPP;
+}
+
+/* run the public or private key on in with the handle's rsa transform
+ * and keep the result, as long as the modulus n at most */
+static int crk_run(struct fcrypt *fcr, struct kernel_crypt_kop *kkop,
+		const struct crk_num **ints, unsigned int count, int priv,
+		const struct crk_num *in, const struct crk_num *n)
+{
+	unsigned int keylen, outlen = n->len;
+	uint8_t *key, *out;
+	int ret;
+
+	ret = crk_check_modulus(n);
+	if (unlikely(ret))
+		return ret;
+
+	key = crk_rsa_key(ints, count, &keylen);
+	if (unlikely(!key))
+		return -ENOMEM;
+
+	out = kmalloc(outlen, GFP_KERNEL);
+	if (unlikely(!out)) {
+		ret = -ENOMEM;
+		goto out_key;
+	}
+
+	/* the transform is allocated once per handle; its key changes
+	 * with every operation, so operations on it are serialised */
+	mutex_lock(&fcr->rsa_lock);
+	if (!fcr->rsa) {
+		fcr->rsa = cryptodev_rsa_alloc();
+		if (IS_ERR(fcr->rsa)) {
+			ret = PTR_ERR(fcr->rsa);
+			fcr->rsa = NULL;
+			mutex_unlock(&fcr->rsa_lock);
+			goto out_free;
+		}
+	}
+	/* the input is in a heap buffer, as scatterlists want */
+	ret = cryptodev_rsa_run(fcr->rsa, priv, key, keylen, (void *)in->p,
+			in->len, out, &outlen);
+	mutex_unlock(&fcr->rsa_lock);
+	if (unlikely(ret)) {
+		derr(1, "rsa operation failed: %d", ret);
+		goto out_free;
+	}
+
+	kkop->res.buf = out;
+	kkop->res.p = out;
+	kkop->res.len = outlen;
+	goto out_key;
+
+out_free:
+	kzfree(out);
+out_key:
+	kzfree(key);
+	return ret;
+}
+
+/* r = a - 1, for a > 0 */
+static int crk_dec(const struct crk_num *a, struct crk_num *r)
+{
+	unsigned int i;
+
+	r->buf = kmemdup(a->p, a->len, GFP_KERNEL);
+	if (unlikely(!r->buf))
+		return -ENOMEM;
+	r->p = r->buf;
+	r->len = a->len;
+
+	for (i = r->len; i-- > 0; )
+		if (r->buf[i]-- != 0)
+			break;
+	crk_strip(r);
+	return 0;
+}
+
+/* r = a * b, a byte of a at a time from the least significant one */
+static int crk_mul(const struct crk_num *a, const struct crk_num *b,
+		struct crk_num *r)
+{
+	unsigned int i, j, carry;
+	uint8_t *d;
+
+	r->len = a->len + b->len;
+	r->buf = kzalloc(r->len, GFP_KERNEL);
+	if (unlikely(!r->buf))
+		return -ENOMEM;
+	r->p = r->buf;
+
+	for (i = 0; i < a->len; i++) {
+		d = r->buf + r->len - 1 - i;
+		carry = 0;
+		for (j = 0; j < b->len; j++, d--) {
+			carry += *d + a->p[a->len - 1 - i] * b->p[b->len - 1 - j];
+			*d = carry;
+			carry >>= 8;
+		}
+		*d = carry;
+	}
+	crk_strip(r);
+	return 0;
+}
+
+/* r = a * k + 1, left with leading zeros for crk_div_word() */
+static int crk_mul_word_inc(const struct crk_num *a, u32 k, struct crk_num *r)
+{
+	unsigned int i;
+	u64 carry = 1;
+
+	r->len = a->len + sizeof(k);
+	r->buf = kzalloc(r->len, GFP_KERNEL);
+	if (unlikely(!r->buf))
+		return -ENOMEM;
+	r->p = r->buf;
+
+	for (i = 0; i < r->len; i++) {
+		if (i < a->len)
+			carry += (u64)a->p[a->len - 1 - i] * k;
+		r->buf[r->len - 1 - i] = carry;
+		carry >>= 8;
+	}
+	return 0;
+}
+
+/* a = a / m, returning the remainder; a must not have been stripped */
+static u32 crk_div_word(struct crk_num *a, u32 m)
+{
+	unsigned int i;
+	u32 rem = 0;
+	u64 n;
+
+	for (i = 0; i < a->len; i++) {
+		n = ((u64)rem << 8) | a->buf[i];
+		rem = do_div(n, m);
+		a->buf[i] = n;
+	}
+	crk_strip(a);
+	return rem;
+}
+
+static u32 crk_mod_word(const struct crk_num *a, u32 m)
+{
+	unsigned int i;
+	u32 rem = 0;
+	u64 n;
+
+	for (i = 0; i < a->len; i++) {
+		n = ((u64)rem << 8) | a->p[i];
+		rem = do_div(n, m);
+	}
+	return rem;
+}
+
+/* the inverse of a modulo m, by the extended Euclidean algorithm */
+static int crk_inv_word(u32 a, u32 m, u32 *inv)
+{
+	u32 r = m, newr = a, q, tmp;
+	s64 t = 0, newt = 1, stmp;
+
+	while (newr) {
+		q = r / newr;
+		stmp = t - (s64)q * newt;
+		t = newt;
+		newt = stmp;
+		tmp = r - q * newr;
+		r = newr;
+		newr = tmp;
+	}
+	if (r != 1)
+		return -EINVAL;
+
+	*inv = t < 0 ? t + m : t;
+	return 0;
+}
+
+/* CRK_MOD_EXP: base^exp mod n is the public key operation with e = exp */
+static int crk_mod_exp(struct fcrypt *fcr, struct kernel_crypt_kop *kkop)
+{
+	const struct crk_num *base = &kkop->num[0], *exp = &kkop->num[1];
+	const struct crk_num *n = &kkop->num[2];
+	const struct crk_num *ints[] = { n, exp };
+
+	return crk_run(fcr, kkop, ints, ARRAY_SIZE(ints), 0, base, n);
+}
+
+/* CRK_MOD_EXP_CRT: x^d mod pq is the private key operation, with
+ * d = (1 + k(p-1)(q-1)) / e for the k that makes it whole */
+static int crk_mod_exp_crt(struct fcrypt *fcr, struct kernel_crypt_kop *kkop)
+{
+	const struct crk_num *p = &kkop->num[0], *q = &kkop->num[1];
+	const struct crk_num *x = &kkop->num[2], *dp = &kkop->num[3];
+	const struct crk_num *dq = &kkop->num[4], *qinv = &kkop->num[5];
+	const struct crk_num *e = &kkop->num[6];
+	static const uint8_t zero;
+	const struct crk_num version = { .p = &zero, .len = 1 };
+	struct crk_num n = { NULL }, d = { NULL };
+	struct crk_num p1 = { NULL }, q1 = { NULL }, phi = { NULL };
+	const struct crk_num *ints[] = {
+		&version, &n, e, &d, p, q, dp, dq, qinv
+	};
+	unsigned int i;
+	u32 ew = 0, k;
+	int ret;
+
+	if (unlikely(e->len > sizeof(ew))) {
+		derr(1, "public exponents of more than 32 bits are not supported");
+		return -EINVAL;
+	}
+	for (i = 0; i < e->len; i++)
+		ew = ew << 8 | e->p[i];
+
+	if (unlikely(ew < 2 || (p->len == 1 && p->p[0] < 2) ||
+	             (q->len == 1 && q->p[0] < 2))) {
+		derr(1, "invalid rsa private key");
+		return -EINVAL;
+	}
+
+	ret = crk_dec(p, &p1);
+	if (likely(!ret))
+		ret = crk_dec(q, &q1);
+	if (likely(!ret))
+		ret = crk_mul(p, q, &n);
+	if (likely(!ret))
+		ret = crk_mul(&p1, &q1, &phi);
+	if (unlikely(ret))
+		goto out;
+
+	/* k = -(p-1)(q-1)^-1 mod e */
+	ret = crk_inv_word(crk_mod_word(&phi, ew), ew, &k);
+	if (unlikely(ret)) {
+		derr(1, "e is not invertible modulo (p-1)(q-1)");
+		goto out;
+	}
+	ret = crk_mul_word_inc(&phi, ew - k, &d);
+	if (unlikely(ret))
+		goto out;
+	if (unlikely(crk_div_word(&d, ew))) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	ret = crk_run(fcr, kkop, ints, ARRAY_SIZE(ints), 1, x, &n);
+
+out:
+	kzfree(phi.buf);
+	kzfree(q1.buf);
+	kzfree(p1.buf);
+	kzfree(d.buf);
+	kfree(n.buf);
+	return ret;
+}
+
+/* read the parameters of kkop->kop in, from the caller's context */
+int crypto_kop_get(struct kernel_crypt_kop *kkop)
+{
+	struct crypt_kop *kop = &kkop->kop;
+	unsigned int i, nparams;
+	int ret;
+
+	memset(kkop->num, 0, sizeof(kkop->num));
+	memset(&kkop->res, 0, sizeof(kkop->res));
+
+	switch (kop->crk_op) {
+	case CRK_MOD_EXP:
+		nparams = 3;
+		break;
+	case CRK_MOD_EXP_CRT:
+		nparams = 7;
+		break;
+	default:
+		ddebug(1, "unsupported key operation %u", kop->crk_op);
+		return -EOPNOTSUPP;
+	}
+
+	if (unlikely(kop->crk_iparams != nparams || kop->crk_oparams != 1)) {
+		derr(1, "key operation %u takes %u parameters and gives one",
+				kop->crk_op, nparams);
+		return -EINVAL;
+	}
+
+	for (i = 0; i < nparams; i++) {
+		ret = crk_get_param(&kop->crk_param[i], &kkop->num[i]);
+		if (unlikely(ret)) {
+			crypto_kop_free(kkop);
+			return ret;
+		}
+	}
+	return 0;
+}
+
+int crypto_kop_run(struct fcrypt *fcr, struct kernel_crypt_kop *kkop)
+{
+	if (kkop->kop.crk_op == CRK_MOD_EXP_CRT)
+		return crk_mod_exp_crt(fcr, kkop);
+	return crk_mod_exp(fcr, kkop);
+}
+
+/* store the result in the output parameter, from the caller's context */
+int crypto_kop_put(struct kernel_crypt_kop *kkop)
+{
+	struct crypt_kop *kop = &kkop->kop;
+	int ret;
+
+	ret = crk_put_param(&kop->crk_param[kop->crk_iparams],
+			kkop->res.p, kkop->res.len);
+	if (likely(!ret))
+		kop->crk_status = 0;
+	return ret;
+}
+
+/* the parameters may be a private key */
+void crypto_kop_free(struct kernel_crypt_kop *kkop)
+{
+	unsigned int i;
+
+	for (i = 0; i < CRK_MAXPARAM; i++) {
+		kzfree(kkop->num[i].buf);
+		kkop->num[i].buf = NULL;
+	}
+	kzfree(kkop->res.buf);
+	kkop->res.buf = NULL;
+}
+
+/* free the rsa transform of a closing handle, wiping the last key */
+void crypto_kop_release(struct fcrypt *fcr)
+{
+	if (fcr->rsa)
+		cryptodev_rsa_free(fcr->rsa);
+	fcr->rsa = NULL;
+}
+
+uint32_t crypto_asym_features(void)
+{
+	uint32_t features = 0;
+
+	if (cryptodev_rsa_has_alg())
+		features |= CRF_MOD_EXP | CRF_MOD_EXP_CRT;
+	return features;
+}
+
+#else
+
+int crypto_kop_get(struct kernel_crypt_kop *kkop)
+{
+	return -EOPNOTSUPP;
+}
+
+int crypto_kop_run(struct fcrypt *fcr, struct kernel_crypt_kop *kkop)
+{
+	return -EOPNOTSUPP;
+}
+
+int crypto_kop_put(struct kernel_crypt_kop *kkop)
+{
+	return -EOPNOTSUPP;
+}
+
+void crypto_kop_free(struct kernel_crypt_kop *kkop)
+{
+}
+
+void crypto_kop_release(struct fcrypt *fcr)
+{
+}
+
+uint32_t crypto_asym_features(void)
+{
+	return 0;
+}
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef ASYM_H
+# define ASYM_H
+
+/* a big endian number without leading zeros, buf is what to free */
+struct crk_num {
+	uint8_t *buf;
+	const uint8_t *p;
+	unsigned int len;
+};
+
+/* A CIOCKEY operation: its input parameters are read in when it is
+ * submitted and its result is kept until it is stored, so that the
+ * operation itself can run away from the caller's address space.
+ */
+struct kernel_crypt_kop {
+	struct crypt_kop kop;
+	struct crk_num num[CRK_MAXPARAM];
+	struct crk_num res;
+};
+
+int crypto_kop_get(struct kernel_crypt_kop *kkop);
+int crypto_kop_run(struct fcrypt *fcr, struct kernel_crypt_kop *kkop);
+int crypto_kop_put(struct kernel_crypt_kop *kkop);
+void crypto_kop_free(struct kernel_crypt_kop *kkop);
+void crypto_kop_release(struct fcrypt *fcr);
+uint32_t crypto_asym_features(void);
+
+#endif
@@ -45,6 +45,7 @@
 #include "zc.h"
 #include "util.h"
 #include "cryptlib.h"
+#include "stats.h"
 #include "version.h"
 
 
@@ -83,7 +84,7 @@ static int get_userbuf_tls(struct csession *ses, struct kernel_crypt_auth_op *kc
 
 	rc = __get_userbuf(caop->dst, kcaop->dst_len, 1, pagecount,
 	                   ses->pages, ses->sg, kcaop->task, kcaop->mm);
-	if (unlikely(rc)) {
+	if (unlikely(rc < 0)) {
 		derr(1, "failed to get user pages for data input");
 		return -EINVAL;
 	}
@@ -149,7 +150,7 @@ static int get_userbuf_srtp(struct csession *ses, struct kernel_crypt_auth_op *k
 
 	rc = __get_userbuf(caop->auth_src, caop->auth_len, 1, auth_pagecount,
 			   ses->pages, ses->sg, kcaop->task, kcaop->mm);
-	if (unlikely(rc)) {
+	if (unlikely(rc < 0)) {
 		derr(1, "failed to get user pages for data input");
 		return -EINVAL;
 	}
@@ -232,12 +233,16 @@ static int fill_kcaop_from_caop(struct kernel_crypt_auth_op *kcaop, struct fcryp
 	if (caop->tag_len == 0)
 		caop->tag_len = cryptodev_get_tag_len(ses_ptr);
 
-	kcaop->ivlen = caop->iv ? ses_ptr->cdata.ivsize : 0;
+	/* the session provides the IV in crypto_auth_run() */
+	if (caop->flags & COP_FLAG_KERNEL_IV)
+		kcaop->ivlen = ses_ptr->cdata.ivsize;
+	else
+		kcaop->ivlen = caop->iv ? ses_ptr->cdata.ivsize : 0;
 	kcaop->dst_len = cryptodev_get_dst_len(caop, ses_ptr);
 	kcaop->task = current;
 	kcaop->mm = current->mm;
 
-	if (caop->iv) {
+	if (caop->iv && !(caop->flags & COP_FLAG_KERNEL_IV)) {
 		ret = copy_from_user(kcaop->iv, caop->iv, kcaop->ivlen);
 		if (unlikely(ret)) {
 			derr(1, "error copying IV (%d bytes), copy_from_user returned %d for address %p",
@@ -261,7 +266,9 @@ static int fill_caop_from_kcaop(struct kernel_crypt_auth_op *kcaop, struct fcryp
 
 	kcaop->caop.len = kcaop->dst_len;
 
-	if (kcaop->ivlen && kcaop->caop.flags & COP_FLAG_WRITE_IV) {
+	/* the IV that was used, or the one to continue with */
+	if (kcaop->ivlen && kcaop->caop.iv && kcaop->caop.flags &
+			(COP_FLAG_WRITE_IV | COP_FLAG_KERNEL_IV)) {
 		ret = copy_to_user(kcaop->caop.iv,
 				kcaop->iv, kcaop->ivlen);
 		if (unlikely(ret)) {
@@ -709,6 +716,7 @@ int crypto_auth_run(struct fcrypt *fcr, struct kernel_crypt_auth_op *kcaop)
 {
 	struct csession *ses_ptr;
 	struct crypt_auth_op *caop = &kcaop->caop;
+	u64 start = ktime_get_ns();
 	int ret;
 
 	if (unlikely(caop->op != COP_ENCRYPT && caop->op != COP_DECRYPT)) {
@@ -738,6 +746,16 @@ int crypto_auth_run(struct fcrypt *fcr, struct kernel_crypt_auth_op *kcaop)
 		}
 	}
 
+	if (caop->flags & COP_FLAG_KERNEL_IV) {
+		if (unlikely(!ses_ptr->kernel_iv)) {
+			derr(1, "session has no IV, set one with CIOCSESSIV");
+			ret = -EINVAL;
+			goto out_unlock;
+		}
+		memcpy(kcaop->iv, ses_ptr->iv, ses_ptr->cdata.ivsize);
+		crypto_session_iv_advance(ses_ptr, caop->len);
+	}
+
 	cryptodev_cipher_set_iv(&ses_ptr->cdata, kcaop->iv,
 				min(ses_ptr->cdata.ivsize, kcaop->ivlen));
 
@@ -749,10 +767,19 @@ int crypto_auth_run(struct fcrypt *fcr, struct kernel_crypt_auth_op *kcaop)
 
 	ret = 0;
 
-	cryptodev_cipher_get_iv(&ses_ptr->cdata, kcaop->iv,
+	if (!(caop->flags & COP_FLAG_KERNEL_IV))
+		cryptodev_cipher_get_iv(&ses_ptr->cdata, kcaop->iv,
 				min(ses_ptr->cdata.ivsize, kcaop->ivlen));
 
 out_unlock:
 	crypto_put_session(ses_ptr);
+
+	if (unlikely(ret)) {
+		cryptodev_stat_inc(fcr, CSTAT_ERRORS);
+	} else {
+		cryptodev_stat_inc(fcr, CSTAT_AUTH_OPS);
+		cryptodev_stat_add(fcr, CSTAT_BYTES, caop->len);
+	}
+	cryptodev_stat_latency(fcr, CSTAT_LAT_AUTH_RUN, start);
 	return ret;
 }
@@ -35,11 +35,164 @@
 #include <crypto/aead.h>
 #include <linux/rtnetlink.h>
 #include <crypto/authenc.h>
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(4, 8, 0))
+# include <crypto/akcipher.h>
+#endif
 #include "cryptodev_int.h"
 #include "cipherapi.h"
+#include "cryptodev_trace.h"
 
 extern const struct crypto_type crypto_givcipher_type;
 
+/* Transform cache.
+ *
+ * Allocating the transform is the bulk of the work of creating a
+ * session. Transforms of destroyed sessions are therefore kept here,
+ * up to cryptodev_tfm_cache_size of them, and handed to the next
+ * session that uses the same algorithm, which sets its own key. On
+ * check-in a transform is rekeyed with zeroes so no key material stays
+ * behind; when that is not possible, or the cache is full, the
+ * transform is freed, which wipes its context.
+ */
+#define TFM_CIPHER	0
+#define TFM_AEAD	1
+#define TFM_HASH	2
+
+struct tfm_cache_entry {
+	struct list_head list;
+	const char *alg_name;
+	int type;
+	void *tfm;
+};
+
+static LIST_HEAD(tfm_cache);
+static DEFINE_MUTEX(tfm_cache_lock);
+static int tfm_cache_count;
+
+static const uint8_t tfm_zero_key[CRYPTO_CIPHER_MAX_KEY_LEN +
+	CRYPTO_HMAC_MAX_KEY_LEN +
+	RTA_SPACE(sizeof(struct crypto_authenc_key_param))];
+
+static void tfm_free(int type, void *tfm)
+{
+	switch (type) {
+	case TFM_CIPHER:
+		cryptodev_crypto_free_blkcipher(tfm);
+		break;
+	case TFM_AEAD:
+		crypto_free_aead(tfm);
+		break;
+	case TFM_HASH:
+		crypto_free_ahash(tfm);
+		break;
+	}
+}
+
+/* Take a transform for alg_name out of the cache, or return NULL. */
+static void *tfm_cache_get(const char *alg_name, int type)
+{
+	struct tfm_cache_entry *entry;
+	void *tfm = NULL;
+
+	mutex_lock(&tfm_cache_lock);
+	list_for_each_entry(entry, &tfm_cache, list) {
+		if (entry->type == type && !strcmp(entry->alg_name, alg_name)) {
+			list_del(&entry->list);
+			tfm_cache_count--;
+			tfm = entry->tfm;
+			kfree(entry);
+			break;
+		}
+	}
+	mutex_unlock(&tfm_cache_lock);
+
+	if (tfm)
+		ddebug(2, "reusing cached transform for %s", alg_name);
+	return tfm;
+}
+
+/* Scrub a transform and keep it in the cache, evicting the oldest
+ * entries if the cache is full. keylen is the length of the key in use,
+ * or -1 for transforms without a key. */
+static void tfm_cache_put(const char *alg_name, int type, void *tfm,
+		int keylen)
+{
+	struct tfm_cache_entry *entry, *victim;
+	LIST_HEAD(evicted);
+	int ret = 0;
+
+	if (cryptodev_tfm_cache_size <= 0)
+		goto free;
+
+	if (keylen >= 0) {
+		switch (type) {
+		case TFM_CIPHER:
+			ret = cryptodev_crypto_blkcipher_setkey(tfm,
+					tfm_zero_key, keylen);
+			break;
+		case TFM_AEAD:
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(5, 5, 0))
+			/* a session may have changed the tag size */
+			ret = crypto_aead_setauthsize(tfm,
+					crypto_aead_maxauthsize(tfm));
+			if (!ret)
+				ret = crypto_aead_setkey(tfm, tfm_zero_key, keylen);
+#else
+			/* the default tag size cannot be restored */
+			ret = -EINVAL;
+#endif
+			break;
+		case TFM_HASH:
+			ret = crypto_ahash_setkey(tfm, tfm_zero_key, keylen);
+			break;
+		}
+		/* e.g. authenc keys, which are not valid when zeroed */
+		if (ret)
+			goto free;
+	}
+
+	entry = kmalloc(sizeof(*entry), GFP_KERNEL);
+	if (unlikely(!entry))
+		goto free;
+	entry->alg_name = alg_name;
+	entry->type = type;
+	entry->tfm = tfm;
+
+	mutex_lock(&tfm_cache_lock);
+	list_add(&entry->list, &tfm_cache);
+	tfm_cache_count++;
+	while (tfm_cache_count > cryptodev_tfm_cache_size) {
+		victim = list_last_entry(&tfm_cache, struct tfm_cache_entry, list);
+		list_move(&victim->list, &evicted);
+		tfm_cache_count--;
+	}
+	mutex_unlock(&tfm_cache_lock);
+
+	list_for_each_entry_safe(entry, victim, &evicted, list) {
+		ddebug(2, "evicting cached transform for %s", entry->alg_name);
+		tfm_free(entry->type, entry->tfm);
+		kfree(entry);
+	}
+	return;
+
+free:
+	tfm_free(type, tfm);
+}
+
+void cryptodev_tfm_cache_flush(void)
+{
+	struct tfm_cache_entry *entry, *tmp;
+
+	mutex_lock(&tfm_cache_lock);
+	list_for_each_entry_safe(entry, tmp, &tfm_cache, list) {
+		list_del(&entry->list);
+		tfm_free(entry->type, entry->tfm);
+		kfree(entry);
+	}
+	tfm_cache_count = 0;
+	mutex_unlock(&tfm_cache_lock);
+}
+
 static void cryptodev_complete(struct crypto_async_request *req, int err)
 {
 	struct cryptodev_result *res = req->data;
@@ -149,7 +302,9 @@ int cryptodev_cipher_init(struct cipher_data *out, const char *alg_name,
 		struct ablkcipher_alg *alg;
 #endif
 
-		out->async.s = cryptodev_crypto_alloc_blkcipher(alg_name, 0, 0);
+		out->async.s = tfm_cache_get(alg_name, TFM_CIPHER);
+		if (!out->async.s)
+			out->async.s = cryptodev_crypto_alloc_blkcipher(alg_name, 0, 0);
 		if (unlikely(IS_ERR(out->async.s))) {
 			ddebug(1, "Failed to load cipher %s", alg_name);
 				return -EINVAL;
@@ -187,7 +342,9 @@ int cryptodev_cipher_init(struct cipher_data *out, const char *alg_name,
 
 		ret = cryptodev_crypto_blkcipher_setkey(out->async.s, keyp, keylen);
 	} else {
-		out->async.as = crypto_alloc_aead(alg_name, 0, 0);
+		out->async.as = tfm_cache_get(alg_name, TFM_AEAD);
+		if (!out->async.as)
+			out->async.as = crypto_alloc_aead(alg_name, 0, 0);
 		if (unlikely(IS_ERR(out->async.as))) {
 			ddebug(1, "Failed to load cipher %s", alg_name);
 			return -EINVAL;
@@ -208,6 +365,9 @@ int cryptodev_cipher_init(struct cipher_data *out, const char *alg_name,
 
 	out->stream = stream;
 	out->aead = aead;
+	out->unchained = strncmp(alg_name, "xts(", 4) == 0;
+	out->alg_name = alg_name;
+	out->keylen = keylen;
 
 	init_completion(&out->async.result.completion);
 
@@ -256,12 +416,13 @@ void cryptodev_cipher_deinit(struct cipher_data *cdata)
 	if (cdata->init) {
 		if (cdata->aead == 0) {
 			cryptodev_blkcipher_request_free(cdata->async.request);
-			cryptodev_crypto_free_blkcipher(cdata->async.s);
+			tfm_cache_put(cdata->alg_name, TFM_CIPHER,
+					cdata->async.s, cdata->keylen);
 		} else {
 			if (cdata->async.arequest)
 				aead_request_free(cdata->async.arequest);
-			if (cdata->async.as)
-				crypto_free_aead(cdata->async.as);
+			tfm_cache_put(cdata->alg_name, TFM_AEAD,
+					cdata->async.as, cdata->keylen);
 		}
 
 		cdata->init = 0;
@@ -272,6 +433,7 @@ static inline int waitfor(struct cryptodev_result *cr, ssize_t ret)
 {
 	switch (ret) {
 	case 0:
+		trace_cryptodev_complete(cr, 0, 0);
 		break;
 	case -EINPROGRESS:
 	case -EBUSY:
@@ -281,6 +443,7 @@ static inline int waitfor(struct cryptodev_result *cr, ssize_t ret)
 		 * This is important because otherwise hardware or driver
 		 * might try to access memory which will be freed or reused for
 		 * another request. */
+		trace_cryptodev_complete(cr, ret, cr->err);
 
 		if (unlikely(cr->err)) {
 			derr(0, "error from async request: %d", cr->err);
@@ -289,6 +452,7 @@ static inline int waitfor(struct cryptodev_result *cr, ssize_t ret)
 
 		break;
 	default:
+		trace_cryptodev_complete(cr, ret, ret);
 		return ret;
 	}
 
@@ -302,6 +466,7 @@ ssize_t cryptodev_cipher_encrypt(struct cipher_data *cdata,
 	int ret;
 
 	reinit_completion(&cdata->async.result.completion);
+	trace_cryptodev_encrypt(&cdata->async.result, len);
 
 	if (cdata->aead == 0) {
 		cryptodev_blkcipher_request_set_crypt(cdata->async.request,
@@ -325,6 +490,8 @@ ssize_t cryptodev_cipher_decrypt(struct cipher_data *cdata,
 	int ret;
 
 	reinit_completion(&cdata->async.result.completion);
+	trace_cryptodev_decrypt(&cdata->async.result, len);
+
 	if (cdata->aead == 0) {
 		cryptodev_blkcipher_request_set_crypt(cdata->async.request,
 			(struct scatterlist *)src, dst,
@@ -347,7 +514,9 @@ int cryptodev_hash_init(struct hash_data *hdata, const char *alg_name,
 {
 	int ret;
 
-	hdata->async.s = crypto_alloc_ahash(alg_name, 0, 0);
+	hdata->async.s = tfm_cache_get(alg_name, TFM_HASH);
+	if (!hdata->async.s)
+		hdata->async.s = crypto_alloc_ahash(alg_name, 0, 0);
 	if (unlikely(IS_ERR(hdata->async.s))) {
 		ddebug(1, "Failed to load transform for %s", alg_name);
 		return -EINVAL;
@@ -366,6 +535,9 @@ int cryptodev_hash_init(struct hash_data *hdata, const char *alg_name,
 
 	hdata->digestsize = crypto_ahash_digestsize(hdata->async.s);
 	hdata->alignmask = crypto_ahash_alignmask(hdata->async.s);
+	hdata->alg_name = alg_name;
+	hdata->hmac_mode = hmac_mode;
+	hdata->keylen = mackeylen;
 
 	init_completion(&hdata->async.result.completion);
 
@@ -391,7 +563,8 @@ void cryptodev_hash_deinit(struct hash_data *hdata)
 {
 	if (hdata->init) {
 		ahash_request_free(hdata->async.request);
-		crypto_free_ahash(hdata->async.s);
+		tfm_cache_put(hdata->alg_name, TFM_HASH, hdata->async.s,
+				hdata->hmac_mode ? hdata->keylen : -1);
 		hdata->init = 0;
 	}
 }
@@ -416,6 +589,7 @@ ssize_t cryptodev_hash_update(struct hash_data *hdata,
 	int ret;
 
 	reinit_completion(&hdata->async.result.completion);
+	trace_cryptodev_hash_update(&hdata->async.result, len);
 	ahash_request_set_crypt(hdata->async.request, sg, NULL, len);
 
 	ret = crypto_ahash_update(hdata->async.request);
@@ -428,6 +602,7 @@ int cryptodev_hash_final(struct hash_data *hdata, void *output)
 	int ret;
 
 	reinit_completion(&hdata->async.result.completion);
+	trace_cryptodev_hash_final(&hdata->async.result, hdata->digestsize);
 	ahash_request_set_crypt(hdata->async.request, NULL, output, 0);
 
 	ret = crypto_ahash_final(hdata->async.request);
@@ -435,3 +610,84 @@ int cryptodev_hash_final(struct hash_data *hdata, void *output)
 	return waitfor(&hdata->async.result, ret);
 }
 
+
+/* Public key */
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(4, 8, 0))
+int cryptodev_rsa_has_alg(void)
+{
+	return crypto_has_alg("rsa", CRYPTO_ALG_TYPE_AKCIPHER,
+			CRYPTO_ALG_TYPE_MASK);
+}
+
+struct crypto_akcipher *cryptodev_rsa_alloc(void)
+{
+	struct crypto_akcipher *tfm;
+
+	tfm = crypto_alloc_akcipher("rsa", 0, 0);
+	if (IS_ERR(tfm))
+		ddebug(1, "Failed to load transform for rsa");
+	return tfm;
+}
+
+void cryptodev_rsa_free(struct crypto_akcipher *tfm)
+{
+	crypto_free_akcipher(tfm);
+}
+
+/* Run the raw RSA primitive of an "rsa" akcipher: src^e mod n with
+ * the public key, or src^d mod n with a private one, DER encoded as the
+ * kernel's rsa_parse_pub_key or rsa_parse_priv_key expects it, which
+ * replaces the transform's previous key. src and dst are big endian
+ * and must not live on the stack; *dst_len is updated with the length
+ * of the result.
+ */
+int cryptodev_rsa_run(struct crypto_akcipher *tfm, int priv,
+		const void *key, unsigned int keylen,
+		void *src, unsigned int src_len,
+		void *dst, unsigned int *dst_len)
+{
+	struct akcipher_request *req;
+	struct cryptodev_result result;
+	struct scatterlist src_sg, dst_sg;
+	int ret;
+
+	if (priv)
+		ret = crypto_akcipher_set_priv_key(tfm, key, keylen);
+	else
+		ret = crypto_akcipher_set_pub_key(tfm, key, keylen);
+	if (unlikely(ret)) {
+		derr(1, "%s rejects the %s key: %d",
+				crypto_tfm_alg_driver_name(crypto_akcipher_tfm(tfm)),
+				priv ? "private" : "public", ret);
+		return ret;
+	}
+
+	if (unlikely(*dst_len < crypto_akcipher_maxsize(tfm)))
+		return -EOVERFLOW;
+
+	req = akcipher_request_alloc(tfm, GFP_KERNEL);
+	if (unlikely(!req)) {
+		derr(1, "error allocating akcipher request");
+		return -ENOMEM;
+	}
+
+	init_completion(&result.completion);
+	akcipher_request_set_callback(req, CRYPTO_TFM_REQ_MAY_BACKLOG,
+			cryptodev_complete, &result);
+	sg_init_one(&src_sg, src, src_len);
+	sg_init_one(&dst_sg, dst, *dst_len);
+	akcipher_request_set_crypt(req, &src_sg, &dst_sg, src_len, *dst_len);
+
+	trace_cryptodev_rsa(&result, src_len);
+	if (priv)
+		ret = crypto_akcipher_decrypt(req);
+	else
+		ret = crypto_akcipher_encrypt(req);
+	ret = waitfor(&result, ret);
+	if (likely(!ret))
+		*dst_len = req->dst_len;
+
+	akcipher_request_free(req);
+	return ret;
+}
+#endif
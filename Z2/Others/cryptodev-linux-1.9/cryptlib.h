@@ -15,8 +15,13 @@ struct cipher_data {
 	int blocksize;
 	int aead;
 	int stream;
+	/* the IV does not carry over from one request to the next, as
+	 * the tweak of xts, so requests must not be split */
+	int unchained;
 	int ivsize;
 	int alignmask;
+	const char *alg_name;
+	unsigned int keylen;
 	struct {
 		/* block ciphers */
 		cryptodev_crypto_blkcipher_t *s;
@@ -87,6 +92,9 @@ struct hash_data {
 	int init; /* 0 uninitialized */
 	int digestsize;
 	int alignmask;
+	const char *alg_name;
+	int hmac_mode;
+	unsigned int keylen;
 	struct {
 		struct crypto_ahash *s;
 		struct cryptodev_result result;
@@ -102,5 +110,18 @@ void cryptodev_hash_deinit(struct hash_data *hdata);
 int cryptodev_hash_init(struct hash_data *hdata, const char *alg_name,
 			int hmac_mode, void *mackey, size_t mackeylen);
 
+void cryptodev_tfm_cache_flush(void);
+
+/* Public key */
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(4, 8, 0))
+int cryptodev_rsa_has_alg(void);
+struct crypto_akcipher *cryptodev_rsa_alloc(void);
+void cryptodev_rsa_free(struct crypto_akcipher *tfm);
+int cryptodev_rsa_run(struct crypto_akcipher *tfm, int priv,
+		const void *key, unsigned int keylen,
+		void *src, unsigned int src_len,
+		void *dst, unsigned int *dst_len);
+#endif
+
 
 #endif
@@ -8,6 +8,9 @@
 #include <linux/types.h>
 #ifndef __KERNEL__
 #define __user
+#include <sys/uio.h>
+#else
+#include <linux/uio.h>
 #endif
 
 /* API extensions for linux */
@@ -218,11 +221,29 @@ struct crypt_auth_op {
 #define COP_FLAG_RESET		(1 << 6) /* multi-update reset the state.
                                           * should be used in combination
                                           * with COP_FLAG_UPDATE */
+#define COP_FLAG_REGBUF		(1 << 7) /* src and dst lie in buffers
+                                          * registered with CIOCREGBUF */
+#define COP_FLAG_KERNEL_IV	(1 << 8) /* use and advance the session IV
+                                          * set with CIOCSESSIV; iv, if
+                                          * given, receives the IV used */
 
 
-/* Stuff for bignum arithmetic and public key
- * cryptography - not supported yet by linux
- * cryptodev.
+/* Stuff for bignum arithmetic and public key cryptography.
+ *
+ * CIOCKEY runs crk_op on crk_iparams input parameters followed by
+ * crk_oparams output ones. Every parameter is a little endian number
+ * of crp_nbits bits; an output is zero padded to its size. Supported,
+ * when the kernel has an "rsa" akcipher (see CIOCASYMFEAT):
+ *  CRK_MOD_EXP     : base, exponent, modulus -> base^exponent mod modulus
+ *  CRK_MOD_EXP_CRT : p, q, x, dp, dq, qinv, e -> x^d mod pq
+ * CRK_MOD_EXP loads the modulus and exponent as an RSA public key, so
+ * use it for public key operations. CRK_MOD_EXP_CRT takes the CRT
+ * parameters of OpenBSD followed by the public exponent e, of 32 bits
+ * at most, and runs the RSA private key operation with them; d is
+ * derived from e. The limits of the kernel's rsa apply: the base must
+ * be smaller than the modulus, and moduli other than 512, 1024, 1536,
+ * 2048, 3072 and 4096 bits long fail with EOPNOTSUPP. CIOCASYNCKEY
+ * queues an operation for asynchronous completion.
  */
 
 #define	CRYPTO_ALG_FLAG_SUPPORTED	1
@@ -230,7 +251,7 @@ struct crypt_auth_op {
 #define	CRYPTO_ALG_FLAG_DSA_SHA		4
 
 struct crparam {
-	__u8	*crp_p;
+	__u8	__user *crp_p;
 	__u32	crp_nbits;
 };
 
@@ -289,4 +310,140 @@ enum cryptodev_crk_op_t {
 #define CIOCASYNCCRYPT    _IOW('c', 110, struct crypt_op)
 #define CIOCASYNCFETCH    _IOR('c', 111, struct crypt_op)
 
+/* Set the maximum number of asynchronous jobs (free, pending and
+ * done queue items) of a handle. The items are preallocated. A
+ * depth of zero only queries the current limit. On return the
+ * argument holds the limit in effect.
+ */
+#define CIOCASYNCDEPTH    _IOWR('c', 112, __u32)
+
+/* Register an eventfd that is signalled with the number of jobs
+ * completed since it was last read. Completions of a worker run are
+ * coalesced into a single event, so an application can add the
+ * eventfd to its own poll/epoll loop and fetch as many jobs as the
+ * eventfd counter reports. A negative value unregisters the eventfd.
+ */
+#define CIOCASYNCEVENTFD  _IOW('c', 113, __s32)
+
+/* Choose where the jobs of a handle are run: on the given CPU, on the
+ * CPU that submitted them (CRYPTODEV_AFFINITY_LOCAL, the default and
+ * the behaviour of earlier versions) or spread over the CPUs of the
+ * submitter's NUMA node (CRYPTODEV_AFFINITY_NODE). Queue items are
+ * allocated from the memory of that node.
+ */
+#define CRYPTODEV_AFFINITY_LOCAL	(-1)
+#define CRYPTODEV_AFFINITY_NODE		(-2)
+#define CIOCASYNCAFFINITY _IOW('c', 119, __s32)
+
+/* input of CIOCASYNCFETCHMANY */
+struct crypt_fetch_op {
+	__u32	count;		/* in: room in cops and results,
+				 * out: number of jobs fetched */
+	__u32	pad;
+	struct crypt_op	__user *cops;	/* completed jobs, as CIOCASYNCFETCH */
+	/* result of each job (0 or -errno); may be NULL, in which
+	 * case failed jobs cannot be told apart */
+	__s32	__user *results;
+};
+
+/* Fetch up to count completed jobs with a single call. Fails with
+ * EBUSY when no job has completed yet.
+ */
+#define CIOCASYNCFETCHMANY _IOWR('c', 114, struct crypt_fetch_op)
+
+/* input of CIOCREGBUF */
+struct crypt_regbuf_op {
+	__u8	__user *addr;	/* start of the buffer, must be writable */
+	__u32	len;		/* length of the buffer */
+	__u32	index;		/* out: handle to pass to CIOCUNREGBUF */
+};
+
+/* Pin a buffer for use by operations with COP_FLAG_REGBUF. Such
+ * operations skip page lookup and pinning: src and dst of the
+ * operation are resolved to the registered buffer containing them.
+ * The buffer stays pinned until CIOCUNREGBUF or until the file
+ * descriptor is closed. Its pages count against RLIMIT_MEMLOCK of
+ * the registering process, and registration fails with ENOMEM past
+ * that limit unless the process has CAP_IPC_LOCK.
+ */
+#define CIOCREGBUF        _IOWR('c', 115, struct crypt_regbuf_op)
+#define CIOCUNREGBUF      _IOW('c', 116, __u32)
+
+#define CRYPTODEV_LAT_BUCKETS	32
+
+/* output of CIOCGSTATS */
+struct crypt_stats_op {
+	__u64	ops;		/* CIOCCRYPT and async operations */
+	__u64	auth_ops;	/* CIOCAUTHCRYPT operations */
+	__u64	bytes;		/* payload processed by both */
+	__u64	errors;		/* operations that failed */
+	__u64	zc_ops;		/* run on pinned user pages */
+	__u64	regbuf_ops;	/* run on registered buffers */
+	__u64	bounce_ops;	/* copied through the bounce buffer */
+	__u64	zc_fallbacks;	/* of the latter, zero-copy attempts that
+				 * failed or met a misaligned buffer */
+	__u64	async_submitted;
+	__u64	async_fetched;
+	__u64	async_busy;	/* submissions rejected with EBUSY */
+	__u64	sessions_created;
+	__u64	sessions_destroyed;
+	__u32	async_depth;	/* current job queue limit */
+	__u32	pad;
+	/* latency histograms, bucket n counts operations that took
+	 * [2^(n-1), 2^n) nanoseconds; the last one anything longer */
+	__u64	run_latency[CRYPTODEV_LAT_BUCKETS];
+	__u64	auth_run_latency[CRYPTODEV_LAT_BUCKETS];
+};
+
+/* Performance counters of this file descriptor since it was opened.
+ * The module-wide counters are in <debugfs>/cryptodev/stats.
+ */
+#define CIOCGSTATS        _IOR('c', 117, struct crypt_stats_op)
+
+/* input of CIOCCRYPTV */
+struct crypt_vec_op {
+	__u32	ses;		/* session identifier */
+	__u16	op;		/* COP_ENCRYPT or COP_DECRYPT */
+	__u16	flags;		/* see COP_FLAG_*, except NO_ZC and REGBUF */
+	__u32	src_iovcnt;	/* at most UIO_MAXIOV */
+	__u32	dst_iovcnt;	/* 0 to operate in place */
+	const struct iovec __user *src;
+	const struct iovec __user *dst;	/* same total length as src */
+	__u8	__user *mac;
+	__u8	__user *iv;
+};
+
+/* Like CIOCCRYPT, but gather the input from and scatter the output to
+ * several buffers. The data is processed as if it was contiguous.
+ */
+#define CIOCCRYPTV        _IOW('c', 118, struct crypt_vec_op)
+
+/* input of CIOCSESSIV */
+struct crypt_sessiv_op {
+	__u32	ses;		/* session identifier */
+	__u32	iv_len;		/* the IV size of the session's cipher */
+	__u8	__user *iv;
+};
+
+/* Hand the IV of a counter mode (CTR or AEAD) session to the kernel;
+ * chaining modes such as CBC are refused, as their next IV would be
+ * known in advance. Operations with COP_FLAG_KERNEL_IV use it instead
+ * of their own and advance it before they run, so a failed operation
+ * uses it up as well: AEAD nonces are incremented as a big endian
+ * number, CTR counters by the blocks of the operation. Jobs of the
+ * async queue take their IVs in submission order.
+ */
+#define CIOCSESSIV        _IOW('c', 120, struct crypt_sessiv_op)
+
+/* Queue a CIOCKEY operation as an asynchronous job; its parameters are
+ * read at submission. CIOCASYNCFETCHKEY takes the first completed one,
+ * stores its result in the output parameter given at submission and
+ * returns its crypt_kop, or the error of the operation. Key jobs share
+ * the queue depth, the eventfd and POLLIN with the others, but
+ * CIOCASYNCFETCH and CIOCASYNCFETCHMANY pass over them. Both ioctls
+ * must be issued by the submitting process.
+ */
+#define CIOCASYNCKEY      _IOW('c', 121, struct crypt_kop)
+#define CIOCASYNCFETCHKEY _IOR('c', 122, struct crypt_kop)
+
 #endif /* L_CRYPTODEV_H */
@@ -17,6 +17,8 @@
 #include <linux/module.h>
 #include <linux/moduleparam.h>
 #include <linux/scatterlist.h>
+#include <linux/kref.h>
+#include <linux/spinlock.h>
 #include <crypto/cryptodev.h>
 #include <crypto/aead.h>
 
@@ -36,10 +38,41 @@
 
 
 extern int cryptodev_verbosity;
+extern int cryptodev_bounce_order;
+extern int cryptodev_tfm_cache_size;
+
+/* Default and maximum allocation order of the per-session bounce
+ * buffer used when an operation is not zero-copied. */
+#define DEF_BOUNCE_ORDER	4
+#define MAX_BOUNCE_ORDER	8
+
+/* maximum number of buffers registered with CIOCREGBUF per handle */
+#define CRYPTODEV_MAX_REGBUFS	16
+/* maximum size of a single registered buffer */
+#define CRYPTODEV_MAX_REGBUF_LEN	(64 * 1024 * 1024)
+
+/* a user buffer whose pages stay pinned until it is unregistered */
+struct regbuf {
+	struct kref ref;
+	uint8_t __user *addr;
+	uint32_t len;
+	unsigned int pagecount;
+	struct page **pages;
+	struct mm_struct *mm;	/* charged with the pinned pages */
+};
+
+struct cryptodev_stats;
 
 struct fcrypt {
 	struct list_head list;
 	struct mutex sem;
+	struct cryptodev_stats __percpu *stats;
+	/* registered buffers; reglock nests inside any session lock */
+	spinlock_t reglock;
+	struct regbuf *regbufs[CRYPTODEV_MAX_REGBUFS];
+	/* transform of CIOCKEY, allocated on first use */
+	struct mutex rsa_lock;
+	struct crypto_akcipher *rsa;
 };
 
 /* compatibility stuff */
@@ -91,6 +124,11 @@ struct kernel_crypt_op {
 	int digestsize;
 	uint8_t hash_output[AALG_MAX_RESULT_LEN];
 
+	/* CIOCCRYPTV: the data is described by these instead of
+	 * cop.src and cop.dst; dst_iov is NULL for in-place operation */
+	const struct iovec *src_iov, *dst_iov;
+	unsigned int src_iovcnt, dst_iovcnt;
+
 	struct task_struct *task;
 	struct mm_struct *mm;
 };
@@ -132,9 +170,18 @@ struct csession {
 	unsigned int readonly_pages;
 	struct page **pages;
 	struct scatterlist *sg;
+
+	/* bounce buffer for non zero-copy operations, allocated on use */
+	void *bounce;
+	unsigned int bounce_order;
+
+	/* IV of COP_FLAG_KERNEL_IV operations, valid once set by CIOCSESSIV */
+	int kernel_iv;
+	uint8_t iv[EALG_MAX_BLOCK_LEN];
 };
 
 struct csession *crypto_get_session_by_sid(struct fcrypt *fcr, uint32_t sid);
+void crypto_session_iv_advance(struct csession *ses_ptr, unsigned int len);
 
 static inline void crypto_put_session(struct csession *ses_ptr)
 {
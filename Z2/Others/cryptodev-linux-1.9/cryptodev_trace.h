@@ -0,0 +1,212 @@
+/* Tracepoints along the life of a request: ioctl entry and exit,
+ * page pinning, cipher, hash and rsa submission and completion, and the
+ * async queue. Enable them with
+ *   echo 1 > /sys/kernel/debug/tracing/events/cryptodev/enable
+ * Requests can be followed by the handle (pcr), the crypto result
+ * (res) or the async queue item (item) pointers.
+ */
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM cryptodev
+
+#if !defined(CRYPTODEV_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define CRYPTODEV_TRACE_H
+
+#include <linux/tracepoint.h>
+
+TRACE_EVENT(cryptodev_session_create,
+	TP_PROTO(uint32_t sid, uint32_t cipher, uint32_t mac),
+	TP_ARGS(sid, cipher, mac),
+	TP_STRUCT__entry(
+		__field(uint32_t, sid)
+		__field(uint32_t, cipher)
+		__field(uint32_t, mac)
+	),
+	TP_fast_assign(
+		__entry->sid = sid;
+		__entry->cipher = cipher;
+		__entry->mac = mac;
+	),
+	TP_printk("sid=0x%08x cipher=%u mac=%u",
+		__entry->sid, __entry->cipher, __entry->mac)
+);
+
+TRACE_EVENT(cryptodev_session_destroy,
+	TP_PROTO(uint32_t sid),
+	TP_ARGS(sid),
+	TP_STRUCT__entry(
+		__field(uint32_t, sid)
+	),
+	TP_fast_assign(
+		__entry->sid = sid;
+	),
+	TP_printk("sid=0x%08x", __entry->sid)
+);
+
+TRACE_EVENT(cryptodev_ioctl_enter,
+	TP_PROTO(const void *pcr, unsigned int cmd),
+	TP_ARGS(pcr, cmd),
+	TP_STRUCT__entry(
+		__field(const void *, pcr)
+		__field(unsigned int, cmd)
+	),
+	TP_fast_assign(
+		__entry->pcr = pcr;
+		__entry->cmd = cmd;
+	),
+	TP_printk("pcr=%p cmd=%u", __entry->pcr, _IOC_NR(__entry->cmd))
+);
+
+TRACE_EVENT(cryptodev_ioctl_exit,
+	TP_PROTO(const void *pcr, unsigned int cmd, long ret),
+	TP_ARGS(pcr, cmd, ret),
+	TP_STRUCT__entry(
+		__field(const void *, pcr)
+		__field(unsigned int, cmd)
+		__field(long, ret)
+	),
+	TP_fast_assign(
+		__entry->pcr = pcr;
+		__entry->cmd = cmd;
+		__entry->ret = ret;
+	),
+	TP_printk("pcr=%p cmd=%u ret=%ld", __entry->pcr,
+		_IOC_NR(__entry->cmd), __entry->ret)
+);
+
+TRACE_EVENT(cryptodev_pin_pages,
+	TP_PROTO(const void __user *addr, uint32_t len, unsigned int pgcount,
+		int pinned),
+	TP_ARGS(addr, len, pgcount, pinned),
+	TP_STRUCT__entry(
+		__field(const void __user *, addr)
+		__field(uint32_t, len)
+		__field(unsigned int, pgcount)
+		__field(int, pinned)
+	),
+	TP_fast_assign(
+		__entry->addr = addr;
+		__entry->len = len;
+		__entry->pgcount = pgcount;
+		__entry->pinned = pinned;
+	),
+	TP_printk("addr=%p len=%u pages=%u pinned=%d", __entry->addr,
+		__entry->len, __entry->pgcount, __entry->pinned)
+);
+
+TRACE_EVENT(cryptodev_unpin_pages,
+	TP_PROTO(unsigned int pgcount),
+	TP_ARGS(pgcount),
+	TP_STRUCT__entry(
+		__field(unsigned int, pgcount)
+	),
+	TP_fast_assign(
+		__entry->pgcount = pgcount;
+	),
+	TP_printk("pages=%u", __entry->pgcount)
+);
+
+DECLARE_EVENT_CLASS(cryptodev_submit,
+	TP_PROTO(const void *res, size_t len),
+	TP_ARGS(res, len),
+	TP_STRUCT__entry(
+		__field(const void *, res)
+		__field(size_t, len)
+	),
+	TP_fast_assign(
+		__entry->res = res;
+		__entry->len = len;
+	),
+	TP_printk("res=%p len=%zu", __entry->res, __entry->len)
+);
+
+DEFINE_EVENT(cryptodev_submit, cryptodev_encrypt,
+	TP_PROTO(const void *res, size_t len),
+	TP_ARGS(res, len)
+);
+
+DEFINE_EVENT(cryptodev_submit, cryptodev_decrypt,
+	TP_PROTO(const void *res, size_t len),
+	TP_ARGS(res, len)
+);
+
+DEFINE_EVENT(cryptodev_submit, cryptodev_hash_update,
+	TP_PROTO(const void *res, size_t len),
+	TP_ARGS(res, len)
+);
+
+DEFINE_EVENT(cryptodev_submit, cryptodev_hash_final,
+	TP_PROTO(const void *res, size_t len),
+	TP_ARGS(res, len)
+);
+
+DEFINE_EVENT(cryptodev_submit, cryptodev_rsa,
+	TP_PROTO(const void *res, size_t len),
+	TP_ARGS(res, len)
+);
+
+/* ret is what the crypto API returned on submission, err the result */
+TRACE_EVENT(cryptodev_complete,
+	TP_PROTO(const void *res, int ret, int err),
+	TP_ARGS(res, ret, err),
+	TP_STRUCT__entry(
+		__field(const void *, res)
+		__field(int, ret)
+		__field(int, err)
+	),
+	TP_fast_assign(
+		__entry->res = res;
+		__entry->ret = ret;
+		__entry->err = err;
+	),
+	TP_printk("res=%p %s err=%d", __entry->res,
+		(__entry->ret == -EINPROGRESS || __entry->ret == -EBUSY) ?
+			"async" : "sync", __entry->err)
+);
+
+DECLARE_EVENT_CLASS(cryptodev_async,
+	TP_PROTO(const void *pcr, const void *item, uint32_t sid, int result),
+	TP_ARGS(pcr, item, sid, result),
+	TP_STRUCT__entry(
+		__field(const void *, pcr)
+		__field(const void *, item)
+		__field(uint32_t, sid)
+		__field(int, result)
+	),
+	TP_fast_assign(
+		__entry->pcr = pcr;
+		__entry->item = item;
+		__entry->sid = sid;
+		__entry->result = result;
+	),
+	TP_printk("pcr=%p item=%p sid=0x%08x result=%d", __entry->pcr,
+		__entry->item, __entry->sid, __entry->result)
+);
+
+DEFINE_EVENT(cryptodev_async, cryptodev_async_enqueue,
+	TP_PROTO(const void *pcr, const void *item, uint32_t sid, int result),
+	TP_ARGS(pcr, item, sid, result)
+);
+
+DEFINE_EVENT(cryptodev_async, cryptodev_async_pickup,
+	TP_PROTO(const void *pcr, const void *item, uint32_t sid, int result),
+	TP_ARGS(pcr, item, sid, result)
+);
+
+DEFINE_EVENT(cryptodev_async, cryptodev_async_done,
+	TP_PROTO(const void *pcr, const void *item, uint32_t sid, int result),
+	TP_ARGS(pcr, item, sid, result)
+);
+
+DEFINE_EVENT(cryptodev_async, cryptodev_async_fetch,
+	TP_PROTO(const void *pcr, const void *item, uint32_t sid, int result),
+	TP_ARGS(pcr, item, sid, result)
+);
+
+#endif /* CRYPTODEV_TRACE_H */
+
+/* This part must be outside protection */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE cryptodev_trace
+#include <trace/define_trace.h>
@@ -0,0 +1,237 @@
+/*
+ * Userspace emulation of the /dev/crypto device
+ *
+ * This file is part of linux cryptodev.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/* Bignum operations of CIOCKEY on OpenSSL's BN, with the checks of the
+ * kernel's rsa that asym.c of the module runs them on, and its
+ * reconstruction of d for CRK_MOD_EXP_CRT.
+ */
+
+#include "emu.h"
+
+/* largest parameter accepted */
+#define CRK_MAX_BITS	8192
+
+/* modulus sizes that the kernel's generic rsa takes */
+static const unsigned int crk_rsa_bits[] = {
+	512, 1024, 1536, 2048, 3072, 4096
+};
+
+static int crk_get_param(const struct crparam *param, BIGNUM **num)
+{
+	unsigned int len = (param->crp_nbits + 7) / 8;
+
+	if (unlikely(!len || param->crp_nbits > CRK_MAX_BITS)) {
+		derr(1, "invalid parameter size of %u bits", param->crp_nbits);
+		return -EINVAL;
+	}
+
+	*num = BN_lebin2bn(param->crp_p, len, NULL);
+	if (unlikely(!*num))
+		return -ENOMEM;
+	BN_set_flags(*num, BN_FLG_CONSTTIME);
+	return 0;
+}
+
+/* store num as the little endian param */
+static int crk_put_param(const struct crparam *param, const BIGNUM *num)
+{
+	unsigned int size = (param->crp_nbits + 7) / 8;
+
+	if (unlikely(BN_num_bytes(num) > (int)size)) {
+		derr(1, "%d bytes of result do not fit in %u",
+				BN_num_bytes(num), size);
+		return -EOVERFLOW;
+	}
+
+	if (unlikely(BN_bn2lebinpad(num, param->crp_p, size) < 0))
+		return -EINVAL;
+	return 0;
+}
+
+/* the modulus is one of crk_rsa_bits, counted in whole bytes */
+static int crk_check_modulus(const BIGNUM *n)
+{
+	unsigned int i, bits = BN_num_bytes(n) * 8;
+
+	for (i = 0; i < sizeof(crk_rsa_bits) / sizeof(crk_rsa_bits[0]); i++)
+		if (bits == crk_rsa_bits[i])
+			return 0;
+
+	derr(1, "%u bit moduli are not supported by the kernel's rsa", bits);
+	return -EOPNOTSUPP;
+}
+
+/* base^exp mod n, as the kernel's rsa, which takes the base as a message */
+static int crk_run(BIGNUM *r, const BIGNUM *base, const BIGNUM *exp,
+		const BIGNUM *n, BN_CTX *ctx)
+{
+	int ret;
+
+	ret = crk_check_modulus(n);
+	if (unlikely(ret))
+		return ret;
+
+	if (unlikely(BN_cmp(base, n) >= 0)) {
+		derr(1, "the base must be smaller than the modulus");
+		return -EINVAL;
+	}
+
+	return BN_mod_exp(r, base, exp, n, ctx) ? 0 : -EINVAL;
+}
+
+/* CRK_MOD_EXP: base^exp mod n */
+static int crk_mod_exp(BIGNUM *r, BIGNUM **num, BN_CTX *ctx)
+{
+	return crk_run(r, num[0], num[1], num[2], ctx);
+}
+
+/* CRK_MOD_EXP_CRT: x^d mod pq, d the inverse of e modulo (p-1)(q-1) */
+static int crk_mod_exp_crt(BIGNUM *r, BIGNUM **num, BN_CTX *ctx)
+{
+	BIGNUM *p = num[0], *q = num[1], *x = num[2], *e = num[6];
+	BIGNUM *n, *d, *p1, *q1, *phi;
+	int ret = -ENOMEM;
+
+	if (unlikely(BN_num_bytes(e) > 4)) {
+		derr(1, "public exponents of more than 32 bits are not supported");
+		return -EINVAL;
+	}
+	if (unlikely(BN_cmp(e, BN_value_one()) <= 0 ||
+	             BN_cmp(p, BN_value_one()) <= 0 ||
+	             BN_cmp(q, BN_value_one()) <= 0)) {
+		derr(1, "invalid rsa private key");
+		return -EINVAL;
+	}
+
+	BN_CTX_start(ctx);
+	n = BN_CTX_get(ctx);
+	d = BN_CTX_get(ctx);
+	p1 = BN_CTX_get(ctx);
+	q1 = BN_CTX_get(ctx);
+	phi = BN_CTX_get(ctx);
+	if (unlikely(!phi || !BN_mul(n, p, q, ctx) ||
+	             !BN_sub(p1, p, BN_value_one()) ||
+	             !BN_sub(q1, q, BN_value_one()) ||
+	             !BN_mul(phi, p1, q1, ctx)))
+		goto out;
+
+	if (unlikely(!BN_mod_inverse(d, e, phi, ctx))) {
+		derr(1, "e is not invertible modulo (p-1)(q-1)");
+		ret = -EINVAL;
+		goto out;
+	}
+	BN_set_flags(d, BN_FLG_CONSTTIME);
+
+	ret = crk_run(r, x, d, n, ctx);
+
+out:
+	BN_clear(d);
+	BN_CTX_end(ctx);
+	return ret;
+}
+
+/* read the parameters of kkop->kop in */
+int crypto_kop_get(struct kernel_crypt_kop *kkop)
+{
+	struct crypt_kop *kop = &kkop->kop;
+	unsigned int i, nparams;
+	int ret;
+
+	memset(kkop->num, 0, sizeof(kkop->num));
+	kkop->res = NULL;
+
+	switch (kop->crk_op) {
+	case CRK_MOD_EXP:
+		nparams = 3;
+		break;
+	case CRK_MOD_EXP_CRT:
+		nparams = 7;
+		break;
+	default:
+		ddebug(1, "unsupported key operation %u", kop->crk_op);
+		return -EOPNOTSUPP;
+	}
+
+	if (unlikely(kop->crk_iparams != nparams || kop->crk_oparams != 1)) {
+		derr(1, "key operation %u takes %u parameters and gives one",
+				kop->crk_op, nparams);
+		return -EINVAL;
+	}
+
+	for (i = 0; i < nparams; i++) {
+		ret = crk_get_param(&kop->crk_param[i], &kkop->num[i]);
+		if (unlikely(ret)) {
+			crypto_kop_free(kkop);
+			return ret;
+		}
+	}
+	return 0;
+}
+
+int crypto_kop_run(struct kernel_crypt_kop *kkop)
+{
+	BN_CTX *ctx;
+	int ret = -ENOMEM;
+
+	ctx = BN_CTX_secure_new();
+	kkop->res = BN_new();
+	if (unlikely(!ctx || !kkop->res))
+		goto out;
+
+	if (kkop->kop.crk_op == CRK_MOD_EXP_CRT)
+		ret = crk_mod_exp_crt(kkop->res, kkop->num, ctx);
+	else
+		ret = crk_mod_exp(kkop->res, kkop->num, ctx);
+
+out:
+	BN_CTX_free(ctx);
+	return ret;
+}
+
+/* store the result in the output parameter */
+int crypto_kop_put(struct kernel_crypt_kop *kkop)
+{
+	struct crypt_kop *kop = &kkop->kop;
+	int ret;
+
+	ret = crk_put_param(&kop->crk_param[kop->crk_iparams], kkop->res);
+	if (likely(!ret))
+		kop->crk_status = 0;
+	return ret;
+}
+
+/* the parameters may be a private key */
+void crypto_kop_free(struct kernel_crypt_kop *kkop)
+{
+	unsigned int i;
+
+	for (i = 0; i < CRK_MAXPARAM; i++) {
+		BN_clear_free(kkop->num[i]);
+		kkop->num[i] = NULL;
+	}
+	BN_clear_free(kkop->res);
+	kkop->res = NULL;
+}
+
+uint32_t crypto_asym_features(void)
+{
+	return CRF_MOD_EXP | CRF_MOD_EXP_CRT;
+}
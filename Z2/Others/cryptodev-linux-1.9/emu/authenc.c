@@ -0,0 +1,553 @@
+/*
+ * Userspace emulation of the /dev/crypto device
+ *
+ * This file is part of linux cryptodev.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/* CIOCAUTHCRYPT: AEAD, TLS and SRTP operations as authenc.c of the
+ * module does them.
+ */
+
+#include <openssl/crypto.h>
+#include "emu.h"
+
+#define MAX_SRTP_AUTH_DATA_DIFF 256
+
+/*
+ * Return tag (digest) length for authenticated encryption
+ * If the cipher and digest are separate, hdata.init is set - just return
+ * digest length. Otherwise return digest length for aead ciphers
+ */
+static int cryptodev_get_tag_len(struct csession *ses_ptr)
+{
+	if (ses_ptr->hdata.init)
+		return ses_ptr->hdata.digestsize;
+	else
+		return ses_ptr->cdata.tag_size;
+}
+
+/*
+ * Calculate destination buffer length for authenticated encryption. The
+ * expectation is that user-space code allocates exactly the same space for
+ * destination buffer before calling cryptodev. The result is cipher-dependent.
+ */
+static int cryptodev_get_dst_len(struct crypt_auth_op *caop, struct csession *ses_ptr)
+{
+	int dst_len = caop->len;
+	if (caop->op == COP_DECRYPT)
+		return dst_len;
+
+	dst_len += caop->tag_len;
+
+	/* for TLS always add some padding so the total length is rounded to
+	 * cipher block size */
+	if (caop->flags & COP_FLAG_AEAD_TLS_TYPE) {
+		int bs = ses_ptr->cdata.blocksize;
+		dst_len += bs - (dst_len % bs);
+	}
+
+	return dst_len;
+}
+
+static int fill_kcaop_from_caop(struct kernel_crypt_auth_op *kcaop, struct fcrypt *fcr)
+{
+	struct crypt_auth_op *caop = &kcaop->caop;
+	struct csession *ses_ptr;
+	int ret;
+
+	/* this also enters ses_ptr->sem */
+	ses_ptr = crypto_get_session_by_sid(fcr, caop->ses);
+	if (unlikely(!ses_ptr)) {
+		derr(1, "invalid session ID=0x%08X", caop->ses);
+		return -EINVAL;
+	}
+
+	if (caop->flags & COP_FLAG_AEAD_TLS_TYPE || caop->flags & COP_FLAG_AEAD_SRTP_TYPE) {
+		if (caop->src != caop->dst) {
+			derr(1, "Non-inplace encryption and decryption is not efficient and not implemented");
+			ret = -EINVAL;
+			goto out_unlock;
+		}
+	}
+
+	if (caop->tag_len == 0)
+		caop->tag_len = cryptodev_get_tag_len(ses_ptr);
+
+	/* the session provides the IV in crypto_auth_run() */
+	if (caop->flags & COP_FLAG_KERNEL_IV)
+		kcaop->ivlen = ses_ptr->cdata.ivsize;
+	else
+		kcaop->ivlen = caop->iv ? ses_ptr->cdata.ivsize : 0;
+	kcaop->dst_len = cryptodev_get_dst_len(caop, ses_ptr);
+
+	if (caop->iv && !(caop->flags & COP_FLAG_KERNEL_IV))
+		memcpy(kcaop->iv, caop->iv, kcaop->ivlen);
+
+	ret = 0;
+
+out_unlock:
+	crypto_put_session(ses_ptr);
+	return ret;
+}
+
+static int fill_caop_from_kcaop(struct kernel_crypt_auth_op *kcaop, struct fcrypt *fcr)
+{
+	kcaop->caop.len = kcaop->dst_len;
+
+	/* the IV that was used, or the one to continue with */
+	if (kcaop->ivlen && kcaop->caop.iv && kcaop->caop.flags &
+			(COP_FLAG_WRITE_IV | COP_FLAG_KERNEL_IV))
+		memcpy(kcaop->caop.iv, kcaop->iv, kcaop->ivlen);
+	return 0;
+}
+
+int kcaop_from_user(struct kernel_crypt_auth_op *kcaop,
+			struct fcrypt *fcr, void *arg)
+{
+	memcpy(&kcaop->caop, arg, sizeof(kcaop->caop));
+
+	return fill_kcaop_from_caop(kcaop, fcr);
+}
+
+int kcaop_to_user(struct kernel_crypt_auth_op *kcaop,
+		struct fcrypt *fcr, void *arg)
+{
+	int ret;
+
+	ret = fill_caop_from_kcaop(kcaop, fcr);
+	if (unlikely(ret)) {
+		derr(1, "fill_caop_from_kcaop");
+		return ret;
+	}
+
+	memcpy(arg, &kcaop->caop, sizeof(kcaop->caop));
+	return 0;
+}
+
+static int pad_record(uint8_t *dst, int len, int block_size)
+{
+	int pad_size = block_size - (len % block_size);
+
+	memset(dst + len, pad_size - 1, pad_size);
+
+	return pad_size;
+}
+
+static int verify_tls_record_pad(const uint8_t *dst, int len, int block_size)
+{
+	uint8_t pad_size;
+	int i;
+
+	pad_size = dst[len - 1];
+
+	if (pad_size + 1 > len) {
+		derr(1, "Pad size: %d", pad_size);
+		return -EBADMSG;
+	}
+
+	for (i = 0; i < pad_size; i++)
+		if (dst[len - pad_size - 1 + i] != pad_size) {
+			derr(1, "Pad size: %u, pad: %d", pad_size,
+					dst[len - pad_size - 1 + i]);
+			return -EBADMSG;
+		}
+
+	return pad_size + 1;
+}
+
+/* Authenticate and encrypt the TLS way (also perform padding).
+ * During decryption it verifies the pad and tag and returns -EBADMSG on error.
+ */
+static int
+tls_auth_n_crypt(struct csession *ses_ptr, struct kernel_crypt_auth_op *kcaop,
+		 const uint8_t *auth, uint32_t auth_len,
+		 uint8_t *dst, uint32_t len)
+{
+	int ret, fail = 0;
+	struct crypt_auth_op *caop = &kcaop->caop;
+	uint8_t vhash[AALG_MAX_RESULT_LEN];
+	uint8_t hash_output[AALG_MAX_RESULT_LEN];
+
+	/* TLS authenticates the plaintext except for the padding.
+	 */
+	if (caop->op == COP_ENCRYPT) {
+		if (ses_ptr->hdata.init != 0) {
+			if (auth_len > 0) {
+				ret = cryptodev_hash_update(&ses_ptr->hdata,
+								auth, auth_len);
+				if (unlikely(ret))
+					return ret;
+			}
+
+			if (len > 0) {
+				ret = cryptodev_hash_update(&ses_ptr->hdata,
+								dst, len);
+				if (unlikely(ret))
+					return ret;
+			}
+
+			ret = cryptodev_hash_final(&ses_ptr->hdata, hash_output);
+			if (unlikely(ret))
+				return ret;
+
+			memcpy(dst + len, hash_output, caop->tag_len);
+			len += caop->tag_len;
+		}
+
+		if (ses_ptr->cdata.init != 0) {
+			if (ses_ptr->cdata.blocksize > 1) {
+				ret = pad_record(dst, len, ses_ptr->cdata.blocksize);
+				len += ret;
+			}
+
+			ret = cryptodev_cipher_encrypt(&ses_ptr->cdata,
+							dst, dst, len);
+			if (unlikely(ret)) {
+				derr(0, "cryptodev_cipher_encrypt: %d", ret);
+				return ret;
+			}
+		}
+	} else {
+		if (ses_ptr->cdata.init != 0) {
+			ret = cryptodev_cipher_decrypt(&ses_ptr->cdata,
+							dst, dst, len);
+
+			if (unlikely(ret)) {
+				derr(0, "cryptodev_cipher_decrypt: %d", ret);
+				return ret;
+			}
+
+			if (ses_ptr->cdata.blocksize > 1) {
+				ret = verify_tls_record_pad(dst, len, ses_ptr->cdata.blocksize);
+				if (unlikely(ret < 0)) {
+					derr(2, "verify_record_pad: %d", ret);
+					fail = 1;
+				} else {
+					len -= ret;
+				}
+			}
+		}
+
+		if (ses_ptr->hdata.init != 0) {
+			if (unlikely(caop->tag_len > sizeof(vhash) || caop->tag_len > len)) {
+				derr(1, "Illegal tag len size");
+				return -EINVAL;
+			}
+
+			memcpy(vhash, dst + len - caop->tag_len, caop->tag_len);
+			len -= caop->tag_len;
+
+			if (auth_len > 0) {
+				ret = cryptodev_hash_update(&ses_ptr->hdata,
+								auth, auth_len);
+				if (unlikely(ret))
+					return ret;
+			}
+
+			if (len > 0) {
+				ret = cryptodev_hash_update(&ses_ptr->hdata,
+								dst, len);
+				if (unlikely(ret))
+					return ret;
+			}
+
+			ret = cryptodev_hash_final(&ses_ptr->hdata, hash_output);
+			if (unlikely(ret))
+				return ret;
+
+			if (CRYPTO_memcmp(vhash, hash_output, caop->tag_len) != 0 || fail != 0) {
+				derr(2, "MAC verification failed (tag_len: %d)", caop->tag_len);
+				return -EBADMSG;
+			}
+		}
+	}
+	kcaop->dst_len = len;
+	return 0;
+}
+
+/* Authenticate and encrypt the SRTP way. During decryption
+ * it verifies the tag and returns -EBADMSG on error.
+ */
+static int
+srtp_auth_n_crypt(struct csession *ses_ptr, struct kernel_crypt_auth_op *kcaop,
+		  const uint8_t *auth, uint32_t auth_len,
+		  uint8_t *dst, uint32_t len)
+{
+	int ret;
+	struct crypt_auth_op *caop = &kcaop->caop;
+	uint8_t hash_output[AALG_MAX_RESULT_LEN];
+
+	/* SRTP authenticates the encrypted data.
+	 */
+	if (caop->op == COP_ENCRYPT) {
+		if (ses_ptr->cdata.init != 0) {
+			ret = cryptodev_cipher_encrypt(&ses_ptr->cdata,
+							dst, dst, len);
+			if (unlikely(ret)) {
+				derr(0, "cryptodev_cipher_encrypt: %d", ret);
+				return ret;
+			}
+		}
+
+		if (ses_ptr->hdata.init != 0) {
+			ret = cryptodev_hash_update(&ses_ptr->hdata,
+							auth, auth_len);
+			if (unlikely(ret))
+				return ret;
+
+			ret = cryptodev_hash_final(&ses_ptr->hdata, hash_output);
+			if (unlikely(ret))
+				return ret;
+
+			memcpy(caop->tag, hash_output, caop->tag_len);
+		}
+
+	} else {
+		if (ses_ptr->hdata.init != 0) {
+			if (unlikely(caop->tag_len > sizeof(hash_output) || caop->tag_len > len)) {
+				derr(1, "Illegal tag len size");
+				return -EINVAL;
+			}
+
+			ret = cryptodev_hash_update(&ses_ptr->hdata,
+							auth, auth_len);
+			if (unlikely(ret))
+				return ret;
+
+			ret = cryptodev_hash_final(&ses_ptr->hdata, hash_output);
+			if (unlikely(ret))
+				return ret;
+
+			if (CRYPTO_memcmp(caop->tag, hash_output, caop->tag_len) != 0) {
+				derr(2, "MAC verification failed");
+				return -EBADMSG;
+			}
+		}
+
+		if (ses_ptr->cdata.init != 0) {
+			ret = cryptodev_cipher_decrypt(&ses_ptr->cdata,
+							dst, dst, len);
+
+			if (unlikely(ret)) {
+				derr(0, "cryptodev_cipher_decrypt: %d", ret);
+				return ret;
+			}
+		}
+
+	}
+	kcaop->dst_len = len;
+	return 0;
+}
+
+/* Typical AEAD (i.e. GCM) encryption/decryption.
+ * During decryption the tag is verified.
+ */
+static int
+auth_n_crypt(struct csession *ses_ptr, struct kernel_crypt_auth_op *kcaop,
+		  const uint8_t *auth, uint32_t auth_len,
+		  const uint8_t *src, uint8_t *dst, uint32_t len)
+{
+	int ret;
+	struct crypt_auth_op *caop = &kcaop->caop;
+	int max_tag_len;
+
+	max_tag_len = ses_ptr->cdata.tag_size;
+	if (unlikely(caop->tag_len > max_tag_len)) {
+		derr(0, "Illegal tag length: %d", caop->tag_len);
+		return -EINVAL;
+	}
+
+	if (caop->tag_len == 0)
+		caop->tag_len = max_tag_len;
+
+	/* a plain stream cipher, without tag */
+	if (!ses_ptr->cdata.aead) {
+		if (caop->op == COP_ENCRYPT)
+			ret = cryptodev_cipher_encrypt(&ses_ptr->cdata, src, dst, len);
+		else
+			ret = cryptodev_cipher_decrypt(&ses_ptr->cdata, src, dst, len);
+		kcaop->dst_len = len;
+		return ret;
+	}
+
+	if (caop->op == COP_ENCRYPT) {
+		ret = cryptodev_cipher_aead(&ses_ptr->cdata, 1, auth, auth_len,
+				src, dst, len, dst + len, caop->tag_len);
+		if (unlikely(ret)) {
+			derr(0, "cryptodev_cipher_encrypt: %d", ret);
+			return ret;
+		}
+		kcaop->dst_len = len + caop->tag_len;
+		caop->tag = caop->dst + len;
+	} else {
+		if (unlikely(len < caop->tag_len))
+			return -EINVAL;
+
+		/* the tag is read before the plaintext may overwrite it */
+		ret = cryptodev_cipher_aead(&ses_ptr->cdata, 0, auth, auth_len,
+				src, dst, len - caop->tag_len,
+				(uint8_t *)src + len - caop->tag_len, caop->tag_len);
+		if (unlikely(ret)) {
+			derr(0, "cryptodev_cipher_decrypt: %d", ret);
+			return ret;
+		}
+		kcaop->dst_len = len - caop->tag_len;
+		caop->tag = caop->dst + len - caop->tag_len;
+	}
+
+	return 0;
+}
+
+static int
+__crypto_auth_run(struct csession *ses_ptr, struct kernel_crypt_auth_op *kcaop)
+{
+	struct crypt_auth_op *caop = &kcaop->caop;
+	const uint8_t *auth = NULL;
+	int diff;
+
+	if (caop->flags & COP_FLAG_AEAD_SRTP_TYPE) {
+		if (unlikely(ses_ptr->cdata.init != 0 &&
+		             (ses_ptr->cdata.stream == 0 ||
+			      ses_ptr->cdata.aead != 0))) {
+			derr(0, "Only stream modes are allowed in SRTP mode (but not AEAD)");
+			return -EINVAL;
+		}
+
+		if (caop->dst == NULL && caop->auth_src == NULL) {
+			derr(1, "dst and auth_src cannot be both null");
+			return -EINVAL;
+		}
+
+		if (unlikely(kcaop->dst_len == 0 || caop->auth_len == 0)) {
+			dwarning(1, "Destination length cannot be zero");
+			return -EINVAL;
+		}
+
+		/* Note that in SRTP auth data overlap with data to be encrypted (dst) */
+		diff = (int)(caop->src - caop->auth_src);
+		if (diff > MAX_SRTP_AUTH_DATA_DIFF || diff < 0) {
+			dwarning(1, "auth_src must overlap with src (diff: %d).", diff);
+			return -EINVAL;
+		}
+
+		return srtp_auth_n_crypt(ses_ptr, kcaop, caop->auth_src,
+				caop->auth_len, caop->dst, caop->len);
+	}
+
+	/* TLS and normal cases, where the module copies the auth data to a page */
+	if (unlikely(caop->auth_len > MAX_AUTH_LEN)) {
+		derr(1, "auth data len is excessive.");
+		return -EINVAL;
+	}
+	if (caop->auth_src && caop->auth_len > 0)
+		auth = caop->auth_src;
+
+	if (caop->flags & COP_FLAG_AEAD_TLS_TYPE && ses_ptr->cdata.aead == 0) {
+		if (caop->dst == NULL || kcaop->dst_len == 0) {
+			dwarning(1, "Destination length cannot be zero");
+			return -EINVAL;
+		}
+
+		return tls_auth_n_crypt(ses_ptr, kcaop, auth, auth ? caop->auth_len : 0,
+				caop->dst, caop->len);
+	}
+
+	if (unlikely(ses_ptr->cdata.init == 0 ||
+	             (ses_ptr->cdata.stream == 0 &&
+		      ses_ptr->cdata.aead == 0))) {
+		derr(0, "Only stream and AEAD ciphers are allowed for authenc");
+		return -EINVAL;
+	}
+
+	if (unlikely(caop->len && (!caop->src || !caop->dst)))
+		return -EFAULT;
+
+	return auth_n_crypt(ses_ptr, kcaop, auth, auth ? caop->auth_len : 0,
+			caop->src, caop->dst, caop->len);
+}
+
+
+int crypto_auth_run(struct fcrypt *fcr, struct kernel_crypt_auth_op *kcaop)
+{
+	struct csession *ses_ptr;
+	struct crypt_auth_op *caop = &kcaop->caop;
+	uint64_t start = cryptodev_get_ns();
+	int ret;
+
+	if (unlikely(caop->op != COP_ENCRYPT && caop->op != COP_DECRYPT)) {
+		ddebug(1, "invalid operation op=%u", caop->op);
+		return -EINVAL;
+	}
+
+	/* this also enters ses_ptr->sem */
+	ses_ptr = crypto_get_session_by_sid(fcr, caop->ses);
+	if (unlikely(!ses_ptr)) {
+		derr(1, "invalid session ID=0x%08X", caop->ses);
+		return -EINVAL;
+	}
+
+	if (unlikely(ses_ptr->cdata.init == 0)) {
+		derr(1, "cipher context not initialized");
+		ret = -EINVAL;
+		goto out_unlock;
+	}
+
+	/* If we have a hash/mac handle reset its state */
+	if (ses_ptr->hdata.init != 0) {
+		ret = cryptodev_hash_reset(&ses_ptr->hdata);
+		if (unlikely(ret)) {
+			derr(1, "error in cryptodev_hash_reset()");
+			goto out_unlock;
+		}
+	}
+
+	if (caop->flags & COP_FLAG_KERNEL_IV) {
+		if (unlikely(!ses_ptr->kernel_iv)) {
+			derr(1, "session has no IV, set one with CIOCSESSIV");
+			ret = -EINVAL;
+			goto out_unlock;
+		}
+		memcpy(kcaop->iv, ses_ptr->iv, ses_ptr->cdata.ivsize);
+		crypto_session_iv_advance(ses_ptr, caop->len);
+	}
+
+	cryptodev_cipher_set_iv(&ses_ptr->cdata, kcaop->iv,
+				min(ses_ptr->cdata.ivsize, kcaop->ivlen));
+
+	ret = __crypto_auth_run(ses_ptr, kcaop);
+	if (unlikely(ret)) {
+		derr(1, "error in __crypto_auth_run()");
+		goto out_unlock;
+	}
+
+	if (!(caop->flags & COP_FLAG_KERNEL_IV))
+		cryptodev_cipher_get_iv(&ses_ptr->cdata, kcaop->iv,
+				min(ses_ptr->cdata.ivsize, kcaop->ivlen));
+
+out_unlock:
+	crypto_put_session(ses_ptr);
+
+	if (unlikely(ret)) {
+		cryptodev_stat_inc(fcr, CSTAT_ERRORS);
+	} else {
+		cryptodev_stat_inc(fcr, CSTAT_AUTH_OPS);
+		cryptodev_stat_add(fcr, CSTAT_BYTES, caop->len);
+	}
+	cryptodev_stat_latency(fcr, CSTAT_LAT_AUTH_RUN, start);
+	return ret;
+}
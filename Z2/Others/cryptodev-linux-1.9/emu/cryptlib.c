@@ -0,0 +1,450 @@
+/*
+ * Userspace emulation of the /dev/crypto device
+ *
+ * This file is part of linux cryptodev.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/* The transforms of the module, done by OpenSSL. Every session keeps
+ * an encryption and a decryption context with the key schedule ready,
+ * so an operation only loads the IV. The IV is carried between calls
+ * in cdata->iv, as the kernel does in req->iv, so a long operation
+ * can be split into several calls without breaking the chain.
+ */
+
+#include <limits.h>
+#include <openssl/core_names.h>
+#include <openssl/err.h>
+#include <openssl/params.h>
+#include <openssl/provider.h>
+#include "emu.h"
+
+static pthread_once_t crypto_once = PTHREAD_ONCE_INIT;
+
+static void crypto_load_providers(void)
+{
+	/* DES and blowfish are in the legacy provider. Loading a provider
+	 * explicitly disables the implicit default one, so load both. */
+	OSSL_PROVIDER_load(NULL, "default");
+	if (!OSSL_PROVIDER_load(NULL, "legacy"))
+		ddebug(1, "no legacy provider, DES and blowfish are unavailable");
+	ERR_clear_error();
+}
+
+void cryptodev_emu_crypto_init(void)
+{
+	pthread_once(&crypto_once, crypto_load_providers);
+}
+
+/* the kernel algorithms of crypto_create_session(), %u is the key size
+ * in bits */
+static const struct {
+	const char *alg_name;
+	const char *evp_name;
+} cipher_map[] = {
+	{ "cbc(des)", "DES-CBC" },
+	{ "cbc(des3_ede)", "DES-EDE3-CBC" },
+	{ "cbc(blowfish)", "BF-CBC" },
+	{ "cbc(aes)", "AES-%u-CBC" },
+	{ "ecb(aes)", "AES-%u-ECB" },
+	{ "cbc(camellia)", "CAMELLIA-%u-CBC" },
+	{ "ctr(aes)", "AES-%u-CTR" },
+	{ "gcm(aes)", "AES-%u-GCM" },
+	{ "xts(aes)", "AES-%u-XTS" },
+};
+
+static const struct {
+	const char *alg_name;
+	const char *evp_name;
+} hash_map[] = {
+	{ "md5", "MD5" },
+	{ "rmd160", "RIPEMD160" },
+	{ "sha1", "SHA1" },
+	{ "sha224", "SHA224" },
+	{ "sha256", "SHA256" },
+	{ "sha384", "SHA384" },
+	{ "sha512", "SHA512" },
+};
+
+/* EVP_CipherUpdate() takes an int, feed it at most this much at once;
+ * a multiple of every block size */
+#define MAX_UPDATE	(1 << 30)
+
+static int cipher_ctx_init(EVP_CIPHER_CTX *ctx, const EVP_CIPHER *evp,
+		const uint8_t *key, size_t keylen, int enc)
+{
+	if (unlikely(EVP_CipherInit_ex(ctx, evp, NULL, NULL, NULL, enc) != 1 ||
+	             EVP_CIPHER_CTX_set_key_length(ctx, keylen) != 1 ||
+	             EVP_CipherInit_ex(ctx, NULL, NULL, key, NULL, enc) != 1)) {
+		ERR_clear_error();
+		return -EINVAL;
+	}
+
+	EVP_CIPHER_CTX_set_padding(ctx, 0);
+	return 0;
+}
+
+int cryptodev_cipher_init(struct cipher_data *out, const char *alg_name,
+			  const uint8_t *key, size_t keylen, int stream, int aead)
+{
+	const char *evp_name = NULL;
+	char name[32];
+	unsigned int i, bits;
+	int ret;
+
+	memset(out, 0, sizeof(*out));
+	out->alg_name = alg_name;
+	out->stream = stream;
+	out->aead = aead;
+	out->unchained = strncmp(alg_name, "xts(", 4) == 0;
+
+	if (strcmp(alg_name, "ecb(cipher_null)") == 0) {
+		out->blocksize = 1;
+		out->init = 1;
+		return 0;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(cipher_map); i++)
+		if (strcmp(alg_name, cipher_map[i].alg_name) == 0)
+			evp_name = cipher_map[i].evp_name;
+	if (unlikely(!evp_name))
+		return -EINVAL;
+
+	if (strstr(evp_name, "%u")) {
+		/* an xts key is two AES keys, named after one */
+		bits = strstr(evp_name, "XTS") ? keylen * 4 : keylen * 8;
+		if (unlikely(bits != 128 && bits != 192 && bits != 256)) {
+			ddebug(1, "invalid key size %zu for %s", keylen, alg_name);
+			return -EINVAL;
+		}
+		snprintf(name, sizeof(name), evp_name, bits);
+	} else {
+		snprintf(name, sizeof(name), "%s", evp_name);
+	}
+
+	out->evp = EVP_CIPHER_fetch(NULL, name, NULL);
+	if (unlikely(!out->evp)) {
+		ddebug(1, "%s is not available", name);
+		ERR_clear_error();
+		return -EINVAL;
+	}
+
+	out->enc = EVP_CIPHER_CTX_new();
+	out->dec = EVP_CIPHER_CTX_new();
+	if (unlikely(!out->enc || !out->dec)) {
+		ret = -ENOMEM;
+		goto error;
+	}
+
+	ret = cipher_ctx_init(out->enc, out->evp, key, keylen, 1);
+	if (likely(!ret))
+		ret = cipher_ctx_init(out->dec, out->evp, key, keylen, 0);
+	if (unlikely(ret)) {
+		ddebug(1, "setting key failed for %s-%zu", alg_name, keylen * 8);
+		goto error;
+	}
+
+	out->blocksize = EVP_CIPHER_get_block_size(out->evp);
+	/* OpenSSL counts xts as a stream mode, the kernel's xts(aes) wants
+	 * whole AES blocks */
+	if (EVP_CIPHER_get_mode(out->evp) == EVP_CIPH_XTS_MODE)
+		out->blocksize = 16;
+	out->ivsize = EVP_CIPHER_get_iv_length(out->evp);
+	/* the kernel's maximum tag size of gcm(aes) */
+	if (aead)
+		out->tag_size = 16;
+	out->init = 1;
+	return 0;
+
+error:
+	cryptodev_cipher_deinit(out);
+	return ret;
+}
+
+void cryptodev_cipher_deinit(struct cipher_data *cdata)
+{
+	EVP_CIPHER_CTX_free(cdata->enc);
+	EVP_CIPHER_CTX_free(cdata->dec);
+	EVP_CIPHER_free(cdata->evp);
+	memset(cdata, 0, sizeof(*cdata));
+}
+
+static int cipher_run(struct cipher_data *cdata, EVP_CIPHER_CTX *ctx,
+		const uint8_t *src, uint8_t *dst, size_t len)
+{
+	int chunk, outl;
+
+	if (!cdata->evp) {
+		if (dst != src)
+			memmove(dst, src, len);
+		return 0;
+	}
+
+	if (cdata->ivsize &&
+	    unlikely(EVP_CipherInit_ex(ctx, NULL, NULL, NULL, cdata->iv, -1) != 1))
+		goto error;
+
+	while (len > 0) {
+		chunk = min(len, MAX_UPDATE);
+		if (unlikely(EVP_CipherUpdate(ctx, dst, &outl, src, chunk) != 1 ||
+		             outl != chunk))
+			goto error;
+		src += chunk;
+		dst += chunk;
+		len -= chunk;
+	}
+
+	/* the chaining value, or the next counter */
+	if (cdata->ivsize &&
+	    unlikely(EVP_CIPHER_CTX_get_updated_iv(ctx, cdata->iv,
+	                                           cdata->ivsize) != 1))
+		goto error;
+	return 0;
+
+error:
+	ERR_clear_error();
+	return -EINVAL;
+}
+
+int cryptodev_cipher_encrypt(struct cipher_data *cdata,
+			     const void *src, void *dst, size_t len)
+{
+	return cipher_run(cdata, cdata->enc, src, dst, len);
+}
+
+int cryptodev_cipher_decrypt(struct cipher_data *cdata,
+			     const void *src, void *dst, size_t len)
+{
+	return cipher_run(cdata, cdata->dec, src, dst, len);
+}
+
+/* AEAD encryption writes the tag to tag, decryption checks it and
+ * fails with -EBADMSG on mismatch. The IV is left as it was, as the
+ * kernel's gcm does. */
+int cryptodev_cipher_aead(struct cipher_data *cdata, int encrypt,
+			  const void *auth, size_t auth_len,
+			  const void *src, void *dst, size_t len,
+			  uint8_t *tag, size_t tag_len)
+{
+	EVP_CIPHER_CTX *ctx = encrypt ? cdata->enc : cdata->dec;
+	int outl;
+
+	if (unlikely(len > INT_MAX || auth_len > INT_MAX))
+		return -EINVAL;
+
+	if (unlikely(EVP_CipherInit_ex(ctx, NULL, NULL, NULL, cdata->iv, -1) != 1))
+		goto error;
+	if (auth_len &&
+	    unlikely(EVP_CipherUpdate(ctx, NULL, &outl, auth, auth_len) != 1))
+		goto error;
+	if (!encrypt &&
+	    unlikely(EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_TAG, tag_len,
+	                                 tag) != 1))
+		goto error;
+	if (len && unlikely(EVP_CipherUpdate(ctx, dst, &outl, src, len) != 1))
+		goto error;
+
+	if (unlikely(EVP_CipherFinal_ex(ctx, (uint8_t *)dst + len, &outl) != 1)) {
+		if (!encrypt) {
+			ERR_clear_error();
+			return -EBADMSG;
+		}
+		goto error;
+	}
+
+	if (encrypt &&
+	    unlikely(EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_GET_TAG, tag_len,
+	                                 tag) != 1))
+		goto error;
+	return 0;
+
+error:
+	ERR_clear_error();
+	return -EINVAL;
+}
+
+const char *cryptodev_cipher_driver_name(struct cipher_data *cdata)
+{
+	return cdata->evp ? EVP_CIPHER_get0_name(cdata->evp) : "NULL";
+}
+
+/* Hash functions */
+
+static const char *hash_evp_name(const char *alg_name, int hmac_mode)
+{
+	unsigned int i;
+	size_t len;
+
+	/* "hmac(sha1)" is the hmac of "sha1" */
+	if (hmac_mode) {
+		if (strncmp(alg_name, "hmac(", 5) != 0)
+			return NULL;
+		alg_name += 5;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(hash_map); i++) {
+		len = strlen(hash_map[i].alg_name);
+		if (strncmp(alg_name, hash_map[i].alg_name, len) == 0 &&
+		    alg_name[len] == (hmac_mode ? ')' : '\0'))
+			return hash_map[i].evp_name;
+	}
+	return NULL;
+}
+
+int cryptodev_hash_init(struct hash_data *hdata, const char *alg_name,
+			int hmac_mode, const void *mackey, size_t mackeylen)
+{
+	OSSL_PARAM params[2];
+	const char *name;
+	EVP_MAC *mac;
+	int ret;
+
+	memset(hdata, 0, sizeof(*hdata));
+	hdata->alg_name = alg_name;
+	hdata->hmac_mode = hmac_mode;
+
+	name = hash_evp_name(alg_name, hmac_mode);
+	if (unlikely(!name))
+		return -EINVAL;
+
+	hdata->md = EVP_MD_fetch(NULL, name, NULL);
+	if (unlikely(!hdata->md)) {
+		ddebug(1, "%s is not available", name);
+		ERR_clear_error();
+		return -EINVAL;
+	}
+	hdata->digestsize = EVP_MD_get_size(hdata->md);
+
+	if (hmac_mode) {
+		mac = EVP_MAC_fetch(NULL, "HMAC", NULL);
+		if (unlikely(!mac)) {
+			ret = -EINVAL;
+			goto error;
+		}
+		hdata->macctx = EVP_MAC_CTX_new(mac);
+		EVP_MAC_free(mac);
+		if (unlikely(!hdata->macctx)) {
+			ret = -ENOMEM;
+			goto error;
+		}
+
+		params[0] = OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST,
+				(char *)name, 0);
+		params[1] = OSSL_PARAM_construct_end();
+		if (unlikely(EVP_MAC_init(hdata->macctx, mackey, mackeylen,
+		                          params) != 1)) {
+			ddebug(1, "setting hmac key failed for %s-%zu",
+					alg_name, mackeylen * 8);
+			ret = -EINVAL;
+			goto error;
+		}
+	} else {
+		hdata->mdctx = EVP_MD_CTX_new();
+		if (unlikely(!hdata->mdctx)) {
+			ret = -ENOMEM;
+			goto error;
+		}
+	}
+
+	hdata->init = 1;
+	return 0;
+
+error:
+	ERR_clear_error();
+	cryptodev_hash_deinit(hdata);
+	return ret;
+}
+
+void cryptodev_hash_deinit(struct hash_data *hdata)
+{
+	EVP_MAC_CTX_free(hdata->macctx);
+	EVP_MD_CTX_free(hdata->mdctx);
+	EVP_MD_free(hdata->md);
+	memset(hdata, 0, sizeof(*hdata));
+}
+
+int cryptodev_hash_reset(struct hash_data *hdata)
+{
+	int ret;
+
+	/* a NULL key keeps the one the context was set up with */
+	if (hdata->hmac_mode)
+		ret = EVP_MAC_init(hdata->macctx, NULL, 0, NULL);
+	else
+		ret = EVP_DigestInit_ex(hdata->mdctx, hdata->md, NULL);
+
+	if (unlikely(ret != 1)) {
+		derr(0, "error in hash reset");
+		ERR_clear_error();
+		return -EINVAL;
+	}
+	hdata->finalized = 0;
+	return 0;
+}
+
+int cryptodev_hash_update(struct hash_data *hdata, const void *buf, size_t len)
+{
+	int ret;
+
+	/* an OpenSSL context cannot be updated after the final call */
+	if (unlikely(hdata->finalized)) {
+		ret = cryptodev_hash_reset(hdata);
+		if (unlikely(ret))
+			return ret;
+	}
+
+	if (hdata->hmac_mode)
+		ret = EVP_MAC_update(hdata->macctx, buf, len);
+	else
+		ret = EVP_DigestUpdate(hdata->mdctx, buf, len);
+
+	if (unlikely(ret != 1)) {
+		ERR_clear_error();
+		return -EINVAL;
+	}
+	return 0;
+}
+
+int cryptodev_hash_final(struct hash_data *hdata, void *output)
+{
+	size_t outl;
+	int ret;
+
+	if (unlikely(hdata->finalized)) {
+		ret = cryptodev_hash_reset(hdata);
+		if (unlikely(ret))
+			return ret;
+	}
+
+	if (hdata->hmac_mode)
+		ret = EVP_MAC_final(hdata->macctx, output, &outl,
+				hdata->digestsize);
+	else
+		ret = EVP_DigestFinal_ex(hdata->mdctx, output, NULL);
+
+	if (unlikely(ret != 1)) {
+		ERR_clear_error();
+		return -EINVAL;
+	}
+	hdata->finalized = 1;
+	return 0;
+}
+
+const char *cryptodev_hash_driver_name(struct hash_data *hdata)
+{
+	return EVP_MD_get0_name(hdata->md);
+}
@@ -0,0 +1,32 @@
+/* Userspace emulation of /dev/crypto, for running the cryptodev
+ * ioctl interface where the module cannot be loaded.
+ *
+ * Programs need no change: preloading libcryptodev-emu.so, or linking
+ * with libcryptodev-emu.a, makes open("/dev/crypto") return an
+ * emulated handle and routes its ioctl() and close() calls here. The
+ * functions below are the same entry points, for callers that want to
+ * pick the emulator explicitly.
+ *
+ * Placed under public domain.
+ */
+#ifndef CRYPTODEV_EMU_H
+# define CRYPTODEV_EMU_H
+
+/* Open a new handle, as open("/dev/crypto", flags) would; of the
+ * flags only O_CLOEXEC matters. Returns the descriptor, or -1 with
+ * errno set. The descriptor can be polled for completed async jobs.
+ */
+int cryptodev_emu_open(int flags);
+
+/* Run one of the ioctls of crypto/cryptodev.h on a handle. Returns 0,
+ * or -1 with errno set as the module would.
+ */
+int cryptodev_emu_ioctl(int fd, unsigned long request, void *arg);
+
+/* Close a handle; clones made with CRIOGET keep it alive. */
+int cryptodev_emu_close(int fd);
+
+/* Whether fd is an emulated handle. */
+int cryptodev_emu_is_handle(int fd);
+
+#endif /* CRYPTODEV_EMU_H */
@@ -0,0 +1,291 @@
+/*
+ * Userspace emulation of the /dev/crypto device
+ *
+ * This file is part of linux cryptodev.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/* The emulator follows the module file by file: ioctl.c holds the
+ * handles, sessions and the async queue, main.c and authenc.c run the
+ * operations and cryptlib.c maps the transforms to OpenSSL, with the
+ * structures named as in the kernel so the two can be read side by
+ * side. User pointers are accessed directly, so a bad one crashes the
+ * caller instead of failing with EFAULT.
+ */
+#ifndef EMU_H
+# define EMU_H
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <openssl/bn.h>
+#include <openssl/evp.h>
+#include <crypto/cryptodev.h>
+
+#define likely(x)	__builtin_expect(!!(x), 1)
+#define unlikely(x)	__builtin_expect(!!(x), 0)
+
+#define min(a, b)	((a) < (b) ? (a) : (b))
+#define max(a, b)	((a) > (b) ? (a) : (b))
+#define ARRAY_SIZE(a)	(sizeof(a) / sizeof((a)[0]))
+
+#define PFX "cryptodev-emu: "
+#define dprintk(level, format, a...)				\
+	do {							\
+		if (level <= cryptodev_verbosity)		\
+			fprintf(stderr, PFX "%u (%s:%u): " format "\n",	\
+			        (unsigned int)getpid(),		\
+			        __func__, __LINE__, ##a);	\
+	} while (0)
+#define derr(level, format, a...) dprintk(level, format, ##a)
+#define dwarning(level, format, a...) dprintk(level, format, ##a)
+#define dinfo(level, format, a...) dprintk(level, format, ##a)
+#define ddebug(level, format, a...) dprintk(level, format, ##a)
+
+/* the module parameter, taken from CRYPTODEV_EMU_VERBOSITY */
+extern int cryptodev_verbosity;
+
+/* Default (pre-allocated) and maximum size of the job queue, as in
+ * the module. */
+#define DEF_COP_RINGSIZE 16
+#define MAX_COP_RINGSIZE 64
+#define LIMIT_COP_RINGSIZE 4096
+
+/* maximum number of buffers registered with CIOCREGBUF per handle */
+#define CRYPTODEV_MAX_REGBUFS	16
+#define CRYPTODEV_MAX_REGBUF_LEN	(64 * 1024 * 1024)
+
+/* authenticated-only data of CIOCAUTHCRYPT, the module's page */
+#define MAX_AUTH_LEN	4096
+
+/* Cipher */
+struct cipher_data {
+	int init; /* 0 uninitialized */
+	int blocksize;
+	int aead;
+	int stream;
+	int unchained; /* xts: requests must not be split */
+	int ivsize;
+	int alignmask;
+	int tag_size;
+	const char *alg_name;
+	EVP_CIPHER *evp; /* NULL for cipher_null */
+	EVP_CIPHER_CTX *enc, *dec;
+	uint8_t iv[EALG_MAX_BLOCK_LEN];
+};
+
+int cryptodev_cipher_init(struct cipher_data *out, const char *alg_name,
+			  const uint8_t *key, size_t keylen, int stream, int aead);
+void cryptodev_cipher_deinit(struct cipher_data *cdata);
+int cryptodev_cipher_encrypt(struct cipher_data *cdata,
+			     const void *src, void *dst, size_t len);
+int cryptodev_cipher_decrypt(struct cipher_data *cdata,
+			     const void *src, void *dst, size_t len);
+int cryptodev_cipher_aead(struct cipher_data *cdata, int encrypt,
+			  const void *auth, size_t auth_len,
+			  const void *src, void *dst, size_t len,
+			  uint8_t *tag, size_t tag_len);
+const char *cryptodev_cipher_driver_name(struct cipher_data *cdata);
+
+static inline void cryptodev_cipher_set_iv(struct cipher_data *cdata,
+				const void *iv, size_t iv_size)
+{
+	memcpy(cdata->iv, iv, min(iv_size, sizeof(cdata->iv)));
+}
+
+static inline void cryptodev_cipher_get_iv(struct cipher_data *cdata,
+				void *iv, size_t iv_size)
+{
+	memcpy(iv, cdata->iv, min(iv_size, sizeof(cdata->iv)));
+}
+
+/* Hash */
+struct hash_data {
+	int init; /* 0 uninitialized */
+	int digestsize;
+	int alignmask;
+	const char *alg_name;
+	int hmac_mode;
+	int finalized; /* the context needs a reset before the next update */
+	EVP_MD *md;
+	EVP_MD_CTX *mdctx;
+	EVP_MAC_CTX *macctx;
+};
+
+int cryptodev_hash_init(struct hash_data *hdata, const char *alg_name,
+			int hmac_mode, const void *mackey, size_t mackeylen);
+void cryptodev_hash_deinit(struct hash_data *hdata);
+int cryptodev_hash_reset(struct hash_data *hdata);
+int cryptodev_hash_update(struct hash_data *hdata, const void *buf, size_t len);
+int cryptodev_hash_final(struct hash_data *hdata, void *output);
+const char *cryptodev_hash_driver_name(struct hash_data *hdata);
+
+void cryptodev_emu_crypto_init(void);
+
+/* Event counters and latency histograms of a handle, see CIOCGSTATS */
+enum cryptodev_stat {
+	CSTAT_OPS,
+	CSTAT_AUTH_OPS,
+	CSTAT_BYTES,
+	CSTAT_ERRORS,
+	CSTAT_ZC,
+	CSTAT_REGBUF,
+	CSTAT_BOUNCE,
+	CSTAT_ZC_FALLBACK,
+	CSTAT_ASYNC_SUBMITTED,
+	CSTAT_ASYNC_FETCHED,
+	CSTAT_ASYNC_BUSY,
+	CSTAT_SESSION_CREATE,
+	CSTAT_SESSION_DESTROY,
+	CSTAT_MAX
+};
+
+enum cryptodev_lat {
+	CSTAT_LAT_RUN,
+	CSTAT_LAT_AUTH_RUN,
+	CSTAT_LAT_MAX
+};
+
+struct cryptodev_stats {
+	uint64_t cnt[CSTAT_MAX];
+	uint64_t lat[CSTAT_LAT_MAX][CRYPTODEV_LAT_BUCKETS];
+};
+
+/* a buffer registered with CIOCREGBUF; nothing is pinned here */
+struct regbuf {
+	uint8_t *addr;
+	uint32_t len;
+};
+
+struct csession;
+
+struct fcrypt {
+	struct csession *list;
+	pthread_mutex_t sem;
+	struct cryptodev_stats stats;
+	/* registered buffers; reglock nests inside any session lock */
+	pthread_mutex_t reglock;
+	struct regbuf regbufs[CRYPTODEV_MAX_REGBUFS];
+};
+
+/* other internal structs */
+struct csession {
+	struct csession *next;
+	pthread_mutex_t sem;
+	struct cipher_data cdata;
+	struct hash_data hdata;
+	uint32_t sid;
+	uint32_t alignmask;
+
+	/* linear copy of the data of CIOCCRYPTV, allocated on use */
+	uint8_t *bounce;
+	size_t bounce_len;
+
+	/* IV of COP_FLAG_KERNEL_IV operations, valid once set by CIOCSESSIV */
+	int kernel_iv;
+	uint8_t iv[EALG_MAX_BLOCK_LEN];
+};
+
+/* internal extension to struct crypt_op */
+struct kernel_crypt_op {
+	struct crypt_op cop;
+
+	int ivlen;
+	uint8_t iv[EALG_MAX_BLOCK_LEN];
+
+	int digestsize;
+	uint8_t hash_output[AALG_MAX_RESULT_LEN];
+
+	/* CIOCCRYPTV: the data is described by these instead of
+	 * cop.src and cop.dst; dst_iov is NULL for in-place operation */
+	const struct iovec *src_iov, *dst_iov;
+	unsigned int src_iovcnt, dst_iovcnt;
+};
+
+struct kernel_crypt_auth_op {
+	struct crypt_auth_op caop;
+
+	int dst_len; /* based on src_len + pad + tag */
+	int ivlen;
+	uint8_t iv[EALG_MAX_BLOCK_LEN];
+};
+
+struct csession *crypto_get_session_by_sid(struct fcrypt *fcr, uint32_t sid);
+void crypto_session_iv_advance(struct csession *ses_ptr, unsigned int len);
+
+static inline void crypto_put_session(struct csession *ses_ptr)
+{
+	pthread_mutex_unlock(&ses_ptr->sem);
+}
+
+struct regbuf *crypto_get_regbuf(struct fcrypt *fcr, void *addr,
+		unsigned int len);
+
+int kcaop_from_user(struct kernel_crypt_auth_op *kcaop,
+		struct fcrypt *fcr, void *arg);
+int kcaop_to_user(struct kernel_crypt_auth_op *kcaop,
+		struct fcrypt *fcr, void *arg);
+int crypto_auth_run(struct fcrypt *fcr, struct kernel_crypt_auth_op *kcaop);
+int crypto_run(struct fcrypt *fcr, struct kernel_crypt_op *kcop);
+
+/* a CIOCKEY operation, see asym.h of the module */
+struct kernel_crypt_kop {
+	struct crypt_kop kop;
+	BIGNUM *num[CRK_MAXPARAM];
+	BIGNUM *res;
+};
+
+int crypto_kop_get(struct kernel_crypt_kop *kkop);
+int crypto_kop_run(struct kernel_crypt_kop *kkop);
+int crypto_kop_put(struct kernel_crypt_kop *kkop);
+void crypto_kop_free(struct kernel_crypt_kop *kkop);
+uint32_t crypto_asym_features(void);
+
+/* counters, relaxed atomics instead of the module's per-CPU ones */
+static inline void cryptodev_stat_add(struct fcrypt *fcr,
+		enum cryptodev_stat stat, uint64_t val)
+{
+	__atomic_fetch_add(&fcr->stats.cnt[stat], val, __ATOMIC_RELAXED);
+}
+
+static inline void cryptodev_stat_inc(struct fcrypt *fcr,
+		enum cryptodev_stat stat)
+{
+	cryptodev_stat_add(fcr, stat, 1);
+}
+
+uint64_t cryptodev_get_ns(void);
+
+/* account an operation that started at start (from cryptodev_get_ns())
+ * in bucket fls64(nsecs), i.e. [2^(n-1), 2^n) nanoseconds */
+static inline void cryptodev_stat_latency(struct fcrypt *fcr,
+		enum cryptodev_lat which, uint64_t start)
+{
+	uint64_t ns = cryptodev_get_ns() - start;
+	unsigned int bucket = ns ? 64 - __builtin_clzll(ns) : 0;
+
+	bucket = min(bucket, CRYPTODEV_LAT_BUCKETS - 1);
+	__atomic_fetch_add(&fcr->stats.lat[which][bucket], 1, __ATOMIC_RELAXED);
+}
+
+#endif /* EMU_H */
@@ -0,0 +1,1601 @@
+/*
+ * Userspace emulation of the /dev/crypto device
+ *
+ * This file is part of linux cryptodev.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/*
+ * A handle is what the module keeps in filp->private_data. Its
+ * descriptors are duplicates of a private eventfd, which the worker
+ * keeps readable while completed jobs wait in the done queue, so that
+ * the descriptor can be passed to poll() and select() as the device
+ * node can. POLLOUT is always reported though, a full queue is only
+ * noticed by EBUSY.
+ *
+ * Asynchronous jobs are run by a thread per handle, started on the
+ * first submission. A CPU given with CIOCASYNCAFFINITY pins it, the
+ * LOCAL and NODE placements leave it to the scheduler.
+ */
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <limits.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/eventfd.h>
+#include <openssl/rand.h>
+#include "emu.h"
+#include "cryptodev_emu.h"
+
+int cryptodev_verbosity;
+
+struct todo_list_item {
+	struct todo_list_item *next;
+	int key; /* a CIOCASYNCKEY job, which uses kkop */
+	union {
+		struct kernel_crypt_op kcop;
+		struct kernel_crypt_kop kkop;
+	};
+	int result;
+};
+
+struct locked_list {
+	struct todo_list_item *head, **tail;
+	pthread_mutex_t lock;
+};
+
+struct crypt_priv {
+	struct fcrypt fcrypt;
+	int refs; /* descriptors and running ioctls */
+	int notify; /* readable while the done queue is not empty */
+	struct locked_list free, todo, done;
+	int itemcount, maxitems;
+	int efd; /* duplicate of the CIOCASYNCEVENTFD descriptor, or -1 */
+	int affinity;
+
+	/* the worker, todo.lock protects these */
+	pthread_t worker;
+	pthread_cond_t kick;
+	int worker_started, stop;
+};
+
+static void list_init(struct locked_list *l)
+{
+	l->head = NULL;
+	l->tail = &l->head;
+	pthread_mutex_init(&l->lock, NULL);
+}
+
+static void list_add_tail(struct locked_list *l, struct todo_list_item *item)
+{
+	item->next = NULL;
+	*l->tail = item;
+	l->tail = &item->next;
+}
+
+static struct todo_list_item *list_del_first(struct locked_list *l)
+{
+	struct todo_list_item *item = l->head;
+
+	if (item) {
+		l->head = item->next;
+		if (!l->head)
+			l->tail = &l->head;
+	}
+	return item;
+}
+
+/* unlink the first item of the kind, key jobs or the others */
+static struct todo_list_item *list_del_first_of(struct locked_list *l, int key)
+{
+	struct todo_list_item *item, **prev;
+
+	for (prev = &l->head; (item = *prev); prev = &item->next) {
+		if (item->key != key)
+			continue;
+		*prev = item->next;
+		if (!*prev)
+			l->tail = prev;
+		return item;
+	}
+	return NULL;
+}
+
+/* move the whole list, NULL terminated, to the caller */
+static struct todo_list_item *list_cut(struct locked_list *l)
+{
+	struct todo_list_item *item = l->head;
+
+	l->head = NULL;
+	l->tail = &l->head;
+	return item;
+}
+
+static void list_free(struct todo_list_item *item)
+{
+	struct todo_list_item *next;
+
+	for (; item; item = next) {
+		next = item->next;
+		free(item);
+	}
+}
+
+uint64_t cryptodev_get_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Prepare session for future use. */
+static int
+crypto_create_session(struct fcrypt *fcr, struct session_op *sop)
+{
+	struct csession	*ses_new = NULL, *ses_ptr;
+	int ret = 0;
+	const char *alg_name = NULL;
+	const char *hash_name = NULL;
+	int hmac_mode = 1, stream = 0, aead = 0;
+	uint8_t mkey[CRYPTO_HMAC_MAX_KEY_LEN] = { 0 };
+
+	/* Does the request make sense? */
+	if (unlikely(!sop->cipher && !sop->mac)) {
+		ddebug(1, "Both 'cipher' and 'mac' unset.");
+		return -EINVAL;
+	}
+
+	switch (sop->cipher) {
+	case 0:
+		break;
+	case CRYPTO_DES_CBC:
+		alg_name = "cbc(des)";
+		break;
+	case CRYPTO_3DES_CBC:
+		alg_name = "cbc(des3_ede)";
+		break;
+	case CRYPTO_BLF_CBC:
+		alg_name = "cbc(blowfish)";
+		break;
+	case CRYPTO_AES_CBC:
+		alg_name = "cbc(aes)";
+		break;
+	case CRYPTO_AES_ECB:
+		alg_name = "ecb(aes)";
+		break;
+	case CRYPTO_AES_XTS:
+		alg_name = "xts(aes)";
+		break;
+	case CRYPTO_CAMELLIA_CBC:
+		alg_name = "cbc(camellia)";
+		break;
+	case CRYPTO_AES_CTR:
+		alg_name = "ctr(aes)";
+		stream = 1;
+		break;
+	case CRYPTO_AES_GCM:
+		alg_name = "gcm(aes)";
+		stream = 1;
+		aead = 1;
+		break;
+	case CRYPTO_NULL:
+		alg_name = "ecb(cipher_null)";
+		stream = 1;
+		break;
+	default:
+		ddebug(1, "bad cipher: %d", sop->cipher);
+		return -EINVAL;
+	}
+
+	switch (sop->mac) {
+	case 0:
+		break;
+	case CRYPTO_MD5_HMAC:
+		hash_name = "hmac(md5)";
+		break;
+	case CRYPTO_RIPEMD160_HMAC:
+		hash_name = "hmac(rmd160)";
+		break;
+	case CRYPTO_SHA1_HMAC:
+		hash_name = "hmac(sha1)";
+		break;
+	case CRYPTO_SHA2_224_HMAC:
+		hash_name = "hmac(sha224)";
+		break;
+
+	case CRYPTO_SHA2_256_HMAC:
+		hash_name = "hmac(sha256)";
+		break;
+	case CRYPTO_SHA2_384_HMAC:
+		hash_name = "hmac(sha384)";
+		break;
+	case CRYPTO_SHA2_512_HMAC:
+		hash_name = "hmac(sha512)";
+		break;
+
+	/* non-hmac cases */
+	case CRYPTO_MD5:
+		hash_name = "md5";
+		hmac_mode = 0;
+		break;
+	case CRYPTO_RIPEMD160:
+		hash_name = "rmd160";
+		hmac_mode = 0;
+		break;
+	case CRYPTO_SHA1:
+		hash_name = "sha1";
+		hmac_mode = 0;
+		break;
+	case CRYPTO_SHA2_224:
+		hash_name = "sha224";
+		hmac_mode = 0;
+		break;
+	case CRYPTO_SHA2_256:
+		hash_name = "sha256";
+		hmac_mode = 0;
+		break;
+	case CRYPTO_SHA2_384:
+		hash_name = "sha384";
+		hmac_mode = 0;
+		break;
+	case CRYPTO_SHA2_512:
+		hash_name = "sha512";
+		hmac_mode = 0;
+		break;
+	default:
+		ddebug(1, "bad mac: %d", sop->mac);
+		return -EINVAL;
+	}
+
+	/* Create a session and put it to the list. Zeroing the structure helps
+	 * also with a single exit point in case of errors */
+	ses_new = calloc(1, sizeof(*ses_new));
+	if (!ses_new)
+		return -ENOMEM;
+
+	/* Set-up crypto transform. The key of a composite aead cipher
+	 * would carry the mac key too, which gcm(aes) refuses. */
+	if (alg_name) {
+		if (unlikely(sop->keylen > CRYPTO_CIPHER_MAX_KEY_LEN ||
+		             (aead && sop->mackeylen))) {
+			ddebug(1, "Setting key failed for %s-%zu.",
+				alg_name, (size_t)sop->keylen*8);
+			ret = -EINVAL;
+			goto session_error;
+		}
+
+		ret = cryptodev_cipher_init(&ses_new->cdata, alg_name, sop->key,
+						sop->keylen, stream, aead);
+		if (ret < 0) {
+			ddebug(1, "Failed to load cipher for %s", alg_name);
+			ret = -EINVAL;
+			goto session_error;
+		}
+	}
+
+	if (hash_name && aead == 0) {
+		if (unlikely(sop->mackeylen > CRYPTO_HMAC_MAX_KEY_LEN)) {
+			ddebug(1, "Setting key failed for %s-%zu.",
+				hash_name, (size_t)sop->mackeylen*8);
+			ret = -EINVAL;
+			goto session_error;
+		}
+
+		if (sop->mackey)
+			memcpy(mkey, sop->mackey, sop->mackeylen);
+
+		ret = cryptodev_hash_init(&ses_new->hdata, hash_name, hmac_mode,
+							mkey, sop->mackeylen);
+		if (ret != 0) {
+			ddebug(1, "Failed to load hash for %s", hash_name);
+			ret = -EINVAL;
+			goto session_error;
+		}
+
+		ret = cryptodev_hash_reset(&ses_new->hdata);
+		if (ret != 0) {
+			goto session_error;
+		}
+	}
+
+	ses_new->alignmask = max(ses_new->cdata.alignmask,
+	                                          ses_new->hdata.alignmask);
+	ddebug(2, "got alignmask %d", ses_new->alignmask);
+
+	/* put the new session to the list */
+	pthread_mutex_init(&ses_new->sem, NULL);
+
+	pthread_mutex_lock(&fcr->sem);
+restart:
+	RAND_bytes((unsigned char *)&ses_new->sid, sizeof(ses_new->sid));
+	for (ses_ptr = fcr->list; ses_ptr; ses_ptr = ses_ptr->next) {
+		/* Check for duplicate SID */
+		if (unlikely(ses_new->sid == ses_ptr->sid))
+			goto restart;
+	}
+
+	ses_new->next = fcr->list;
+	fcr->list = ses_new;
+	pthread_mutex_unlock(&fcr->sem);
+
+	cryptodev_stat_inc(fcr, CSTAT_SESSION_CREATE);
+
+	/* Fill in some values for the user. */
+	sop->ses = ses_new->sid;
+	return 0;
+
+session_error:
+	cryptodev_hash_deinit(&ses_new->hdata);
+	cryptodev_cipher_deinit(&ses_new->cdata);
+	free(ses_new);
+	return ret;
+}
+
+/* Everything that needs to be done when removing a session. */
+static inline void
+crypto_destroy_session(struct csession *ses_ptr)
+{
+	/* wait for an operation in progress */
+	pthread_mutex_lock(&ses_ptr->sem);
+	ddebug(2, "Removed session 0x%08X", ses_ptr->sid);
+	cryptodev_cipher_deinit(&ses_ptr->cdata);
+	cryptodev_hash_deinit(&ses_ptr->hdata);
+	free(ses_ptr->bounce);
+	pthread_mutex_unlock(&ses_ptr->sem);
+	pthread_mutex_destroy(&ses_ptr->sem);
+	free(ses_ptr);
+}
+
+/* Look up a session by ID and remove. */
+static int
+crypto_finish_session(struct fcrypt *fcr, uint32_t sid)
+{
+	struct csession **pses, *ses_ptr;
+	int ret = 0;
+
+	pthread_mutex_lock(&fcr->sem);
+	for (pses = &fcr->list; (ses_ptr = *pses); pses = &ses_ptr->next) {
+		if (ses_ptr->sid == sid) {
+			*pses = ses_ptr->next;
+			crypto_destroy_session(ses_ptr);
+			cryptodev_stat_inc(fcr, CSTAT_SESSION_DESTROY);
+			break;
+		}
+	}
+
+	if (unlikely(!ses_ptr)) {
+		derr(1, "Session with sid=0x%08X not found!", sid);
+		ret = -ENOENT;
+	}
+	pthread_mutex_unlock(&fcr->sem);
+
+	return ret;
+}
+
+/* Remove all sessions when closing the file */
+static int
+crypto_finish_all_sessions(struct fcrypt *fcr)
+{
+	struct csession *ses_ptr;
+
+	pthread_mutex_lock(&fcr->sem);
+	while ((ses_ptr = fcr->list)) {
+		fcr->list = ses_ptr->next;
+		crypto_destroy_session(ses_ptr);
+		cryptodev_stat_inc(fcr, CSTAT_SESSION_DESTROY);
+	}
+	pthread_mutex_unlock(&fcr->sem);
+
+	return 0;
+}
+
+/* Look up session by session ID. The returned session is locked. */
+struct csession *
+crypto_get_session_by_sid(struct fcrypt *fcr, uint32_t sid)
+{
+	struct csession *ses_ptr;
+
+	if (unlikely(fcr == NULL))
+		return NULL;
+
+	pthread_mutex_lock(&fcr->sem);
+	for (ses_ptr = fcr->list; ses_ptr; ses_ptr = ses_ptr->next) {
+		if (ses_ptr->sid == sid) {
+			pthread_mutex_lock(&ses_ptr->sem);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&fcr->sem);
+
+	return ses_ptr;
+}
+
+/* Registered buffers only need to be remembered here: the user memory
+ * is accessed directly, so there is nothing to pin.
+ */
+static int crypto_register_buf(struct fcrypt *fcr, struct crypt_regbuf_op *rop)
+{
+	int i;
+
+	if (unlikely(!rop->addr || !rop->len ||
+	             rop->len > CRYPTODEV_MAX_REGBUF_LEN)) {
+		derr(1, "invalid buffer %p of %u bytes", rop->addr, rop->len);
+		return -EINVAL;
+	}
+
+	pthread_mutex_lock(&fcr->reglock);
+	for (i = 0; i < CRYPTODEV_MAX_REGBUFS; i++) {
+		if (!fcr->regbufs[i].addr) {
+			fcr->regbufs[i].addr = rop->addr;
+			fcr->regbufs[i].len = rop->len;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&fcr->reglock);
+
+	if (unlikely(i == CRYPTODEV_MAX_REGBUFS)) {
+		dwarning(1, "all %d buffer slots are in use", CRYPTODEV_MAX_REGBUFS);
+		return -ENOSPC;
+	}
+
+	ddebug(2, "registered buffer %d: %u bytes at %p", i, rop->len, rop->addr);
+	rop->index = i;
+	return 0;
+}
+
+static int crypto_unregister_buf(struct fcrypt *fcr, uint32_t index)
+{
+	uint8_t *addr;
+
+	if (unlikely(index >= CRYPTODEV_MAX_REGBUFS))
+		return -EINVAL;
+
+	pthread_mutex_lock(&fcr->reglock);
+	addr = fcr->regbufs[index].addr;
+	fcr->regbufs[index].addr = NULL;
+	fcr->regbufs[index].len = 0;
+	pthread_mutex_unlock(&fcr->reglock);
+
+	if (unlikely(!addr)) {
+		derr(1, "buffer %u is not registered", index);
+		return -ENOENT;
+	}
+	return 0;
+}
+
+/* Look up the registered buffer that contains [addr, addr + len). */
+struct regbuf *crypto_get_regbuf(struct fcrypt *fcr, void *addr,
+		unsigned int len)
+{
+	struct regbuf *rb, *retval = NULL;
+	uint8_t *p = addr;
+	int i;
+
+	pthread_mutex_lock(&fcr->reglock);
+	for (i = 0; i < CRYPTODEV_MAX_REGBUFS; i++) {
+		rb = &fcr->regbufs[i];
+		if (rb->addr && p >= rb->addr &&
+		    (uint64_t)(p - rb->addr) + len <= rb->len) {
+			retval = rb;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&fcr->reglock);
+
+	return retval;
+}
+
+/* Run the queued jobs; the module's cryptask_routine() as a thread
+ * that waits to be kicked.
+ */
+static void *crypto_async_worker(void *arg)
+{
+	struct crypt_priv *pcr = arg;
+	struct todo_list_item *first, *item, **last;
+	uint64_t completed;
+	cpu_set_t cpus;
+	int cpu, pinned = -1;
+
+	for (;;) {
+		/* fetch all pending jobs into the temporary list */
+		pthread_mutex_lock(&pcr->todo.lock);
+		while (!pcr->todo.head && !pcr->stop)
+			pthread_cond_wait(&pcr->kick, &pcr->todo.lock);
+		if (pcr->stop) {
+			pthread_mutex_unlock(&pcr->todo.lock);
+			break;
+		}
+		first = list_cut(&pcr->todo);
+		pthread_mutex_unlock(&pcr->todo.lock);
+
+		cpu = __atomic_load_n(&pcr->affinity, __ATOMIC_RELAXED);
+		if (cpu >= 0 && cpu != pinned) {
+			CPU_ZERO(&cpus);
+			CPU_SET(cpu, &cpus);
+			if (pthread_setaffinity_np(pthread_self(),
+			                           sizeof(cpus), &cpus) == 0)
+				pinned = cpu;
+		}
+
+		/* handle each job locklessly */
+		completed = 0;
+		for (item = first, last = &first; item; item = item->next) {
+			if (item->key)
+				item->result = crypto_kop_run(&item->kkop);
+			else
+				item->result = crypto_run(&pcr->fcrypt, &item->kcop);
+			if (unlikely(item->result))
+				derr(0, "%s failed: %d", item->key ? "crypto_kop_run()" :
+						"crypto_run()", item->result);
+			completed++;
+			last = &item->next;
+		}
+
+		/* push all handled jobs to the done list at once, and
+		 * report them to the eventfd as a single event */
+		pthread_mutex_lock(&pcr->done.lock);
+		*pcr->done.tail = first;
+		pcr->done.tail = last;
+		if (write(pcr->notify, &completed, sizeof(completed)) < 0)
+			derr(0, "cannot signal completion: %d", errno);
+		if (pcr->efd >= 0 &&
+		    write(pcr->efd, &completed, sizeof(completed)) < 0)
+			derr(1, "cannot signal the eventfd: %d", errno);
+		pthread_mutex_unlock(&pcr->done.lock);
+	}
+
+	return NULL;
+}
+
+/* the done queue was emptied, stop reporting POLLIN; done.lock is held */
+static void crypto_async_drained(struct crypt_priv *pcr)
+{
+	uint64_t count;
+
+	if (!pcr->done.head && read(pcr->notify, &count, sizeof(count)) < 0 &&
+	    errno != EAGAIN)
+		derr(0, "cannot reset the completion count: %d", errno);
+}
+
+/* grow the free list until the handle owns count items */
+static int crypto_prealloc_items(struct crypt_priv *pcr, int count)
+{
+	struct todo_list_item *item;
+	int ret = 0;
+
+	pthread_mutex_lock(&pcr->free.lock);
+	while (pcr->itemcount < count) {
+		item = calloc(1, sizeof(*item));
+		if (unlikely(!item)) {
+			ret = -ENOMEM;
+			break;
+		}
+		pcr->itemcount++;
+		ddebug(2, "allocated new item at %p", item);
+		list_add_tail(&pcr->free, item);
+	}
+	pthread_mutex_unlock(&pcr->free.lock);
+
+	return ret;
+}
+
+/* Take the idle items beyond the handle's limit off the free list, to
+ * be freed once free.lock is dropped. Called with free.lock held. */
+static struct todo_list_item *crypto_trim_items(struct crypt_priv *pcr)
+{
+	struct todo_list_item *item, *surplus = NULL;
+
+	while (pcr->itemcount > pcr->maxitems &&
+	       (item = list_del_first(&pcr->free))) {
+		item->next = surplus;
+		surplus = item;
+		pcr->itemcount--;
+	}
+	return surplus;
+}
+
+/* give the fetched items first..last back to the free list, releasing
+ * those that a lowered limit has made surplus */
+static void crypto_put_items(struct crypt_priv *pcr,
+		struct todo_list_item *first, struct todo_list_item **last)
+{
+	struct todo_list_item *surplus;
+
+	pthread_mutex_lock(&pcr->free.lock);
+	*pcr->free.tail = first;
+	pcr->free.tail = last;
+	surplus = crypto_trim_items(pcr);
+	pthread_mutex_unlock(&pcr->free.lock);
+
+	list_free(surplus);
+}
+
+/* ====== /dev/crypto ====== */
+
+static void
+cryptodev_release(struct crypt_priv *pcr)
+{
+	int items_freed = 0;
+	struct todo_list_item *item;
+
+	pthread_mutex_lock(&pcr->todo.lock);
+	pcr->stop = 1;
+	pthread_cond_signal(&pcr->kick);
+	pthread_mutex_unlock(&pcr->todo.lock);
+	if (pcr->worker_started)
+		pthread_join(pcr->worker, NULL);
+
+	if (pcr->efd >= 0)
+		close(pcr->efd);
+	close(pcr->notify);
+
+	for (item = pcr->free.head; item; item = item->next)
+		items_freed++;
+	for (item = pcr->todo.head; item; item = item->next) {
+		if (item->key)
+			crypto_kop_free(&item->kkop);
+		items_freed++;
+	}
+	for (item = pcr->done.head; item; item = item->next) {
+		if (item->key)
+			crypto_kop_free(&item->kkop);
+		items_freed++;
+	}
+	list_free(pcr->free.head);
+	list_free(pcr->todo.head);
+	list_free(pcr->done.head);
+
+	if (items_freed != pcr->itemcount) {
+		derr(0, "freed %d items, but %d should exist!",
+				items_freed, pcr->itemcount);
+	}
+
+	crypto_finish_all_sessions(&pcr->fcrypt);
+
+	pthread_cond_destroy(&pcr->kick);
+	pthread_mutex_destroy(&pcr->done.lock);
+	pthread_mutex_destroy(&pcr->todo.lock);
+	pthread_mutex_destroy(&pcr->free.lock);
+	pthread_mutex_destroy(&pcr->fcrypt.reglock);
+	pthread_mutex_destroy(&pcr->fcrypt.sem);
+
+	free(pcr);
+
+	ddebug(2, "Cryptodev handle deinitialised, %d elements freed",
+			items_freed);
+}
+
+static struct crypt_priv *
+cryptodev_alloc(void)
+{
+	struct crypt_priv *pcr;
+
+	pcr = calloc(1, sizeof(*pcr));
+	if (!pcr)
+		return NULL;
+
+	pcr->notify = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (pcr->notify < 0) {
+		free(pcr);
+		return NULL;
+	}
+
+	pcr->refs = 0;
+	pcr->efd = -1;
+	pthread_mutex_init(&pcr->fcrypt.sem, NULL);
+	pthread_mutex_init(&pcr->fcrypt.reglock, NULL);
+	list_init(&pcr->free);
+	list_init(&pcr->todo);
+	list_init(&pcr->done);
+	pthread_cond_init(&pcr->kick, NULL);
+
+	pcr->affinity = CRYPTODEV_AFFINITY_LOCAL;
+	pcr->maxitems = MAX_COP_RINGSIZE;
+	if (crypto_prealloc_items(pcr, DEF_COP_RINGSIZE)) {
+		cryptodev_release(pcr);
+		return NULL;
+	}
+
+	ddebug(2, "Cryptodev handle initialised, %d elements in queue",
+			pcr->itemcount);
+	return pcr;
+}
+
+/* Descriptor to handle table, in chunks allocated as descriptors are
+ * used. Lookups hold the read lock until they have a reference.
+ */
+#define FDTAB_CHUNK	1024
+#define FDTAB_MAX	(FDTAB_CHUNK * FDTAB_CHUNK)
+
+static struct crypt_priv **fdtab[FDTAB_CHUNK];
+static pthread_rwlock_t fdtab_lock = PTHREAD_RWLOCK_INITIALIZER;
+
+static inline struct crypt_priv **fdtab_slot(int fd)
+{
+	struct crypt_priv **chunk;
+
+	if (unlikely(fd < 0 || fd >= FDTAB_MAX))
+		return NULL;
+	chunk = __atomic_load_n(&fdtab[fd / FDTAB_CHUNK], __ATOMIC_ACQUIRE);
+	return chunk ? &chunk[fd % FDTAB_CHUNK] : NULL;
+}
+
+static void crypto_put_priv(struct crypt_priv *pcr)
+{
+	if (__atomic_sub_fetch(&pcr->refs, 1, __ATOMIC_ACQ_REL) == 0)
+		cryptodev_release(pcr);
+}
+
+static struct crypt_priv *crypto_get_priv(int fd)
+{
+	struct crypt_priv **slot, *pcr = NULL;
+
+	pthread_rwlock_rdlock(&fdtab_lock);
+	slot = fdtab_slot(fd);
+	if (slot && (pcr = *slot))
+		__atomic_add_fetch(&pcr->refs, 1, __ATOMIC_RELAXED);
+	pthread_rwlock_unlock(&fdtab_lock);
+
+	return pcr;
+}
+
+/* make fd a descriptor of pcr, taking a reference */
+static int fdtab_install(int fd, struct crypt_priv *pcr)
+{
+	struct crypt_priv **chunk, *old;
+
+	if (unlikely(fd >= FDTAB_MAX))
+		return -EMFILE;
+
+	pthread_rwlock_wrlock(&fdtab_lock);
+	chunk = fdtab[fd / FDTAB_CHUNK];
+	if (!chunk) {
+		chunk = calloc(FDTAB_CHUNK, sizeof(*chunk));
+		if (unlikely(!chunk)) {
+			pthread_rwlock_unlock(&fdtab_lock);
+			return -ENOMEM;
+		}
+		__atomic_store_n(&fdtab[fd / FDTAB_CHUNK], chunk, __ATOMIC_RELEASE);
+	}
+	/* a descriptor closed behind our back and reused */
+	old = chunk[fd % FDTAB_CHUNK];
+	__atomic_add_fetch(&pcr->refs, 1, __ATOMIC_RELAXED);
+	__atomic_store_n(&chunk[fd % FDTAB_CHUNK], pcr, __ATOMIC_RELEASE);
+	pthread_rwlock_unlock(&fdtab_lock);
+
+	if (old)
+		crypto_put_priv(old);
+	return 0;
+}
+
+static struct crypt_priv *fdtab_remove(int fd)
+{
+	struct crypt_priv **slot, *pcr = NULL;
+
+	pthread_rwlock_wrlock(&fdtab_lock);
+	slot = fdtab_slot(fd);
+	if (slot) {
+		pcr = *slot;
+		__atomic_store_n(slot, NULL, __ATOMIC_RELEASE);
+	}
+	pthread_rwlock_unlock(&fdtab_lock);
+
+	return pcr;
+}
+
+static int
+clonefd(struct crypt_priv *pcr, int fd)
+{
+	int ret;
+
+	ret = fcntl(fd, F_DUPFD, 0);
+	if (ret < 0)
+		return -errno;
+
+	if (unlikely(fdtab_install(ret, pcr) < 0)) {
+		close(ret);
+		return -EMFILE;
+	}
+	return ret;
+}
+
+static int crypto_affinity_valid(int cpu)
+{
+	if (cpu >= 0)
+		return cpu < CPU_SETSIZE && cpu < sysconf(_SC_NPROCESSORS_CONF);
+	return cpu == CRYPTODEV_AFFINITY_LOCAL || cpu == CRYPTODEV_AFFINITY_NODE;
+}
+
+/* take a free queue item, allocating one below the handle's maxitems
+ *
+ * returns:
+ * -EBUSY when there are no free queue slots left
+ *        (and the number of slots has reached the handle's maxitems)
+ * -EFAULT when there was a memory allocation error
+ * 0 on success */
+static int crypto_async_get_item(struct crypt_priv *pcr,
+		struct todo_list_item **itemp)
+{
+	struct todo_list_item *item = NULL;
+
+	pthread_mutex_lock(&pcr->free.lock);
+	if (likely(pcr->free.head)) {
+		item = list_del_first(&pcr->free);
+	} else if (pcr->itemcount < pcr->maxitems) {
+		pcr->itemcount++;
+	} else {
+		pthread_mutex_unlock(&pcr->free.lock);
+		cryptodev_stat_inc(&pcr->fcrypt, CSTAT_ASYNC_BUSY);
+		return -EBUSY;
+	}
+	pthread_mutex_unlock(&pcr->free.lock);
+
+	if (unlikely(!item)) {
+		item = calloc(1, sizeof(*item));
+		if (unlikely(!item)) {
+			pthread_mutex_lock(&pcr->free.lock);
+			pcr->itemcount--;
+			pthread_mutex_unlock(&pcr->free.lock);
+			return -EFAULT;
+		}
+		dinfo(1, "increased item count to %d", pcr->itemcount);
+	}
+
+	*itemp = item;
+	return 0;
+}
+
+/* hand a filled in item to the worker, starting it on first use
+ *
+ * returns:
+ * -EAGAIN if the worker could not be started, the item is the caller's
+ * 0 on success */
+static int crypto_async_submit(struct crypt_priv *pcr,
+		struct todo_list_item *item)
+{
+	pthread_mutex_lock(&pcr->todo.lock);
+	if (unlikely(!pcr->worker_started)) {
+		if (pthread_create(&pcr->worker, NULL, crypto_async_worker, pcr)) {
+			pthread_mutex_unlock(&pcr->todo.lock);
+			return -EAGAIN;
+		}
+		pcr->worker_started = 1;
+	}
+	list_add_tail(&pcr->todo, item);
+	pthread_cond_signal(&pcr->kick);
+	pthread_mutex_unlock(&pcr->todo.lock);
+
+	cryptodev_stat_inc(&pcr->fcrypt, CSTAT_ASYNC_SUBMITTED);
+	return 0;
+}
+
+/* enqueue a job for asynchronous completion
+ *
+ * returns:
+ * -EBUSY or -EFAULT as crypto_async_get_item()
+ * -EAGAIN as crypto_async_submit()
+ * 0 on success */
+static int crypto_async_run(struct crypt_priv *pcr, struct kernel_crypt_op *kcop)
+{
+	struct todo_list_item *item;
+	int ret;
+
+	if (unlikely(kcop->cop.flags & COP_FLAG_NO_ZC))
+		return -EINVAL;
+
+	ret = crypto_async_get_item(pcr, &item);
+	if (unlikely(ret))
+		return ret;
+
+	item->key = 0;
+	memcpy(&item->kcop, kcop, sizeof(struct kernel_crypt_op));
+	ret = crypto_async_submit(pcr, item);
+	if (unlikely(ret)) {
+		item->next = NULL;
+		crypto_put_items(pcr, item, &item->next);
+	}
+	return ret;
+}
+
+/* enqueue a key operation, whose parameters are read in here
+ *
+ * returns:
+ * -EBUSY or -EFAULT as crypto_async_get_item()
+ * the error of crypto_kop_get() for invalid parameters
+ * -EAGAIN as crypto_async_submit()
+ * 0 on success */
+static int crypto_async_key(struct crypt_priv *pcr, struct crypt_kop *kop)
+{
+	struct todo_list_item *item;
+	int ret;
+
+	ret = crypto_async_get_item(pcr, &item);
+	if (unlikely(ret))
+		return ret;
+
+	item->key = 1;
+	item->kkop.kop = *kop;
+	ret = crypto_kop_get(&item->kkop);
+	if (likely(!ret)) {
+		ret = crypto_async_submit(pcr, item);
+		if (likely(!ret))
+			return 0;
+		crypto_kop_free(&item->kkop);
+	}
+
+	item->next = NULL;
+	crypto_put_items(pcr, item, &item->next);
+	return ret;
+}
+
+/* get the first completed job from the "done" queue
+ *
+ * returns:
+ * -EBUSY if no completed jobs are ready (yet)
+ * the return value of crypto_run() otherwise */
+static int crypto_async_fetch(struct crypt_priv *pcr,
+		struct kernel_crypt_op *kcop)
+{
+	struct todo_list_item *item;
+	int retval;
+
+	pthread_mutex_lock(&pcr->done.lock);
+	item = list_del_first_of(&pcr->done, 0);
+	if (item)
+		crypto_async_drained(pcr);
+	pthread_mutex_unlock(&pcr->done.lock);
+	if (!item)
+		return -EBUSY;
+
+	memcpy(kcop, &item->kcop, sizeof(struct kernel_crypt_op));
+	retval = item->result;
+	cryptodev_stat_inc(&pcr->fcrypt, CSTAT_ASYNC_FETCHED);
+
+	item->next = NULL;
+	crypto_put_items(pcr, item, &item->next);
+
+	return retval;
+}
+
+/* get the first completed key operation from the "done" queue and
+ * store its result for the caller
+ *
+ * returns:
+ * -EBUSY if no completed key operations are ready (yet)
+ * the return value of crypto_kop_run() or crypto_kop_put() otherwise */
+static int crypto_async_fetch_key(struct crypt_priv *pcr, struct crypt_kop *kop)
+{
+	struct todo_list_item *item;
+	int retval;
+
+	pthread_mutex_lock(&pcr->done.lock);
+	item = list_del_first_of(&pcr->done, 1);
+	if (item)
+		crypto_async_drained(pcr);
+	pthread_mutex_unlock(&pcr->done.lock);
+	if (!item)
+		return -EBUSY;
+
+	retval = item->result;
+	if (likely(!retval))
+		retval = crypto_kop_put(&item->kkop);
+	*kop = item->kkop.kop;
+	crypto_kop_free(&item->kkop);
+	cryptodev_stat_inc(&pcr->fcrypt, CSTAT_ASYNC_FETCHED);
+
+	item->next = NULL;
+	crypto_put_items(pcr, item, &item->next);
+
+	return retval;
+}
+
+/* does fd refer to an eventfd? */
+static int is_eventfd(int fd)
+{
+	char path[32], target[32];
+	ssize_t len;
+
+	snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+	len = readlink(path, target, sizeof(target) - 1);
+	if (len < 0)
+		return 0;
+	target[len] = '\0';
+	return strcmp(target, "anon_inode:[eventfd]") == 0;
+}
+
+/* register an eventfd to be signalled with the number of completed
+ * jobs; a negative fd removes the current one
+ *
+ * Jobs already waiting in the done queue are accounted for at
+ * registration, so that no completion is missed.
+ *
+ * returns:
+ * -EBADF or -EINVAL if fd does not refer to an eventfd
+ * 0 on success */
+static int crypto_async_set_eventfd(struct crypt_priv *pcr, int fd)
+{
+	struct todo_list_item *item;
+	uint64_t pending = 0;
+	int efd = -1, old;
+
+	if (fd >= 0) {
+		if (fcntl(fd, F_GETFD) < 0)
+			return -EBADF;
+		if (!is_eventfd(fd))
+			return -EINVAL;
+		efd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+		if (efd < 0)
+			return -errno;
+	}
+
+	pthread_mutex_lock(&pcr->done.lock);
+	old = pcr->efd;
+	pcr->efd = efd;
+	if (efd >= 0) {
+		for (item = pcr->done.head; item; item = item->next)
+			pending++;
+		if (pending && write(efd, &pending, sizeof(pending)) < 0)
+			derr(1, "cannot signal the eventfd: %d", errno);
+	}
+	pthread_mutex_unlock(&pcr->done.lock);
+
+	if (old >= 0)
+		close(old);
+	return 0;
+}
+
+/* set where the jobs of the handle are run
+ *
+ * returns:
+ * -EINVAL if cpu is neither a CPU nor CRYPTODEV_AFFINITY_*
+ * 0 on success */
+static int crypto_async_set_affinity(struct crypt_priv *pcr, int cpu)
+{
+	if (unlikely(!crypto_affinity_valid(cpu)))
+		return -EINVAL;
+
+	__atomic_store_n(&pcr->affinity, cpu, __ATOMIC_RELAXED);
+	return 0;
+}
+
+/* set the maximum number of queue items of the handle
+ *
+ * A depth of zero only queries the current setting. Idle items
+ * beyond a lowered limit are released at once, busy ones as they are
+ * fetched, and the free list is grown up to a raised limit.
+ *
+ * returns:
+ * -ENOMEM if the items could not be preallocated, the limit is then
+ *         left as it was
+ * 0 on success, *depth holds the limit in effect */
+static int crypto_async_set_depth(struct crypt_priv *pcr, uint32_t *depth)
+{
+	struct todo_list_item *surplus;
+	int ret;
+
+	if (*depth == 0) {
+		*depth = __atomic_load_n(&pcr->maxitems, __ATOMIC_RELAXED);
+		return 0;
+	}
+	if (*depth > LIMIT_COP_RINGSIZE)
+		*depth = LIMIT_COP_RINGSIZE;
+
+	/* the limit only changes once its items are there; on failure
+	 * those allocated beyond the old limit are released again */
+	ret = crypto_prealloc_items(pcr, *depth);
+
+	pthread_mutex_lock(&pcr->free.lock);
+	if (likely(!ret))
+		pcr->maxitems = *depth;
+	surplus = crypto_trim_items(pcr);
+	pthread_mutex_unlock(&pcr->free.lock);
+
+	list_free(surplus);
+
+	return ret;
+}
+
+static int fill_kcop_from_cop(struct kernel_crypt_op *kcop, struct fcrypt *fcr)
+{
+	struct crypt_op *cop = &kcop->cop;
+	struct csession *ses_ptr;
+
+	/* this also enters ses_ptr->sem */
+	ses_ptr = crypto_get_session_by_sid(fcr, cop->ses);
+	if (unlikely(!ses_ptr)) {
+		derr(1, "invalid session ID=0x%08X", cop->ses);
+		return -EINVAL;
+	}
+	/* the session provides the IV in crypto_run() */
+	if (cop->flags & COP_FLAG_KERNEL_IV)
+		kcop->ivlen = ses_ptr->cdata.ivsize;
+	else
+		kcop->ivlen = cop->iv ? ses_ptr->cdata.ivsize : 0;
+	kcop->digestsize = 0; /* will be updated during operation */
+	kcop->src_iov = kcop->dst_iov = NULL;
+
+	crypto_put_session(ses_ptr);
+
+	if (cop->iv && !(cop->flags & COP_FLAG_KERNEL_IV))
+		memcpy(kcop->iv, cop->iv, kcop->ivlen);
+
+	return 0;
+}
+
+static int fill_cop_from_kcop(struct kernel_crypt_op *kcop, struct fcrypt *fcr)
+{
+	if (kcop->digestsize)
+		memcpy(kcop->cop.mac, kcop->hash_output, kcop->digestsize);
+	/* the IV that was used, or the one to continue with */
+	if (kcop->ivlen && kcop->cop.iv && kcop->cop.flags &
+			(COP_FLAG_WRITE_IV | COP_FLAG_KERNEL_IV))
+		memcpy(kcop->cop.iv, kcop->iv, kcop->ivlen);
+	return 0;
+}
+
+static int kcop_from_user(struct kernel_crypt_op *kcop,
+			struct fcrypt *fcr, void *arg)
+{
+	memcpy(&kcop->cop, arg, sizeof(kcop->cop));
+
+	return fill_kcop_from_cop(kcop, fcr);
+}
+
+static int kcop_to_user(struct kernel_crypt_op *kcop,
+			struct fcrypt *fcr, void *arg)
+{
+	int ret;
+
+	ret = fill_cop_from_kcop(kcop, fcr);
+	if (unlikely(ret)) {
+		derr(1, "Error in fill_cop_from_kcop");
+		return ret;
+	}
+
+	memcpy(arg, &kcop->cop, sizeof(kcop->cop));
+	return 0;
+}
+
+/* sum up the segment lengths of an iovec array into len */
+static int iov_total_len(const struct iovec *iov, unsigned int iovcnt,
+		uint32_t *len)
+{
+	uint64_t total = 0;
+	unsigned int i;
+
+	for (i = 0; i < iovcnt; i++) {
+		if (unlikely(iov[i].iov_len > UINT32_MAX))
+			return -EINVAL;
+		total += iov[i].iov_len;
+	}
+	if (unlikely(total > UINT32_MAX))
+		return -EINVAL;
+
+	*len = total;
+	return 0;
+}
+
+/* CIOCCRYPTV: turn a crypt_vec_op into a kernel_crypt_op and run it */
+static int crypto_run_vec(struct fcrypt *fcr, void *arg)
+{
+	struct kernel_crypt_op kcop;
+	struct crypt_op *cop = &kcop.cop;
+	struct crypt_vec_op vop;
+	uint32_t dst_len;
+	int ret;
+
+	memcpy(&vop, arg, sizeof(vop));
+
+	if (unlikely(!vop.src_iovcnt || vop.src_iovcnt > IOV_MAX ||
+	             vop.dst_iovcnt > IOV_MAX ||
+	             vop.flags & (COP_FLAG_NO_ZC | COP_FLAG_REGBUF))) {
+		ddebug(1, "invalid vectored operation");
+		return -EINVAL;
+	}
+
+	memset(cop, 0, sizeof(*cop));
+	ret = iov_total_len(vop.src, vop.src_iovcnt, &cop->len);
+	if (!ret && vop.dst_iovcnt) {
+		ret = iov_total_len(vop.dst, vop.dst_iovcnt, &dst_len);
+		if (!ret && dst_len != cop->len)
+			ret = -EINVAL;
+	}
+	if (unlikely(ret)) {
+		ddebug(1, "invalid iovec lengths");
+		return ret;
+	}
+
+	cop->ses = vop.ses;
+	cop->op = vop.op;
+	cop->flags = vop.flags;
+	cop->mac = vop.mac;
+	cop->iv = vop.iv;
+	ret = fill_kcop_from_cop(&kcop, fcr);
+	if (unlikely(ret))
+		return ret;
+
+	kcop.src_iov = vop.src;
+	kcop.src_iovcnt = vop.src_iovcnt;
+	if (vop.dst_iovcnt) {
+		kcop.dst_iov = vop.dst;
+		kcop.dst_iovcnt = vop.dst_iovcnt;
+	}
+
+	ret = crypto_run(fcr, &kcop);
+	if (likely(!ret))
+		ret = fill_cop_from_kcop(&kcop, fcr);
+	return ret;
+}
+
+/* move up to fop->count completed jobs to userspace
+ *
+ * returns:
+ * -EBUSY if no completed jobs are ready (yet)
+ * 0 on success, fop->count holds the number of jobs fetched */
+static int crypto_async_fetch_many(struct crypt_priv *pcr,
+		struct crypt_fetch_op *fop)
+{
+	struct todo_list_item *item, *first = NULL, **last = &first;
+	unsigned int fetched = 0;
+
+	if (unlikely(fop->count == 0))
+		return -EINVAL;
+
+	pthread_mutex_lock(&pcr->done.lock);
+	while (fetched < fop->count && (item = list_del_first_of(&pcr->done, 0))) {
+		*last = item;
+		last = &item->next;
+		fetched++;
+	}
+	*last = NULL;
+	if (fetched)
+		crypto_async_drained(pcr);
+	pthread_mutex_unlock(&pcr->done.lock);
+
+	if (!fetched)
+		return -EBUSY;
+
+	fop->count = 0;
+	for (item = first; item; item = item->next) {
+		kcop_to_user(&item->kcop, &pcr->fcrypt, fop->cops + fop->count);
+		if (fop->results)
+			fop->results[fop->count] = item->result;
+		fop->count++;
+	}
+
+	cryptodev_stat_add(&pcr->fcrypt, CSTAT_ASYNC_FETCHED, fop->count);
+
+	crypto_put_items(pcr, first, last);
+
+	return 0;
+}
+
+static int get_session_info(struct fcrypt *fcr, struct session_info_op *siop)
+{
+	struct csession *ses_ptr;
+
+	/* this also enters ses_ptr->sem */
+	ses_ptr = crypto_get_session_by_sid(fcr, siop->ses);
+	if (unlikely(!ses_ptr)) {
+		derr(1, "invalid session ID=0x%08X", siop->ses);
+		return -EINVAL;
+	}
+
+	/* everything runs in software, nothing is kernel driver only */
+	siop->flags = 0;
+
+	if (ses_ptr->cdata.init) {
+		snprintf(siop->cipher_info.cra_name, CRYPTODEV_MAX_ALG_NAME,
+				"%s", ses_ptr->cdata.alg_name);
+		snprintf(siop->cipher_info.cra_driver_name, CRYPTODEV_MAX_ALG_NAME,
+				"openssl(%s)", cryptodev_cipher_driver_name(&ses_ptr->cdata));
+	}
+	if (ses_ptr->hdata.init) {
+		snprintf(siop->hash_info.cra_name, CRYPTODEV_MAX_ALG_NAME,
+				"%s", ses_ptr->hdata.alg_name);
+		snprintf(siop->hash_info.cra_driver_name, CRYPTODEV_MAX_ALG_NAME,
+				ses_ptr->hdata.hmac_mode ? "hmac(openssl(%s))" : "openssl(%s)",
+				cryptodev_hash_driver_name(&ses_ptr->hdata));
+	}
+
+	siop->alignmask = ses_ptr->alignmask;
+
+	crypto_put_session(ses_ptr);
+	return 0;
+}
+
+/* CIOCSESSIV: set the IV of COP_FLAG_KERNEL_IV operations */
+static int crypto_set_session_iv(struct fcrypt *fcr,
+		struct crypt_sessiv_op *sivop)
+{
+	struct csession *ses_ptr;
+	int ret = 0;
+
+	/* this also enters ses_ptr->sem */
+	ses_ptr = crypto_get_session_by_sid(fcr, sivop->ses);
+	if (unlikely(!ses_ptr)) {
+		derr(1, "invalid session ID=0x%08X", sivop->ses);
+		return -EINVAL;
+	}
+
+	if (unlikely(!ses_ptr->cdata.init || !ses_ptr->cdata.ivsize ||
+	             sivop->iv_len != ses_ptr->cdata.ivsize)) {
+		ddebug(1, "session 0x%08X takes no IV of %u bytes",
+				sivop->ses, sivop->iv_len);
+		ret = -EINVAL;
+		goto out_unlock;
+	}
+
+	/* chained IVs such as CBC's are refused, as by the module */
+	if (unlikely(!ses_ptr->cdata.stream)) {
+		ddebug(1, "session 0x%08X is not in a counter mode", sivop->ses);
+		ret = -EINVAL;
+		goto out_unlock;
+	}
+
+	memcpy(ses_ptr->iv, sivop->iv, sivop->iv_len);
+	ses_ptr->kernel_iv = 1;
+
+out_unlock:
+	crypto_put_session(ses_ptr);
+	return ret;
+}
+
+/* copy the performance counters of this handle to userspace */
+static int get_stats(struct crypt_priv *pcr, struct crypt_stats_op *sop)
+{
+	struct cryptodev_stats *stats = &pcr->fcrypt.stats;
+	int i;
+
+	memset(sop, 0, sizeof(*sop));
+	sop->ops = stats->cnt[CSTAT_OPS];
+	sop->auth_ops = stats->cnt[CSTAT_AUTH_OPS];
+	sop->bytes = stats->cnt[CSTAT_BYTES];
+	sop->errors = stats->cnt[CSTAT_ERRORS];
+	sop->zc_ops = stats->cnt[CSTAT_ZC];
+	sop->regbuf_ops = stats->cnt[CSTAT_REGBUF];
+	sop->bounce_ops = stats->cnt[CSTAT_BOUNCE];
+	sop->zc_fallbacks = stats->cnt[CSTAT_ZC_FALLBACK];
+	sop->async_submitted = stats->cnt[CSTAT_ASYNC_SUBMITTED];
+	sop->async_fetched = stats->cnt[CSTAT_ASYNC_FETCHED];
+	sop->async_busy = stats->cnt[CSTAT_ASYNC_BUSY];
+	sop->sessions_created = stats->cnt[CSTAT_SESSION_CREATE];
+	sop->sessions_destroyed = stats->cnt[CSTAT_SESSION_DESTROY];
+	for (i = 0; i < CRYPTODEV_LAT_BUCKETS; i++) {
+		sop->run_latency[i] = __atomic_load_n(
+				&stats->lat[CSTAT_LAT_RUN][i], __ATOMIC_RELAXED);
+		sop->auth_run_latency[i] = __atomic_load_n(
+				&stats->lat[CSTAT_LAT_AUTH_RUN][i], __ATOMIC_RELAXED);
+	}
+	sop->async_depth = __atomic_load_n(&pcr->maxitems, __ATOMIC_RELAXED);
+	return 0;
+}
+
+/* bignum operation, see asym.c */
+static int run_kop(void *arg)
+{
+	struct kernel_crypt_kop kkop;
+	int ret;
+
+	memcpy(&kkop.kop, arg, sizeof(kkop.kop));
+
+	ret = crypto_kop_get(&kkop);
+	if (unlikely(ret))
+		return ret;
+
+	ret = crypto_kop_run(&kkop);
+	if (likely(!ret))
+		ret = crypto_kop_put(&kkop);
+	crypto_kop_free(&kkop);
+	if (unlikely(ret))
+		return ret;
+
+	memcpy(arg, &kkop.kop, sizeof(kkop.kop));
+	return 0;
+}
+
+static long
+__cryptodev_ioctl(struct crypt_priv *pcr, int filp, unsigned int cmd, void *arg)
+{
+	int *p = arg;
+	struct session_op *sop;
+	struct kernel_crypt_op kcop;
+	struct kernel_crypt_auth_op kcaop;
+	struct fcrypt *fcr;
+	struct crypt_fetch_op *fop;
+	uint32_t depth;
+	int ret, fd;
+
+	fcr = &pcr->fcrypt;
+
+	switch (cmd) {
+	case CIOCASYMFEAT:
+		*(uint32_t *)arg = crypto_asym_features();
+		return 0;
+	case CIOCKEY:
+		return run_kop(arg);
+	case CRIOGET:
+		fd = clonefd(pcr, filp);
+		if (unlikely(fd < 0))
+			return fd;
+		*p = fd;
+		return 0;
+	case CIOCGSESSION:
+		sop = arg;
+		return crypto_create_session(fcr, sop);
+	case CIOCFSESSION:
+		return crypto_finish_session(fcr, *(uint32_t *)arg);
+	case CIOCGSESSINFO:
+		return get_session_info(fcr, arg);
+	case CIOCCRYPT:
+		if (unlikely(ret = kcop_from_user(&kcop, fcr, arg))) {
+			dwarning(1, "Error copying from user");
+			return ret;
+		}
+
+		ret = crypto_run(fcr, &kcop);
+		if (unlikely(ret)) {
+			dwarning(1, "Error in crypto_run");
+			return ret;
+		}
+
+		return kcop_to_user(&kcop, fcr, arg);
+	case CIOCCRYPTV:
+		return crypto_run_vec(fcr, arg);
+	case CIOCAUTHCRYPT:
+		if (unlikely(ret = kcaop_from_user(&kcaop, fcr, arg))) {
+			dwarning(1, "Error copying from user");
+			return ret;
+		}
+
+		ret = crypto_auth_run(fcr, &kcaop);
+		if (unlikely(ret)) {
+			dwarning(1, "Error in crypto_auth_run");
+			return ret;
+		}
+		return kcaop_to_user(&kcaop, fcr, arg);
+	case CIOCREGBUF:
+		return crypto_register_buf(fcr, arg);
+	case CIOCUNREGBUF:
+		return crypto_unregister_buf(fcr, *(uint32_t *)arg);
+	case CIOCGSTATS:
+		return get_stats(pcr, arg);
+	case CIOCSESSIV:
+		return crypto_set_session_iv(fcr, arg);
+	case CIOCASYNCCRYPT:
+		if (unlikely(ret = kcop_from_user(&kcop, fcr, arg)))
+			return ret;
+
+		return crypto_async_run(pcr, &kcop);
+	case CIOCASYNCFETCH:
+		ret = crypto_async_fetch(pcr, &kcop);
+		if (unlikely(ret))
+			return ret;
+
+		return kcop_to_user(&kcop, fcr, arg);
+	case CIOCASYNCFETCHMANY:
+		fop = arg;
+		return crypto_async_fetch_many(pcr, fop);
+	case CIOCASYNCKEY:
+		return crypto_async_key(pcr, arg);
+	case CIOCASYNCFETCHKEY:
+		return crypto_async_fetch_key(pcr, arg);
+	case CIOCASYNCDEPTH:
+		depth = *(uint32_t *)arg;
+		ret = crypto_async_set_depth(pcr, &depth);
+		if (unlikely(ret))
+			return ret;
+		*(uint32_t *)arg = depth;
+		return 0;
+	case CIOCASYNCEVENTFD:
+		return crypto_async_set_eventfd(pcr, *p);
+	case CIOCASYNCAFFINITY:
+		return crypto_async_set_affinity(pcr, *p);
+	default:
+		return -EINVAL;
+	}
+}
+
+static pthread_once_t cryptodev_once = PTHREAD_ONCE_INIT;
+
+static void init_cryptodev(void)
+{
+	const char *verbosity = getenv("CRYPTODEV_EMU_VERBOSITY");
+
+	if (verbosity)
+		cryptodev_verbosity = atoi(verbosity);
+	cryptodev_emu_crypto_init();
+}
+
+int cryptodev_emu_open(int flags)
+{
+	struct crypt_priv *pcr;
+	int fd, ret;
+
+	pthread_once(&cryptodev_once, init_cryptodev);
+
+	pcr = cryptodev_alloc();
+	if (!pcr) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	fd = fcntl(pcr->notify, flags & O_CLOEXEC ? F_DUPFD_CLOEXEC : F_DUPFD, 0);
+	if (fd < 0) {
+		ret = -errno;
+		goto err_release;
+	}
+	ret = fdtab_install(fd, pcr);
+	if (unlikely(ret)) {
+		close(fd);
+		goto err_release;
+	}
+	return fd;
+
+err_release:
+	cryptodev_release(pcr);
+	errno = -ret;
+	return -1;
+}
+
+int cryptodev_emu_ioctl(int fd, unsigned long request, void *arg)
+{
+	struct crypt_priv *pcr;
+	long ret;
+
+	pcr = crypto_get_priv(fd);
+	if (unlikely(!pcr)) {
+		errno = EBADF;
+		return -1;
+	}
+
+	ret = __cryptodev_ioctl(pcr, fd, request, arg);
+	crypto_put_priv(pcr);
+
+	if (ret < 0) {
+		errno = -ret;
+		return -1;
+	}
+	return ret;
+}
+
+int cryptodev_emu_close(int fd)
+{
+	struct crypt_priv *pcr;
+	int ret;
+
+	pcr = fdtab_remove(fd);
+	if (unlikely(!pcr)) {
+		errno = EBADF;
+		return -1;
+	}
+
+	/* the descriptor is no longer a handle, so this is the real close */
+	ret = close(fd);
+	crypto_put_priv(pcr);
+	return ret;
+}
+
+int cryptodev_emu_is_handle(int fd)
+{
+	struct crypt_priv **slot = fdtab_slot(fd);
+
+	return slot && __atomic_load_n(slot, __ATOMIC_ACQUIRE) != NULL;
+}
@@ -0,0 +1,290 @@
+/*
+ * Userspace emulation of the /dev/crypto device
+ *
+ * This file is part of linux cryptodev.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/* This file contains the traditional operations of encryption
+ * and hashing of /dev/crypto, as main.c of the module. The user
+ * buffers are used in place, so every operation is "zero-copy"
+ * except for CIOCCRYPTV, which is gathered into a bounce buffer.
+ */
+
+#include <stdlib.h>
+#include "emu.h"
+
+/* Sessions with both a cipher and a hash are processed in slices of
+ * this size, as the module does.
+ */
+#define HASH_CRYPT_SLICE	(16 * 1024)
+
+static int
+__hash_n_crypt(struct csession *ses_ptr, struct crypt_op *cop,
+		const uint8_t *src, uint8_t *dst, uint32_t len)
+{
+	int ret;
+
+	/* Always hash before encryption and after decryption. */
+	if (cop->op == COP_ENCRYPT) {
+		if (ses_ptr->hdata.init != 0) {
+			ret = cryptodev_hash_update(&ses_ptr->hdata, src, len);
+			if (unlikely(ret))
+				goto out_err;
+		}
+		if (ses_ptr->cdata.init != 0) {
+			ret = cryptodev_cipher_encrypt(&ses_ptr->cdata,
+							src, dst, len);
+			if (unlikely(ret))
+				goto out_err;
+		}
+	} else {
+		if (ses_ptr->cdata.init != 0) {
+			ret = cryptodev_cipher_decrypt(&ses_ptr->cdata,
+							src, dst, len);
+			if (unlikely(ret))
+				goto out_err;
+		}
+
+		if (ses_ptr->hdata.init != 0) {
+			ret = cryptodev_hash_update(&ses_ptr->hdata,
+					ses_ptr->cdata.init ? dst : src, len);
+			if (unlikely(ret))
+				goto out_err;
+		}
+	}
+	return 0;
+out_err:
+	derr(0, "OpenSSL failure: %d", ret);
+	return ret;
+}
+
+static int
+hash_n_crypt(struct csession *ses_ptr, struct crypt_op *cop,
+		const uint8_t *src, uint8_t *dst, uint32_t len)
+{
+	uint32_t n;
+	int ret;
+
+	if (ses_ptr->hdata.init == 0 || ses_ptr->cdata.init == 0 ||
+	    ses_ptr->cdata.unchained || len <= HASH_CRYPT_SLICE)
+		return __hash_n_crypt(ses_ptr, cop, src, dst, len);
+
+	for (; len > 0; len -= n) {
+		n = min(len, HASH_CRYPT_SLICE);
+		ret = __hash_n_crypt(ses_ptr, cop, src, dst, n);
+		if (unlikely(ret))
+			return ret;
+		src += n;
+		dst += n;
+	}
+	return 0;
+}
+
+static int get_bounce_buffer(struct csession *ses_ptr, size_t len)
+{
+	uint8_t *bounce;
+
+	if (likely(ses_ptr->bounce_len >= len))
+		return 0;
+
+	bounce = realloc(ses_ptr->bounce, len);
+	if (unlikely(!bounce)) {
+		derr(1, "Error getting a bounce buffer of %zu bytes.", len);
+		return -ENOMEM;
+	}
+	ses_ptr->bounce = bounce;
+	ses_ptr->bounce_len = len;
+	return 0;
+}
+
+/* This is the main crypto function - vectored edition */
+static int
+__crypto_run_iov(struct csession *ses_ptr, struct kernel_crypt_op *kcop)
+{
+	const struct iovec *iov;
+	unsigned int i, iovcnt;
+	uint8_t *p;
+	int ret;
+
+	ret = get_bounce_buffer(ses_ptr, kcop->cop.len);
+	if (unlikely(ret))
+		return ret;
+
+	for (i = 0, p = ses_ptr->bounce; i < kcop->src_iovcnt; i++) {
+		memcpy(p, kcop->src_iov[i].iov_base, kcop->src_iov[i].iov_len);
+		p += kcop->src_iov[i].iov_len;
+	}
+
+	ret = hash_n_crypt(ses_ptr, &kcop->cop, ses_ptr->bounce,
+			ses_ptr->bounce, kcop->cop.len);
+	if (unlikely(ret) || ses_ptr->cdata.init == 0)
+		return ret;
+
+	iov = kcop->dst_iov ? kcop->dst_iov : kcop->src_iov;
+	iovcnt = kcop->dst_iov ? kcop->dst_iovcnt : kcop->src_iovcnt;
+	for (i = 0, p = ses_ptr->bounce; i < iovcnt; i++) {
+		memcpy(iov[i].iov_base, p, iov[i].iov_len);
+		p += iov[i].iov_len;
+	}
+	return 0;
+}
+
+/* This is the main crypto function - registered buffer edition */
+static int
+__crypto_run_regbuf(struct fcrypt *fcr, struct csession *ses_ptr,
+		struct kernel_crypt_op *kcop)
+{
+	struct crypt_op *cop = &kcop->cop;
+
+	if (unlikely(!crypto_get_regbuf(fcr, cop->src, cop->len))) {
+		derr(1, "source %p is not in a registered buffer", cop->src);
+		return -EINVAL;
+	}
+
+	if (cop->dst && unlikely(!crypto_get_regbuf(fcr, cop->dst, cop->len))) {
+		derr(1, "destination %p is not in a registered buffer", cop->dst);
+		return -EINVAL;
+	}
+
+	return hash_n_crypt(ses_ptr, cop, cop->src, cop->dst, cop->len);
+}
+
+/* step the session IV past an operation of len bytes before it runs,
+ * as the module does: AEAD nonces by one, counters by the blocks */
+void crypto_session_iv_advance(struct csession *ses_ptr, unsigned int len)
+{
+	unsigned int i = ses_ptr->cdata.ivsize;
+	uint64_t carry;
+
+	if (ses_ptr->cdata.aead)
+		carry = 1;
+	else
+		carry = (len + ses_ptr->cdata.ivsize - 1) / ses_ptr->cdata.ivsize;
+
+	while (carry && i--) {
+		carry += ses_ptr->iv[i];
+		ses_ptr->iv[i] = carry & 0xff;
+		carry >>= 8;
+	}
+}
+
+int crypto_run(struct fcrypt *fcr, struct kernel_crypt_op *kcop)
+{
+	struct csession *ses_ptr;
+	struct crypt_op *cop = &kcop->cop;
+	uint64_t start = cryptodev_get_ns();
+	int ret = 0;
+
+	if (unlikely(cop->op != COP_ENCRYPT && cop->op != COP_DECRYPT)) {
+		ddebug(1, "invalid operation op=%u", cop->op);
+		return -EINVAL;
+	}
+
+	/* this also enters ses_ptr->sem */
+	ses_ptr = crypto_get_session_by_sid(fcr, cop->ses);
+	if (unlikely(!ses_ptr)) {
+		derr(1, "invalid session ID=0x%08X", cop->ses);
+		return -EINVAL;
+	}
+
+	if (ses_ptr->hdata.init != 0 && (cop->flags == 0 || cop->flags & COP_FLAG_RESET)) {
+		ret = cryptodev_hash_reset(&ses_ptr->hdata);
+		if (unlikely(ret)) {
+			derr(1, "error in cryptodev_hash_reset()");
+			goto out_unlock;
+		}
+	}
+
+	if (ses_ptr->cdata.init != 0) {
+		int blocksize = ses_ptr->cdata.blocksize;
+
+		if (unlikely(cop->len % blocksize)) {
+			derr(1, "data size (%u) isn't a multiple of block size (%u)",
+				cop->len, blocksize);
+			ret = -EINVAL;
+			goto out_unlock;
+		}
+
+		if (cop->flags & COP_FLAG_KERNEL_IV) {
+			if (unlikely(!ses_ptr->kernel_iv)) {
+				derr(1, "session has no IV, set one with CIOCSESSIV");
+				ret = -EINVAL;
+				goto out_unlock;
+			}
+			memcpy(kcop->iv, ses_ptr->iv, ses_ptr->cdata.ivsize);
+			crypto_session_iv_advance(ses_ptr, cop->len);
+		}
+
+		cryptodev_cipher_set_iv(&ses_ptr->cdata, kcop->iv,
+				min(ses_ptr->cdata.ivsize, kcop->ivlen));
+	}
+
+	if (likely(cop->len)) {
+		/* where the module would fault on the user address */
+		if (!kcop->src_iov && unlikely(!cop->src ||
+		    (ses_ptr->cdata.init != 0 && !cop->dst))) {
+			ret = -EFAULT;
+			goto out_unlock;
+		}
+
+		if (kcop->src_iov) {
+			cryptodev_stat_inc(fcr, CSTAT_ZC);
+			ret = __crypto_run_iov(ses_ptr, kcop);
+		} else if (cop->flags & COP_FLAG_REGBUF) {
+			cryptodev_stat_inc(fcr, CSTAT_REGBUF);
+			ret = __crypto_run_regbuf(fcr, ses_ptr, kcop);
+		} else {
+			cryptodev_stat_inc(fcr, cop->flags & COP_FLAG_NO_ZC ?
+					CSTAT_BOUNCE : CSTAT_ZC);
+			ret = hash_n_crypt(ses_ptr, cop, cop->src, cop->dst,
+					cop->len);
+		}
+		if (unlikely(ret))
+			goto out_unlock;
+	}
+
+	/* kernel IV operations report the IV they used, which kcop->iv
+	 * still holds */
+	if (ses_ptr->cdata.init != 0 && !(cop->flags & COP_FLAG_KERNEL_IV))
+		cryptodev_cipher_get_iv(&ses_ptr->cdata, kcop->iv,
+				min(ses_ptr->cdata.ivsize, kcop->ivlen));
+
+	if (ses_ptr->hdata.init != 0 &&
+		((cop->flags & COP_FLAG_FINAL) ||
+		   (!(cop->flags & COP_FLAG_UPDATE) || cop->len == 0))) {
+
+		ret = cryptodev_hash_final(&ses_ptr->hdata, kcop->hash_output);
+		if (unlikely(ret)) {
+			derr(0, "OpenSSL failure: %d", ret);
+			goto out_unlock;
+		}
+		kcop->digestsize = ses_ptr->hdata.digestsize;
+	}
+
+out_unlock:
+	crypto_put_session(ses_ptr);
+
+	if (unlikely(ret)) {
+		cryptodev_stat_inc(fcr, CSTAT_ERRORS);
+	} else {
+		cryptodev_stat_inc(fcr, CSTAT_OPS);
+		cryptodev_stat_add(fcr, CSTAT_BYTES, cop->len);
+	}
+	cryptodev_stat_latency(fcr, CSTAT_LAT_RUN, start);
+	return ret;
+}
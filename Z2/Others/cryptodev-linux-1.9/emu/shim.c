@@ -0,0 +1,163 @@
+/*
+ * Userspace emulation of the /dev/crypto device
+ *
+ * This file is part of linux cryptodev.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/* The system calls a program uses on /dev/crypto, taken over either by
+ * preloading the shared library or by linking the static one before
+ * the C library. Opening the device gives an emulated handle; anything
+ * else, and every other descriptor, goes to the C library.
+ */
+
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <sys/ioctl.h>
+#include "emu.h"
+#include "cryptodev_emu.h"
+
+#define CRYPTODEV_PATH	"/dev/crypto"
+
+static int (*real_open)(const char *, int, ...);
+static int (*real_openat)(int, const char *, int, ...);
+static int (*real_ioctl)(int, unsigned long, ...);
+static int (*real_close)(int);
+
+static pthread_once_t shim_once = PTHREAD_ONCE_INIT;
+
+static void shim_init(void)
+{
+	real_open = dlsym(RTLD_NEXT, "open");
+	real_openat = dlsym(RTLD_NEXT, "openat");
+	real_ioctl = dlsym(RTLD_NEXT, "ioctl");
+	real_close = dlsym(RTLD_NEXT, "close");
+}
+
+static inline int is_cryptodev(const char *path)
+{
+	return path && strcmp(path, CRYPTODEV_PATH) == 0;
+}
+
+/* the mode argument is only there when a file may be created */
+static inline int open_needs_mode(int flags)
+{
+	return flags & O_CREAT || (flags & O_TMPFILE) == O_TMPFILE;
+}
+
+static int shim_openat(int dirfd, const char *path, int flags, mode_t mode)
+{
+	if (is_cryptodev(path))
+		return cryptodev_emu_open(flags);
+
+	pthread_once(&shim_once, shim_init);
+	if (dirfd == AT_FDCWD)
+		return real_open(path, flags, mode);
+	return real_openat(dirfd, path, flags, mode);
+}
+
+#define SHIM_MODE(flags, mode)				\
+	do {						\
+		va_list ap;				\
+							\
+		if (open_needs_mode(flags)) {		\
+			va_start(ap, flags);		\
+			mode = va_arg(ap, mode_t);	\
+			va_end(ap);			\
+		}					\
+	} while (0)
+
+int open(const char *path, int flags, ...)
+{
+	mode_t mode = 0;
+
+	SHIM_MODE(flags, mode);
+	return shim_openat(AT_FDCWD, path, flags, mode);
+}
+
+int open64(const char *path, int flags, ...)
+{
+	mode_t mode = 0;
+
+	SHIM_MODE(flags, mode);
+	return shim_openat(AT_FDCWD, path, flags | O_LARGEFILE, mode);
+}
+
+int openat(int dirfd, const char *path, int flags, ...)
+{
+	mode_t mode = 0;
+
+	SHIM_MODE(flags, mode);
+	return shim_openat(dirfd, path, flags, mode);
+}
+
+int openat64(int dirfd, const char *path, int flags, ...)
+{
+	mode_t mode = 0;
+
+	SHIM_MODE(flags, mode);
+	return shim_openat(dirfd, path, flags | O_LARGEFILE, mode);
+}
+
+/* the _FORTIFY_SOURCE variants, called when the mode is known to be
+ * absent */
+int __open_2(const char *path, int flags)
+{
+	return shim_openat(AT_FDCWD, path, flags, 0);
+}
+
+int __open64_2(const char *path, int flags)
+{
+	return shim_openat(AT_FDCWD, path, flags | O_LARGEFILE, 0);
+}
+
+int __openat_2(int dirfd, const char *path, int flags)
+{
+	return shim_openat(dirfd, path, flags, 0);
+}
+
+int __openat64_2(int dirfd, const char *path, int flags)
+{
+	return shim_openat(dirfd, path, flags | O_LARGEFILE, 0);
+}
+
+int ioctl(int fd, unsigned long request, ...)
+{
+	va_list ap;
+	void *arg;
+
+	va_start(ap, request);
+	arg = va_arg(ap, void *);
+	va_end(ap);
+
+	if (cryptodev_emu_is_handle(fd))
+		return cryptodev_emu_ioctl(fd, request, arg);
+
+	pthread_once(&shim_once, shim_init);
+	return real_ioctl(fd, request, arg);
+}
+
+int close(int fd)
+{
+	if (cryptodev_emu_is_handle(fd))
+		return cryptodev_emu_close(fd);
+
+	pthread_once(&shim_once, shim_init);
+	return real_close(fd);
+}
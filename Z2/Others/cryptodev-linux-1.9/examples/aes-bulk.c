@@ -0,0 +1,503 @@
+/*
+ * Demo on how to encrypt large files with /dev/crypto on all CPUs.
+ *
+ * The file is cut into segments that are ciphered independently, so
+ * that any number of threads, each with its own descriptor and session,
+ * can work on them at once. In CTR mode the counter of a segment starts
+ * where the previous one ends, and the result is that of a single CTR
+ * pass over the file. In XTS mode each segment is a data unit whose
+ * tweak is its number, as disk sectors are; decryption must then use
+ * the same segment size.
+ *
+ * The segments are mapped and ciphered from one file into the other in
+ * a single operation, the pages going to the driver without a copy.
+ * Each thread starts writing its output back as soon as it is done and
+ * drops the oldest segments from the page cache once more than a window
+ * of them is pending, so memory use stays flat however large the file.
+ * With -D the files are read and written with O_DIRECT into one buffer
+ * per thread instead.
+ *
+ * Build: gcc -O2 -I.. aes-bulk.c -o aes-bulk -lpthread
+ *
+ * Placed under public domain.
+ *
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <crypto/cryptodev.h>
+
+#define	AES_BLOCK_SIZE	16
+#define	DEFAULT_SEGMENT	(1024 * 1024)
+#define	DEFAULT_WINDOW	8
+#define	MAX_WINDOW	64
+#define	MAX_WORKERS	256
+/* the alignment O_DIRECT wants of offsets, lengths and buffers */
+#define	DIRECT_ALIGN	4096
+
+static struct {
+	int cipher;
+	int op;			/* COP_ENCRYPT or COP_DECRYPT */
+	uint8_t key[CRYPTO_CIPHER_MAX_KEY_LEN];
+	unsigned int keylen;
+	uint8_t iv[AES_BLOCK_SIZE];
+	int direct;
+	unsigned int window;
+
+	int in_fd, out_fd;
+	/* the O_DIRECT descriptors, when -D is given */
+	int in_dfd, out_dfd;
+	off_t size;
+	size_t segment;
+	uint64_t nsegments;
+	unsigned int nworkers;
+
+	pthread_mutex_t lock;
+	uint64_t next;		/* the next segment to cipher */
+	int failed;
+} g = {
+	.cipher = CRYPTO_AES_CTR,
+	.op = COP_ENCRYPT,
+	.segment = DEFAULT_SEGMENT,
+	.window = DEFAULT_WINDOW,
+	.in_fd = -1, .out_fd = -1,
+	.in_dfd = -1, .out_dfd = -1,
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+struct worker {
+	pthread_t thread;
+	int cfd;
+	struct session_op sess;
+	uint8_t *buf;		/* a segment, with -D */
+	/* the segments written but maybe still in the page cache */
+	uint64_t behind[MAX_WINDOW];
+	unsigned int nbehind;
+};
+
+static int parse_hex(const char *s, uint8_t *out, unsigned int max)
+{
+	unsigned int n = 0, v;
+
+	while (s[0] && s[1]) {
+		if (n == max || sscanf(s, "%2x", &v) != 1)
+			return -1;
+		out[n++] = v;
+		s += 2;
+	}
+	return *s ? -1 : (int)n;
+}
+
+/* The counter block of segment i in CTR mode, the base IV plus its
+ * offset in blocks, or its tweak in XTS mode, i in little endian as
+ * the plain64 IVs of dm-crypt. */
+static void segment_iv(uint64_t i, uint8_t *iv)
+{
+	uint64_t add;
+	unsigned int carry, b;
+
+	if (g.cipher == CRYPTO_AES_XTS) {
+		memset(iv, 0, AES_BLOCK_SIZE);
+		for (b = 0; b < 8; b++)
+			iv[b] = i >> (8 * b);
+		return;
+	}
+
+	memcpy(iv, g.iv, AES_BLOCK_SIZE);
+	add = i * (g.segment / AES_BLOCK_SIZE);
+	carry = 0;
+	for (b = AES_BLOCK_SIZE; b-- > 0; ) {
+		carry += iv[b] + (add & 0xff);
+		iv[b] = carry;
+		carry >>= 8;
+		add >>= 8;
+	}
+}
+
+static int worker_init(struct worker *w)
+{
+	memset(w, 0, sizeof(*w));
+	w->cfd = open("/dev/crypto", O_RDWR | O_CLOEXEC, 0);
+	if (w->cfd < 0) {
+		perror("open(/dev/crypto)");
+		return -1;
+	}
+
+	w->sess.cipher = g.cipher;
+	w->sess.keylen = g.keylen;
+	w->sess.key = g.key;
+	if (ioctl(w->cfd, CIOCGSESSION, &w->sess)) {
+		perror("ioctl(CIOCGSESSION)");
+		close(w->cfd);
+		return -1;
+	}
+
+	if (g.direct && posix_memalign((void **)&w->buf, DIRECT_ALIGN,
+				g.segment)) {
+		fprintf(stderr, "out of memory\n");
+		ioctl(w->cfd, CIOCFSESSION, &w->sess.ses);
+		close(w->cfd);
+		return -1;
+	}
+	return 0;
+}
+
+static void worker_deinit(struct worker *w)
+{
+	if (ioctl(w->cfd, CIOCFSESSION, &w->sess.ses))
+		perror("ioctl(CIOCFSESSION)");
+	close(w->cfd);
+	free(w->buf);
+}
+
+static int crypt_segment(struct worker *w, uint64_t i, const void *src,
+		void *dst, size_t len)
+{
+	struct crypt_op cop;
+	uint8_t iv[AES_BLOCK_SIZE];
+
+	segment_iv(i, iv);
+	memset(&cop, 0, sizeof(cop));
+	cop.ses = w->sess.ses;
+	cop.op = g.op;
+	cop.len = len;
+	cop.src = (void *)src;
+	cop.dst = dst;
+	cop.iv = iv;
+	if (ioctl(w->cfd, CIOCCRYPT, &cop)) {
+		perror("ioctl(CIOCCRYPT)");
+		return -1;
+	}
+	return 0;
+}
+
+static size_t segment_len(uint64_t i)
+{
+	off_t off = i * g.segment;
+
+	return g.size - off < (off_t)g.segment ? (size_t)(g.size - off) : g.segment;
+}
+
+/* Waits for segment i to be on disk and evicts it from the cache. */
+static void retire(uint64_t i)
+{
+	off_t off = i * g.segment;
+	size_t len = segment_len(i);
+
+	sync_file_range(g.out_fd, off, len, SYNC_FILE_RANGE_WAIT_BEFORE |
+			SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+	posix_fadvise(g.out_fd, off, len, POSIX_FADV_DONTNEED);
+	posix_fadvise(g.in_fd, off, len, POSIX_FADV_DONTNEED);
+}
+
+static void write_behind(struct worker *w, uint64_t i)
+{
+	sync_file_range(g.out_fd, i * g.segment, segment_len(i),
+			SYNC_FILE_RANGE_WRITE);
+
+	if (w->nbehind == g.window) {
+		retire(w->behind[0]);
+		memmove(w->behind, w->behind + 1,
+				--w->nbehind * sizeof(w->behind[0]));
+	}
+	w->behind[w->nbehind++] = i;
+}
+
+static int do_mmap(struct worker *w, uint64_t i, uint64_t ahead)
+{
+	off_t off = i * g.segment;
+	size_t len = segment_len(i);
+	void *src, *dst;
+	int ret;
+
+	/* the segment this thread is likely to take next */
+	if (ahead < g.nsegments)
+		posix_fadvise(g.in_fd, ahead * g.segment, segment_len(ahead),
+				POSIX_FADV_WILLNEED);
+
+	src = mmap(NULL, len, PROT_READ, MAP_SHARED, g.in_fd, off);
+	if (src == MAP_FAILED) {
+		perror("mmap");
+		return -1;
+	}
+	dst = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, g.out_fd,
+			off);
+	if (dst == MAP_FAILED) {
+		perror("mmap");
+		munmap(src, len);
+		return -1;
+	}
+
+	ret = crypt_segment(w, i, src, dst, len);
+	munmap(dst, len);
+	munmap(src, len);
+	if (!ret)
+		write_behind(w, i);
+	return ret;
+}
+
+static int do_direct(struct worker *w, uint64_t i)
+{
+	off_t off = i * g.segment;
+	size_t len = segment_len(i);
+	size_t rlen = (len + DIRECT_ALIGN - 1) & ~(size_t)(DIRECT_ALIGN - 1);
+	ssize_t n;
+	int fd;
+
+	/* reading a whole block past the end stops at it */
+	n = pread(g.in_dfd, w->buf, rlen, off);
+	if (n != (ssize_t)len) {
+		fprintf(stderr, "segment %llu: %s\n", (unsigned long long)i,
+				n < 0 ? strerror(errno) : "short read");
+		return -1;
+	}
+	if (crypt_segment(w, i, w->buf, w->buf, len))
+		return -1;
+
+	/* an unaligned tail cannot be written directly */
+	fd = len == rlen ? g.out_dfd : g.out_fd;
+	n = pwrite(fd, w->buf, len, off);
+	if (n != (ssize_t)len) {
+		fprintf(stderr, "segment %llu: %s\n", (unsigned long long)i,
+				n < 0 ? strerror(errno) : "short write");
+		return -1;
+	}
+	return 0;
+}
+
+static void *worker_routine(void *arg)
+{
+	struct worker *w = arg;
+	uint64_t i;
+	int ret;
+
+	for (;;) {
+		pthread_mutex_lock(&g.lock);
+		i = g.failed ? g.nsegments : g.next;
+		if (i < g.nsegments)
+			g.next++;
+		pthread_mutex_unlock(&g.lock);
+		if (i >= g.nsegments)
+			break;
+
+		if (g.direct)
+			ret = do_direct(w, i);
+		else
+			ret = do_mmap(w, i, i + g.nworkers);
+		if (ret) {
+			pthread_mutex_lock(&g.lock);
+			g.failed = 1;
+			pthread_mutex_unlock(&g.lock);
+			break;
+		}
+	}
+
+	while (w->nbehind)
+		retire(w->behind[--w->nbehind]);
+	return NULL;
+}
+
+static int open_files(const char *in, const char *out)
+{
+	struct stat st;
+
+	g.in_fd = open(in, O_RDONLY | O_CLOEXEC);
+	if (g.in_fd < 0 || fstat(g.in_fd, &st)) {
+		perror(in);
+		return -1;
+	}
+	g.size = st.st_size;
+
+	/* checked before the output is truncated */
+	if (g.cipher == CRYPTO_AES_XTS && g.size % AES_BLOCK_SIZE) {
+		fprintf(stderr, "xts needs whole blocks of %d bytes, use ctr\n",
+				AES_BLOCK_SIZE);
+		return -1;
+	}
+
+	g.out_fd = open(out, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (g.out_fd < 0) {
+		perror(out);
+		return -1;
+	}
+	if (ftruncate(g.out_fd, g.size)) {
+		perror(out);
+		return -1;
+	}
+
+	if (!g.direct)
+		return 0;
+	g.in_dfd = open(in, O_RDONLY | O_DIRECT | O_CLOEXEC);
+	g.out_dfd = open(out, O_WRONLY | O_DIRECT | O_CLOEXEC);
+	if (g.in_dfd < 0 || g.out_dfd < 0) {
+		fprintf(stderr, "O_DIRECT is not supported here (%s), "
+				"mapping the files instead\n", strerror(errno));
+		g.direct = 0;
+	}
+	return 0;
+}
+
+static void usage(FILE *fp)
+{
+	fprintf(fp, "Usage: aes-bulk [options] -k KEY INPUT OUTPUT\n"
+		"  -d        decrypt\n"
+		"  -m MODE   ctr or xts (ctr)\n"
+		"  -k HEX    the key, 16, 24 or 32 bytes, twice that for xts\n"
+		"  -i HEX    the initial counter block for ctr, 16 bytes; never\n"
+		"            use one twice with the same key\n"
+		"  -j N      worker threads (the number of CPUs)\n"
+		"  -s BYTES  segment size, a multiple of the page size (%d)\n"
+		"  -w N      segments each thread leaves to write back (%d)\n"
+		"  -D        read and write with O_DIRECT\n"
+		"  -v        tell the time taken\n",
+		DEFAULT_SEGMENT, DEFAULT_WINDOW);
+}
+
+int main(int argc, char **argv)
+{
+	struct worker *w;
+	struct timespec start, end;
+	long nworkers, page = sysconf(_SC_PAGESIZE);
+	int c, i, n, verbose = 0, have_iv = 0, started = 0;
+	double secs;
+
+	nworkers = sysconf(_SC_NPROCESSORS_ONLN);
+
+	while ((c = getopt(argc, argv, "dm:k:i:j:s:w:Dvh")) != -1) {
+		switch (c) {
+		case 'd':
+			g.op = COP_DECRYPT;
+			break;
+		case 'm':
+			if (!strcmp(optarg, "ctr")) {
+				g.cipher = CRYPTO_AES_CTR;
+			} else if (!strcmp(optarg, "xts")) {
+				g.cipher = CRYPTO_AES_XTS;
+			} else {
+				fprintf(stderr, "unknown mode %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'k':
+			n = parse_hex(optarg, g.key, sizeof(g.key));
+			if (n < 0) {
+				fprintf(stderr, "bad key\n");
+				return 1;
+			}
+			g.keylen = n;
+			break;
+		case 'i':
+			if (parse_hex(optarg, g.iv, sizeof(g.iv)) !=
+					AES_BLOCK_SIZE) {
+				fprintf(stderr, "the IV is 16 bytes\n");
+				return 1;
+			}
+			have_iv = 1;
+			break;
+		case 'j':
+			nworkers = atoi(optarg);
+			break;
+		case 's':
+			g.segment = strtoul(optarg, NULL, 0);
+			break;
+		case 'w':
+			g.window = atoi(optarg);
+			break;
+		case 'D':
+			g.direct = 1;
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		case 'h':
+			usage(stdout);
+			return 0;
+		default:
+			usage(stderr);
+			return 1;
+		}
+	}
+	if (argc - optind != 2 || !g.keylen) {
+		usage(stderr);
+		return 1;
+	}
+	if (g.cipher == CRYPTO_AES_CTR && !have_iv) {
+		fprintf(stderr, "ctr needs an IV (-i)\n");
+		return 1;
+	}
+	if (!g.segment || g.segment % page ||
+			(g.direct && g.segment % DIRECT_ALIGN)) {
+		fprintf(stderr, "the segment size must be a multiple of %ld\n",
+				g.direct ? DIRECT_ALIGN : page);
+		return 1;
+	}
+	if (g.window < 1 || g.window > MAX_WINDOW) {
+		fprintf(stderr, "the window is 1 to %d segments\n", MAX_WINDOW);
+		return 1;
+	}
+
+	if (open_files(argv[optind], argv[optind + 1]))
+		return 1;
+	g.nsegments = (g.size + g.segment - 1) / g.segment;
+
+	if (nworkers < 1)
+		nworkers = 1;
+	if (nworkers > MAX_WORKERS)
+		nworkers = MAX_WORKERS;
+	if ((uint64_t)nworkers > g.nsegments)
+		nworkers = g.nsegments ? g.nsegments : 1;
+
+	g.nworkers = nworkers;
+
+	w = calloc(nworkers, sizeof(*w));
+	if (!w) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < nworkers; i++) {
+		if (worker_init(&w[i]))
+			break;
+		if (pthread_create(&w[i].thread, NULL, worker_routine, &w[i])) {
+			perror("pthread_create");
+			worker_deinit(&w[i]);
+			break;
+		}
+		started++;
+	}
+	if (!started)
+		return 1;
+
+	for (i = 0; i < started; i++) {
+		pthread_join(w[i].thread, NULL);
+		worker_deinit(&w[i]);
+	}
+	if (fsync(g.out_fd)) {
+		perror(argv[optind + 1]);
+		g.failed = 1;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	if (verbose) {
+		secs = end.tv_sec - start.tv_sec +
+			(end.tv_nsec - start.tv_nsec) / 1e9;
+		fprintf(stderr, "%llu bytes in %llu segments with %d threads: "
+			"%.3f s, %.1f MB/s\n", (unsigned long long)g.size,
+			(unsigned long long)g.nsegments, started, secs,
+			secs > 0 ? g.size / secs / 1e6 : 0);
+	}
+
+	free(w);
+	return g.failed;
+}
@@ -0,0 +1,421 @@
+/*
+ * Demo on how to hash many files in parallel with /dev/crypto, as
+ * sha256sum does for one at a time.
+ *
+ * Each worker thread has its own descriptor and session, and takes the
+ * next file from a shared list. Files are mapped a window at a time and
+ * streamed through multi-update operations, so they may be larger than
+ * memory, the kernel being asked to read the next window while the
+ * current one is hashed. Files too small for the ioctl to pay off are
+ * hashed by OpenSSL instead.
+ *
+ * Build: gcc -O2 -I.. sha-files.c -o sha-files -lcrypto -lpthread
+ *
+ * Placed under public domain.
+ *
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <crypto/cryptodev.h>
+#include <openssl/evp.h>
+
+/* mapped and read ahead at a time */
+#define WINDOW		(64 * 1024 * 1024)
+/* bytes per update; a multiple of the page size */
+#define CHUNK		(1024 * 1024)
+/* below this the system call costs more than it saves */
+#define TINY		(16 * 1024)
+#define MAX_WORKERS	256
+
+static const struct {
+	const char *name;
+	int mac;
+} algs[] = {
+	{ "md5", CRYPTO_MD5 },
+	{ "sha1", CRYPTO_SHA1 },
+	{ "sha224", CRYPTO_SHA2_224 },
+	{ "sha256", CRYPTO_SHA2_256 },
+	{ "sha384", CRYPTO_SHA2_384 },
+	{ "sha512", CRYPTO_SHA2_512 },
+	{ NULL, 0 }
+};
+
+struct file {
+	char *path;
+	uint8_t digest[HASH_MAX_LEN];
+	int done, failed;
+};
+
+static struct {
+	int mac;
+	const EVP_MD *md;
+	unsigned int digest_len;
+	size_t tiny;
+	int recurse;
+
+	struct file *files;
+	size_t nfiles, room;
+
+	/* the next file to hash, and to print */
+	size_t next, printed;
+	pthread_mutex_t lock;
+	int failed;
+} g = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+struct worker {
+	pthread_t thread;
+	int cfd;
+	struct session_op sess;
+	EVP_MD_CTX *mctx;
+	uint8_t *buf;		/* for the small files */
+	uint64_t kernel_bytes, user_bytes;
+};
+
+static int add_file(const char *path)
+{
+	struct file *f;
+
+	if (g.nfiles == g.room) {
+		g.room = g.room ? 2 * g.room : 1024;
+		f = realloc(g.files, g.room * sizeof(*f));
+		if (!f)
+			return -1;
+		g.files = f;
+	}
+	f = &g.files[g.nfiles];
+	memset(f, 0, sizeof(*f));
+	f->path = strdup(path);
+	if (!f->path)
+		return -1;
+	g.nfiles++;
+	return 0;
+}
+
+static int walk_fn(const char *path, const struct stat *st, int type,
+		struct FTW *ftw)
+{
+	(void)ftw;
+
+	if (type == FTW_F && S_ISREG(st->st_mode))
+		return add_file(path) ? FTW_STOP : FTW_CONTINUE;
+	if (type == FTW_DNR || type == FTW_NS)
+		fprintf(stderr, "%s: %s\n", path, strerror(errno));
+	return FTW_CONTINUE;
+}
+
+static int add_path(const char *path)
+{
+	struct stat st;
+
+	if (stat(path, &st)) {
+		perror(path);
+		return -1;
+	}
+	if (!S_ISDIR(st.st_mode))
+		return add_file(path);
+	if (!g.recurse) {
+		fprintf(stderr, "%s: is a directory\n", path);
+		return -1;
+	}
+	return nftw(path, walk_fn, 64, FTW_PHYS | FTW_ACTIONRETVAL) ? -1 : 0;
+}
+
+static int worker_init(struct worker *w)
+{
+	w->cfd = open("/dev/crypto", O_RDWR | O_CLOEXEC, 0);
+	if (w->cfd < 0) {
+		perror("open(/dev/crypto)");
+		return -1;
+	}
+
+	memset(&w->sess, 0, sizeof(w->sess));
+	w->sess.mac = g.mac;
+	if (ioctl(w->cfd, CIOCGSESSION, &w->sess)) {
+		perror("ioctl(CIOCGSESSION)");
+		close(w->cfd);
+		return -1;
+	}
+
+	w->mctx = EVP_MD_CTX_new();
+	w->buf = malloc(g.tiny ? g.tiny : 1);
+	if (!w->mctx || !w->buf) {
+		fprintf(stderr, "out of memory\n");
+		return -1;
+	}
+	return 0;
+}
+
+static void worker_deinit(struct worker *w)
+{
+	if (ioctl(w->cfd, CIOCFSESSION, &w->sess.ses))
+		perror("ioctl(CIOCFSESSION)");
+	close(w->cfd);
+	EVP_MD_CTX_free(w->mctx);
+	free(w->buf);
+}
+
+/* One update of the session's hash; the first resets it, the last
+ * finishes it into digest. */
+static int kernel_update(struct worker *w, const void *data, size_t len,
+		int first, int last, uint8_t *digest)
+{
+	struct crypt_op cop;
+
+	memset(&cop, 0, sizeof(cop));
+	cop.ses = w->sess.ses;
+	cop.op = COP_ENCRYPT;
+	cop.len = len;
+	cop.src = (void *)data;
+	cop.mac = digest;
+	if (last)
+		cop.flags = first ? 0 : COP_FLAG_FINAL;
+	else
+		cop.flags = COP_FLAG_UPDATE | (first ? COP_FLAG_RESET : 0);
+
+	if (ioctl(w->cfd, CIOCCRYPT, &cop)) {
+		perror("ioctl(CIOCCRYPT)");
+		return -1;
+	}
+	return 0;
+}
+
+static int hash_kernel(struct worker *w, int fd, off_t size, uint8_t *digest)
+{
+	off_t off, len;
+	size_t done, n;
+	uint8_t *map;
+
+	for (off = 0; off < size; off += len) {
+		len = size - off < WINDOW ? size - off : WINDOW;
+
+		/* start reading the next window while this one is hashed */
+		if (off + len < size)
+			readahead(fd, off + len, WINDOW);
+
+		map = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, off);
+		if (map == MAP_FAILED) {
+			perror("mmap");
+			return -1;
+		}
+		madvise(map, len, MADV_SEQUENTIAL);
+
+		for (done = 0; done < (size_t)len; done += n) {
+			n = len - done < CHUNK ? len - done : CHUNK;
+			if (kernel_update(w, map + done, n, off == 0 && done == 0,
+						off + done + n == (size_t)size, digest)) {
+				munmap(map, len);
+				return -1;
+			}
+		}
+		munmap(map, len);
+	}
+	w->kernel_bytes += size;
+	return 0;
+}
+
+static int hash_user(struct worker *w, int fd, uint8_t *digest)
+{
+	ssize_t n;
+
+	if (!EVP_DigestInit_ex(w->mctx, g.md, NULL))
+		return -1;
+	while ((n = read(fd, w->buf, g.tiny ? g.tiny : 1)) != 0) {
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		EVP_DigestUpdate(w->mctx, w->buf, n);
+		w->user_bytes += n;
+	}
+	return EVP_DigestFinal_ex(w->mctx, digest, NULL) ? 0 : -1;
+}
+
+static int hash_file(struct worker *w, struct file *f)
+{
+	struct stat st;
+	int fd, ret;
+
+	fd = open(f->path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0 || fstat(fd, &st)) {
+		perror(f->path);
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+
+	/* empty files too, which cannot be mapped */
+	if ((size_t)st.st_size < g.tiny || st.st_size == 0)
+		ret = hash_user(w, fd, f->digest);
+	else
+		ret = hash_kernel(w, fd, st.st_size, f->digest);
+	if (ret)
+		fprintf(stderr, "%s: hashing failed\n", f->path);
+	close(fd);
+	return ret;
+}
+
+/* print the finished files in the order given, called locked */
+static void print_ready(void)
+{
+	struct file *f;
+	unsigned int i;
+
+	while (g.printed < g.nfiles && g.files[g.printed].done) {
+		f = &g.files[g.printed++];
+		if (!f->failed) {
+			for (i = 0; i < g.digest_len; i++)
+				printf("%02x", f->digest[i]);
+			printf("  %s\n", f->path);
+		}
+		free(f->path);
+		f->path = NULL;
+	}
+}
+
+static void *worker_routine(void *arg)
+{
+	struct worker *w = arg;
+	struct file *f;
+	size_t i;
+	int ret;
+
+	for (;;) {
+		pthread_mutex_lock(&g.lock);
+		i = g.next < g.nfiles ? g.next++ : g.nfiles;
+		pthread_mutex_unlock(&g.lock);
+		if (i == g.nfiles)
+			break;
+
+		f = &g.files[i];
+		ret = hash_file(w, f);
+
+		pthread_mutex_lock(&g.lock);
+		f->failed = ret != 0;
+		f->done = 1;
+		if (ret)
+			g.failed = 1;
+		print_ready();
+		pthread_mutex_unlock(&g.lock);
+	}
+	return NULL;
+}
+
+static void usage(FILE *fp)
+{
+	fprintf(fp, "Usage: sha-files [options] FILE|DIR...\n"
+		"  -a NAME   md5, sha1, sha224, sha256, sha384 or sha512 (sha256)\n"
+		"  -j N      worker threads (the number of CPUs)\n"
+		"  -t BYTES  files smaller than this are hashed in user-space (%d)\n"
+		"  -r        hash the files under directories\n"
+		"  -v        tell how many bytes went each way\n", TINY);
+}
+
+int main(int argc, char **argv)
+{
+	struct worker *w;
+	uint64_t kernel_bytes = 0, user_bytes = 0;
+	long nworkers;
+	int c, i, verbose = 0, started = 0;
+
+	g.mac = CRYPTO_SHA2_256;
+	g.tiny = TINY;
+	g.md = EVP_sha256();
+	nworkers = sysconf(_SC_NPROCESSORS_ONLN);
+
+	while ((c = getopt(argc, argv, "a:j:t:rvh")) != -1) {
+		switch (c) {
+		case 'a':
+			for (i = 0; algs[i].name; i++)
+				if (!strcmp(optarg, algs[i].name))
+					break;
+			if (!algs[i].name) {
+				fprintf(stderr, "unknown hash %s\n", optarg);
+				return 1;
+			}
+			g.mac = algs[i].mac;
+			g.md = EVP_get_digestbyname(algs[i].name);
+			break;
+		case 'j':
+			nworkers = atoi(optarg);
+			break;
+		case 't':
+			g.tiny = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			g.recurse = 1;
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		case 'h':
+			usage(stdout);
+			return 0;
+		default:
+			usage(stderr);
+			return 1;
+		}
+	}
+	if (optind == argc || !g.md) {
+		usage(stderr);
+		return 1;
+	}
+	if (nworkers < 1)
+		nworkers = 1;
+	if (nworkers > MAX_WORKERS)
+		nworkers = MAX_WORKERS;
+	g.digest_len = EVP_MD_size(g.md);
+
+	for (i = optind; i < argc; i++)
+		if (add_path(argv[i]))
+			g.failed = 1;
+	if ((size_t)nworkers > g.nfiles)
+		nworkers = g.nfiles ? g.nfiles : 1;
+
+	w = calloc(nworkers, sizeof(*w));
+	if (!w) {
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+	for (i = 0; i < nworkers; i++) {
+		if (worker_init(&w[i]))
+			break;
+		if (pthread_create(&w[i].thread, NULL, worker_routine, &w[i])) {
+			perror("pthread_create");
+			worker_deinit(&w[i]);
+			break;
+		}
+		started++;
+	}
+	if (!started)
+		return 1;
+
+	for (i = 0; i < started; i++) {
+		pthread_join(w[i].thread, NULL);
+		kernel_bytes += w[i].kernel_bytes;
+		user_bytes += w[i].user_bytes;
+		worker_deinit(&w[i]);
+	}
+	if (verbose)
+		fprintf(stderr, "%zu files with %d workers: %llu bytes hashed "
+			"by the kernel, %llu in user-space\n", g.nfiles, started,
+			(unsigned long long)kernel_bytes,
+			(unsigned long long)user_bytes);
+
+	free(w);
+	free(g.files);
+	return g.failed;
+}
@@ -41,6 +41,9 @@
 #include <linux/syscalls.h>
 #include <linux/pagemap.h>
 #include <linux/poll.h>
+#include <linux/eventfd.h>
+#include <linux/cpumask.h>
+#include <linux/topology.h>
 #include <linux/uaccess.h>
 #include <crypto/cryptodev.h>
 #include <linux/scatterlist.h>
@@ -51,9 +54,14 @@
 
 #include "cryptodev_int.h"
 #include "zc.h"
+#include "stats.h"
+#include "asym.h"
 #include "version.h"
 #include "cipherapi.h"
 
+#define CREATE_TRACE_POINTS
+#include "cryptodev_trace.h"
+
 MODULE_AUTHOR("Nikos Mavrogiannopoulos <nmav@gnutls.org>");
 MODULE_DESCRIPTION("CryptoDev driver");
 MODULE_LICENSE("GPL");
@@ -64,6 +72,12 @@ MODULE_LICENSE("GPL");
  * These are free, pending and done items all together. */
 #define DEF_COP_RINGSIZE 16
 #define MAX_COP_RINGSIZE 64
+/* Hard limit for the job queue size that can be requested
+ * through the module parameters or CIOCASYNCDEPTH. */
+#define LIMIT_COP_RINGSIZE 4096
+
+/* Default number of idle transforms kept for new sessions. */
+#define DEF_TFM_CACHE_SIZE 32
 
 /* ====== Module parameters ====== */
 
@@ -71,10 +85,34 @@ int cryptodev_verbosity;
 module_param(cryptodev_verbosity, int, 0644);
 MODULE_PARM_DESC(cryptodev_verbosity, "0: normal, 1: verbose, 2: debug");
 
+static int cryptodev_ringsize = DEF_COP_RINGSIZE;
+module_param(cryptodev_ringsize, int, 0644);
+MODULE_PARM_DESC(cryptodev_ringsize, "job queue items preallocated on open");
+
+static int cryptodev_max_ringsize = MAX_COP_RINGSIZE;
+module_param(cryptodev_max_ringsize, int, 0644);
+MODULE_PARM_DESC(cryptodev_max_ringsize, "default maximum job queue size of a handle");
+
+int cryptodev_bounce_order = DEF_BOUNCE_ORDER;
+module_param(cryptodev_bounce_order, int, 0644);
+MODULE_PARM_DESC(cryptodev_bounce_order, "allocation order of the bounce buffer for non zero-copy operations");
+
+int cryptodev_tfm_cache_size = DEF_TFM_CACHE_SIZE;
+module_param(cryptodev_tfm_cache_size, int, 0644);
+MODULE_PARM_DESC(cryptodev_tfm_cache_size, "transforms of finished sessions kept for reuse (0 disables)");
+
+static int cryptodev_async_affinity = CRYPTODEV_AFFINITY_LOCAL;
+module_param(cryptodev_async_affinity, int, 0644);
+MODULE_PARM_DESC(cryptodev_async_affinity, "where async jobs run by default: -1 submitting CPU, -2 submitting NUMA node, or a CPU number");
+
 /* ====== CryptoAPI ====== */
 struct todo_list_item {
 	struct list_head __hook;
-	struct kernel_crypt_op kcop;
+	int key; /* a CIOCASYNCKEY job, which uses kkop */
+	union {
+		struct kernel_crypt_op kcop;
+		struct kernel_crypt_kop kkop;
+	};
 	int result;
 };
 
@@ -87,8 +125,12 @@ struct crypt_priv {
 	struct fcrypt fcrypt;
 	struct locked_list free, todo, done;
 	int itemcount;
+	int maxitems; /* limit for itemcount, protected by free.lock */
 	struct work_struct cryptask;
 	wait_queue_head_t user_waiter;
+	struct eventfd_ctx *efd; /* completion notifier, protected by done.lock */
+	int affinity; /* a CPU or CRYPTODEV_AFFINITY_*, see CIOCASYNCAFFINITY */
+	atomic_t spread; /* next CPU of the node, for CRYPTODEV_AFFINITY_NODE */
 };
 
 #define FILL_SG(sg, ptr, len)					\
@@ -102,6 +144,9 @@ struct crypt_priv {
 /* cryptodev's own workqueue, keeps crypto tasks from disturbing the force */
 static struct workqueue_struct *cryptodev_wq;
 
+/* all job queue items are carved from this cache */
+static struct kmem_cache *cryptodev_item_cache;
+
 /* Prepare session for future use. */
 static int
 crypto_create_session(struct fcrypt *fcr, struct session_op *sop)
@@ -147,6 +192,9 @@ crypto_create_session(struct fcrypt *fcr, struct session_op *sop)
 	case CRYPTO_AES_ECB:
 		alg_name = "ecb(aes)";
 		break;
+	case CRYPTO_AES_XTS:
+		alg_name = "xts(aes)";
+		break;
 	case CRYPTO_CAMELLIA_CBC:
 		alg_name = "cbc(camellia)";
 		break;
@@ -320,6 +368,10 @@ restart:
 	list_add(&ses_new->entry, &fcr->list);
 	mutex_unlock(&fcr->sem);
 
+	trace_cryptodev_session_create(ses_new->sid, sop->cipher, sop->mac);
+
+	cryptodev_stat_inc(fcr, CSTAT_SESSION_CREATE);
+
 	/* Fill in some values for the user. */
 	sop->ses = ses_new->sid;
 	return 0;
@@ -346,11 +398,14 @@ crypto_destroy_session(struct csession *ses_ptr)
 		mutex_lock(&ses_ptr->sem);
 	}
 	ddebug(2, "Removed session 0x%08X", ses_ptr->sid);
+	trace_cryptodev_session_destroy(ses_ptr->sid);
 	cryptodev_cipher_deinit(&ses_ptr->cdata);
 	cryptodev_hash_deinit(&ses_ptr->hdata);
 	ddebug(2, "freeing space for %d user pages", ses_ptr->array_size);
 	kfree(ses_ptr->pages);
 	kfree(ses_ptr->sg);
+	if (ses_ptr->bounce)
+		free_pages((unsigned long)ses_ptr->bounce, ses_ptr->bounce_order);
 	mutex_unlock(&ses_ptr->sem);
 	mutex_destroy(&ses_ptr->sem);
 	kfree(ses_ptr);
@@ -370,6 +425,7 @@ crypto_finish_session(struct fcrypt *fcr, uint32_t sid)
 		if (ses_ptr->sid == sid) {
 			list_del(&ses_ptr->entry);
 			crypto_destroy_session(ses_ptr);
+			cryptodev_stat_inc(fcr, CSTAT_SESSION_DESTROY);
 			break;
 		}
 	}
@@ -396,6 +452,7 @@ crypto_finish_all_sessions(struct fcrypt *fcr)
 	list_for_each_entry_safe(ses_ptr, tmp, head, entry) {
 		list_del(&ses_ptr->entry);
 		crypto_destroy_session(ses_ptr);
+		cryptodev_stat_inc(fcr, CSTAT_SESSION_DESTROY);
 	}
 	mutex_unlock(&fcr->sem);
 
@@ -428,6 +485,8 @@ static void cryptask_routine(struct work_struct *work)
 {
 	struct crypt_priv *pcr = container_of(work, struct crypt_priv, cryptask);
 	struct todo_list_item *item;
+	unsigned int completed = 0;
+	uint32_t ses;
 	LIST_HEAD(tmp);
 
 	/* fetch all pending jobs into the temporary list */
@@ -437,18 +496,73 @@ static void cryptask_routine(struct work_struct *work)
 
 	/* handle each job locklessly */
 	list_for_each_entry(item, &tmp, __hook) {
-		item->result = crypto_run(&pcr->fcrypt, &item->kcop);
+		ses = item->key ? 0 : item->kcop.cop.ses;
+		trace_cryptodev_async_pickup(pcr, item, ses, 0);
+		if (item->key)
+			item->result = crypto_kop_run(&pcr->fcrypt, &item->kkop);
+		else
+			item->result = crypto_run(&pcr->fcrypt, &item->kcop);
 		if (unlikely(item->result))
-			derr(0, "crypto_run() failed: %d", item->result);
+			derr(0, "%s failed: %d", item->key ? "crypto_kop_run()" :
+					"crypto_run()", item->result);
+		trace_cryptodev_async_done(pcr, item, ses, item->result);
+		completed++;
 	}
 
-	/* push all handled jobs to the done list at once */
+	/* push all handled jobs to the done list at once, and
+	 * report them to the eventfd as a single event */
 	mutex_lock(&pcr->done.lock);
 	list_splice_tail(&tmp, &pcr->done.list);
+	if (pcr->efd && completed)
+		eventfd_signal(pcr->efd, completed);
 	mutex_unlock(&pcr->done.lock);
 
 	/* wake for POLLIN */
-	wake_up_interruptible(&pcr->user_waiter);
+	if (wq_has_sleeper(&pcr->user_waiter))
+		wake_up_interruptible(&pcr->user_waiter);
+}
+
+static int crypto_affinity_valid(int cpu)
+{
+	if (cpu >= 0)
+		return cpu < nr_cpu_ids && cpu_online(cpu);
+	return cpu == CRYPTODEV_AFFINITY_LOCAL || cpu == CRYPTODEV_AFFINITY_NODE;
+}
+
+/* the memory node the queue items of the handle are allocated from */
+static int crypto_affinity_node(struct crypt_priv *pcr)
+{
+	int cpu = READ_ONCE(pcr->affinity);
+
+	return cpu >= 0 ? cpu_to_node(cpu) : numa_node_id();
+}
+
+static struct todo_list_item *crypto_alloc_item(struct crypt_priv *pcr)
+{
+	return kmem_cache_alloc_node(cryptodev_item_cache,
+			GFP_KERNEL | __GFP_ZERO, crypto_affinity_node(pcr));
+}
+
+/* grow the free list until the handle owns count items */
+static int crypto_prealloc_items(struct crypt_priv *pcr, int count)
+{
+	struct todo_list_item *item;
+	int ret = 0;
+
+	mutex_lock(&pcr->free.lock);
+	while (pcr->itemcount < count) {
+		item = crypto_alloc_item(pcr);
+		if (unlikely(!item)) {
+			ret = -ENOMEM;
+			break;
+		}
+		pcr->itemcount++;
+		ddebug(2, "allocated new item at %p", item);
+		list_add(&item->__hook, &pcr->free.list);
+	}
+	mutex_unlock(&pcr->free.lock);
+
+	return ret;
 }
 
 /* ====== /dev/crypto ====== */
@@ -458,14 +572,20 @@ cryptodev_open(struct inode *inode, struct file *filp)
 {
 	struct todo_list_item *tmp, *tmp_next;
 	struct crypt_priv *pcr;
-	int i;
 
 	pcr = kzalloc(sizeof(*pcr), GFP_KERNEL);
 	if (!pcr)
 		return -ENOMEM;
+	pcr->fcrypt.stats = alloc_percpu(struct cryptodev_stats);
+	if (!pcr->fcrypt.stats) {
+		kfree(pcr);
+		return -ENOMEM;
+	}
 	filp->private_data = pcr;
 
 	mutex_init(&pcr->fcrypt.sem);
+	mutex_init(&pcr->fcrypt.rsa_lock);
+	spin_lock_init(&pcr->fcrypt.reglock);
 	mutex_init(&pcr->free.lock);
 	mutex_init(&pcr->todo.lock);
 	mutex_init(&pcr->done.lock);
@@ -479,29 +599,30 @@ cryptodev_open(struct inode *inode, struct file *filp)
 
 	init_waitqueue_head(&pcr->user_waiter);
 
-	for (i = 0; i < DEF_COP_RINGSIZE; i++) {
-		tmp = kzalloc(sizeof(struct todo_list_item), GFP_KERNEL);
-		if (!tmp)
-			goto err_ringalloc;
-		pcr->itemcount++;
-		ddebug(2, "allocated new item at %p", tmp);
-		list_add(&tmp->__hook, &pcr->free.list);
-	}
+	pcr->affinity = cryptodev_async_affinity;
+	if (!crypto_affinity_valid(pcr->affinity))
+		pcr->affinity = CRYPTODEV_AFFINITY_LOCAL;
+
+	pcr->maxitems = clamp(cryptodev_max_ringsize, 1, LIMIT_COP_RINGSIZE);
+	if (crypto_prealloc_items(pcr, min(cryptodev_ringsize, pcr->maxitems)))
+		goto err_ringalloc;
 
 	ddebug(2, "Cryptodev handle initialised, %d elements in queue",
-			DEF_COP_RINGSIZE);
+			pcr->itemcount);
 	return 0;
 
 /* In case of errors, free any memory allocated so far */
 err_ringalloc:
 	list_for_each_entry_safe(tmp, tmp_next, &pcr->free.list, __hook) {
 		list_del(&tmp->__hook);
-		kfree(tmp);
+		kmem_cache_free(cryptodev_item_cache, tmp);
 	}
 	mutex_destroy(&pcr->done.lock);
 	mutex_destroy(&pcr->todo.lock);
 	mutex_destroy(&pcr->free.lock);
+	mutex_destroy(&pcr->fcrypt.rsa_lock);
 	mutex_destroy(&pcr->fcrypt.sem);
+	free_percpu(pcr->fcrypt.stats);
 	kfree(pcr);
 	filp->private_data = NULL;
 	return -ENOMEM;
@@ -512,20 +633,32 @@ cryptodev_release(struct inode *inode, struct file *filp)
 {
 	struct crypt_priv *pcr = filp->private_data;
 	struct todo_list_item *item, *item_safe;
-	int items_freed = 0;
+	int items_freed = 0, dropped = 0;
 
 	if (!pcr)
 		return 0;
 
 	cancel_work_sync(&pcr->cryptask);
 
+	if (pcr->efd)
+		eventfd_ctx_put(pcr->efd);
+
+	/* jobs that were never fetched leave the queue depth here, key
+	 * jobs wiping their parameters */
+	list_splice_tail_init(&pcr->done.list, &pcr->todo.list);
+	list_for_each_entry(item, &pcr->todo.list, __hook) {
+		if (item->key)
+			crypto_kop_free(&item->kkop);
+		dropped++;
+	}
+	atomic64_sub(dropped, &cryptodev_async_depth);
+
 	list_splice_tail(&pcr->todo.list, &pcr->free.list);
-	list_splice_tail(&pcr->done.list, &pcr->free.list);
 
 	list_for_each_entry_safe(item, item_safe, &pcr->free.list, __hook) {
 		ddebug(2, "freeing item at %p", item);
 		list_del(&item->__hook);
-		kfree(item);
+		kmem_cache_free(cryptodev_item_cache, item);
 		items_freed++;
 	}
 
@@ -535,12 +668,16 @@ cryptodev_release(struct inode *inode, struct file *filp)
 	}
 
 	crypto_finish_all_sessions(&pcr->fcrypt);
+	crypto_unregister_all_bufs(&pcr->fcrypt);
+	crypto_kop_release(&pcr->fcrypt);
 
 	mutex_destroy(&pcr->done.lock);
 	mutex_destroy(&pcr->todo.lock);
 	mutex_destroy(&pcr->free.lock);
+	mutex_destroy(&pcr->fcrypt.rsa_lock);
 	mutex_destroy(&pcr->fcrypt.sem);
 
+	free_percpu(pcr->fcrypt.stats);
 	kfree(pcr);
 	filp->private_data = NULL;
 
@@ -563,50 +700,183 @@ clonefd(struct file *filp)
 }
 
 #ifdef ENABLE_ASYNC
-/* enqueue a job for asynchronous completion
+/* Move the idle items beyond the handle's limit to surplus, to be
+ * freed once free.lock is dropped. Called with free.lock held. */
+static void crypto_trim_items(struct crypt_priv *pcr, struct list_head *surplus)
+{
+	struct todo_list_item *item, *item_safe;
+
+	list_for_each_entry_safe(item, item_safe, &pcr->free.list, __hook) {
+		if (pcr->itemcount <= pcr->maxitems)
+			break;
+		list_move(&item->__hook, surplus);
+		pcr->itemcount--;
+	}
+}
+
+static void crypto_free_items(struct list_head *items)
+{
+	struct todo_list_item *item, *item_safe;
+
+	list_for_each_entry_safe(item, item_safe, items, __hook) {
+		list_del(&item->__hook);
+		kmem_cache_free(cryptodev_item_cache, item);
+	}
+}
+
+/* give fetched items back to the free list, releasing those that a
+ * lowered limit has made surplus */
+static void crypto_put_items(struct crypt_priv *pcr, struct list_head *items)
+{
+	LIST_HEAD(surplus);
+
+	mutex_lock(&pcr->free.lock);
+	list_splice_tail(items, &pcr->free.list);
+	crypto_trim_items(pcr, &surplus);
+	mutex_unlock(&pcr->free.lock);
+
+	crypto_free_items(&surplus);
+}
+
+/* Kick the worker of the handle. cryptodev_wq is per CPU, so for
+ * CRYPTODEV_AFFINITY_LOCAL this is what queue_work() did already; the
+ * other settings move the worker to a given CPU or round-robin it over
+ * the submitter's node, for submitters that share one handle or that
+ * want the crypto off their own CPU.
+ */
+static void crypto_async_queue(struct crypt_priv *pcr)
+{
+	int cpu = READ_ONCE(pcr->affinity);
+
+	if (cpu == CRYPTODEV_AFFINITY_NODE) {
+		int node = numa_node_id();
+
+		/* submitters may race here, hence the atomic counter */
+		cpu = cpumask_local_spread((unsigned int)atomic_inc_return(
+				&pcr->spread) % nr_cpus_node(node), node);
+	} else if (cpu < 0 || unlikely(!cpu_online(cpu))) {
+		cpu = raw_smp_processor_id();
+	}
+
+	queue_work_on(cpu, cryptodev_wq, &pcr->cryptask);
+}
+
+/* take a free queue item, allocating one below the handle's maxitems
  *
  * returns:
  * -EBUSY when there are no free queue slots left
- *        (and the number of slots has reached it MAX_COP_RINGSIZE)
- * -EFAULT when there was a memory allocation error
- * 0 on success */
-static int crypto_async_run(struct crypt_priv *pcr, struct kernel_crypt_op *kcop)
+ *        (and the number of slots has reached the handle's maxitems)
+ * -EFAULT when there was a memory allocation error */
+static struct todo_list_item *crypto_async_get_item(struct crypt_priv *pcr)
 {
 	struct todo_list_item *item = NULL;
 
-	if (unlikely(kcop->cop.flags & COP_FLAG_NO_ZC))
-		return -EINVAL;
-
 	mutex_lock(&pcr->free.lock);
 	if (likely(!list_empty(&pcr->free.list))) {
 		item = list_first_entry(&pcr->free.list,
 				struct todo_list_item, __hook);
 		list_del(&item->__hook);
-	} else if (pcr->itemcount < MAX_COP_RINGSIZE) {
+	} else if (pcr->itemcount < pcr->maxitems) {
 		pcr->itemcount++;
 	} else {
 		mutex_unlock(&pcr->free.lock);
-		return -EBUSY;
+		cryptodev_stat_inc(&pcr->fcrypt, CSTAT_ASYNC_BUSY);
+		return ERR_PTR(-EBUSY);
 	}
 	mutex_unlock(&pcr->free.lock);
 
 	if (unlikely(!item)) {
-		item = kzalloc(sizeof(struct todo_list_item), GFP_KERNEL);
-		if (unlikely(!item))
-			return -EFAULT;
+		item = crypto_alloc_item(pcr);
+		if (unlikely(!item)) {
+			mutex_lock(&pcr->free.lock);
+			pcr->itemcount--;
+			mutex_unlock(&pcr->free.lock);
+			return ERR_PTR(-EFAULT);
+		}
 		dinfo(1, "increased item count to %d", pcr->itemcount);
 	}
+	return item;
+}
 
-	memcpy(&item->kcop, kcop, sizeof(struct kernel_crypt_op));
-
+/* hand a filled in item to the worker */
+static void crypto_async_submit(struct crypt_priv *pcr,
+		struct todo_list_item *item)
+{
 	mutex_lock(&pcr->todo.lock);
 	list_add_tail(&item->__hook, &pcr->todo.list);
 	mutex_unlock(&pcr->todo.lock);
 
-	queue_work(cryptodev_wq, &pcr->cryptask);
+	crypto_async_queue(pcr);
+	cryptodev_stat_inc(&pcr->fcrypt, CSTAT_ASYNC_SUBMITTED);
+	atomic64_inc(&cryptodev_async_depth);
+}
+
+/* enqueue a job for asynchronous completion
+ *
+ * returns:
+ * -EBUSY or -EFAULT as crypto_async_get_item()
+ * 0 on success */
+static int crypto_async_run(struct crypt_priv *pcr, struct kernel_crypt_op *kcop)
+{
+	struct todo_list_item *item;
+
+	if (unlikely(kcop->cop.flags & COP_FLAG_NO_ZC))
+		return -EINVAL;
+
+	item = crypto_async_get_item(pcr);
+	if (IS_ERR(item))
+		return PTR_ERR(item);
+
+	item->key = 0;
+	memcpy(&item->kcop, kcop, sizeof(struct kernel_crypt_op));
+	trace_cryptodev_async_enqueue(pcr, item, kcop->cop.ses, 0);
+
+	crypto_async_submit(pcr, item);
 	return 0;
 }
 
+/* enqueue a key operation, whose parameters are read in here
+ *
+ * returns:
+ * -EBUSY or -EFAULT as crypto_async_get_item()
+ * the error of crypto_kop_get() for invalid parameters
+ * 0 on success */
+static int crypto_async_key(struct crypt_priv *pcr, struct crypt_kop *kop)
+{
+	struct todo_list_item *item;
+	LIST_HEAD(unused);
+	int ret;
+
+	item = crypto_async_get_item(pcr);
+	if (IS_ERR(item))
+		return PTR_ERR(item);
+
+	item->key = 1;
+	item->kkop.kop = *kop;
+	ret = crypto_kop_get(&item->kkop);
+	if (unlikely(ret)) {
+		list_add(&item->__hook, &unused);
+		crypto_put_items(pcr, &unused);
+		return ret;
+	}
+	trace_cryptodev_async_enqueue(pcr, item, 0, 0);
+
+	crypto_async_submit(pcr, item);
+	return 0;
+}
+
+/* the first completed job of the kind, with done.lock held */
+static struct todo_list_item *crypto_async_first_done(struct crypt_priv *pcr,
+		int key)
+{
+	struct todo_list_item *item;
+
+	list_for_each_entry(item, &pcr->done.list, __hook)
+		if (item->key == key)
+			return item;
+	return NULL;
+}
+
 /* get the first completed job from the "done" queue
  *
  * returns:
@@ -616,28 +886,167 @@ static int crypto_async_fetch(struct crypt_priv *pcr,
 		struct kernel_crypt_op *kcop)
 {
 	struct todo_list_item *item;
+	LIST_HEAD(done);
 	int retval;
 
 	mutex_lock(&pcr->done.lock);
-	if (list_empty(&pcr->done.list)) {
+	item = crypto_async_first_done(pcr, 0);
+	if (!item) {
 		mutex_unlock(&pcr->done.lock);
 		return -EBUSY;
 	}
-	item = list_first_entry(&pcr->done.list, struct todo_list_item, __hook);
 	list_del(&item->__hook);
 	mutex_unlock(&pcr->done.lock);
 
 	memcpy(kcop, &item->kcop, sizeof(struct kernel_crypt_op));
 	retval = item->result;
+	cryptodev_stat_inc(&pcr->fcrypt, CSTAT_ASYNC_FETCHED);
+	atomic64_dec(&cryptodev_async_depth);
+	trace_cryptodev_async_fetch(pcr, item, kcop->cop.ses, retval);
+
+	list_add(&item->__hook, &done);
+	crypto_put_items(pcr, &done);
+
+	/* wake for POLLOUT */
+	if (wq_has_sleeper(&pcr->user_waiter))
+		wake_up_interruptible(&pcr->user_waiter);
+
+	return retval;
+}
+
+/* get the first completed key operation from the "done" queue and
+ * store its result for the caller
+ *
+ * returns:
+ * -EBUSY if no completed key operations are ready (yet)
+ * the return value of crypto_kop_run() or crypto_kop_put() otherwise */
+static int crypto_async_fetch_key(struct crypt_priv *pcr, struct crypt_kop *kop)
+{
+	struct todo_list_item *item;
+	LIST_HEAD(done);
+	int retval;
+
+	mutex_lock(&pcr->done.lock);
+	item = crypto_async_first_done(pcr, 1);
+	if (!item) {
+		mutex_unlock(&pcr->done.lock);
+		return -EBUSY;
+	}
+	list_del(&item->__hook);
+	mutex_unlock(&pcr->done.lock);
+
+	retval = item->result;
+	if (likely(!retval))
+		retval = crypto_kop_put(&item->kkop);
+	*kop = item->kkop.kop;
+	crypto_kop_free(&item->kkop);
+	cryptodev_stat_inc(&pcr->fcrypt, CSTAT_ASYNC_FETCHED);
+	atomic64_dec(&cryptodev_async_depth);
+	trace_cryptodev_async_fetch(pcr, item, 0, retval);
+
+	list_add(&item->__hook, &done);
+	crypto_put_items(pcr, &done);
+
+	/* wake for POLLOUT */
+	if (wq_has_sleeper(&pcr->user_waiter))
+		wake_up_interruptible(&pcr->user_waiter);
+
+	return retval;
+}
+
+/* register an eventfd to be signalled with the number of completed
+ * jobs; a negative fd removes the current one
+ *
+ * Jobs already waiting in the done queue are accounted for at
+ * registration, so that no completion is missed.
+ *
+ * returns:
+ * -EBADF or -EINVAL if fd does not refer to an eventfd
+ * 0 on success */
+static int crypto_async_set_eventfd(struct crypt_priv *pcr, int fd)
+{
+	struct eventfd_ctx *efd = NULL, *old;
+	struct todo_list_item *item;
+	unsigned int pending = 0;
+
+	if (fd >= 0) {
+		efd = eventfd_ctx_fdget(fd);
+		if (IS_ERR(efd))
+			return PTR_ERR(efd);
+	}
+
+	mutex_lock(&pcr->done.lock);
+	old = pcr->efd;
+	pcr->efd = efd;
+	if (efd) {
+		list_for_each_entry(item, &pcr->done.list, __hook)
+			pending++;
+		if (pending)
+			eventfd_signal(efd, pending);
+	}
+	mutex_unlock(&pcr->done.lock);
+
+	if (old)
+		eventfd_ctx_put(old);
+	return 0;
+}
+
+/* set where the jobs of the handle are run
+ *
+ * Queued jobs are not moved, the setting applies to the next
+ * submission.
+ *
+ * returns:
+ * -EINVAL if cpu is neither an online CPU nor CRYPTODEV_AFFINITY_*
+ * 0 on success */
+static int crypto_async_set_affinity(struct crypt_priv *pcr, int cpu)
+{
+	if (unlikely(!crypto_affinity_valid(cpu)))
+		return -EINVAL;
+
+	WRITE_ONCE(pcr->affinity, cpu);
+	return 0;
+}
+
+/* set the maximum number of queue items of the handle
+ *
+ * A depth of zero only queries the current setting. Idle items
+ * beyond a lowered limit are released at once, busy ones as they are
+ * fetched, and the free list is grown up to a raised limit so that
+ * deep pipelines do not allocate on the submission path.
+ *
+ * returns:
+ * -ENOMEM if the items could not be preallocated, the limit is then
+ *         left as it was
+ * 0 on success, *depth holds the limit in effect */
+static int crypto_async_set_depth(struct crypt_priv *pcr, uint32_t *depth)
+{
+	LIST_HEAD(surplus);
+	int ret;
+
+	if (*depth == 0) {
+		*depth = READ_ONCE(pcr->maxitems);
+		return 0;
+	}
+	if (*depth > LIMIT_COP_RINGSIZE)
+		*depth = LIMIT_COP_RINGSIZE;
+
+	/* the limit only changes once its items are there; on failure
+	 * those allocated beyond the old limit are released again */
+	ret = crypto_prealloc_items(pcr, *depth);
 
 	mutex_lock(&pcr->free.lock);
-	list_add_tail(&item->__hook, &pcr->free.list);
+	if (likely(!ret))
+		pcr->maxitems = *depth;
+	crypto_trim_items(pcr, &surplus);
 	mutex_unlock(&pcr->free.lock);
 
+	crypto_free_items(&surplus);
+
 	/* wake for POLLOUT */
 	wake_up_interruptible(&pcr->user_waiter);
 
-	return retval;
+	return ret;
 }
 #endif
 
@@ -654,15 +1063,20 @@ static int fill_kcop_from_cop(struct kernel_crypt_op *kcop, struct fcrypt *fcr)
 		derr(1, "invalid session ID=0x%08X", cop->ses);
 		return -EINVAL;
 	}
-	kcop->ivlen = cop->iv ? ses_ptr->cdata.ivsize : 0;
+	/* the session provides the IV in crypto_run() */
+	if (cop->flags & COP_FLAG_KERNEL_IV)
+		kcop->ivlen = ses_ptr->cdata.ivsize;
+	else
+		kcop->ivlen = cop->iv ? ses_ptr->cdata.ivsize : 0;
 	kcop->digestsize = 0; /* will be updated during operation */
+	kcop->src_iov = kcop->dst_iov = NULL;
 
 	crypto_put_session(ses_ptr);
 
 	kcop->task = current;
 	kcop->mm = current->mm;
 
-	if (cop->iv) {
+	if (cop->iv && !(cop->flags & COP_FLAG_KERNEL_IV)) {
 		rc = copy_from_user(kcop->iv, cop->iv, kcop->ivlen);
 		if (unlikely(rc)) {
 			derr(1, "error copying IV (%d bytes), copy_from_user returned %d for address %p",
@@ -685,7 +1099,9 @@ static int fill_cop_from_kcop(struct kernel_crypt_op *kcop, struct fcrypt *fcr)
 		if (unlikely(ret))
 			return -EFAULT;
 	}
-	if (kcop->ivlen && kcop->cop.flags & COP_FLAG_WRITE_IV) {
+	/* the IV that was used, or the one to continue with */
+	if (kcop->ivlen && kcop->cop.iv && kcop->cop.flags &
+			(COP_FLAG_WRITE_IV | COP_FLAG_KERNEL_IV)) {
 		ret = copy_to_user(kcop->cop.iv,
 				kcop->iv, kcop->ivlen);
 		if (unlikely(ret))
@@ -703,6 +1119,100 @@ static int kcop_from_user(struct kernel_crypt_op *kcop,
 	return fill_kcop_from_cop(kcop, fcr);
 }
 
+/* sum up the segment lengths of an iovec array into len */
+static int iov_total_len(const struct iovec *iov, unsigned int iovcnt,
+		uint32_t *len)
+{
+	uint64_t total = 0;
+	unsigned int i;
+
+	for (i = 0; i < iovcnt; i++) {
+		if (unlikely(iov[i].iov_len > U32_MAX))
+			return -EINVAL;
+		total += iov[i].iov_len;
+	}
+	if (unlikely(total > U32_MAX))
+		return -EINVAL;
+
+	*len = total;
+	return 0;
+}
+
+/* CIOCCRYPTV: turn a crypt_vec_op into a kernel_crypt_op and run it */
+static int crypto_run_vec(struct fcrypt *fcr, void __user *arg)
+{
+	struct iovec fast_iov[UIO_FASTIOV], *iov = fast_iov;
+	struct kernel_crypt_op kcop;
+	struct crypt_op *cop = &kcop.cop;
+	struct crypt_vec_op vop;
+	unsigned int iovcnt;
+	uint32_t dst_len;
+	int ret;
+
+	if (unlikely(copy_from_user(&vop, arg, sizeof(vop))))
+		return -EFAULT;
+
+	if (unlikely(!vop.src_iovcnt || vop.src_iovcnt > UIO_MAXIOV ||
+	             vop.dst_iovcnt > UIO_MAXIOV ||
+	             vop.flags & (COP_FLAG_NO_ZC | COP_FLAG_REGBUF))) {
+		ddebug(1, "invalid vectored operation");
+		return -EINVAL;
+	}
+
+	iovcnt = vop.src_iovcnt + vop.dst_iovcnt;
+	if (iovcnt > ARRAY_SIZE(fast_iov)) {
+		iov = kmalloc_array(iovcnt, sizeof(*iov), GFP_KERNEL);
+		if (unlikely(!iov))
+			return -ENOMEM;
+	}
+
+	if (unlikely(copy_from_user(iov, vop.src,
+	                            vop.src_iovcnt * sizeof(*iov)) ||
+	             copy_from_user(iov + vop.src_iovcnt, vop.dst,
+	                            vop.dst_iovcnt * sizeof(*iov)))) {
+		ret = -EFAULT;
+		goto out;
+	}
+
+	memset(cop, 0, sizeof(*cop));
+	ret = iov_total_len(iov, vop.src_iovcnt, &cop->len);
+	if (!ret && vop.dst_iovcnt) {
+		ret = iov_total_len(iov + vop.src_iovcnt, vop.dst_iovcnt,
+		                    &dst_len);
+		if (!ret && dst_len != cop->len)
+			ret = -EINVAL;
+	}
+	if (unlikely(ret)) {
+		ddebug(1, "invalid iovec lengths");
+		goto out;
+	}
+
+	cop->ses = vop.ses;
+	cop->op = vop.op;
+	cop->flags = vop.flags;
+	cop->mac = vop.mac;
+	cop->iv = vop.iv;
+	ret = fill_kcop_from_cop(&kcop, fcr);
+	if (unlikely(ret))
+		goto out;
+
+	kcop.src_iov = iov;
+	kcop.src_iovcnt = vop.src_iovcnt;
+	if (vop.dst_iovcnt) {
+		kcop.dst_iov = iov + vop.src_iovcnt;
+		kcop.dst_iovcnt = vop.dst_iovcnt;
+	}
+
+	ret = crypto_run(fcr, &kcop);
+	if (likely(!ret))
+		ret = fill_cop_from_kcop(&kcop, fcr);
+
+out:
+	if (iov != fast_iov)
+		kfree(iov);
+	return ret;
+}
+
 static int kcop_to_user(struct kernel_crypt_op *kcop,
 			struct fcrypt *fcr, void __user *arg)
 {
@@ -721,6 +1231,78 @@ static int kcop_to_user(struct kernel_crypt_op *kcop,
 	return 0;
 }
 
+#ifdef ENABLE_ASYNC
+/* move up to fop->count completed jobs to userspace
+ *
+ * The done and free lists are locked once for the whole batch, and
+ * waiters are woken once. Should copying a job out fail, it and the
+ * jobs after it are put back to the head of the done queue.
+ *
+ * returns:
+ * -EBUSY if no completed jobs are ready (yet)
+ * -EFAULT if not even the first job could be copied to userspace
+ * 0 on success, fop->count holds the number of jobs fetched */
+static int crypto_async_fetch_many(struct crypt_priv *pcr,
+		struct crypt_fetch_op *fop)
+{
+	struct todo_list_item *item, *item_safe;
+	unsigned int fetched = 0;
+	LIST_HEAD(tmp);
+	LIST_HEAD(reported);
+	int ret = 0;
+
+	if (unlikely(fop->count == 0))
+		return -EINVAL;
+
+	mutex_lock(&pcr->done.lock);
+	list_for_each_entry_safe(item, item_safe, &pcr->done.list, __hook) {
+		if (fetched == fop->count)
+			break;
+		if (item->key)
+			continue;
+		list_move_tail(&item->__hook, &tmp);
+		fetched++;
+	}
+	mutex_unlock(&pcr->done.lock);
+
+	if (!fetched)
+		return -EBUSY;
+
+	fop->count = 0;
+	list_for_each_entry_safe(item, item_safe, &tmp, __hook) {
+		ret = kcop_to_user(&item->kcop, &pcr->fcrypt, fop->cops + fop->count);
+		if (!ret && fop->results)
+			ret = put_user(item->result, fop->results + fop->count);
+		if (unlikely(ret))
+			break;
+		trace_cryptodev_async_fetch(pcr, item, item->kcop.cop.ses,
+				item->result);
+		list_move_tail(&item->__hook, &reported);
+		fop->count++;
+	}
+
+	if (unlikely(!list_empty(&tmp))) {
+		mutex_lock(&pcr->done.lock);
+		list_splice(&tmp, &pcr->done.list);
+		mutex_unlock(&pcr->done.lock);
+	}
+
+	if (fop->count) {
+		cryptodev_stat_add(&pcr->fcrypt, CSTAT_ASYNC_FETCHED, fop->count);
+		atomic64_sub(fop->count, &cryptodev_async_depth);
+
+		crypto_put_items(pcr, &reported);
+
+		/* wake for POLLOUT */
+		if (wq_has_sleeper(&pcr->user_waiter))
+			wake_up_interruptible(&pcr->user_waiter);
+		ret = 0;
+	}
+
+	return ret;
+}
+#endif
+
 static inline void tfm_info_to_alg_info(struct alg_info *dst, struct crypto_tfm *tfm)
 {
 	snprintf(dst->cra_name, CRYPTODEV_MAX_ALG_NAME,
@@ -802,8 +1384,93 @@ static int get_session_info(struct fcrypt *fcr, struct session_info_op *siop)
 	return 0;
 }
 
+/* CIOCSESSIV: set the IV of COP_FLAG_KERNEL_IV operations */
+static int crypto_set_session_iv(struct fcrypt *fcr,
+		struct crypt_sessiv_op *sivop)
+{
+	struct csession *ses_ptr;
+	int ret = 0;
+
+	/* this also enters ses_ptr->sem */
+	ses_ptr = crypto_get_session_by_sid(fcr, sivop->ses);
+	if (unlikely(!ses_ptr)) {
+		derr(1, "invalid session ID=0x%08X", sivop->ses);
+		return -EINVAL;
+	}
+
+	if (unlikely(!ses_ptr->cdata.init || !ses_ptr->cdata.ivsize ||
+	             sivop->iv_len != ses_ptr->cdata.ivsize)) {
+		ddebug(1, "session 0x%08X takes no IV of %u bytes",
+				sivop->ses, sivop->iv_len);
+		ret = -EINVAL;
+		goto out_unlock;
+	}
+
+	/* a chained IV such as the last CBC ciphertext block is known to
+	 * whoever picks the next plaintext, so only counters and nonces
+	 * are left to the kernel */
+	if (unlikely(!ses_ptr->cdata.stream)) {
+		ddebug(1, "session 0x%08X is not in a counter mode", sivop->ses);
+		ret = -EINVAL;
+		goto out_unlock;
+	}
+
+	if (unlikely(copy_from_user(ses_ptr->iv, sivop->iv, sivop->iv_len))) {
+		ret = -EFAULT;
+		goto out_unlock;
+	}
+	ses_ptr->kernel_iv = 1;
+
+out_unlock:
+	crypto_put_session(ses_ptr);
+	return ret;
+}
+
+/* copy the performance counters of this handle to userspace */
+static int get_stats(struct crypt_priv *pcr, void __user *arg)
+{
+	struct crypt_stats_op *sop;
+	int ret = 0;
+
+	/* too large for the ioctl stack frame */
+	sop = kzalloc(sizeof(*sop), GFP_KERNEL);
+	if (unlikely(!sop))
+		return -ENOMEM;
+
+	cryptodev_stats_fill(pcr->fcrypt.stats, sop);
+	sop->async_depth = READ_ONCE(pcr->maxitems);
+
+	if (unlikely(copy_to_user(arg, sop, sizeof(*sop))))
+		ret = -EFAULT;
+	kfree(sop);
+	return ret;
+}
+
+/* bignum operation, see asym.c */
+static int run_kop(struct fcrypt *fcr, void __user *arg)
+{
+	struct kernel_crypt_kop kkop;
+	int ret;
+
+	if (unlikely(copy_from_user(&kkop.kop, arg, sizeof(kkop.kop))))
+		return -EFAULT;
+
+	ret = crypto_kop_get(&kkop);
+	if (unlikely(ret))
+		return ret;
+
+	ret = crypto_kop_run(fcr, &kkop);
+	if (likely(!ret))
+		ret = crypto_kop_put(&kkop);
+	crypto_kop_free(&kkop);
+	if (unlikely(ret))
+		return ret;
+
+	return copy_to_user(arg, &kkop.kop, sizeof(kkop.kop)) ? -EFAULT : 0;
+}
+
 static long
-cryptodev_ioctl(struct file *filp, unsigned int cmd, unsigned long arg_)
+__cryptodev_ioctl(struct file *filp, unsigned int cmd, unsigned long arg_)
 {
 	void __user *arg = (void __user *)arg_;
 	int __user *p = arg;
@@ -813,8 +1480,14 @@ cryptodev_ioctl(struct file *filp, unsigned int cmd, unsigned long arg_)
 	struct crypt_priv *pcr = filp->private_data;
 	struct fcrypt *fcr;
 	struct session_info_op siop;
-	uint32_t ses;
-	int ret, fd;
+	struct crypt_regbuf_op rop;
+	struct crypt_sessiv_op sivop;
+#ifdef ENABLE_ASYNC
+	struct crypt_fetch_op fop;
+	struct crypt_kop kop;
+#endif
+	uint32_t ses, depth, index;
+	int ret, fd, efd, cpu;
 
 	if (unlikely(!pcr))
 		BUG();
@@ -823,7 +1496,9 @@ cryptodev_ioctl(struct file *filp, unsigned int cmd, unsigned long arg_)
 
 	switch (cmd) {
 	case CIOCASYMFEAT:
-		return put_user(0, p);
+		return put_user(crypto_asym_features(), p);
+	case CIOCKEY:
+		return run_kop(fcr, arg);
 	case CRIOGET:
 		fd = clonefd(filp);
 		ret = put_user(fd, p);
@@ -872,6 +1547,8 @@ cryptodev_ioctl(struct file *filp, unsigned int cmd, unsigned long arg_)
 		}
 
 		return kcop_to_user(&kcop, fcr, arg);
+	case CIOCCRYPTV:
+		return crypto_run_vec(fcr, arg);
 	case CIOCAUTHCRYPT:
 		if (unlikely(ret = kcaop_from_user(&kcaop, fcr, arg))) {
 			dwarning(1, "Error copying from user");
@@ -884,6 +1561,31 @@ cryptodev_ioctl(struct file *filp, unsigned int cmd, unsigned long arg_)
 			return ret;
 		}
 		return kcaop_to_user(&kcaop, fcr, arg);
+	case CIOCREGBUF:
+		if (unlikely(copy_from_user(&rop, arg, sizeof(rop))))
+			return -EFAULT;
+
+		ret = crypto_register_buf(fcr, &rop);
+		if (unlikely(ret))
+			return ret;
+		ret = copy_to_user(arg, &rop, sizeof(rop));
+		if (unlikely(ret)) {
+			crypto_unregister_buf(fcr, rop.index);
+			return -EFAULT;
+		}
+		return ret;
+	case CIOCUNREGBUF:
+		ret = get_user(index, (uint32_t __user *)arg);
+		if (unlikely(ret))
+			return ret;
+		return crypto_unregister_buf(fcr, index);
+	case CIOCGSTATS:
+		return get_stats(pcr, arg);
+	case CIOCSESSIV:
+		if (unlikely(copy_from_user(&sivop, arg, sizeof(sivop))))
+			return -EFAULT;
+
+		return crypto_set_session_iv(fcr, &sivop);
 #ifdef ENABLE_ASYNC
 	case CIOCASYNCCRYPT:
 		if (unlikely(ret = kcop_from_user(&kcop, fcr, arg)))
@@ -896,12 +1598,65 @@ cryptodev_ioctl(struct file *filp, unsigned int cmd, unsigned long arg_)
 			return ret;
 
 		return kcop_to_user(&kcop, fcr, arg);
+	case CIOCASYNCFETCHMANY:
+		if (unlikely(copy_from_user(&fop, arg, sizeof(fop))))
+			return -EFAULT;
+
+		ret = crypto_async_fetch_many(pcr, &fop);
+		if (unlikely(ret))
+			return ret;
+
+		return put_user(fop.count, (uint32_t __user *)arg);
+	case CIOCASYNCKEY:
+		if (unlikely(copy_from_user(&kop, arg, sizeof(kop))))
+			return -EFAULT;
+
+		return crypto_async_key(pcr, &kop);
+	case CIOCASYNCFETCHKEY:
+		ret = crypto_async_fetch_key(pcr, &kop);
+		if (unlikely(ret))
+			return ret;
+
+		return copy_to_user(arg, &kop, sizeof(kop)) ? -EFAULT : 0;
+	case CIOCASYNCDEPTH:
+		ret = get_user(depth, (uint32_t __user *)arg);
+		if (unlikely(ret))
+			return ret;
+
+		ret = crypto_async_set_depth(pcr, &depth);
+		if (unlikely(ret))
+			return ret;
+		return put_user(depth, (uint32_t __user *)arg);
+	case CIOCASYNCEVENTFD:
+		ret = get_user(efd, p);
+		if (unlikely(ret))
+			return ret;
+
+		return crypto_async_set_eventfd(pcr, efd);
+	case CIOCASYNCAFFINITY:
+		ret = get_user(cpu, p);
+		if (unlikely(ret))
+			return ret;
+
+		return crypto_async_set_affinity(pcr, cpu);
 #endif
 	default:
 		return -EINVAL;
 	}
 }
 
+static long
+cryptodev_ioctl(struct file *filp, unsigned int cmd, unsigned long arg_)
+{
+	long ret;
+
+	trace_cryptodev_ioctl_enter(filp->private_data, cmd);
+	ret = __cryptodev_ioctl(filp, cmd, arg_);
+	trace_cryptodev_ioctl_exit(filp->private_data, cmd, ret);
+
+	return ret;
+}
+
 /* compatibility code for 32bit userlands */
 #ifdef CONFIG_COMPAT
 
@@ -1012,6 +1767,11 @@ cryptodev_compat_ioctl(struct file *file, unsigned int cmd, unsigned long arg_)
 	case CRIOGET:
 	case CIOCFSESSION:
 	case CIOCGSESSINFO:
+	case CIOCASYNCDEPTH:
+	case CIOCASYNCEVENTFD:
+	case CIOCASYNCAFFINITY:
+	case CIOCUNREGBUF:
+	case CIOCGSTATS:
 		return cryptodev_ioctl(file, cmd, arg_);
 
 	case COMPAT_CIOCGSESSION:
@@ -1071,7 +1831,7 @@ static unsigned int cryptodev_poll(struct file *file, poll_table *wait)
 
 	if (!list_empty_careful(&pcr->done.list))
 		ret |= POLLIN | POLLRDNORM;
-	if (!list_empty_careful(&pcr->free.list) || pcr->itemcount < MAX_COP_RINGSIZE)
+	if (!list_empty_careful(&pcr->free.list) || pcr->itemcount < pcr->maxitems)
 		ret |= POLLOUT | POLLWRNORM;
 
 	return ret;
@@ -1146,13 +1906,22 @@ static int __init init_cryptodev(void)
 		return -EFAULT;
 	}
 
+	cryptodev_item_cache = KMEM_CACHE(todo_list_item, 0);
+	if (unlikely(!cryptodev_item_cache)) {
+		pr_err(PFX "failed to allocate the job queue cache\n");
+		destroy_workqueue(cryptodev_wq);
+		return -ENOMEM;
+	}
+
 	rc = cryptodev_register();
 	if (unlikely(rc)) {
+		kmem_cache_destroy(cryptodev_item_cache);
 		destroy_workqueue(cryptodev_wq);
 		return rc;
 	}
 
 	verbosity_sysctl_header = register_sysctl_table(verbosity_ctl_root);
+	cryptodev_stats_init();
 
 	pr_info(PFX "driver %s loaded.\n", VERSION);
 
@@ -1167,7 +1936,10 @@ static void __exit exit_cryptodev(void)
 	if (verbosity_sysctl_header)
 		unregister_sysctl_table(verbosity_sysctl_header);
 
+	cryptodev_stats_exit();
 	cryptodev_deregister();
+	cryptodev_tfm_cache_flush();
+	kmem_cache_destroy(cryptodev_item_cache);
 	pr_info(PFX "driver unloaded.\n");
 }
 
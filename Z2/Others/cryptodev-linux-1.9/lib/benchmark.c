@@ -17,72 +17,131 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-#include <stdio.h>
+#include <math.h>
 #include <string.h>
-#include <signal.h>
-#include <sys/time.h>
 #include <time.h>
-#include <unistd.h>
 #include "benchmark.h"
 
-int benchmark_must_finish = 0;
+/* two-sided 95% quantiles of Student's t, by degrees of freedom */
+static const double t95[] = {
+  0, 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262,
+  2.228, 2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093,
+  2.086, 2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045,
+  2.042
+};
 
-static void
-alarm_handler (int signo)
+#define T95_MAX (sizeof(t95) / sizeof(t95[0]) - 1)
+
+static double
+t_quantile (unsigned int df)
 {
-  benchmark_must_finish = 1;
+  if (df <= T95_MAX)
+    return t95[df];
+  /* within 0.002 of the real values beyond the table */
+  return 1.960 + 2.5 / df;
 }
 
-int start_benchmark(struct benchmark_st * st)
+void benchmark_defaults(struct benchmark_opts * opts)
 {
-  int ret;
-  struct itimerval timer;
-
-  memset(st, 0, sizeof(*st));
-
-  st->old_handler = signal (SIGPROF, alarm_handler);
+  memset(opts, 0, sizeof(*opts));
+  opts->warmup_ns = 10 * 1000 * 1000;
+  opts->min_sample_ns = 1000 * 1000;
+  opts->min_samples = 5;
+  opts->max_samples = 100;
+  opts->rel_ci = 0.02;
+  opts->max_ns = 200 * 1000 * 1000;
+}
 
-  ret = gettimeofday (&st->start, NULL);
-  if (ret < 0) {
-    perror("gettimeofday");
-    return -1;
-  }
+uint64_t benchmark_ns(void)
+{
+  struct timespec ts;
 
-  benchmark_must_finish = 0;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
 
-  memset(&timer, 0, sizeof(timer));
-  timer.it_value.tv_sec = 0;
-  timer.it_value.tv_usec = 100*1000;
+/* Returns the time of count calls, or 0 if one failed */
+static uint64_t
+run_batch (int (*fn)(void *arg), void *arg, uint64_t count)
+{
+  uint64_t start, i;
 
-  ret = setitimer(ITIMER_PROF, &timer, NULL);
-  if (ret < 0) {
-    perror("setitimer");
-    return -1;
-  }
+  start = benchmark_ns ();
+  for (i = 0; i < count; i++)
+    if (fn (arg))
+      return 0;
+  return benchmark_ns () - start ? : 1;
+}
 
+int benchmark_run(int (*fn)(void *arg), void *arg,
+                  const struct benchmark_opts * opts,
+                  struct benchmark_result * res)
+{
+  struct benchmark_opts defaults;
+  uint64_t start, elapsed, batch = 1;
+  double x, delta, m2 = 0;
+
+  if (opts == NULL)
+    {
+      benchmark_defaults (&defaults);
+      opts = &defaults;
+    }
+
+  memset(res, 0, sizeof(*res));
+
+  /* Warm up caches, frequency and the kernel's paths, doubling the
+   * batch until a sample is long enough to time.
+   */
+  start = benchmark_ns ();
+  do
+    {
+      elapsed = run_batch (fn, arg, batch);
+      if (elapsed == 0)
+        return -1;
+      if (elapsed < opts->min_sample_ns)
+        batch *= 2;
+    }
+  while (elapsed < opts->min_sample_ns ||
+         benchmark_ns () - start < opts->warmup_ns);
+
+  /* Welford's running mean and variance of the per-call time */
+  start = benchmark_ns ();
+  do
+    {
+      elapsed = run_batch (fn, arg, batch);
+      if (elapsed == 0)
+        return -1;
+
+      x = (double) elapsed / batch;
+      res->samples++;
+      delta = x - res->mean;
+      res->mean += delta / res->samples;
+      m2 += delta * (x - res->mean);
+      if (res->samples == 1 || x < res->min)
+        res->min = x;
+
+      if (res->samples < 2)
+        continue;
+      res->variance = m2 / (res->samples - 1);
+      res->stddev = sqrt (res->variance);
+      res->ci = t_quantile (res->samples - 1) * res->stddev /
+        sqrt (res->samples);
+      res->converged = res->ci <= opts->rel_ci * res->mean;
+    }
+  while (res->samples < opts->min_samples ||
+         (!res->converged && res->samples < opts->max_samples &&
+          benchmark_ns () - start < opts->max_ns));
+
+  res->batch = batch;
   return 0;
 }
 
-/* Returns -1 on error or 0 on success.
- * elapsed: the elapsed time in milliseconds
- */
-int stop_benchmark(struct benchmark_st * st, unsigned long * elapsed)
+int benchmark_compare(const struct benchmark_result * a,
+                      const struct benchmark_result * b)
 {
-  unsigned long msecs;
-  struct timeval stop;
-  int ret;
-
-  signal(SIGPROF, st->old_handler);
-
-  ret = gettimeofday (&stop, NULL);
-  if (ret < 0)
+  if (a->mean + a->ci < b->mean - b->ci)
+    return 1;
+  if (a->mean - a->ci > b->mean + b->ci)
     return -1;
-
-  msecs = (stop.tv_sec * 1000 + stop.tv_usec / 1000 -
-          (st->start.tv_sec * 1000 + st->start.tv_usec / (1000)));
-
-  if (elapsed) *elapsed = msecs;
-
   return 0;
 }
-
@@ -1,18 +1,50 @@
-#include <sys/time.h>
-#include <time.h>
-#include <sys/time.h>
-#include <signal.h>
+#ifndef BENCHMARK_H
+# define BENCHMARK_H
 
-typedef void (*sighandler_t)(int);
+#include <stdint.h>
 
-struct benchmark_st
+/* How long to measure. A sample times a batch of calls, the batch
+ * being grown during the warmup until it takes min_sample_ns, so the
+ * clock's resolution and overhead do not show. Sampling stops once the
+ * 95% confidence interval of the mean is within rel_ci of it, or
+ * after max_samples or max_ns.
+ */
+struct benchmark_opts
 {
-  struct timeval start;
-  sighandler_t old_handler;
+  uint64_t warmup_ns;
+  uint64_t min_sample_ns;
+  unsigned int min_samples, max_samples;
+  double rel_ci;
+  uint64_t max_ns;
 };
 
-extern int benchmark_must_finish;
+/* times are in nanoseconds per call */
+struct benchmark_result
+{
+  double mean, variance, stddev;
+  double ci;                    /* half width of the 95% interval */
+  double min;                   /* of the samples */
+  unsigned int samples;
+  uint64_t batch;               /* calls per sample */
+  int converged;                /* the interval got within rel_ci */
+};
+
+void benchmark_defaults(struct benchmark_opts * opts);
+
+/* monotonic nanoseconds */
+uint64_t benchmark_ns(void);
+
+/* Time fn(arg), which returns non-zero on failure. opts may be NULL
+ * for the defaults. Returns -1 if fn failed.
+ */
+int benchmark_run(int (*fn)(void *arg), void *arg,
+                  const struct benchmark_opts * opts,
+                  struct benchmark_result * res);
 
-int start_benchmark(struct benchmark_st * st);
-int stop_benchmark(struct benchmark_st * st, unsigned long * elapsed);
+/* 1 if a is faster than b beyond both intervals, -1 if slower, 0 if
+ * they overlap.
+ */
+int benchmark_compare(const struct benchmark_result * a,
+                      const struct benchmark_result * b);
 
+#endif
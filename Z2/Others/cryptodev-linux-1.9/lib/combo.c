@@ -6,153 +6,96 @@
  */
 #include <stdio.h>
 #include <string.h>
-#include <unistd.h>
-#include <fcntl.h>
-#include <sys/ioctl.h>
 #include <crypto/cryptodev.h>
 #include "benchmark.h"
 #include "hash.h"
+#include "libcryptodev.h"
 
-int aead_ctx_init(struct cryptodev_ctx* ctx, int cipher, int hash, void* key, int key_size, int cfd)
-{
-#ifdef CIOCGSESSINFO
-	struct session_info_op siop;
-#endif
-
-	memset(ctx, 0, sizeof(*ctx));
-	ctx->cfd = cfd;
-
-	ctx->sess.mac = hash;
-	ctx->sess.cipher = cipher;
-	ctx->sess.key = key;
-	ctx->sess.keylen = key_size;
+static const int sizes[] = {64, 256, 512, 1024, 4096, 16*1024};
 
-	if (ioctl(ctx->cfd, CIOCGSESSION, &ctx->sess)) {
-		perror("ioctl(CIOCGSESSION)");
-		return -1;
-	}
+struct aead_bench {
+	struct cdev_session* s;
+	void* user_ctx;
+	void (*user_combo)(void* user_ctx, void* plaintext, void* ciphertext, int size, void* res);
+	char* text;
+	char* ctext;
+	char* iv;
+	int size;
+	uint8_t* digest;
+};
+
+static int kernel_fn(void* arg)
+{
+	struct aead_bench* b = arg;
 
-#ifdef CIOCGSESSINFO
-	memset(&siop, 0, sizeof(siop));
-	siop.ses = ctx->sess.ses;
-	if (ioctl(ctx->cfd, CIOCGSESSINFO, &siop)) {
-		perror("ioctl(CIOCGSESSINFO)");
+	/* the TLS way, MAC and padding following the text */
+	if (cdev_aead_encrypt(b->s, b->iv, 16, NULL, 0, b->text, b->text,
+				b->size, 0) < 0)
 		return -1;
-	}
-#ifdef DEBUG
-	printf("Got %s-%s with drivers %s and %s\n",
-			siop.cipher_info.cra_name, siop.hash_info.cra_name,
-			siop.cipher_info.cra_driver_name, siop.hash_info.cra_driver_name);
-#endif
-	/*printf("Alignmask is %x\n", (unsigned int)siop.alignmask);*/
-	ctx->alignmask = siop.alignmask;
-#endif
 	return 0;
 }
 
-void aead_ctx_deinit(struct cryptodev_ctx* ctx)
-{
-	if (ioctl(ctx->cfd, CIOCFSESSION, &ctx->sess.ses)) {
-		perror("ioctl(CIOCFSESSION)");
-	}
-}
-
-int
-aead_encrypt(struct cryptodev_ctx* ctx, const void* iv, const void* plaintext, void* ciphertext, size_t size, void* digest)
+static int user_fn(void* arg)
 {
-	struct crypt_auth_op cryp;
-
-	memset(&cryp, 0, sizeof(cryp));
-
-	/* Encrypt data.in to data.encrypted */
-	cryp.ses = ctx->sess.ses;
-	cryp.len = size;
-	cryp.iv = (void*)iv;
-	cryp.iv_len = 16;
-	cryp.src = (void*)plaintext;
-	cryp.dst = (void*)ciphertext;
-	cryp.flags = COP_FLAG_AEAD_TLS_TYPE;
-
-	if (ioctl(ctx->cfd, CIOCAUTHCRYPT, &cryp)) {
-		perror("ioctl(CIOCAUTHCRYPT)");
-		return -1;
-	}
+	struct aead_bench* b = arg;
 
+	b->user_combo(b->user_ctx, b->text, b->ctext, b->size, b->digest);
 	return 0;
 }
 
-static const int sizes[] = {64, 256, 512, 1024, 4096, 16*1024};
-
-
 int aead_test(int cipher, int mac, void* ukey, int ukey_size,
 		void* user_ctx, void (*user_combo)(void* user_ctx, void* plaintext, void* ciphertext, int size, void* res))
 {
-	int cfd = -1, i, ret;
-	struct cryptodev_ctx ctx;
+	int i, ret;
+	struct cdev_pool pool;
 	uint8_t digest[AALG_MAX_RESULT_LEN];
-	char text[16*1024];
-	char ctext[16*1024];
+	/* room for the TLS padding and MAC */
+	char ctext[16*1024 + 64];
 	char iv[16];
-	unsigned long elapsed, counted;
-	double t1, t2;
-	struct benchmark_st bst;
+	struct aead_bench b;
+	struct benchmark_result kernel, user;
 
-	/* Open the crypto device */
-	cfd = open("/dev/crypto", O_RDWR, 0);
-	if (cfd < 0) {
+	if (cdev_pool_init(&pool, 1, 0) < 0) {
 		perror("open(/dev/crypto)");
 		return -1;
 	}
 
-	aead_ctx_init(&ctx, cipher, mac, ukey, ukey_size, cfd);
-
-	for (i=0;i<sizeof(sizes)/sizeof(sizes[0]);i++) {
-		counted = 0;
-		ret = start_benchmark(&bst);
-		if (ret < 0) {
-			ret = -1;
-			goto finish;
-		}
-
-		do {
-			if (aead_encrypt(&ctx, iv, text, text, sizes[i], digest) < 0)
-				return -2;
-			counted += sizes[i];
-		} while(benchmark_must_finish==0);
-
-		ret = stop_benchmark(&bst, &elapsed);
-		if (ret < 0) {
-			ret = -1;
-			goto finish;
-		}
-
-		t1 = (double)counted/(double)elapsed;
-
-		/* now check the user function */
-		counted = 0;
-		ret = start_benchmark(&bst);
-		if (ret < 0) {
-			ret = -1;
-			goto finish;
-		}
+	b.s = cdev_session_get(&pool, cipher, ukey, ukey_size, mac, NULL, 0);
+	if (b.s == NULL) {
+		perror("ioctl(CIOCGSESSION)");
+		cdev_pool_deinit(&pool);
+		return -1;
+	}
 
-		do {
-			user_combo(user_ctx, text, ctext, sizes[i], digest);
-			counted += sizes[i];
-		} while(benchmark_must_finish==0);
+	b.text = cdev_alloc(b.s, 16*1024 + 64);
+	if (b.text == NULL) {
+		ret = -1;
+		goto finish;
+	}
+	memset(b.text, 0, 16*1024 + 64);
+	memset(iv, 0, sizeof(iv));
+	b.user_ctx = user_ctx;
+	b.user_combo = user_combo;
+	b.ctext = ctext;
+	b.iv = iv;
+	b.digest = digest;
 
-		ret = stop_benchmark(&bst, &elapsed);
-		if (ret < 0) {
+	for (i=0;i<sizeof(sizes)/sizeof(sizes[0]);i++) {
+		b.size = sizes[i];
+		if (benchmark_run(kernel_fn, &b, NULL, &kernel) < 0 ||
+		    benchmark_run(user_fn, &b, NULL, &user) < 0) {
 			ret = -1;
 			goto finish;
 		}
 
-		t2 = (double)counted/(double)elapsed;
-
 #ifdef DEBUG
-		printf("%d: kernel: %.4f bytes/msec, user: %.4f bytes/msec\n", sizes[i], t1, t2);
+		printf("%d: kernel: %.4f bytes/msec (+-%.1f%%), user: %.4f bytes/msec (+-%.1f%%)\n",
+				sizes[i], sizes[i] * 1e6 / kernel.mean,
+				100 * kernel.ci / kernel.mean,
+				sizes[i] * 1e6 / user.mean, 100 * user.ci / user.mean);
 #endif
-		if (t1 > t2) {
+		/* only a difference beyond the noise counts */
+		if (benchmark_compare(&kernel, &user) > 0) {
 			ret = sizes[i];
 			goto finish;
 		}
@@ -160,12 +103,8 @@ int aead_test(int cipher, int mac, void* ukey, int ukey_size,
 
 	ret = -1;
 finish:
-	aead_ctx_deinit(&ctx);
-
-	/* Close the original descriptor */
-	if (close(cfd)) {
-		perror("close(cfd)");
-		return 1;
-	}
+	cdev_free(b.text);
+	cdev_session_put(b.s);
+	cdev_pool_deinit(&pool);
 	return ret;
 }
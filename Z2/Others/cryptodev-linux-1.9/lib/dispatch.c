@@ -0,0 +1,596 @@
+/*
+ * Routing of hash and cipher requests between OpenSSL and /dev/crypto
+ * by size, with thresholds calibrated per machine.
+ *
+ * Placed under public domain.
+ *
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/utsname.h>
+#include "benchmark.h"
+#include "dispatch.h"
+
+static const struct {
+	const char *name;	/* in the profile, and for OpenSSL */
+	int cipher, mac;
+	int keylen;
+} algos[DISPATCH_ALGO_MAX] = {
+	[DISPATCH_MD5] = { "md5", 0, CRYPTO_MD5, 0 },
+	[DISPATCH_SHA1] = { "sha1", 0, CRYPTO_SHA1, 0 },
+	[DISPATCH_SHA224] = { "sha224", 0, CRYPTO_SHA2_224, 0 },
+	[DISPATCH_SHA256] = { "sha256", 0, CRYPTO_SHA2_256, 0 },
+	[DISPATCH_SHA384] = { "sha384", 0, CRYPTO_SHA2_384, 0 },
+	[DISPATCH_SHA512] = { "sha512", 0, CRYPTO_SHA2_512, 0 },
+	[DISPATCH_AES_128_CBC] = { "aes-128-cbc", CRYPTO_AES_CBC, 0, 16 },
+	[DISPATCH_AES_256_CBC] = { "aes-256-cbc", CRYPTO_AES_CBC, 0, 32 },
+	[DISPATCH_AES_128_CTR] = { "aes-128-ctr", CRYPTO_AES_CTR, 0, 16 },
+	[DISPATCH_AES_256_CTR] = { "aes-256-ctr", CRYPTO_AES_CTR, 0, 32 },
+};
+
+/* the sizes the calibration compares at */
+static const int sizes[] = {64, 128, 256, 512, 1024, 2048, 4096, 8192,
+	16*1024, 32*1024, 64*1024};
+#define MAX_SIZE (64*1024)
+
+/* requests go to OpenSSL in pieces of this size */
+#define USER_CHUNK (1 << 30)
+
+/* OpenSSL 3 looks implementations up on every init unless they are
+ * fetched beforehand */
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+# define md_get(name)		EVP_MD_fetch(NULL, name, NULL)
+# define md_put(md)		EVP_MD_free(md)
+# define cipher_get(name)	EVP_CIPHER_fetch(NULL, name, NULL)
+# define cipher_put(cipher)	EVP_CIPHER_free(cipher)
+#else
+# define md_get(name)		((EVP_MD *)EVP_get_digestbyname(name))
+# define md_put(md)
+# define cipher_get(name)	((EVP_CIPHER *)EVP_get_cipherbyname(name))
+# define cipher_put(cipher)
+#endif
+
+const char *dispatch_algo_name(enum dispatch_algo algo)
+{
+	return algo < DISPATCH_ALGO_MAX ? algos[algo].name : NULL;
+}
+
+static int open_session(int cfd, enum dispatch_algo algo, const void *key,
+		struct session_op *sess, struct session_info_op *siop)
+{
+	memset(sess, 0, sizeof(*sess));
+	sess->cipher = algos[algo].cipher;
+	sess->mac = algos[algo].mac;
+	sess->keylen = algos[algo].keylen;
+	sess->key = (void *)key;
+	if (ioctl(cfd, CIOCGSESSION, sess))
+		return -1;
+
+	if (siop) {
+		memset(siop, 0, sizeof(*siop));
+		siop->ses = sess->ses;
+		if (ioctl(cfd, CIOCGSESSINFO, siop)) {
+			ioctl(cfd, CIOCFSESSION, &sess->ses);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static const char *driver_name(enum dispatch_algo algo,
+		const struct session_info_op *siop)
+{
+	if (algos[algo].cipher)
+		return siop->cipher_info.cra_driver_name;
+	return siop->hash_info.cra_driver_name;
+}
+
+/* one request through the kernel; dst is the digest for hashes */
+static int kernel_op(int cfd, uint32_t ses, enum dispatch_algo algo, int op,
+		const void *iv, const void *src, void *dst, size_t size)
+{
+	struct crypt_op cryp;
+
+	memset(&cryp, 0, sizeof(cryp));
+	cryp.ses = ses;
+	cryp.op = op;
+	cryp.len = size;
+	cryp.src = (void *)src;
+	if (algos[algo].cipher) {
+		cryp.dst = dst;
+		cryp.iv = (void *)iv;
+	} else {
+		cryp.mac = dst;
+	}
+	return ioctl(cfd, CIOCCRYPT, &cryp);
+}
+
+static int user_hash(EVP_MD_CTX *mctx, const EVP_MD *md, const void *text,
+		size_t size, void *digest)
+{
+	size_t len;
+
+	if (!md || !EVP_DigestInit_ex(mctx, md, NULL))
+		return -1;
+	for (; size; size -= len, text = (const uint8_t *)text + len) {
+		len = size < USER_CHUNK ? size : USER_CHUNK;
+		if (!EVP_DigestUpdate(mctx, text, len))
+			return -1;
+	}
+	return EVP_DigestFinal_ex(mctx, digest, NULL) ? 0 : -1;
+}
+
+static int user_crypt(EVP_CIPHER_CTX *evp, const void *iv, const void *src,
+		void *dst, size_t size)
+{
+	int len, chunk;
+
+	if (!EVP_CipherInit_ex(evp, NULL, NULL, NULL, iv, -1))
+		return -1;
+	for (; size; size -= chunk) {
+		chunk = size < USER_CHUNK ? size : USER_CHUNK;
+		/* without padding nothing is held back, unless the
+		 * request was not whole blocks */
+		if (!EVP_CipherUpdate(evp, dst, &len, src, chunk) || len != chunk)
+			return -1;
+		src = (const uint8_t *)src + chunk;
+		dst = (uint8_t *)dst + chunk;
+	}
+	return 0;
+}
+
+static EVP_CIPHER_CTX *user_cipher_new(enum dispatch_algo algo,
+		const void *key, int enc)
+{
+	EVP_CIPHER *cipher = cipher_get(algos[algo].name);
+	EVP_CIPHER_CTX *evp = EVP_CIPHER_CTX_new();
+
+	if (!cipher || !evp ||
+	    !EVP_CipherInit_ex(evp, cipher, NULL, key, NULL, enc)) {
+		EVP_CIPHER_CTX_free(evp);
+		evp = NULL;
+	} else {
+		EVP_CIPHER_CTX_set_padding(evp, 0);
+	}
+	/* the context holds its own reference */
+	cipher_put(cipher);
+	return evp;
+}
+
+/* The profile: a line identifying the machine, then a line per
+ * algorithm with its threshold, the time of the calibration and the
+ * driver it was made with.
+ */
+static void machine_id(char *id, size_t size)
+{
+	struct utsname u;
+
+	if (uname(&u))
+		snprintf(id, size, "unknown");
+	else
+		snprintf(id, size, "%s %s %s", u.nodename, u.release, u.machine);
+}
+
+static void profile_read(const char *path, struct dispatch_profile *profile)
+{
+	char line[512], id[256], name[32], driver[CRYPTODEV_MAX_ALG_NAME];
+	long long stamp;
+	int threshold, same = 0, i;
+	FILE *fp;
+
+	fp = fopen(path, "r");
+	if (fp == NULL)
+		return;
+
+	machine_id(id, sizeof(id));
+	while (fgets(line, sizeof(line), fp)) {
+		line[strcspn(line, "\n")] = 0;
+		if (line[0] == '#')
+			continue;
+		if (strncmp(line, "machine ", 8) == 0) {
+			/* a profile of another host or kernel is stale */
+			same = strcmp(line + 8, id) == 0;
+			continue;
+		}
+		if (!same || sscanf(line, "%31s %d %lld %63s",
+					name, &threshold, &stamp, driver) != 4)
+			continue;
+
+		for (i = 0; i < DISPATCH_ALGO_MAX; i++) {
+			if (strcmp(name, algos[i].name))
+				continue;
+			profile[i].valid = 1;
+			profile[i].threshold = threshold;
+			profile[i].stamp = stamp;
+			strcpy(profile[i].driver, driver);
+		}
+	}
+	fclose(fp);
+}
+
+static void make_dirs(const char *path)
+{
+	char dir[PATH_MAX], *p;
+
+	snprintf(dir, sizeof(dir), "%s", path);
+	for (p = dir + 1; *p; p++) {
+		if (*p != '/')
+			continue;
+		*p = 0;
+		mkdir(dir, 0700);
+		*p = '/';
+	}
+}
+
+/* merge the profile into the file, where the newer entry of an
+ * algorithm wins, and replace it */
+static int profile_save(struct dispatch_ctx *ctx)
+{
+	struct dispatch_profile saved[DISPATCH_ALGO_MAX], *p;
+	char tmp[PATH_MAX + 16], id[256];
+	FILE *fp;
+	int i;
+
+	memset(saved, 0, sizeof(saved));
+	profile_read(ctx->path, saved);
+
+	make_dirs(ctx->path);
+	snprintf(tmp, sizeof(tmp), "%s.%d", ctx->path, (int)getpid());
+	fp = fopen(tmp, "w");
+	if (fp == NULL) {
+		perror(tmp);
+		return -1;
+	}
+
+	machine_id(id, sizeof(id));
+	fprintf(fp, "# cryptodev dispatch thresholds, in bytes\n");
+	fprintf(fp, "machine %s\n", id);
+	for (i = 0; i < DISPATCH_ALGO_MAX; i++) {
+		p = &ctx->profile[i];
+		if (!p->valid || (saved[i].valid && saved[i].stamp > p->stamp))
+			p = &saved[i];
+		if (p->valid)
+			fprintf(fp, "%s %d %lld %s\n", algos[i].name, p->threshold,
+					(long long)p->stamp, p->driver);
+	}
+
+	if (fclose(fp) || rename(tmp, ctx->path)) {
+		perror(ctx->path);
+		unlink(tmp);
+		return -1;
+	}
+	return 0;
+}
+
+/* what the calibration compares */
+struct calib {
+	int cfd;
+	enum dispatch_algo algo;
+	struct session_op sess;
+	const EVP_MD *md;
+	EVP_MD_CTX *mctx;
+	EVP_CIPHER_CTX *evp;
+	uint8_t *buf;
+	int size;
+	uint8_t iv[16];
+	uint8_t digest[AALG_MAX_RESULT_LEN];
+};
+
+static int calib_kernel(void *arg)
+{
+	struct calib *c = arg;
+
+	return kernel_op(c->cfd, c->sess.ses, c->algo, COP_ENCRYPT, c->iv,
+			c->buf, algos[c->algo].cipher ? c->buf : c->digest, c->size);
+}
+
+static int calib_user(void *arg)
+{
+	struct calib *c = arg;
+
+	if (c->evp)
+		return user_crypt(c->evp, c->iv, c->buf, c->buf, c->size);
+	return user_hash(c->mctx, c->md, c->buf, c->size, c->digest);
+}
+
+/* Worst case running time: around 4.4 secs, usually well below as
+ * the measurements settle
+ */
+int dispatch_calibrate(struct dispatch_ctx *ctx, enum dispatch_algo algo)
+{
+	struct dispatch_profile *p;
+	struct session_info_op siop;
+	struct calib c;
+	struct benchmark_result kernel, user;
+	uint8_t key[32];
+	int i, cmp, candidate = -1, ret = -1;
+
+	if (algo >= DISPATCH_ALGO_MAX)
+		return -1;
+
+	p = &ctx->profile[algo];
+	memset(p, 0, sizeof(*p));
+	p->threshold = -1;
+	p->checked = 1;
+	p->stamp = time(NULL);
+	strcpy(p->driver, "-");
+	if (ctx->cfd < 0) {
+		/* nothing to compare with, and nothing worth saving */
+		p->valid = 1;
+		return 0;
+	}
+
+	memset(&c, 0, sizeof(c));
+	c.cfd = ctx->cfd;
+	c.algo = algo;
+	c.md = ctx->md[algo];
+	c.mctx = ctx->mctx;
+	memset(key, 0x42, sizeof(key));
+
+	if (open_session(ctx->cfd, algo, key, &c.sess, &siop)) {
+		/* not in this kernel: always user-space */
+		p->valid = 1;
+		return profile_save(ctx);
+	}
+	snprintf(p->driver, sizeof(p->driver), "%s", driver_name(algo, &siop));
+
+	if (algos[algo].cipher) {
+		c.evp = user_cipher_new(algo, key, 1);
+		if (c.evp == NULL)
+			goto finish;
+	}
+	if (posix_memalign((void **)&c.buf, siop.alignmask < 64 ? 64 :
+				siop.alignmask + 1, MAX_SIZE))
+		goto finish;
+	memset(c.buf, 0x23, MAX_SIZE);
+
+	/* The threshold is the first size the kernel wins at beyond the
+	 * noise, as long as it does not lose at the next one.
+	 */
+	for (i = 0; i < sizeof(sizes)/sizeof(sizes[0]); i++) {
+		c.size = sizes[i];
+		if (benchmark_run(calib_kernel, &c, NULL, &kernel) < 0 ||
+		    benchmark_run(calib_user, &c, NULL, &user) < 0)
+			goto finish;
+#ifdef DEBUG
+		printf("%s %d: kernel: %.4f bytes/msec (+-%.1f%%), user: %.4f bytes/msec (+-%.1f%%)\n",
+				algos[algo].name, sizes[i], sizes[i] * 1e6 / kernel.mean,
+				100 * kernel.ci / kernel.mean, sizes[i] * 1e6 / user.mean,
+				100 * user.ci / user.mean);
+#endif
+		cmp = benchmark_compare(&kernel, &user);
+		if (candidate >= 0) {
+			if (cmp >= 0)
+				break;
+			candidate = -1;
+		}
+		if (cmp > 0)
+			candidate = sizes[i];
+	}
+	p->threshold = candidate;
+	p->valid = 1;
+	ret = profile_save(ctx);
+
+finish:
+	free(c.buf);
+	EVP_CIPHER_CTX_free(c.evp);
+	ioctl(ctx->cfd, CIOCFSESSION, &c.sess.ses);
+	return ret;
+}
+
+/* the profile of algo, checked once per process for staleness, or
+ * NULL if it stays in user-space */
+static struct dispatch_profile *profile_get(struct dispatch_ctx *ctx,
+		enum dispatch_algo algo)
+{
+	struct dispatch_profile *p = &ctx->profile[algo];
+	struct session_info_op siop;
+	struct session_op sess;
+	uint8_t key[32];
+
+	if (ctx->cfd < 0)
+		return NULL;
+
+	if (!p->checked) {
+		p->checked = 1;
+		if (p->valid && time(NULL) - p->stamp > ctx->max_age)
+			p->valid = 0;
+
+		/* the kernel may pick another driver since, e.g. after
+		 * an accelerator's module was loaded */
+		memset(key, 0, sizeof(key));
+		if (p->valid && open_session(ctx->cfd, algo, key, &sess, &siop) == 0) {
+			if (strcmp(p->driver, driver_name(algo, &siop)))
+				p->valid = 0;
+			ioctl(ctx->cfd, CIOCFSESSION, &sess.ses);
+		}
+	}
+
+	if (!p->valid) {
+		if (ctx->flags & DISPATCH_NO_CALIBRATE)
+			return NULL;
+		dispatch_calibrate(ctx, algo);
+	}
+	return p;
+}
+
+static inline int use_kernel(struct dispatch_profile *p, size_t size)
+{
+	return p && p->threshold >= 0 && size >= p->threshold &&
+		size <= UINT32_MAX;
+}
+
+int dispatch_threshold(struct dispatch_ctx *ctx, enum dispatch_algo algo)
+{
+	struct dispatch_profile *p;
+
+	if (algo >= DISPATCH_ALGO_MAX)
+		return -1;
+	p = profile_get(ctx, algo);
+	return p ? p->threshold : -1;
+}
+
+int dispatch_init(struct dispatch_ctx *ctx, const char *path, unsigned int flags)
+{
+	const char *dir;
+	int i;
+
+	memset(ctx, 0, sizeof(*ctx));
+	ctx->cfd = -1;
+	ctx->flags = flags;
+	ctx->max_age = DISPATCH_MAX_AGE;
+
+	if (path == NULL)
+		path = getenv("CRYPTODEV_PROFILE");
+	if (path && *path)
+		snprintf(ctx->path, sizeof(ctx->path), "%s", path);
+	else if ((dir = getenv("XDG_CACHE_HOME")) && *dir)
+		snprintf(ctx->path, sizeof(ctx->path), "%s/cryptodev/dispatch", dir);
+	else
+		snprintf(ctx->path, sizeof(ctx->path), "%s/.cache/cryptodev/dispatch",
+				getenv("HOME") ? getenv("HOME") : "/tmp");
+
+	ctx->mctx = EVP_MD_CTX_new();
+	if (ctx->mctx == NULL)
+		return -1;
+	for (i = 0; i < DISPATCH_ALGO_MAX; i++)
+		if (algos[i].mac)
+			ctx->md[i] = md_get(algos[i].name);
+
+	ctx->cfd = open("/dev/crypto", O_RDWR | O_CLOEXEC, 0);
+	if (ctx->cfd < 0) {
+#ifdef DEBUG
+		perror("open(/dev/crypto)");
+#endif
+		return 0;
+	}
+
+	if (!(flags & DISPATCH_RECALIBRATE))
+		profile_read(ctx->path, ctx->profile);
+	return 0;
+}
+
+void dispatch_deinit(struct dispatch_ctx *ctx)
+{
+	int i;
+
+	for (i = 0; i < DISPATCH_ALGO_MAX; i++) {
+		md_put(ctx->md[i]);
+		ctx->md[i] = NULL;
+	}
+	EVP_MD_CTX_free(ctx->mctx);
+	ctx->mctx = NULL;
+
+	if (ctx->cfd < 0)
+		return;
+	for (i = 0; i < DISPATCH_ALGO_MAX; i++)
+		if (ctx->has_sess[i])
+			ioctl(ctx->cfd, CIOCFSESSION, &ctx->sess[i].ses);
+	close(ctx->cfd);
+	ctx->cfd = -1;
+}
+
+int dispatch_hash(struct dispatch_ctx *ctx, enum dispatch_algo algo,
+		const void *text, size_t size, void *digest)
+{
+	struct dispatch_profile *p;
+
+	if (algo >= DISPATCH_ALGO_MAX || !algos[algo].mac) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	p = profile_get(ctx, algo);
+	if (use_kernel(p, size)) {
+		if (!ctx->has_sess[algo]) {
+			if (open_session(ctx->cfd, algo, NULL, &ctx->sess[algo], NULL) == 0)
+				ctx->has_sess[algo] = 1;
+			else
+				p->threshold = -1;
+		}
+		if (ctx->has_sess[algo] && kernel_op(ctx->cfd, ctx->sess[algo].ses,
+					algo, COP_ENCRYPT, NULL, text, digest, size) == 0)
+			return 0;
+		/* fall back to user-space */
+	}
+	return user_hash(ctx->mctx, ctx->md[algo], text, size, digest);
+}
+
+int dispatch_cipher_init(struct dispatch_cipher_ctx *cctx,
+		struct dispatch_ctx *ctx, enum dispatch_algo algo, const void *key)
+{
+	struct dispatch_profile *p;
+
+	memset(cctx, 0, sizeof(*cctx));
+	if (algo >= DISPATCH_ALGO_MAX || !algos[algo].cipher) {
+		errno = EINVAL;
+		return -1;
+	}
+	cctx->ctx = ctx;
+	cctx->algo = algo;
+
+	cctx->enc = user_cipher_new(algo, key, 1);
+	cctx->dec = user_cipher_new(algo, key, 0);
+	if (cctx->enc == NULL || cctx->dec == NULL) {
+		dispatch_cipher_deinit(cctx);
+		return -1;
+	}
+
+	/* calibrated here rather than on the first request */
+	p = profile_get(ctx, algo);
+	if (p && p->threshold >= 0 &&
+	    open_session(ctx->cfd, algo, key, &cctx->sess, NULL) == 0)
+		cctx->has_sess = 1;
+	return 0;
+}
+
+void dispatch_cipher_deinit(struct dispatch_cipher_ctx *cctx)
+{
+	if (cctx->has_sess)
+		ioctl(cctx->ctx->cfd, CIOCFSESSION, &cctx->sess.ses);
+	EVP_CIPHER_CTX_free(cctx->enc);
+	EVP_CIPHER_CTX_free(cctx->dec);
+	memset(cctx, 0, sizeof(*cctx));
+}
+
+static int dispatch_crypt(struct dispatch_cipher_ctx *cctx, int op,
+		const void *iv, const void *src, void *dst, size_t size)
+{
+	struct dispatch_ctx *ctx = cctx->ctx;
+
+	/* neither side pads, so refuse what either would cut short */
+	if (size % EVP_CIPHER_CTX_block_size(cctx->enc)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (cctx->has_sess && use_kernel(&ctx->profile[cctx->algo], size)) {
+		if (kernel_op(ctx->cfd, cctx->sess.ses, cctx->algo, op, iv, src,
+			    dst, size) == 0)
+			return 0;
+		/* the kernel may have overwritten part of the input */
+		if (src == dst)
+			return -1;
+		/* fall back to user-space */
+	}
+	return user_crypt(op == COP_ENCRYPT ? cctx->enc : cctx->dec, iv, src,
+			dst, size);
+}
+
+int dispatch_encrypt(struct dispatch_cipher_ctx *cctx, const void *iv,
+		const void *src, void *dst, size_t size)
+{
+	return dispatch_crypt(cctx, COP_ENCRYPT, iv, src, dst, size);
+}
+
+int dispatch_decrypt(struct dispatch_cipher_ctx *cctx, const void *iv,
+		const void *src, void *dst, size_t size)
+{
+	return dispatch_crypt(cctx, COP_DECRYPT, iv, src, dst, size);
+}
@@ -0,0 +1,109 @@
+#ifndef DISPATCH_H
+# define DISPATCH_H
+
+#include <stdint.h>
+#include <time.h>
+#include <limits.h>
+#include <crypto/cryptodev.h>
+#include <openssl/evp.h>
+
+/* Routing of hash and cipher requests either to OpenSSL or to
+ * /dev/crypto, by size. Small requests are faster in user-space, where
+ * there is no system call; large ones may be faster on an accelerator.
+ * The size from which the kernel wins is measured per algorithm and
+ * kept in a profile file for the machine, so the measurement, about
+ * a second per algorithm, is only taken again when the profile gets
+ * stale: too old, from another kernel or host, or made with another
+ * driver than the one the kernel now picks.
+ *
+ * A context is not thread-safe; use one per thread.
+ */
+
+enum dispatch_algo {
+	DISPATCH_MD5,
+	DISPATCH_SHA1,
+	DISPATCH_SHA224,
+	DISPATCH_SHA256,
+	DISPATCH_SHA384,
+	DISPATCH_SHA512,
+	DISPATCH_AES_128_CBC,
+	DISPATCH_AES_256_CBC,
+	DISPATCH_AES_128_CTR,
+	DISPATCH_AES_256_CTR,
+	DISPATCH_ALGO_MAX
+};
+
+/* route algorithms without a valid profile to user-space instead of
+ * calibrating them on first use */
+#define DISPATCH_NO_CALIBRATE	(1 << 0)
+/* ignore the saved profile */
+#define DISPATCH_RECALIBRATE	(1 << 1)
+
+/* default maximum age of a profile entry, in seconds */
+#define DISPATCH_MAX_AGE	(30 * 24 * 3600)
+
+struct dispatch_profile {
+	int valid;
+	int checked;	/* driver compared in this process */
+	int threshold;	/* bytes from which the kernel is faster, -1 if never */
+	time_t stamp;	/* of the calibration */
+	char driver[CRYPTODEV_MAX_ALG_NAME];
+};
+
+struct dispatch_ctx {
+	int cfd;
+	unsigned int flags;
+	time_t max_age;
+	char path[PATH_MAX];
+	struct dispatch_profile profile[DISPATCH_ALGO_MAX];
+	/* user-space digests, kept to avoid a lookup per request */
+	EVP_MD *md[DISPATCH_ALGO_MAX];
+	EVP_MD_CTX *mctx;
+	/* hash sessions, opened on first use */
+	struct session_op sess[DISPATCH_ALGO_MAX];
+	int has_sess[DISPATCH_ALGO_MAX];
+};
+
+struct dispatch_cipher_ctx {
+	struct dispatch_ctx *ctx;
+	enum dispatch_algo algo;
+	EVP_CIPHER_CTX *enc, *dec;
+	struct session_op sess;
+	int has_sess;
+};
+
+/* Open /dev/crypto, if there is one, and load the profile from path,
+ * or by default from $CRYPTODEV_PROFILE or
+ * $XDG_CACHE_HOME/cryptodev/dispatch. Without the device every request
+ * goes to user-space.
+ */
+int dispatch_init(struct dispatch_ctx *ctx, const char *path, unsigned int flags);
+void dispatch_deinit(struct dispatch_ctx *ctx);
+
+const char *dispatch_algo_name(enum dispatch_algo algo);
+
+/* Measure the threshold of algo now, and save the profile. */
+int dispatch_calibrate(struct dispatch_ctx *ctx, enum dispatch_algo algo);
+
+/* The size from which algo goes to the kernel, calibrating it if the
+ * profile is missing or stale; -1 if it always stays in user-space.
+ */
+int dispatch_threshold(struct dispatch_ctx *ctx, enum dispatch_algo algo);
+
+/* digest of size bytes of text */
+int dispatch_hash(struct dispatch_ctx *ctx, enum dispatch_algo algo,
+		const void *text, size_t size, void *digest);
+
+/* A cipher with a fixed key. Every call starts from iv; CBC requests
+ * must be whole blocks, or fail with EINVAL. An in-place request the
+ * kernel fails is not retried in user-space, as its input may be gone.
+ */
+int dispatch_cipher_init(struct dispatch_cipher_ctx *cctx,
+		struct dispatch_ctx *ctx, enum dispatch_algo algo, const void *key);
+void dispatch_cipher_deinit(struct dispatch_cipher_ctx *cctx);
+int dispatch_encrypt(struct dispatch_cipher_ctx *cctx, const void *iv,
+		const void *src, void *dst, size_t size);
+int dispatch_decrypt(struct dispatch_cipher_ctx *cctx, const void *iv,
+		const void *src, void *dst, size_t size);
+
+#endif
@@ -0,0 +1,470 @@
+/*
+ * A /dev/crypto handle with a session pool, aligned buffers and
+ * synchronous, batched and asynchronous requests.
+ *
+ * Placed under public domain.
+ *
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include "libcryptodev.h"
+
+#define CACHE_LINE	64
+/* jobs harvested by one CIOCASYNCFETCHMANY of cdev_batch() */
+#define BATCH_FETCH	64
+
+/* FNV-1a, over the algorithms and both keys */
+static uint32_t fnv1a(uint32_t h, const void *data, size_t len)
+{
+	const uint8_t *p = data;
+
+	while (len--) {
+		h ^= *p++;
+		h *= 16777619;
+	}
+	return h;
+}
+
+static uint32_t key_hash(int cipher, const void *key, unsigned int keylen,
+		int mac, const void *mackey, unsigned int mackeylen)
+{
+	uint32_t h = 2166136261u;
+
+	h = fnv1a(h, &cipher, sizeof(cipher));
+	h = fnv1a(h, &mac, sizeof(mac));
+	h = fnv1a(h, key, keylen);
+	return fnv1a(h, mackey, mackeylen);
+}
+
+static int session_match(const struct cdev_session *s, int cipher,
+		const void *key, unsigned int keylen, int mac,
+		const void *mackey, unsigned int mackeylen)
+{
+	return s->cipher == cipher && s->mac == mac &&
+		s->keylen == keylen && s->mackeylen == mackeylen &&
+		memcmp(s->key, key, keylen) == 0 &&
+		memcmp(s->mackey, mackey, mackeylen) == 0;
+}
+
+int cdev_pool_init(struct cdev_pool *pool, unsigned int max_sessions,
+		unsigned int depth)
+{
+	uint32_t want;
+
+	memset(pool, 0, sizeof(*pool));
+	pool->max_sessions = max_sessions ? max_sessions : CDEV_POOL_SESSIONS;
+
+	pool->cfd = open("/dev/crypto", O_RDWR | O_CLOEXEC, 0);
+	if (pool->cfd < 0)
+		return -1;
+	pthread_mutex_init(&pool->lock, NULL);
+
+	/* without async support in the module the queue stays empty and
+	 * batches run one by one */
+	want = depth ? depth : CDEV_POOL_DEPTH;
+	if (ioctl(pool->cfd, CIOCASYNCDEPTH, &want) == 0 && want) {
+		pool->depth = want;
+		pool->pending = calloc(want, sizeof(*pool->pending));
+		pool->done = calloc(want, sizeof(*pool->done));
+		pool->results = calloc(want, sizeof(*pool->results));
+		if (!pool->pending || !pool->done || !pool->results) {
+			cdev_pool_deinit(pool);
+			errno = ENOMEM;
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static void session_close(struct cdev_pool *pool, struct cdev_session *s)
+{
+	ioctl(pool->cfd, CIOCFSESSION, &s->ses);
+	free(s);
+}
+
+void cdev_pool_deinit(struct cdev_pool *pool)
+{
+	struct cdev_session *s, *next;
+	int i;
+
+	for (i = 0; i < CDEV_POOL_BUCKETS; i++) {
+		for (s = pool->bucket[i]; s; s = next) {
+			next = s->next;
+			session_close(pool, s);
+		}
+		pool->bucket[i] = NULL;
+	}
+	free(pool->pending);
+	free(pool->done);
+	free(pool->results);
+	pthread_mutex_destroy(&pool->lock);
+	close(pool->cfd);
+	pool->cfd = -1;
+}
+
+/* Unlink the least recently used idle session, if any; called locked. */
+static struct cdev_session *pool_evict(struct cdev_pool *pool)
+{
+	struct cdev_session **p, **victim = NULL, *s;
+	int i;
+
+	for (i = 0; i < CDEV_POOL_BUCKETS; i++)
+		for (p = &pool->bucket[i]; *p; p = &(*p)->next)
+			if (!(*p)->refs && (!victim || (*p)->used < (*victim)->used))
+				victim = p;
+	if (!victim)
+		return NULL;
+
+	s = *victim;
+	*victim = s->next;
+	pool->nsessions--;
+	return s;
+}
+
+static struct cdev_session *session_open(struct cdev_pool *pool,
+		int cipher, const void *key, unsigned int keylen,
+		int mac, const void *mackey, unsigned int mackeylen)
+{
+	struct cdev_session *s;
+	struct session_op sess;
+#ifdef CIOCGSESSINFO
+	struct session_info_op siop;
+#endif
+
+	if (keylen > sizeof(s->key) || mackeylen > sizeof(s->mackey)) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	s = calloc(1, sizeof(*s));
+	if (!s)
+		return NULL;
+	s->pool = pool;
+	s->cipher = cipher;
+	s->mac = mac;
+	s->keylen = keylen;
+	s->mackeylen = mackeylen;
+	memcpy(s->key, key, keylen);
+	memcpy(s->mackey, mackey, mackeylen);
+
+	memset(&sess, 0, sizeof(sess));
+	sess.cipher = cipher;
+	sess.key = s->key;
+	sess.keylen = keylen;
+	sess.mac = mac;
+	sess.mackey = mackeylen ? s->mackey : NULL;
+	sess.mackeylen = mackeylen;
+	if (ioctl(pool->cfd, CIOCGSESSION, &sess)) {
+		free(s);
+		return NULL;
+	}
+	s->ses = sess.ses;
+
+#ifdef CIOCGSESSINFO
+	memset(&siop, 0, sizeof(siop));
+	siop.ses = s->ses;
+	if (ioctl(pool->cfd, CIOCGSESSINFO, &siop)) {
+		session_close(pool, s);
+		return NULL;
+	}
+	s->alignmask = siop.alignmask;
+#endif
+	return s;
+}
+
+struct cdev_session *cdev_session_get(struct cdev_pool *pool,
+		int cipher, const void *key, unsigned int keylen,
+		int mac, const void *mackey, unsigned int mackeylen)
+{
+	struct cdev_session *s, *victim = NULL;
+	uint32_t h;
+
+	if (!key)
+		keylen = 0;
+	if (!mackey)
+		mackeylen = 0;
+	h = key_hash(cipher, key, keylen, mac, mackey, mackeylen);
+
+	pthread_mutex_lock(&pool->lock);
+	for (s = pool->bucket[h % CDEV_POOL_BUCKETS]; s; s = s->next)
+		if (s->hash == h && session_match(s, cipher, key, keylen,
+					mac, mackey, mackeylen))
+			break;
+	if (s) {
+		s->refs++;
+		s->used = ++pool->clock;
+	}
+	pthread_mutex_unlock(&pool->lock);
+	if (s)
+		return s;
+
+	/* opened unlocked, as it may take the module a while; two threads
+	 * racing for the same keys both get a session */
+	s = session_open(pool, cipher, key, keylen, mac, mackey, mackeylen);
+	if (!s)
+		return NULL;
+	s->hash = h;
+	s->refs = 1;
+
+	pthread_mutex_lock(&pool->lock);
+	if (pool->nsessions >= pool->max_sessions)
+		victim = pool_evict(pool);
+	s->used = ++pool->clock;
+	s->next = pool->bucket[h % CDEV_POOL_BUCKETS];
+	pool->bucket[h % CDEV_POOL_BUCKETS] = s;
+	pool->nsessions++;
+	pthread_mutex_unlock(&pool->lock);
+
+	if (victim)
+		session_close(pool, victim);
+	return s;
+}
+
+void cdev_session_put(struct cdev_session *s)
+{
+	pthread_mutex_lock(&s->pool->lock);
+	s->refs--;
+	pthread_mutex_unlock(&s->pool->lock);
+}
+
+void *cdev_alloc(const struct cdev_session *s, size_t size)
+{
+	size_t align = s ? s->alignmask + 1 : 1;
+	long page = sysconf(_SC_PAGESIZE);
+	void *p;
+
+	if (align < CACHE_LINE)
+		align = CACHE_LINE;
+	if (page > 0 && size >= (size_t)page && align < (size_t)page)
+		align = page;
+
+	if (posix_memalign(&p, align, size ? size : 1)) {
+		errno = ENOMEM;
+		return NULL;
+	}
+	return p;
+}
+
+void cdev_free(void *p)
+{
+	free(p);
+}
+
+int cdev_aligned(const struct cdev_session *s, const void *p)
+{
+	return ((uintptr_t)p & s->alignmask) == 0;
+}
+
+static void op_to_cop(const struct cdev_op *op, struct crypt_op *cop)
+{
+	memset(cop, 0, sizeof(*cop));
+	cop->ses = op->s->ses;
+	cop->op = op->op;
+	cop->flags = op->flags;
+	cop->len = op->len;
+	cop->src = (void *)op->src;
+	cop->dst = op->dst;
+	cop->iv = (void *)op->iv;
+	cop->mac = op->mac;
+}
+
+static int op_run(struct cdev_op *op)
+{
+	struct crypt_op cop;
+
+	op_to_cop(op, &cop);
+	if (ioctl(op->s->pool->cfd, CIOCCRYPT, &cop)) {
+		op->result = -errno;
+		return -1;
+	}
+	op->result = 0;
+	return 0;
+}
+
+int cdev_hash(struct cdev_session *s, const void *src, size_t len,
+		void *digest)
+{
+	struct cdev_op op = {
+		.s = s, .op = COP_ENCRYPT, .src = src, .len = len, .mac = digest,
+	};
+
+	return op_run(&op);
+}
+
+int cdev_encrypt(struct cdev_session *s, const void *iv, const void *src,
+		void *dst, size_t len)
+{
+	struct cdev_op op = {
+		.s = s, .op = COP_ENCRYPT, .src = src, .dst = dst, .len = len,
+		.iv = iv,
+	};
+
+	return op_run(&op);
+}
+
+int cdev_decrypt(struct cdev_session *s, const void *iv, const void *src,
+		void *dst, size_t len)
+{
+	struct cdev_op op = {
+		.s = s, .op = COP_DECRYPT, .src = src, .dst = dst, .len = len,
+		.iv = iv,
+	};
+
+	return op_run(&op);
+}
+
+static ssize_t aead_run(struct cdev_session *s, int op, const void *iv,
+		unsigned int iv_len, const void *aad, size_t aad_len,
+		const void *src, void *dst, size_t len, unsigned int tag_len)
+{
+	struct crypt_auth_op caop;
+
+	memset(&caop, 0, sizeof(caop));
+	caop.ses = s->ses;
+	caop.op = op;
+	caop.len = len;
+	caop.auth_src = (void *)aad;
+	caop.auth_len = aad_len;
+	caop.iv = (void *)iv;
+	caop.iv_len = iv_len;
+	caop.tag_len = tag_len;
+	caop.dst = dst;
+
+	/* the TLS way works in dst only */
+	if (s->mac) {
+		caop.flags = COP_FLAG_AEAD_TLS_TYPE;
+		if (src != dst)
+			memmove(dst, src, len);
+		caop.src = dst;
+	} else {
+		caop.src = (void *)src;
+	}
+
+	if (ioctl(s->pool->cfd, CIOCAUTHCRYPT, &caop))
+		return -1;
+	return caop.len;
+}
+
+ssize_t cdev_aead_encrypt(struct cdev_session *s, const void *iv,
+		unsigned int iv_len, const void *aad, size_t aad_len,
+		const void *src, void *dst, size_t len, unsigned int tag_len)
+{
+	return aead_run(s, COP_ENCRYPT, iv, iv_len, aad, aad_len, src, dst,
+			len, tag_len);
+}
+
+ssize_t cdev_aead_decrypt(struct cdev_session *s, const void *iv,
+		unsigned int iv_len, const void *aad, size_t aad_len,
+		const void *src, void *dst, size_t len, unsigned int tag_len)
+{
+	return aead_run(s, COP_DECRYPT, iv, iv_len, aad, aad_len, src, dst,
+			len, tag_len);
+}
+
+int cdev_submit(struct cdev_pool *pool, struct cdev_op *op)
+{
+	struct crypt_op cop;
+
+	if (!pool->depth) {
+		errno = EOPNOTSUPP;
+		return -1;
+	}
+	if (pool->inflight == pool->depth) {
+		errno = EBUSY;
+		return -1;
+	}
+
+	op_to_cop(op, &cop);
+	if (ioctl(pool->cfd, CIOCASYNCCRYPT, &cop))
+		return -1;
+	pool->pending[(pool->head + pool->inflight) % pool->depth] = op;
+	pool->inflight++;
+	return 0;
+}
+
+int cdev_fetch(struct cdev_pool *pool, struct cdev_op **done,
+		unsigned int max, int timeout_ms)
+{
+	struct crypt_fetch_op fop;
+	struct pollfd pfd;
+	unsigned int i;
+	int ret;
+
+	if (!pool->inflight || !max)
+		return 0;
+
+	for (;;) {
+		memset(&fop, 0, sizeof(fop));
+		fop.count = max < pool->inflight ? max : pool->inflight;
+		fop.cops = pool->done;
+		fop.results = pool->results;
+		if (ioctl(pool->cfd, CIOCASYNCFETCHMANY, &fop) == 0)
+			break;
+		if (errno != EBUSY)
+			return -1;
+
+		pfd.fd = pool->cfd;
+		pfd.events = POLLIN;
+		ret = poll(&pfd, 1, timeout_ms);
+		if (ret == 0)
+			return 0;
+		if (ret < 0 && errno != EINTR)
+			return -1;
+	}
+
+	/* the handle's queue is worked in order */
+	for (i = 0; i < fop.count; i++) {
+		done[i] = pool->pending[pool->head];
+		done[i]->result = pool->results[i];
+		pool->head = (pool->head + 1) % pool->depth;
+		pool->inflight--;
+	}
+	return fop.count;
+}
+
+int cdev_batch(struct cdev_pool *pool, struct cdev_op *ops, unsigned int n)
+{
+	struct cdev_op *done[BATCH_FETCH];
+	unsigned int next = 0, completed = 0, i;
+	int ret, failed = 0;
+
+	if (!pool->depth) {
+		for (i = 0; i < n; i++)
+			if (op_run(&ops[i]))
+				failed = 1;
+		return failed ? -1 : 0;
+	}
+	if (pool->inflight) {
+		errno = EBUSY;
+		return -1;
+	}
+
+	while (completed < n) {
+		while (next < n) {
+			if (cdev_submit(pool, &ops[next]) == 0) {
+				next++;
+				continue;
+			}
+			if (errno == EBUSY)
+				break;
+			/* not queued, so it fails alone */
+			ops[next++].result = -errno;
+			completed++;
+			failed = 1;
+		}
+
+		ret = cdev_fetch(pool, done, BATCH_FETCH, -1);
+		if (ret < 0)
+			return -1;
+		for (i = 0; i < (unsigned int)ret; i++)
+			if (done[i]->result)
+				failed = 1;
+		completed += ret;
+	}
+	return failed ? -1 : 0;
+}
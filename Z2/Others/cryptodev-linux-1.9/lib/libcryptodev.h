@@ -0,0 +1,139 @@
+#ifndef LIBCRYPTODEV_H
+# define LIBCRYPTODEV_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <crypto/cryptodev.h>
+
+/* A handle on /dev/crypto with a pool of sessions, so that programs
+ * do not open a session per request or keep their own bookkeeping.
+ * Sessions are looked up by algorithm and keys, and stay open while
+ * unused until the pool needs room, the least recently used going
+ * first.
+ *
+ * Sessions and synchronous requests are thread-safe. The asynchronous
+ * queue belongs to the handle, so cdev_submit(), cdev_fetch() and
+ * cdev_batch() must not be used by several threads of one pool at
+ * once; give each thread its own pool instead.
+ */
+
+#define CDEV_POOL_BUCKETS	64
+/* default number of idle sessions kept open */
+#define CDEV_POOL_SESSIONS	32
+/* default number of async jobs in flight */
+#define CDEV_POOL_DEPTH		64
+
+struct cdev_pool;
+
+struct cdev_session {
+	struct cdev_pool *pool;
+	uint32_t ses;
+	int cipher, mac;
+	unsigned int keylen, mackeylen;
+	uint8_t key[CRYPTO_CIPHER_MAX_KEY_LEN];
+	uint8_t mackey[CRYPTO_HMAC_MAX_KEY_LEN];
+	uint16_t alignmask;	/* from CIOCGSESSINFO */
+	unsigned int refs;
+	uint64_t used;		/* pool clock at the last cdev_session_get() */
+	uint32_t hash;
+	struct cdev_session *next;
+};
+
+/* A request for cdev_batch() and the async calls. dst is NULL for a
+ * hash, mac NULL for a cipher. result is 0 or -errno on completion.
+ */
+struct cdev_op {
+	struct cdev_session *s;
+	int op;			/* COP_ENCRYPT or COP_DECRYPT */
+	int flags;		/* COP_FLAG_* */
+	const void *src;
+	void *dst;
+	size_t len;
+	const void *iv;
+	void *mac;
+	int result;
+	void *priv;		/* for the caller */
+};
+
+struct cdev_pool {
+	int cfd;
+	pthread_mutex_t lock;
+	unsigned int max_sessions, nsessions;
+	uint64_t clock;
+	struct cdev_session *bucket[CDEV_POOL_BUCKETS];
+	/* the async queue, 0 deep if the module has none; jobs of a
+	 * handle complete in submission order */
+	unsigned int depth, head, inflight;
+	struct cdev_op **pending;
+	struct crypt_op *done;
+	int32_t *results;
+};
+
+/* Open /dev/crypto. max_sessions sessions are kept open, more only
+ * while all are in use; depth bounds the async jobs in flight. 0
+ * picks the defaults.
+ */
+int cdev_pool_init(struct cdev_pool *pool, unsigned int max_sessions,
+		unsigned int depth);
+/* Closes every session; none may be in use. */
+void cdev_pool_deinit(struct cdev_pool *pool);
+
+/* A session for the cipher and/or mac with these keys, opened if the
+ * pool has none. Either algorithm may be 0, and mackey NULL for a
+ * plain hash. Returns NULL on failure.
+ */
+struct cdev_session *cdev_session_get(struct cdev_pool *pool,
+		int cipher, const void *key, unsigned int keylen,
+		int mac, const void *mackey, unsigned int mackeylen);
+void cdev_session_put(struct cdev_session *s);
+
+/* Buffers that the module can work on in place: aligned to the
+ * session's alignmask, which zero-copy needs, and to a page when they
+ * are that large, so that they pin as few pages as possible. Other
+ * buffers work too but go through the module's bounce buffer.
+ */
+void *cdev_alloc(const struct cdev_session *s, size_t size);
+void cdev_free(void *p);
+int cdev_aligned(const struct cdev_session *s, const void *p);
+
+/* synchronous requests, 0 or -1 */
+int cdev_hash(struct cdev_session *s, const void *src, size_t len,
+		void *digest);
+int cdev_encrypt(struct cdev_session *s, const void *iv, const void *src,
+		void *dst, size_t len);
+int cdev_decrypt(struct cdev_session *s, const void *iv, const void *src,
+		void *dst, size_t len);
+
+/* Authenticated encryption of a GCM session, or of a cipher and MAC
+ * session the TLS way with the padding added. dst needs room for the
+ * tag, and for TLS for the padding. A tag_len of 0 is the full one.
+ * Returns the length written to dst, or -1. Decryption returns the
+ * plaintext length, or -1 with errno EBADMSG if the tag is wrong.
+ */
+ssize_t cdev_aead_encrypt(struct cdev_session *s, const void *iv,
+		unsigned int iv_len, const void *aad, size_t aad_len,
+		const void *src, void *dst, size_t len, unsigned int tag_len);
+ssize_t cdev_aead_decrypt(struct cdev_session *s, const void *iv,
+		unsigned int iv_len, const void *aad, size_t aad_len,
+		const void *src, void *dst, size_t len, unsigned int tag_len);
+
+/* Queue op; -1 with errno EBUSY when depth jobs are in flight. op must
+ * stay valid until fetched.
+ */
+int cdev_submit(struct cdev_pool *pool, struct cdev_op *op);
+/* Up to max completed jobs into done, waiting at most timeout_ms
+ * (-1 for ever) for the first one. Returns their number, 0 on timeout
+ * or -1.
+ */
+int cdev_fetch(struct cdev_pool *pool, struct cdev_op **done,
+		unsigned int max, int timeout_ms);
+
+/* Run n requests, kept in flight together on the async queue if the
+ * module has one, which must be empty. Returns 0 if all succeeded, -1
+ * if any failed.
+ */
+int cdev_batch(struct cdev_pool *pool, struct cdev_op *ops, unsigned int n);
+
+#endif
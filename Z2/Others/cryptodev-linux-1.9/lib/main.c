@@ -1,5 +1,6 @@
 /*
- * Demo on how to use /dev/crypto device for ciphering.
+ * Calibrates the kernel vs user-space thresholds of the machine and
+ * saves them in the dispatch profile.
  *
  * Placed under public domain.
  *
@@ -7,22 +8,34 @@
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
-#include <fcntl.h>
-#include <sys/ioctl.h>
-#include <crypto/cryptodev.h>
-#include "threshold.h"
+#include "dispatch.h"
 
-int main()
+int main(int argc, char **argv)
 {
-int ret;
+struct dispatch_ctx ctx;
+unsigned int flags = 0;
+int i, ret;
 
-	ret = get_sha1_threshold();
-	if (ret > 0)
-		printf("SHA1 in kernel outperforms user-space after %d input bytes\n", ret);
+	/* -f measures again even if the profile is fresh */
+	if (argc > 1 && strcmp(argv[1], "-f") == 0) {
+		flags |= DISPATCH_RECALIBRATE;
+		argc--;
+		argv++;
+	}
 
-	ret = get_aes_sha1_threshold();
-	if (ret > 0)
-		printf("AES-SHA1 in kernel outperforms user-space after %d input bytes\n", ret);
+	if (dispatch_init(&ctx, argc > 1 ? argv[1] : NULL, flags) < 0)
+		return 1;
 
+	for (i = 0; i < DISPATCH_ALGO_MAX; i++) {
+		ret = dispatch_threshold(&ctx, i);
+		if (ret >= 0)
+			printf("%s in kernel outperforms user-space after %d input bytes\n",
+					dispatch_algo_name(i), ret);
+		else
+			printf("%s is faster in user-space\n", dispatch_algo_name(i));
+	}
+	printf("Profile: %s\n", ctx.path);
+
+	dispatch_deinit(&ctx);
 	return 0;
 }
@@ -4,8 +4,6 @@
 #include <fcntl.h>
 #include <sys/ioctl.h>
 #include <crypto/cryptodev.h>
-#include <openssl/aes.h>
-#include <openssl/engine.h>
 #include <openssl/hmac.h>
 #include <openssl/evp.h>
 #include "hash.h"
@@ -13,31 +11,21 @@
 
 void sha_hash(void* text, int size, void* digest)
 {
-SHA_CTX ctx;
-
-	SHA_Init(&ctx);
-
-	SHA_Update(&ctx, text, size);
-
-	SHA_Final(digest, &ctx);
+	EVP_Digest(text, size, digest, NULL, EVP_sha1(), NULL);
 }
 
+/* ctx is an AES-128-CBC encryption context without padding */
 void aes_sha_combo(void* ctx, void* plaintext, void* ciphertext, int size, void* tag)
 {
 uint8_t iv[16];
-AES_KEY* key = ctx;
-HMAC_CTX hctx;
 unsigned int rlen = 20;
+int len;
 
-	HMAC_CTX_init(&hctx);
-	HMAC_Init_ex(&hctx, iv, 16, EVP_sha1(), NULL);
-
-	HMAC_Update(&hctx, plaintext, size);
+	memset(iv, 0, sizeof(iv));
+	HMAC(EVP_sha1(), iv, 16, plaintext, size, tag, &rlen);
 
-	HMAC_Final(&hctx, tag, &rlen);
-	HMAC_CTX_cleanup(&hctx);
-
-	AES_cbc_encrypt(plaintext, ciphertext, size, key, iv, 1);
+	EVP_EncryptInit_ex(ctx, NULL, NULL, NULL, iv);
+	EVP_EncryptUpdate(ctx, ciphertext, &len, plaintext, size);
 }
 
 int get_sha1_threshold()
@@ -47,15 +35,21 @@ int get_sha1_threshold()
 
 int get_aes_sha1_threshold()
 {
-AES_KEY key;
+EVP_CIPHER_CTX *ctx;
 uint8_t ukey[16];
-
-	ENGINE_load_builtin_engines();
-        ENGINE_register_all_complete();
+int ret;
 
 	memset(ukey, 0xaf, sizeof(ukey));
-	AES_set_encrypt_key(ukey, 16*8, &key);
-
-	return aead_test(CRYPTO_AES_CBC, CRYPTO_SHA1, ukey, 16, &key, aes_sha_combo);
+	ctx = EVP_CIPHER_CTX_new();
+	if (ctx == NULL ||
+	    !EVP_EncryptInit_ex(ctx, EVP_aes_128_cbc(), NULL, ukey, NULL)) {
+		EVP_CIPHER_CTX_free(ctx);
+		return -1;
+	}
+	EVP_CIPHER_CTX_set_padding(ctx, 0);
+
+	ret = aead_test(CRYPTO_AES_CBC, CRYPTO_SHA1, ukey, 16, ctx, aes_sha_combo);
+
+	EVP_CIPHER_CTX_free(ctx);
+	return ret;
 }
-
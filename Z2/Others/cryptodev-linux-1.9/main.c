@@ -34,6 +34,7 @@
 #include <crypto/hash.h>
 #include <linux/crypto.h>
 #include <linux/mm.h>
+#include <linux/vmalloc.h>
 #include <linux/highmem.h>
 #include <linux/ioctl.h>
 #include <linux/random.h>
@@ -47,14 +48,21 @@
 #include "cryptodev_int.h"
 #include "zc.h"
 #include "cryptlib.h"
+#include "stats.h"
 #include "version.h"
 
 /* This file contains the traditional operations of encryption
  * and hashing of /dev/crypto.
  */
 
+/* Sessions with both a cipher and a hash are processed in slices of
+ * this size, small enough for a slice to still be in the cache when the
+ * second transform reads it. It is a multiple of every block size.
+ */
+#define HASH_CRYPT_SLICE	(16 * 1024)
+
 static int
-hash_n_crypt(struct csession *ses_ptr, struct crypt_op *cop,
+__hash_n_crypt(struct csession *ses_ptr, struct crypt_op *cop,
 		struct scatterlist *src_sg, struct scatterlist *dst_sg,
 		uint32_t len)
 {
@@ -99,6 +107,128 @@ out_err:
 	return ret;
 }
 
+/* Running the hash over the whole buffer and then the cipher over it
+ * again reads everything twice from memory. For combined sessions both
+ * passes are done slice by slice instead; the cipher IV is chained by
+ * the crypto API and the hash state carries over, so the result is the
+ * same as with a single pass of each. Unchained modes such as xts
+ * would restart every slice from the initial tweak, so they are not
+ * sliced.
+ */
+static int
+hash_n_crypt(struct csession *ses_ptr, struct crypt_op *cop,
+		struct scatterlist *src_sg, struct scatterlist *dst_sg,
+		uint32_t len)
+{
+	struct scatterlist src_tmp[2][2], dst_tmp[2][2];
+	struct scatterlist *src = src_sg, *dst = dst_sg;
+	uint32_t n;
+	int i = 0, ret;
+
+	if (ses_ptr->cdata.init == 0 || ses_ptr->hdata.init == 0 ||
+	    ses_ptr->cdata.unchained || len <= HASH_CRYPT_SLICE)
+		return __hash_n_crypt(ses_ptr, cop, src_sg, dst_sg, len);
+
+	for (;;) {
+		n = min_t(uint32_t, len, HASH_CRYPT_SLICE);
+		ret = __hash_n_crypt(ses_ptr, cop, src, dst, n);
+		if (unlikely(ret))
+			return ret;
+
+		len -= n;
+		if (len == 0)
+			return 0;
+
+		/* the previous slice may live in src_tmp[i], so alternate */
+		i ^= 1;
+		src = scatterwalk_ffwd(src_tmp[i], src, n);
+		if (dst_sg == src_sg)
+			dst = src;
+		else
+			dst = scatterwalk_ffwd(dst_tmp[i], dst, n);
+	}
+}
+
+/* Make sure the session has a bounce buffer. It is physically
+ * contiguous so that a single scatterlist entry covers it; when memory
+ * is too fragmented for the configured order, smaller ones are tried.
+ */
+static int
+get_bounce_buffer(struct csession *ses_ptr)
+{
+	int order;
+
+	if (likely(ses_ptr->bounce))
+		return 0;
+
+	for (order = clamp(cryptodev_bounce_order, 0, MAX_BOUNCE_ORDER);
+	     order >= 0; order--) {
+		ses_ptr->bounce = (void *)__get_free_pages(GFP_KERNEL |
+				(order ? __GFP_NOWARN | __GFP_NORETRY : 0), order);
+		if (ses_ptr->bounce) {
+			ses_ptr->bounce_order = order;
+			ddebug(2, "allocated bounce buffer of order %d", order);
+			return 0;
+		}
+	}
+
+	derr(1, "Error getting free page.");
+	return -ENOMEM;
+}
+
+/* An unchained request larger than the bounce buffer cannot be done
+ * in pieces, so it is bounced through a buffer of its own size in a
+ * single pass, mapped page by page.
+ */
+static int
+__crypto_run_std_whole(struct csession *ses_ptr, struct crypt_op *cop)
+{
+	unsigned int npages = DIV_ROUND_UP(cop->len, PAGE_SIZE), i;
+	struct scatterlist *sg;
+	struct sg_table sgt;
+	size_t off = 0, n;
+	char *data;
+	int ret;
+
+	data = vmalloc(cop->len);
+	if (unlikely(!data)) {
+		derr(1, "Error getting a bounce buffer of %u bytes.", cop->len);
+		return -ENOMEM;
+	}
+
+	ret = sg_alloc_table(&sgt, npages, GFP_KERNEL);
+	if (unlikely(ret))
+		goto out_free;
+	for_each_sg(sgt.sgl, sg, npages, i) {
+		n = min_t(size_t, cop->len - off, PAGE_SIZE);
+		sg_set_page(sg, vmalloc_to_page(data + off), n, 0);
+		off += n;
+	}
+
+	if (unlikely(copy_from_user(data, cop->src, cop->len))) {
+		derr(1, "Error copying %u bytes from user address %p.", cop->len, cop->src);
+		ret = -EFAULT;
+		goto out_table;
+	}
+
+	ret = hash_n_crypt(ses_ptr, cop, sgt.sgl, sgt.sgl, cop->len);
+	if (unlikely(ret)) {
+		derr(1, "hash_n_crypt failed.");
+		goto out_table;
+	}
+
+	if (unlikely(copy_to_user(cop->dst, data, cop->len))) {
+		derr(1, "could not copy to user.");
+		ret = -EFAULT;
+	}
+
+out_table:
+	sg_free_table(&sgt);
+out_free:
+	vfree(data);
+	return ret;
+}
+
 /* This is the main crypto function - feed it with plaintext
    and get a ciphertext (or vice versa :-) */
 static int
@@ -111,14 +241,17 @@ __crypto_run_std(struct csession *ses_ptr, struct crypt_op *cop)
 	int ret = 0;
 
 	nbytes = cop->len;
-	data = (char *)__get_free_page(GFP_KERNEL);
-
-	if (unlikely(!data)) {
-		derr(1, "Error getting free page.");
-		return -ENOMEM;
-	}
-
-	bufsize = PAGE_SIZE < nbytes ? PAGE_SIZE : nbytes;
+	ret = get_bounce_buffer(ses_ptr);
+	if (unlikely(ret))
+		return ret;
+	data = ses_ptr->bounce;
+
+	/* a power of two number of pages holds whole cipher blocks, so
+	 * every chunk of a chaining mode continues where the previous one
+	 * ended; an unchained one is not split */
+	bufsize = min_t(size_t, PAGE_SIZE << ses_ptr->bounce_order, nbytes);
+	if (ses_ptr->cdata.unchained && nbytes > bufsize)
+		return __crypto_run_std_whole(ses_ptr, cop);
 
 	src = cop->src;
 	dst = cop->dst;
@@ -154,7 +287,6 @@ __crypto_run_std(struct csession *ses_ptr, struct crypt_op *cop)
 		src += current_len;
 	}
 
-	free_page((unsigned long)data);
 	return ret;
 }
 
@@ -162,7 +294,8 @@ __crypto_run_std(struct csession *ses_ptr, struct crypt_op *cop)
 
 /* This is the main crypto function - zero-copy edition */
 static int
-__crypto_run_zc(struct csession *ses_ptr, struct kernel_crypt_op *kcop)
+__crypto_run_zc(struct fcrypt *fcr, struct csession *ses_ptr,
+		struct kernel_crypt_op *kcop)
 {
 	struct scatterlist *src_sg, *dst_sg;
 	struct crypt_op *cop = &kcop->cop;
@@ -172,8 +305,11 @@ __crypto_run_zc(struct csession *ses_ptr, struct kernel_crypt_op *kcop)
 	                  kcop->task, kcop->mm, &src_sg, &dst_sg);
 	if (unlikely(ret)) {
 		derr(1, "Error getting user pages. Falling back to non zero copy.");
+		cryptodev_stat_inc(fcr, CSTAT_ZC_FALLBACK);
+		cryptodev_stat_inc(fcr, CSTAT_BOUNCE);
 		return __crypto_run_std(ses_ptr, cop);
 	}
+	cryptodev_stat_inc(fcr, CSTAT_ZC);
 
 	ret = hash_n_crypt(ses_ptr, cop, src_sg, dst_sg, cop->len);
 
@@ -181,11 +317,97 @@ __crypto_run_zc(struct csession *ses_ptr, struct kernel_crypt_op *kcop)
 	return ret;
 }
 
+/* This is the main crypto function - vectored edition */
+static int
+__crypto_run_iov(struct csession *ses_ptr, struct kernel_crypt_op *kcop)
+{
+	struct scatterlist *src_sg, *dst_sg;
+	int ret;
+
+	ret = get_userbuf_iov(ses_ptr, kcop->src_iov, kcop->src_iovcnt,
+	                      kcop->dst_iov, kcop->dst_iovcnt,
+	                      kcop->task, kcop->mm, &src_sg, &dst_sg);
+	if (unlikely(ret)) {
+		derr(1, "Error getting user pages.");
+		return ret;
+	}
+
+	ret = hash_n_crypt(ses_ptr, &kcop->cop, src_sg, dst_sg, kcop->cop.len);
+
+	release_user_pages(ses_ptr);
+	return ret;
+}
+
+/* This is the main crypto function - registered buffer edition */
+static int
+__crypto_run_regbuf(struct fcrypt *fcr, struct csession *ses_ptr,
+		struct kernel_crypt_op *kcop)
+{
+	struct scatterlist *src_sg, *dst_sg;
+	struct crypt_op *cop = &kcop->cop;
+	struct regbuf *src_rb, *dst_rb = NULL;
+	int ret;
+
+	src_rb = crypto_get_regbuf(fcr, cop->src, cop->len);
+	if (unlikely(!src_rb)) {
+		derr(1, "source %p is not in a registered buffer", cop->src);
+		return -EINVAL;
+	}
+
+	if (cop->dst) {
+		dst_rb = crypto_get_regbuf(fcr, cop->dst, cop->len);
+		if (unlikely(!dst_rb)) {
+			derr(1, "destination %p is not in a registered buffer", cop->dst);
+			ret = -EINVAL;
+			goto out;
+		}
+	}
+
+	ret = get_regbuf(ses_ptr, src_rb, cop->src, dst_rb, cop->dst, cop->len,
+	                 &src_sg, &dst_sg);
+	if (unlikely(ret))
+		goto out;
+
+	ret = hash_n_crypt(ses_ptr, cop, src_sg, dst_sg, cop->len);
+
+	if (dst_rb)
+		flush_regbuf(dst_rb, cop->dst, cop->len);
+out:
+	if (dst_rb)
+		crypto_put_regbuf(dst_rb);
+	crypto_put_regbuf(src_rb);
+	return ret;
+}
+
+/* Step the session IV past an operation of len bytes. This is done
+ * before the operation runs, so that one which fails half way does not
+ * leave its keystream to the next: AEAD nonces count up by one, and
+ * counters by the number of blocks of len, which is where ctr(aes)
+ * leaves off.
+ */
+void crypto_session_iv_advance(struct csession *ses_ptr, unsigned int len)
+{
+	unsigned int i = ses_ptr->cdata.ivsize;
+	uint64_t carry;
+
+	if (ses_ptr->cdata.aead)
+		carry = 1;
+	else
+		carry = DIV_ROUND_UP(len, ses_ptr->cdata.ivsize);
+
+	while (carry && i--) {
+		carry += ses_ptr->iv[i];
+		ses_ptr->iv[i] = carry & 0xff;
+		carry >>= 8;
+	}
+}
+
 int crypto_run(struct fcrypt *fcr, struct kernel_crypt_op *kcop)
 {
 	struct csession *ses_ptr;
 	struct crypt_op *cop = &kcop->cop;
-	int ret;
+	u64 start = ktime_get_ns();
+	int no_zc, ret;
 
 	if (unlikely(cop->op != COP_ENCRYPT && cop->op != COP_DECRYPT)) {
 		ddebug(1, "invalid operation op=%u", cop->op);
@@ -217,37 +439,63 @@ int crypto_run(struct fcrypt *fcr, struct kernel_crypt_op *kcop)
 			goto out_unlock;
 		}
 
+		if (cop->flags & COP_FLAG_KERNEL_IV) {
+			if (unlikely(!ses_ptr->kernel_iv)) {
+				derr(1, "session has no IV, set one with CIOCSESSIV");
+				ret = -EINVAL;
+				goto out_unlock;
+			}
+			memcpy(kcop->iv, ses_ptr->iv, ses_ptr->cdata.ivsize);
+			crypto_session_iv_advance(ses_ptr, cop->len);
+		}
+
 		cryptodev_cipher_set_iv(&ses_ptr->cdata, kcop->iv,
 				min(ses_ptr->cdata.ivsize, kcop->ivlen));
 	}
 
 	if (likely(cop->len)) {
-		if (cop->flags & COP_FLAG_NO_ZC) {
-			if (unlikely(ses_ptr->alignmask && !IS_ALIGNED((unsigned long)cop->src, ses_ptr->alignmask))) {
+		/* decided here rather than in cop->flags, which the caller
+		 * gets back */
+		no_zc = cop->flags & COP_FLAG_NO_ZC;
+		if (!(cop->flags & (COP_FLAG_NO_ZC | COP_FLAG_REGBUF))) {
+			if (unlikely(ses_ptr->alignmask && !IS_ALIGNED((unsigned long)cop->src, ses_ptr->alignmask + 1))) {
 				dwarning(2, "source address %p is not %d byte aligned - disabling zero copy",
 						cop->src, ses_ptr->alignmask + 1);
-				cop->flags &= ~COP_FLAG_NO_ZC;
+				no_zc = 1;
 			}
 
-			if (unlikely(ses_ptr->alignmask && !IS_ALIGNED((unsigned long)cop->dst, ses_ptr->alignmask))) {
+			if (unlikely(ses_ptr->alignmask && !IS_ALIGNED((unsigned long)cop->dst, ses_ptr->alignmask + 1))) {
 				dwarning(2, "destination address %p is not %d byte aligned - disabling zero copy",
 						cop->dst, ses_ptr->alignmask + 1);
-				cop->flags &= ~COP_FLAG_NO_ZC;
+				no_zc = 1;
 			}
+
+			/* not asked for by the caller */
+			if (no_zc)
+				cryptodev_stat_inc(fcr, CSTAT_ZC_FALLBACK);
 		}
 
-		if (cop->flags & COP_FLAG_NO_ZC)
+		if (kcop->src_iov) {
+			cryptodev_stat_inc(fcr, CSTAT_ZC);
+			ret = __crypto_run_iov(ses_ptr, kcop);
+		} else if (cop->flags & COP_FLAG_REGBUF) {
+			cryptodev_stat_inc(fcr, CSTAT_REGBUF);
+			ret = __crypto_run_regbuf(fcr, ses_ptr, kcop);
+		} else if (no_zc) {
+			cryptodev_stat_inc(fcr, CSTAT_BOUNCE);
 			ret = __crypto_run_std(ses_ptr, &kcop->cop);
-		else
-			ret = __crypto_run_zc(ses_ptr, kcop);
+		} else {
+			ret = __crypto_run_zc(fcr, ses_ptr, kcop);
+		}
 		if (unlikely(ret))
 			goto out_unlock;
 	}
 
-	if (ses_ptr->cdata.init != 0) {
+	/* kernel IV operations report the IV they used, which kcop->iv
+	 * still holds */
+	if (ses_ptr->cdata.init != 0 && !(cop->flags & COP_FLAG_KERNEL_IV))
 		cryptodev_cipher_get_iv(&ses_ptr->cdata, kcop->iv,
 				min(ses_ptr->cdata.ivsize, kcop->ivlen));
-	}
 
 	if (ses_ptr->hdata.init != 0 &&
 		((cop->flags & COP_FLAG_FINAL) ||
@@ -263,5 +511,13 @@ int crypto_run(struct fcrypt *fcr, struct kernel_crypt_op *kcop)
 
 out_unlock:
 	crypto_put_session(ses_ptr);
+
+	if (unlikely(ret)) {
+		cryptodev_stat_inc(fcr, CSTAT_ERRORS);
+	} else {
+		cryptodev_stat_inc(fcr, CSTAT_OPS);
+		cryptodev_stat_add(fcr, CSTAT_BYTES, cop->len);
+	}
+	cryptodev_stat_latency(fcr, CSTAT_LAT_RUN, start);
 	return ret;
 }
@@ -0,0 +1,172 @@
+/*
+ * Driver for /dev/crypto device (aka CryptoDev)
+ *
+ * This file is part of linux cryptodev.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/* Performance counters. They are always on and cheap enough for
+ * production: every event is a per-CPU add, on the module-wide set and
+ * on the set of the file handle. The module-wide ones are shown in
+ * <debugfs>/cryptodev/stats, the per-handle ones are returned by
+ * CIOCGSTATS.
+ */
+
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/cpumask.h>
+#include <linux/slab.h>
+#include <crypto/cryptodev.h>
+#include "cryptodev_int.h"
+#include "stats.h"
+
+DEFINE_PER_CPU(struct cryptodev_stats, cryptodev_stats);
+atomic64_t cryptodev_async_depth = ATOMIC64_INIT(0);
+
+static struct dentry *cryptodev_debugfs_dir;
+
+static const char *const stat_names[CSTAT_MAX] = {
+	[CSTAT_OPS]		= "ops",
+	[CSTAT_AUTH_OPS]	= "auth_ops",
+	[CSTAT_BYTES]		= "bytes",
+	[CSTAT_ERRORS]		= "errors",
+	[CSTAT_ZC]		= "zero_copy",
+	[CSTAT_REGBUF]		= "registered_buffer",
+	[CSTAT_BOUNCE]		= "bounce_buffer",
+	[CSTAT_ZC_FALLBACK]	= "zero_copy_fallbacks",
+	[CSTAT_ASYNC_SUBMITTED]	= "async_submitted",
+	[CSTAT_ASYNC_FETCHED]	= "async_fetched",
+	[CSTAT_ASYNC_BUSY]	= "async_busy",
+	[CSTAT_SESSION_CREATE]	= "sessions_created",
+	[CSTAT_SESSION_DESTROY]	= "sessions_destroyed",
+};
+
+static const char *const lat_names[CSTAT_LAT_MAX] = {
+	[CSTAT_LAT_RUN]		= "crypto_run",
+	[CSTAT_LAT_AUTH_RUN]	= "crypto_auth_run",
+};
+
+/* add up the per-CPU copies of stats */
+static void stats_sum(struct cryptodev_stats __percpu *stats,
+		struct cryptodev_stats *sum)
+{
+	struct cryptodev_stats *s;
+	int cpu, i, j;
+
+	memset(sum, 0, sizeof(*sum));
+	for_each_possible_cpu(cpu) {
+		s = per_cpu_ptr(stats, cpu);
+		for (i = 0; i < CSTAT_MAX; i++)
+			sum->cnt[i] += s->cnt[i];
+		for (i = 0; i < CSTAT_LAT_MAX; i++)
+			for (j = 0; j < CRYPTODEV_LAT_BUCKETS; j++)
+				sum->lat[i][j] += s->lat[i][j];
+	}
+}
+
+void cryptodev_stats_fill(struct cryptodev_stats __percpu *stats,
+		struct crypt_stats_op *sop)
+{
+	struct cryptodev_stats sum;
+
+	stats_sum(stats, &sum);
+
+	sop->ops = sum.cnt[CSTAT_OPS];
+	sop->auth_ops = sum.cnt[CSTAT_AUTH_OPS];
+	sop->bytes = sum.cnt[CSTAT_BYTES];
+	sop->errors = sum.cnt[CSTAT_ERRORS];
+	sop->zc_ops = sum.cnt[CSTAT_ZC];
+	sop->regbuf_ops = sum.cnt[CSTAT_REGBUF];
+	sop->bounce_ops = sum.cnt[CSTAT_BOUNCE];
+	sop->zc_fallbacks = sum.cnt[CSTAT_ZC_FALLBACK];
+	sop->async_submitted = sum.cnt[CSTAT_ASYNC_SUBMITTED];
+	sop->async_fetched = sum.cnt[CSTAT_ASYNC_FETCHED];
+	sop->async_busy = sum.cnt[CSTAT_ASYNC_BUSY];
+	sop->sessions_created = sum.cnt[CSTAT_SESSION_CREATE];
+	sop->sessions_destroyed = sum.cnt[CSTAT_SESSION_DESTROY];
+	memcpy(sop->run_latency, sum.lat[CSTAT_LAT_RUN],
+			sizeof(sop->run_latency));
+	memcpy(sop->auth_run_latency, sum.lat[CSTAT_LAT_AUTH_RUN],
+			sizeof(sop->auth_run_latency));
+}
+
+static int stats_show(struct seq_file *m, void *v)
+{
+	struct cryptodev_stats *sum;
+	int i, j;
+
+	/* too large for the stack */
+	sum = kmalloc(sizeof(*sum), GFP_KERNEL);
+	if (unlikely(!sum))
+		return -ENOMEM;
+
+	stats_sum(&cryptodev_stats, sum);
+
+	for (i = 0; i < CSTAT_MAX; i++)
+		seq_printf(m, "%-24s %llu\n", stat_names[i], sum->cnt[i]);
+	seq_printf(m, "%-24s %lld\n", "async_pending",
+		(long long)atomic64_read(&cryptodev_async_depth));
+
+	for (i = 0; i < CSTAT_LAT_MAX; i++) {
+		seq_printf(m, "\n%s latency (ns):\n", lat_names[i]);
+		for (j = 0; j < CRYPTODEV_LAT_BUCKETS; j++) {
+			if (!sum->lat[i][j])
+				continue;
+			if (j == CRYPTODEV_LAT_BUCKETS - 1)
+				seq_printf(m, "  >= %-12llu %llu\n",
+						1ULL << (j - 1), sum->lat[i][j]);
+			else
+				seq_printf(m, "  <  %-12llu %llu\n",
+						1ULL << j, sum->lat[i][j]);
+		}
+	}
+
+	kfree(sum);
+	return 0;
+}
+
+static int stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, stats_show, NULL);
+}
+
+static const struct file_operations stats_fops = {
+	.owner = THIS_MODULE,
+	.open = stats_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+/* The statistics are optional: failing to create the debugfs files
+ * does not keep the module from loading. */
+void cryptodev_stats_init(void)
+{
+	cryptodev_debugfs_dir = debugfs_create_dir("cryptodev", NULL);
+	if (IS_ERR_OR_NULL(cryptodev_debugfs_dir)) {
+		cryptodev_debugfs_dir = NULL;
+		return;
+	}
+
+	debugfs_create_file("stats", 0444, cryptodev_debugfs_dir, NULL,
+			&stats_fops);
+}
+
+void cryptodev_stats_exit(void)
+{
+	debugfs_remove_recursive(cryptodev_debugfs_dir);
+}
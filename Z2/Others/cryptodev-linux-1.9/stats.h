@@ -0,0 +1,77 @@
+#ifndef CRYPTODEV_STATS_H
+# define CRYPTODEV_STATS_H
+
+#include <linux/percpu.h>
+#include <linux/ktime.h>
+#include <linux/bitops.h>
+#include <linux/atomic.h>
+
+/* Event counters, kept per CPU both module-wide and per handle. */
+enum cryptodev_stat {
+	CSTAT_OPS,
+	CSTAT_AUTH_OPS,
+	CSTAT_BYTES,
+	CSTAT_ERRORS,
+	CSTAT_ZC,
+	CSTAT_REGBUF,
+	CSTAT_BOUNCE,
+	CSTAT_ZC_FALLBACK,
+	CSTAT_ASYNC_SUBMITTED,
+	CSTAT_ASYNC_FETCHED,
+	CSTAT_ASYNC_BUSY,
+	CSTAT_SESSION_CREATE,
+	CSTAT_SESSION_DESTROY,
+	CSTAT_MAX
+};
+
+/* latency histograms */
+enum cryptodev_lat {
+	CSTAT_LAT_RUN,
+	CSTAT_LAT_AUTH_RUN,
+	CSTAT_LAT_MAX
+};
+
+struct cryptodev_stats {
+	u64 cnt[CSTAT_MAX];
+	u64 lat[CSTAT_LAT_MAX][CRYPTODEV_LAT_BUCKETS];
+};
+
+DECLARE_PER_CPU(struct cryptodev_stats, cryptodev_stats);
+
+/* async jobs submitted and neither fetched nor dropped with their
+ * handle yet, over all handles */
+extern atomic64_t cryptodev_async_depth;
+
+static inline void cryptodev_stat_add(struct fcrypt *fcr,
+		enum cryptodev_stat stat, u64 val)
+{
+	this_cpu_add(cryptodev_stats.cnt[stat], val);
+	if (likely(fcr->stats))
+		this_cpu_add(fcr->stats->cnt[stat], val);
+}
+
+static inline void cryptodev_stat_inc(struct fcrypt *fcr,
+		enum cryptodev_stat stat)
+{
+	cryptodev_stat_add(fcr, stat, 1);
+}
+
+/* account an operation that started at start (from ktime_get_ns()) in
+ * bucket fls64(nsecs), i.e. [2^(n-1), 2^n) nanoseconds */
+static inline void cryptodev_stat_latency(struct fcrypt *fcr,
+		enum cryptodev_lat which, u64 start)
+{
+	unsigned int bucket = min_t(unsigned int,
+			fls64(ktime_get_ns() - start), CRYPTODEV_LAT_BUCKETS - 1);
+
+	this_cpu_inc(cryptodev_stats.lat[which][bucket]);
+	if (likely(fcr->stats))
+		this_cpu_inc(fcr->stats->lat[which][bucket]);
+}
+
+void cryptodev_stats_fill(struct cryptodev_stats __percpu *stats,
+		struct crypt_stats_op *sop);
+void cryptodev_stats_init(void);
+void cryptodev_stats_exit(void);
+
+#endif
@@ -0,0 +1,547 @@
+/*  cryptodev_test - AEAD, TLS record and SRTP packet throughput
+ *
+ *  Times the three CIOCAUTHCRYPT paths of authenc.c, GCM, TLS 1.0
+ *  CBC+HMAC with padding and SRTP CTR+HMAC, at record and packet sizes
+ *  the protocols use, one at a time or in bursts, against the same
+ *  operations done by OpenSSL EVP through openssl_wrapper.c.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <crypto/cryptodev.h>
+
+#include "benchlib.h"
+#include "openssl_wrapper.h"
+
+#define MAX_LIST	64
+#define MAX_BURST	1024
+/* room after a record for its MAC and TLS padding, or a GCM tag */
+#define TAG_ROOM	128
+
+enum suite {
+	SUITE_GCM,	/* auth_n_crypt() */
+	SUITE_TLS,	/* tls_auth_n_crypt() */
+	SUITE_SRTP,	/* srtp_auth_n_crypt() */
+};
+
+/* A protocol's use of an algorithm: aad is the record header that is
+ * authenticated but not encrypted, tag_len 0 the full MAC.
+ */
+struct record_alg {
+	const char *name;
+	enum suite suite;
+	const char *alg;
+	unsigned int aad_len, tag_len, iv_len;
+	const char *sizes;
+};
+
+static const char *suite_names[] = { "gcm", "tls", "srtp" };
+
+/* TLS records up to the 16 KiB maximum, SRTP packets of 20 ms of
+ * G.711 audio up to a full MTU */
+static const struct record_alg record_algs[] = {
+	{ "gcm-aes128", SUITE_GCM, "aes-128-gcm", 13, 16, 12,
+		"64,256,1024,4096,16384" },
+	{ "gcm-aes256", SUITE_GCM, "aes-256-gcm", 13, 16, 12,
+		"64,256,1024,4096,16384" },
+	{ "tls-aes128-sha1", SUITE_TLS, "aes-128-cbc+hmac-sha1", 13, 0, 16,
+		"64,256,1024,4096,16384" },
+	{ "tls-aes128-sha256", SUITE_TLS, "aes-128-cbc+hmac-sha256", 13, 0, 16,
+		"64,256,1024,4096,16384" },
+	{ "srtp-aes128-sha1-80", SUITE_SRTP, "aes-128-ctr+hmac-sha1", 12, 10, 16,
+		"160,480,1200" },
+	{ NULL }
+};
+
+enum backend {
+	BACKEND_KERNEL,
+	BACKEND_EVP,
+	BACKEND_MAX
+};
+
+static const char *backend_names[BACKEND_MAX] = { "kernel", "evp" };
+
+static struct {
+	const struct record_alg *algs[MAX_LIST];
+	int nalgs;
+	unsigned int bursts[MAX_LIST]; /* 0 for sync */
+	int nbursts;
+	int backends[BACKEND_MAX];
+	int nbackends;
+	unsigned int sizes[MAX_LIST];
+	int nsizes; /* 0 for the defaults of each algorithm */
+	uint64_t duration, warmup; /* ns */
+	unsigned int reps;
+	enum bench_format format;
+	int si;
+} opts;
+
+/* the keys have to outlive the session for the EVP backend */
+static uint8_t key[CRYPTO_CIPHER_MAX_KEY_LEN], mackey[64];
+
+struct ctx {
+	int fd;
+	const struct record_alg *ra;
+	struct session_op sess;
+	unsigned int size;
+	uint8_t iv[EALG_MAX_BLOCK_LEN];
+	uint8_t tag[AALG_MAX_RESULT_LEN];
+};
+
+/* a record starts with its header, the payload following it */
+static int record_op(struct ctx *c, enum backend backend, uint8_t *rec,
+		unsigned int *out_len)
+{
+	const struct record_alg *ra = c->ra;
+	struct crypt_auth_op caop;
+
+	memset(&caop, 0, sizeof(caop));
+	caop.ses = c->sess.ses;
+	caop.op = COP_ENCRYPT;
+	caop.len = c->size;
+	caop.src = caop.dst = rec + ra->aad_len;
+	caop.auth_src = rec;
+	caop.auth_len = ra->aad_len;
+	caop.tag_len = ra->tag_len;
+	caop.iv = c->iv;
+	caop.iv_len = ra->iv_len;
+
+	switch (ra->suite) {
+	case SUITE_GCM:
+		break;
+	case SUITE_TLS:
+		caop.flags = COP_FLAG_AEAD_TLS_TYPE;
+		break;
+	case SUITE_SRTP:
+		/* the MAC covers the header and the encrypted payload */
+		caop.flags = COP_FLAG_AEAD_SRTP_TYPE;
+		caop.auth_len += c->size;
+		caop.tag = c->tag;
+		break;
+	}
+
+	if (backend == BACKEND_KERNEL) {
+		if (ioctl(c->fd, CIOCAUTHCRYPT, &caop)) {
+			perror("ioctl(CIOCAUTHCRYPT)");
+			return -1;
+		}
+	} else if (openssl_ciocauthcrypt(&c->sess, &caop)) {
+		return -1;
+	}
+
+	if (out_len)
+		*out_len = caop.len;
+	return 0;
+}
+
+/* Encrypt one record with both backends and compare, so that the
+ * numbers are of the same work.
+ */
+static int cross_check(struct ctx *c)
+{
+	size_t len = c->ra->aad_len + c->size + TAG_ROOM;
+	uint8_t *rec[BACKEND_MAX], tag[AALG_MAX_RESULT_LEN];
+	unsigned int out_len[BACKEND_MAX];
+	int i, ret = -1;
+
+	for (i = 0; i < BACKEND_MAX; i++) {
+		rec[i] = malloc(len);
+		if (!rec[i]) {
+			while (i--)
+				free(rec[i]);
+			return -1;
+		}
+		memset(rec[i], 0x17, c->ra->aad_len);
+		memset(rec[i] + c->ra->aad_len, 0x5a, len - c->ra->aad_len);
+	}
+
+	memset(c->tag, 0, sizeof(c->tag));
+	if (record_op(c, BACKEND_KERNEL, rec[0], &out_len[0]))
+		goto out;
+	memcpy(tag, c->tag, sizeof(tag));
+	memset(c->tag, 0, sizeof(c->tag));
+	if (record_op(c, BACKEND_EVP, rec[1], &out_len[1]))
+		goto out;
+
+	if (out_len[0] != out_len[1] ||
+	    memcmp(rec[0], rec[1], c->ra->aad_len + out_len[0]) ||
+	    memcmp(tag, c->tag, sizeof(tag))) {
+		fprintf(stderr, "%s: the kernel and EVP disagree at %u bytes\n",
+				c->ra->name, c->size);
+		goto out;
+	}
+	ret = 0;
+out:
+	for (i = 0; i < BACKEND_MAX; i++)
+		free(rec[i]);
+	return ret;
+}
+
+/* one timed run, bursts of burst records or single ones */
+static int run_once(struct ctx *c, enum backend backend, unsigned int burst,
+		uint8_t *recs, size_t stride, struct bench_result *r,
+		double *secs, double *bytes)
+{
+	unsigned int n = burst ? burst : 1, i;
+	uint64_t start, end, t, t0, cycles, ops = 0;
+
+	start = bench_ns();
+	while (bench_ns() - start < opts.warmup)
+		for (i = 0; i < n; i++)
+			if (record_op(c, backend, recs + i * stride, NULL))
+				return -1;
+
+	cycles = bench_cycles();
+	start = t = bench_ns();
+	do {
+		t0 = t;
+		for (i = 0; i < n; i++)
+			if (record_op(c, backend, recs + i * stride, NULL))
+				return -1;
+		t = bench_ns();
+		bench_hist_add(&r->hist, t - t0);
+		ops += n;
+	} while (t - start < opts.duration);
+	end = t;
+	cycles = bench_cycles() - cycles;
+
+	*secs = (end - start) / 1e9;
+	*bytes = (double)ops * c->size;
+	r->ops += ops;
+	r->bytes += *bytes;
+	r->secs += *secs;
+	if (cycles)
+		r->cycles += cycles;
+	return 0;
+}
+
+static int run(struct ctx *c, enum backend backend, unsigned int burst,
+		uint8_t *recs, size_t stride)
+{
+	struct bench_result r;
+	char mode[32];
+	double secs, bytes, mbps, sum = 0, sumsq = 0;
+	unsigned int rep;
+
+	if (burst)
+		snprintf(mode, sizeof(mode), "burst%u-%s", burst,
+				backend_names[backend]);
+	else
+		snprintf(mode, sizeof(mode), "sync-%s", backend_names[backend]);
+
+	memset(&r, 0, sizeof(r));
+	r.alg = c->ra->name;
+	r.mode = mode;
+	r.size = c->size;
+	r.threads = 1;
+	r.depth = burst ? burst : 1;
+	bench_hist_init(&r.hist);
+
+	for (rep = 0; rep < opts.reps; rep++) {
+		if (run_once(c, backend, burst, recs, stride, &r, &secs, &bytes))
+			return -1;
+		mbps = secs ? bytes / secs / 1e6 : 0;
+		sum += mbps;
+		sumsq += mbps * mbps;
+	}
+	if (!r.secs)
+		return -1;
+
+	r.reps = opts.reps;
+	r.mbps = sum / opts.reps;
+	if (opts.reps > 1)
+		r.mbps_stddev = sqrt(fabs(sumsq - sum * sum / opts.reps) /
+				(opts.reps - 1));
+	bench_report(stdout, opts.format, opts.si, &r);
+	return 0;
+}
+
+/* every size, mode and backend of one algorithm */
+static int run_alg(int fd, const struct record_alg *ra)
+{
+	unsigned int sizes[MAX_LIST], max_burst = 1;
+	struct bench_alg alg;
+	struct ctx c;
+	uint8_t *recs;
+	size_t stride;
+	int nsizes, s, m, b, failed = 0;
+
+	if (opts.nsizes) {
+		memcpy(sizes, opts.sizes, sizeof(sizes));
+		nsizes = opts.nsizes;
+	} else {
+		nsizes = bench_parse_sizes(ra->sizes, sizes, MAX_LIST);
+	}
+	for (m = 0; m < opts.nbursts; m++)
+		if (opts.bursts[m] > max_burst)
+			max_burst = opts.bursts[m];
+
+	if (bench_alg_parse(ra->alg, &alg)) {
+		fprintf(stderr, "%s: unknown algorithm %s\n", ra->name, ra->alg);
+		return -1;
+	}
+
+	memset(&c, 0, sizeof(c));
+	c.fd = fd;
+	c.ra = ra;
+	memset(c.iv, 0x23, sizeof(c.iv));
+	c.sess.cipher = alg.cipher;
+	c.sess.keylen = alg.keylen;
+	c.sess.key = key;
+	c.sess.mac = alg.mac;
+	c.sess.mackeylen = alg.mackeylen;
+	c.sess.mackey = mackey;
+	if (ioctl(fd, CIOCGSESSION, &c.sess)) {
+		perror("ioctl(CIOCGSESSION)");
+		return -1;
+	}
+
+	for (s = 0; s < nsizes && !failed; s++) {
+		c.size = sizes[s];
+		if (cross_check(&c)) {
+			failed = 1;
+			break;
+		}
+
+		/* a burst goes through distinct records, as a real one would */
+		recs = bench_alloc(ra->aad_len + c.size + TAG_ROOM, max_burst,
+				0, &stride);
+		if (!recs) {
+			fprintf(stderr, "cannot allocate %u records\n", max_burst);
+			failed = 1;
+			break;
+		}
+		memset(recs, 0x5a, stride * max_burst);
+
+		for (m = 0; m < opts.nbursts && !failed; m++)
+			for (b = 0; b < opts.nbackends && !failed; b++)
+				if (run(&c, opts.backends[b], opts.bursts[m],
+				        recs, stride))
+					failed = 1;
+		free(recs);
+	}
+
+	openssl_fsession(c.sess.ses);
+	if (ioctl(fd, CIOCFSESSION, &c.sess.ses))
+		perror("ioctl(CIOCFSESSION)");
+	return failed ? -1 : 0;
+}
+
+static void usage(FILE *fp)
+{
+	const struct record_alg *ra;
+
+	fprintf(fp, "Usage: aead_speed [options]\n"
+		"  -a, --alg LIST      algorithms or suites gcm, tls, srtp (all)\n"
+		"  -m, --mode LIST     sync, or burstN for N records in a row\n"
+		"                      whose latency is that of the burst (sync,burst16)\n"
+		"  -b, --backend LIST  kernel, evp (kernel,evp)\n"
+		"  -s, --size LIST     payload sizes, as 64,1024 or 64:16384\n"
+		"                      (the protocol's typical ones)\n"
+		"  -T, --time SECS     measured time of a run (2)\n"
+		"  -w, --warmup SECS   unmeasured time before a run (0.1)\n"
+		"  -r, --reps N        repetitions of a run (1)\n"
+		"  -f, --format FMT    text, csv or json (text)\n"
+		"      --kib           binary units in text output\n"
+		"  -l, --list          list the algorithms\n");
+	if (fp != stdout)
+		return;
+	fprintf(fp, "\nAlgorithms:\n");
+	for (ra = record_algs; ra->name; ra++)
+		fprintf(fp, "\t%-20s %s, %u byte header, sizes %s\n",
+			ra->name, ra->alg, ra->aad_len, ra->sizes);
+}
+
+static int parse_algs(char *arg)
+{
+	const struct record_alg *ra;
+	char *name;
+	int found;
+
+	opts.nalgs = 0;
+	for (name = strtok(arg, ","); name; name = strtok(NULL, ",")) {
+		found = 0;
+		for (ra = record_algs; ra->name; ra++) {
+			if (strcmp(name, "all") && strcmp(name, ra->name) &&
+			    strcmp(name, suite_names[ra->suite]))
+				continue;
+			if (opts.nalgs == MAX_LIST)
+				return -1;
+			opts.algs[opts.nalgs++] = ra;
+			found = 1;
+		}
+		if (!found) {
+			fprintf(stderr, "unknown algorithm %s\n", name);
+			return -1;
+		}
+	}
+	return opts.nalgs ? 0 : -1;
+}
+
+static int parse_modes(char *arg)
+{
+	char *name, *end;
+	unsigned long n;
+
+	opts.nbursts = 0;
+	for (name = strtok(arg, ","); name; name = strtok(NULL, ",")) {
+		if (!strcmp(name, "sync")) {
+			n = 0;
+		} else if (!strncmp(name, "burst", 5)) {
+			n = strtoul(name + 5, &end, 10);
+			if (*end || n < 1 || n > MAX_BURST)
+				n = ULONG_MAX;
+		} else {
+			n = ULONG_MAX;
+		}
+		if (n == ULONG_MAX || opts.nbursts == MAX_LIST) {
+			fprintf(stderr, "unknown mode %s\n", name);
+			return -1;
+		}
+		opts.bursts[opts.nbursts++] = n;
+	}
+	return opts.nbursts ? 0 : -1;
+}
+
+static int parse_backends(char *arg)
+{
+	char *name;
+	int b;
+
+	opts.nbackends = 0;
+	for (name = strtok(arg, ","); name; name = strtok(NULL, ",")) {
+		for (b = 0; b < BACKEND_MAX; b++)
+			if (!strcmp(name, backend_names[b]))
+				break;
+		if (b == BACKEND_MAX || opts.nbackends == BACKEND_MAX) {
+			fprintf(stderr, "unknown backend %s\n", name);
+			return -1;
+		}
+		opts.backends[opts.nbackends++] = b;
+	}
+	return opts.nbackends ? 0 : -1;
+}
+
+static const struct option long_options[] = {
+	{ "alg", required_argument, NULL, 'a' },
+	{ "mode", required_argument, NULL, 'm' },
+	{ "backend", required_argument, NULL, 'b' },
+	{ "size", required_argument, NULL, 's' },
+	{ "time", required_argument, NULL, 'T' },
+	{ "warmup", required_argument, NULL, 'w' },
+	{ "reps", required_argument, NULL, 'r' },
+	{ "format", required_argument, NULL, 'f' },
+	{ "kib", no_argument, NULL, 'k' },
+	{ "list", no_argument, NULL, 'l' },
+	{ "help", no_argument, NULL, 'h' },
+	{ NULL, 0, NULL, 0 }
+};
+
+int main(int argc, char **argv)
+{
+	char algs[] = "all", modes[] = "sync,burst16", backends[] = "kernel,evp";
+	const struct record_alg *ra;
+	int fd, a, c, failed = 0;
+
+	memset(key, 0x42, sizeof(key));
+	memset(mackey, 0x23, sizeof(mackey));
+	parse_algs(algs);
+	parse_modes(modes);
+	parse_backends(backends);
+	opts.duration = 2000000000ULL;
+	opts.warmup = 100000000ULL;
+	opts.reps = 1;
+	opts.si = 1;
+
+	while ((c = getopt_long(argc, argv, "a:m:b:s:T:w:r:f:lh",
+				long_options, NULL)) != -1) {
+		switch (c) {
+		case 'a':
+			if (parse_algs(optarg))
+				return 1;
+			break;
+		case 'm':
+			if (parse_modes(optarg))
+				return 1;
+			break;
+		case 'b':
+			if (parse_backends(optarg))
+				return 1;
+			break;
+		case 's':
+			opts.nsizes = bench_parse_sizes(optarg, opts.sizes, MAX_LIST);
+			if (opts.nsizes <= 0) {
+				fprintf(stderr, "invalid sizes %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'T':
+			opts.duration = atof(optarg) * 1e9;
+			break;
+		case 'w':
+			opts.warmup = atof(optarg) * 1e9;
+			break;
+		case 'r':
+			opts.reps = atoi(optarg);
+			if (opts.reps < 1) {
+				fprintf(stderr, "invalid repetitions %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'f':
+			if (bench_parse_format(optarg, &opts.format)) {
+				fprintf(stderr, "unknown format %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'k':
+			opts.si = 0;
+			break;
+		case 'l':
+			for (ra = record_algs; ra->name; ra++)
+				printf("\t%s\n", ra->name);
+			return 0;
+		case 'h':
+			usage(stdout);
+			return 0;
+		default:
+			usage(stderr);
+			return 1;
+		}
+	}
+
+	if ((fd = open("/dev/crypto", O_RDWR, 0)) < 0) {
+		perror("open(/dev/crypto)");
+		return 1;
+	}
+
+	bench_report_begin(stdout, opts.format);
+	for (a = 0; a < opts.nalgs; a++)
+		if (run_alg(fd, opts.algs[a]))
+			failed = 1;
+	bench_report_end(stdout, opts.format);
+
+	close(fd);
+	return failed;
+}
@@ -0,0 +1,218 @@
+/*
+ * Demo on how to fold /dev/crypto completions into an epoll loop
+ * using an eventfd.
+ *
+ * Placed under public domain.
+ *
+ */
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <crypto/cryptodev.h>
+
+#include "asynchelper.h"
+#include "testhelper.h"
+
+#ifdef ENABLE_ASYNC
+
+static int debug = 0;
+
+#define	DATA_SIZE	4096
+#define	BLOCK_SIZE	16
+#define	KEY_SIZE	16
+#define	NJOBS		16
+
+static int
+test_eventfd(int cfd)
+{
+	uint8_t plaintext_raw[NJOBS][DATA_SIZE + 63], *plaintext[NJOBS];
+	uint8_t ciphertext_raw[NJOBS][DATA_SIZE + 63], *ciphertext[NJOBS];
+	uint8_t expected[DATA_SIZE];
+	uint8_t iv[BLOCK_SIZE];
+	uint8_t key[KEY_SIZE];
+	struct session_op sess;
+#ifdef CIOCGSESSINFO
+	struct session_info_op siop;
+#endif
+	struct crypt_op cryp;
+	struct epoll_event ev;
+	uint64_t completed;
+	int efd, epfd, i, fetched = 0, noefd = -1;
+
+	memset(&sess, 0, sizeof(sess));
+	memset(key, 0x33,  sizeof(key));
+	memset(iv, 0x03,  sizeof(iv));
+
+	/* Get crypto session for AES128 */
+	sess.cipher = CRYPTO_AES_CBC;
+	sess.keylen = KEY_SIZE;
+	sess.key = key;
+	if (ioctl(cfd, CIOCGSESSION, &sess)) {
+		perror("ioctl(CIOCGSESSION)");
+		return 1;
+	}
+
+#ifdef CIOCGSESSINFO
+	siop.ses = sess.ses;
+	if (ioctl(cfd, CIOCGSESSINFO, &siop)) {
+		perror("ioctl(CIOCGSESSINFO)");
+		return 1;
+	}
+	for (i = 0; i < NJOBS; i++) {
+		plaintext[i] = buf_align(plaintext_raw[i], siop.alignmask);
+		ciphertext[i] = buf_align(ciphertext_raw[i], siop.alignmask);
+	}
+#else
+	for (i = 0; i < NJOBS; i++) {
+		plaintext[i] = plaintext_raw[i];
+		ciphertext[i] = ciphertext_raw[i];
+	}
+#endif
+
+	efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (efd < 0) {
+		perror("eventfd()");
+		return 1;
+	}
+	if (ioctl(cfd, CIOCASYNCEVENTFD, &efd)) {
+		perror("ioctl(CIOCASYNCEVENTFD)");
+		return 1;
+	}
+
+	epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (epfd < 0) {
+		perror("epoll_create1()");
+		return 1;
+	}
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = efd;
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, efd, &ev)) {
+		perror("epoll_ctl()");
+		return 1;
+	}
+
+	/* queue all jobs at once */
+	for (i = 0; i < NJOBS; i++) {
+		memset(plaintext[i], i, DATA_SIZE);
+
+		memset(&cryp, 0, sizeof(cryp));
+		cryp.ses = sess.ses;
+		cryp.len = DATA_SIZE;
+		cryp.src = plaintext[i];
+		cryp.dst = ciphertext[i];
+		cryp.iv = iv;
+		cryp.op = COP_ENCRYPT;
+		DO_OR_DIE(do_async_crypt(cfd, &cryp), 0);
+	}
+
+	/* fetch as many jobs as each event reports */
+	while (fetched < NJOBS) {
+		if (epoll_wait(epfd, &ev, 1, -1) < 1) {
+			perror("epoll_wait()");
+			return 1;
+		}
+		if (read(efd, &completed, sizeof(completed)) != sizeof(completed)) {
+			perror("read(eventfd)");
+			return 1;
+		}
+		if (debug)
+			printf("%s: event for %llu jobs\n", __func__,
+					(unsigned long long)completed);
+
+		for (; completed > 0; completed--, fetched++) {
+			if (ioctl(cfd, CIOCASYNCFETCH, &cryp)) {
+				perror("ioctl(CIOCASYNCFETCH)");
+				return 1;
+			}
+		}
+	}
+
+	/* compare each job against the synchronous interface */
+	for (i = 0; i < NJOBS; i++) {
+		memset(&cryp, 0, sizeof(cryp));
+		cryp.ses = sess.ses;
+		cryp.len = DATA_SIZE;
+		cryp.src = plaintext[i];
+		cryp.dst = expected;
+		cryp.iv = iv;
+		cryp.op = COP_ENCRYPT;
+		if (ioctl(cfd, CIOCCRYPT, &cryp)) {
+			perror("ioctl(CIOCCRYPT)");
+			return 1;
+		}
+		if (memcmp(expected, ciphertext[i], DATA_SIZE) != 0) {
+			fprintf(stderr, "FAIL: job %d differs from CIOCCRYPT output.\n", i);
+			return 1;
+		}
+	}
+	if (debug)
+		printf("Test passed\n");
+
+	if (ioctl(cfd, CIOCASYNCEVENTFD, &noefd)) {
+		perror("ioctl(CIOCASYNCEVENTFD)");
+		return 1;
+	}
+	close(epfd);
+	close(efd);
+
+	/* Finish crypto session */
+	if (ioctl(cfd, CIOCFSESSION, &sess.ses)) {
+		perror("ioctl(CIOCFSESSION)");
+		return 1;
+	}
+
+	return 0;
+}
+
+int
+main(int argc, char** argv)
+{
+	int fd = -1, cfd = -1;
+
+	if (argc > 1) debug = 1;
+
+	/* Open the crypto device */
+	fd = open("/dev/crypto", O_RDWR, 0);
+	if (fd < 0) {
+		perror("open(/dev/crypto)");
+		return 1;
+	}
+
+	/* Clone file descriptor */
+	if (ioctl(fd, CRIOGET, &cfd)) {
+		perror("ioctl(CRIOGET)");
+		return 1;
+	}
+
+	/* Run the test itself */
+	if (test_eventfd(cfd))
+		return 1;
+
+	/* Close cloned descriptor */
+	if (close(cfd)) {
+		perror("close(cfd)");
+		return 1;
+	}
+
+	/* Close the original descriptor */
+	if (close(fd)) {
+		perror("close(fd)");
+		return 1;
+	}
+
+	return 0;
+}
+#else
+int
+main(int argc, char** argv)
+{
+	return (0);
+}
+#endif
@@ -2,7 +2,7 @@
 #define __ASYNCHELPER_H
 
 /* poll until POLLOUT, then call CIOCASYNCCRYPT */
-inline int do_async_crypt(int cfd, struct crypt_op *cryp)
+static inline int do_async_crypt(int cfd, struct crypt_op *cryp)
 {
 	struct pollfd pfd;
 
@@ -22,7 +22,7 @@ inline int do_async_crypt(int cfd, struct crypt_op *cryp)
 }
 
 /* poll until POLLIN, then call CIOCASYNCFETCH */
-inline int do_async_fetch(int cfd, struct crypt_op *cryp)
+static inline int do_async_fetch(int cfd, struct crypt_op *cryp)
 {
 	struct pollfd pfd;
 
@@ -0,0 +1,874 @@
+/*  cryptodev_test - benchmark driver for cryptodev
+ *
+ *  Runs any algorithm of the module through the synchronous,
+ *  bounce-buffer, registered buffer, asynchronous or
+ *  session-per-operation path, over chunk sizes, thread counts and
+ *  queue depths, and prints throughput, operation rate, cycles per
+ *  byte and latency percentiles as text, CSV or JSON. RSA sized
+ *  modular exponentiations of CIOCKEY, next to OpenSSL's private key
+ *  operation of the same size, misaligned or huge page buffers and the
+ *  placement of async jobs are measured the same way.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <math.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <crypto/cryptodev.h>
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/rsa.h>
+
+#include "benchlib.h"
+
+#define MAX_LIST	64
+/* deepest asynchronous queue, the module's limit */
+#define MAX_DEPTH	4096
+/* room after each buffer for an aead tag */
+#define TAG_ROOM	64
+/* a transparent huge page on most architectures */
+#define HUGE_PAGE	(2 * 1024 * 1024)
+
+enum mode {
+	MODE_SYNC,	/* CIOCCRYPT on user pages */
+	MODE_NOZC,	/* CIOCCRYPT through the bounce buffer */
+	MODE_REGBUF,	/* CIOCCRYPT on a buffer registered with CIOCREGBUF */
+	MODE_ASYNC,	/* CIOCASYNCCRYPT and CIOCASYNCFETCHMANY */
+	MODE_SESSION,	/* a session per operation */
+	MODE_OPENSSL,	/* the rsa algorithms in user space, as a baseline */
+	MODE_MAX
+};
+
+static const char *mode_names[MODE_MAX] = {
+	"sync", "nozc", "regbuf", "async", "session", "openssl"
+};
+
+/* Public key algorithms, run as CIOCKEY modular exponentiations with
+ * an exponent as long as the modulus, which is what a private key
+ * operation without CRT costs. The openssl mode times a raw private key
+ * decryption of a generated key of the same size instead.
+ */
+static const struct {
+	const char *name;
+	int bits;
+} key_algs[] = {
+	{ "rsa-1024", 1024 },
+	{ "rsa-2048", 2048 },
+	{ "rsa-4096", 4096 },
+};
+
+/* the CPU half the machine away from the thread's, which on a two
+ * socket box is on the other node */
+#define AFFINITY_REMOTE	(-100)
+
+/* where async jobs run, relative to the submitting thread */
+static const struct {
+	const char *name;
+	int affinity;
+} placements[] = {
+	{ "local", CRYPTODEV_AFFINITY_LOCAL },
+	{ "node", CRYPTODEV_AFFINITY_NODE },
+	{ "remote", AFFINITY_REMOTE },
+};
+
+#define ARRAY_SIZE(a)	(sizeof(a) / sizeof((a)[0]))
+
+static struct {
+	struct bench_alg algs[MAX_LIST];
+	int keybits[MAX_LIST]; /* of public key algorithms, else 0 */
+	int nalgs;
+	int modes[MAX_LIST];
+	int nmodes;
+	unsigned int sizes[MAX_LIST], threads[MAX_LIST], depths[MAX_LIST];
+	int nsizes, nthreads, ndepths;
+	int placements[MAX_LIST], nplacements;
+	unsigned int offset;
+	int huge, ncpus;
+	uint64_t duration, warmup; /* ns */
+	unsigned int reps;
+	enum bench_format format;
+	int si;
+} opts;
+
+/* one run of a thread */
+struct worker {
+	pthread_t thread;
+	pthread_barrier_t *barrier;
+	const struct bench_alg *alg;
+	int keybits;
+	enum mode mode;
+	unsigned int size, depth;
+	int cpu, placement; /* -1 for anywhere, and the default */
+
+	int fd;
+	struct session_op sess;
+	struct crypt_kop kop;
+	EVP_PKEY_CTX *pctx;
+	uint8_t *base, *buf, *mac;
+	size_t stride;
+	uint64_t *stamp;
+	unsigned int *slots;
+
+	int ret;
+	double bytes, ops;
+	uint64_t ns, cycles;
+	struct bench_hist hist;
+};
+
+/* one synchronous operation on the buffer */
+static int run_op(struct worker *w, uint8_t *buf)
+{
+	size_t outlen = w->size;
+	int flags = 0;
+
+	if (w->mode == MODE_OPENSSL) {
+		if (EVP_PKEY_decrypt(w->pctx, buf + w->size, &outlen, buf,
+				w->size) <= 0) {
+			ERR_print_errors_fp(stderr);
+			return -1;
+		}
+		return 0;
+	}
+
+	if (w->keybits) {
+		if (ioctl(w->fd, CIOCKEY, &w->kop)) {
+			perror("ioctl(CIOCKEY)");
+			return -1;
+		}
+		return 0;
+	}
+
+	if (w->mode == MODE_NOZC)
+		flags = COP_FLAG_NO_ZC;
+	else if (w->mode == MODE_REGBUF)
+		flags = COP_FLAG_REGBUF;
+
+	if (w->mode == MODE_SESSION &&
+	    bench_session(w->fd, w->alg, &w->sess, NULL))
+		return -1;
+
+	if (bench_crypt(w->fd, w->alg, w->sess.ses, buf, w->mac, w->size,
+			flags))
+		return -1;
+
+	if (w->mode == MODE_SESSION && ioctl(w->fd, CIOCFSESSION, &w->sess.ses)) {
+		perror("ioctl(CIOCFSESSION)");
+		return -1;
+	}
+	return 0;
+}
+
+static int run_sync(struct worker *w, uint64_t until, int record)
+{
+	uint64_t start, end;
+
+	do {
+		start = bench_ns();
+		if (run_op(w, w->buf))
+			return -1;
+		end = bench_ns();
+		if (record) {
+			bench_hist_add(&w->hist, end - start);
+			w->bytes += w->size;
+			w->ops++;
+		}
+	} while (end < until);
+	return 0;
+}
+
+#ifdef ENABLE_ASYNC
+/* keep depth jobs in flight until the deadline, then drain the queue;
+ * the latency of a job is from submission to its fetch */
+static int run_async(struct worker *w, uint64_t until, int record)
+{
+	struct crypt_op cop, done[64];
+	struct crypt_fetch_op fop;
+	unsigned int nfree = w->depth, inflight = 0, i, slot;
+	uint8_t iv[EALG_MAX_BLOCK_LEN];
+	int32_t results[64];
+	struct pollfd pfd;
+	uint64_t now;
+
+	memset(iv, 0x23, sizeof(iv));
+	for (i = 0; i < w->depth; i++)
+		w->slots[i] = i;
+
+	for (;;) {
+		now = bench_ns();
+		while (nfree && now < until) {
+			slot = w->slots[--nfree];
+			memset(&cop, 0, sizeof(cop));
+			cop.ses = w->sess.ses;
+			cop.op = COP_ENCRYPT;
+			cop.len = w->size;
+			cop.src = w->buf + slot * w->stride;
+			if (w->alg->cipher) {
+				cop.dst = cop.src;
+				cop.iv = iv;
+			}
+			if (w->alg->mac)
+				cop.mac = w->mac + slot * AALG_MAX_RESULT_LEN;
+			w->stamp[slot] = now;
+			if (ioctl(w->fd, CIOCASYNCCRYPT, &cop)) {
+				nfree++;
+				if (errno == EBUSY)
+					break;
+				perror("ioctl(CIOCASYNCCRYPT)");
+				return -1;
+			}
+			inflight++;
+		}
+		if (!inflight)
+			return 0;
+
+		memset(&fop, 0, sizeof(fop));
+		fop.count = inflight < 64 ? inflight : 64;
+		fop.cops = done;
+		fop.results = results;
+		if (ioctl(w->fd, CIOCASYNCFETCHMANY, &fop)) {
+			if (errno != EBUSY) {
+				perror("ioctl(CIOCASYNCFETCHMANY)");
+				return -1;
+			}
+			pfd.fd = w->fd;
+			pfd.events = POLLIN;
+			if (poll(&pfd, 1, 1000) < 0 && errno != EINTR) {
+				perror("poll()");
+				return -1;
+			}
+			continue;
+		}
+
+		now = bench_ns();
+		for (i = 0; i < fop.count; i++) {
+			if (results[i]) {
+				fprintf(stderr, "job failed: %s\n", strerror(-results[i]));
+				return -1;
+			}
+			slot = (done[i].src - w->buf) / w->stride;
+			w->slots[nfree++] = slot;
+			if (record) {
+				bench_hist_add(&w->hist, now - w->stamp[slot]);
+				w->bytes += done[i].len;
+				w->ops++;
+			}
+		}
+		inflight -= fop.count;
+	}
+}
+#endif
+
+/* base, exponent, modulus and room for the result of a CIOCKEY
+ * operation, little endian: any odd modulus will do, and numbers with
+ * the top bit clear are below it */
+static int key_setup(struct worker *w)
+{
+	unsigned int bytes = w->keybits / 8, seed = 1, i;
+	uint32_t features;
+
+	if (ioctl(w->fd, CIOCASYMFEAT, &features)) {
+		perror("ioctl(CIOCASYMFEAT)");
+		return -1;
+	}
+	if (!(features & CRF_MOD_EXP)) {
+		fprintf(stderr, "%s: no modular exponentiation here\n", w->alg->name);
+		return -1;
+	}
+
+	w->buf = w->base = malloc(4 * bytes);
+	if (!w->buf)
+		return -1;
+	for (i = 0; i < 3 * bytes; i++)
+		w->buf[i] = rand_r(&seed);
+	w->buf[bytes - 1] &= 0x7f;
+	w->buf[2 * bytes - 1] &= 0x7f;
+	w->buf[2 * bytes] |= 1;
+	w->buf[3 * bytes - 1] |= 0x80;
+
+	memset(&w->kop, 0, sizeof(w->kop));
+	w->kop.crk_op = CRK_MOD_EXP;
+	w->kop.crk_iparams = 3;
+	w->kop.crk_oparams = 1;
+	for (i = 0; i < 4; i++) {
+		w->kop.crk_param[i].crp_p = w->buf + i * bytes;
+		w->kop.crk_param[i].crp_nbits = w->keybits;
+	}
+	return 0;
+}
+
+/* a key of keybits and a number below its modulus, big endian, for
+ * unpadded private key operations; key generation is not timed */
+static int openssl_setup(struct worker *w)
+{
+	unsigned int bytes = w->keybits / 8, seed = 1, i;
+	EVP_PKEY_CTX *kctx;
+	EVP_PKEY *pkey = NULL;
+
+	kctx = EVP_PKEY_CTX_new_id(EVP_PKEY_RSA, NULL);
+	if (!kctx || EVP_PKEY_keygen_init(kctx) <= 0 ||
+	    EVP_PKEY_CTX_set_rsa_keygen_bits(kctx, w->keybits) <= 0 ||
+	    EVP_PKEY_keygen(kctx, &pkey) <= 0) {
+		ERR_print_errors_fp(stderr);
+		EVP_PKEY_CTX_free(kctx);
+		return -1;
+	}
+	EVP_PKEY_CTX_free(kctx);
+
+	w->pctx = EVP_PKEY_CTX_new(pkey, NULL);
+	EVP_PKEY_free(pkey);
+	if (!w->pctx || EVP_PKEY_decrypt_init(w->pctx) <= 0 ||
+	    EVP_PKEY_CTX_set_rsa_padding(w->pctx, RSA_NO_PADDING) <= 0) {
+		ERR_print_errors_fp(stderr);
+		return -1;
+	}
+
+	w->buf = w->base = malloc(2 * bytes);
+	if (!w->buf)
+		return -1;
+	for (i = 0; i < bytes; i++)
+		w->buf[i] = rand_r(&seed);
+	w->buf[0] &= 0x7f;
+	return 0;
+}
+
+/* count buffers of len bytes, opts.offset bytes past their alignment;
+ * with opts.huge they start on huge pages, which the kernel backs with
+ * one if it has one to spare */
+static int buf_alloc(struct worker *w, size_t len, unsigned int count,
+		int alignmask)
+{
+	size_t size;
+
+	len += opts.offset;
+	if (!opts.huge) {
+		w->base = bench_alloc(len, count, alignmask, &w->stride);
+		if (!w->base)
+			return -1;
+		w->buf = w->base + opts.offset;
+		return 0;
+	}
+
+	w->stride = (len + HUGE_PAGE - 1) / HUGE_PAGE * HUGE_PAGE;
+	size = w->stride * count;
+	if (posix_memalign((void **)&w->base, HUGE_PAGE, size)) {
+		fprintf(stderr, "posix_memalign() failed! (size: %zu)\n", size);
+		return -1;
+	}
+#ifdef MADV_HUGEPAGE
+	madvise(w->base, size, MADV_HUGEPAGE);
+#endif
+	memset(w->base, 0x23, size);
+	w->buf = w->base + opts.offset;
+	return 0;
+}
+
+static int worker_setup(struct worker *w)
+{
+	unsigned int nbufs = w->mode == MODE_ASYNC ? w->depth : 1;
+	struct crypt_regbuf_op rop;
+	int alignmask = 0, affinity;
+	uint32_t depth;
+	cpu_set_t set;
+
+	if (w->mode == MODE_OPENSSL)
+		return openssl_setup(w);
+
+	if (w->cpu >= 0) {
+		CPU_ZERO(&set);
+		CPU_SET(w->cpu, &set);
+		if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set)) {
+			fprintf(stderr, "cannot bind to CPU %d\n", w->cpu);
+			return -1;
+		}
+	}
+
+	w->fd = open("/dev/crypto", O_RDWR, 0);
+	if (w->fd < 0) {
+		perror("open(/dev/crypto)");
+		return -1;
+	}
+
+	if (w->keybits)
+		return key_setup(w);
+
+	/* a throwaway session tells the alignment */
+	if (bench_session(w->fd, w->alg, &w->sess, &alignmask))
+		return -1;
+	if (w->mode == MODE_SESSION && ioctl(w->fd, CIOCFSESSION, &w->sess.ses)) {
+		perror("ioctl(CIOCFSESSION)");
+		return -1;
+	}
+
+	w->mac = calloc(nbufs, AALG_MAX_RESULT_LEN);
+	if (buf_alloc(w, w->size + TAG_ROOM, nbufs, alignmask) || !w->mac)
+		return -1;
+
+	/* unregistered when the descriptor is closed */
+	if (w->mode == MODE_REGBUF) {
+		memset(&rop, 0, sizeof(rop));
+		rop.addr = w->base;
+		rop.len = w->stride * nbufs;
+		if (ioctl(w->fd, CIOCREGBUF, &rop)) {
+			perror("ioctl(CIOCREGBUF)");
+			return -1;
+		}
+	}
+
+	if (w->mode == MODE_ASYNC) {
+		w->stamp = calloc(nbufs, sizeof(*w->stamp));
+		w->slots = calloc(nbufs, sizeof(*w->slots));
+		if (!w->stamp || !w->slots)
+			return -1;
+		depth = w->depth;
+		if (ioctl(w->fd, CIOCASYNCDEPTH, &depth)) {
+			perror("ioctl(CIOCASYNCDEPTH)");
+			return -1;
+		}
+	}
+
+	if (w->placement >= 0) {
+		affinity = placements[w->placement].affinity;
+		if (affinity == AFFINITY_REMOTE)
+			affinity = (w->cpu + opts.ncpus / 2) % opts.ncpus;
+		if (ioctl(w->fd, CIOCASYNCAFFINITY, &affinity)) {
+			perror("ioctl(CIOCASYNCAFFINITY)");
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int worker_loop(struct worker *w, uint64_t until, int record)
+{
+#ifdef ENABLE_ASYNC
+	if (w->mode == MODE_ASYNC)
+		return run_async(w, until, record);
+#endif
+	return run_sync(w, until, record);
+}
+
+static void *worker_routine(void *arg)
+{
+	struct worker *w = arg;
+	uint64_t start;
+
+	w->fd = -1;
+	bench_hist_init(&w->hist);
+	w->ret = worker_setup(w);
+
+	/* a failed thread still takes part in the barriers */
+	pthread_barrier_wait(w->barrier);
+	if (!w->ret && opts.warmup)
+		w->ret = worker_loop(w, bench_ns() + opts.warmup, 0);
+
+	pthread_barrier_wait(w->barrier);
+	if (!w->ret) {
+		start = bench_ns();
+		w->cycles = bench_cycles();
+		w->ret = worker_loop(w, start + opts.duration, 1);
+		w->cycles = bench_cycles() - w->cycles;
+		w->ns = bench_ns() - start;
+	}
+
+	if (w->fd >= 0)
+		close(w->fd);
+	EVP_PKEY_CTX_free(w->pctx);
+	free(w->base);
+	free(w->mac);
+	free(w->stamp);
+	free(w->slots);
+	return NULL;
+}
+
+/* all repetitions of one configuration */
+static int run(const struct bench_alg *alg, int keybits, enum mode mode,
+		unsigned int size, unsigned int nthreads, unsigned int depth,
+		int placement)
+{
+	struct bench_result r;
+	char label[32];
+	pthread_barrier_t barrier;
+	struct worker *w;
+	double sum = 0, sumsq = 0, bytes, secs;
+	unsigned int rep, i;
+	int ret = 0;
+
+	memset(&r, 0, sizeof(r));
+	r.alg = alg->name;
+	r.mode = mode_names[mode];
+	if (placement >= 0) {
+		snprintf(label, sizeof(label), "%s-%s", mode_names[mode],
+				placements[placement].name);
+		r.mode = label;
+	}
+	r.size = size;
+	r.threads = nthreads;
+	r.depth = mode == MODE_ASYNC ? depth : 1;
+	bench_hist_init(&r.hist);
+
+	w = calloc(nthreads, sizeof(*w));
+	if (!w)
+		return -1;
+
+	for (rep = 0; rep < opts.reps && !ret; rep++) {
+		pthread_barrier_init(&barrier, NULL, nthreads);
+		memset(w, 0, nthreads * sizeof(*w));
+		for (i = 0; i < nthreads; i++) {
+			w[i].barrier = &barrier;
+			w[i].alg = alg;
+			w[i].keybits = keybits;
+			w[i].mode = mode;
+			w[i].size = size;
+			w[i].depth = r.depth;
+			/* placements are relative to the thread's CPU */
+			w[i].cpu = placement >= 0 ? i % opts.ncpus : -1;
+			w[i].placement = placement;
+			if (pthread_create(&w[i].thread, NULL, worker_routine, &w[i])) {
+				perror("pthread_create()");
+				exit(1);
+			}
+		}
+
+		bytes = secs = 0;
+		for (i = 0; i < nthreads; i++) {
+			pthread_join(w[i].thread, NULL);
+			if (w[i].ret)
+				ret = -1;
+			bytes += w[i].bytes;
+			r.ops += w[i].ops;
+			r.cycles += w[i].cycles;
+			if (w[i].ns / 1e9 > secs)
+				secs = w[i].ns / 1e9;
+			bench_hist_merge(&r.hist, &w[i].hist);
+		}
+		pthread_barrier_destroy(&barrier);
+
+		r.bytes += bytes;
+		r.secs += secs;
+		if (secs) {
+			sum += bytes / secs / 1e6;
+			sumsq += (bytes / secs / 1e6) * (bytes / secs / 1e6);
+		}
+	}
+	free(w);
+
+	if (ret || !r.secs)
+		return -1;
+
+	r.reps = opts.reps;
+	r.mbps = sum / opts.reps;
+	if (opts.reps > 1)
+		r.mbps_stddev = sqrt(fabs(sumsq - sum * sum / opts.reps) /
+				(opts.reps - 1));
+	bench_report(stdout, opts.format, opts.si, &r);
+	return 0;
+}
+
+static void usage(FILE *fp)
+{
+	fprintf(fp, "Usage: bench [options]\n"
+		"  -a, --alg LIST      algorithms, or \"all\" (null,aes-128-cbc)\n"
+		"  -m, --mode LIST     sync, nozc, regbuf, async, session, openssl\n"
+		"                      or \"all\" (sync); rsa runs openssl after sync\n"
+		"  -s, --size LIST     chunk sizes, as 512,4096 or 512:65536 (512:65536)\n"
+		"  -t, --threads LIST  threads, each with its own descriptor (1)\n"
+		"  -d, --depth LIST    jobs in flight per thread in async mode (64)\n"
+		"  -A, --affinity LIST where async jobs run: local, node or remote to\n"
+		"                      the thread, each bound to a CPU (the default)\n"
+		"  -o, --offset BYTES  start buffers this far past their alignment (0)\n"
+		"  -H, --hugepages     put buffers on transparent huge pages\n"
+		"  -T, --time SECS     measured time of a run (5)\n"
+		"  -w, --warmup SECS   unmeasured time before a run (0)\n"
+		"  -r, --reps N        repetitions of a run (1)\n"
+		"  -f, --format FMT    text, csv or json (text)\n"
+		"      --kib           binary units in text output\n"
+		"  -l, --list          list the algorithms\n");
+}
+
+static void list_algs(FILE *fp)
+{
+	unsigned int i;
+
+	bench_alg_list(fp);
+	for (i = 0; i < ARRAY_SIZE(key_algs); i++)
+		fprintf(fp, "\t%s\n", key_algs[i].name);
+}
+
+static int parse_algs(char *arg)
+{
+	const struct bench_alg *a;
+	unsigned int i;
+	char *name;
+
+	opts.nalgs = 0;
+	for (name = strtok(arg, ","); name; name = strtok(NULL, ",")) {
+		if (!strcmp(name, "all")) {
+			for (a = bench_algs; a->name && opts.nalgs < MAX_LIST; a++) {
+				opts.keybits[opts.nalgs] = 0;
+				opts.algs[opts.nalgs++] = *a;
+			}
+			continue;
+		}
+		for (i = 0; i < ARRAY_SIZE(key_algs); i++)
+			if (!strcmp(name, key_algs[i].name))
+				break;
+		if (i < ARRAY_SIZE(key_algs) && opts.nalgs < MAX_LIST) {
+			memset(&opts.algs[opts.nalgs], 0, sizeof(opts.algs[0]));
+			opts.algs[opts.nalgs].name = key_algs[i].name;
+			opts.keybits[opts.nalgs++] = key_algs[i].bits;
+			continue;
+		}
+		opts.keybits[opts.nalgs] = 0;
+		if (opts.nalgs == MAX_LIST ||
+		    bench_alg_parse(name, &opts.algs[opts.nalgs])) {
+			fprintf(stderr, "unknown algorithm %s\n", name);
+			return -1;
+		}
+		opts.nalgs++;
+	}
+	return opts.nalgs ? 0 : -1;
+}
+
+static int mode_selected(int mode)
+{
+	int m;
+
+	for (m = 0; m < opts.nmodes; m++)
+		if (opts.modes[m] == mode)
+			return 1;
+	return 0;
+}
+
+static int parse_modes(char *arg)
+{
+	char *name;
+	int m;
+
+	opts.nmodes = 0;
+	for (name = strtok(arg, ","); name; name = strtok(NULL, ",")) {
+		if (!strcmp(name, "all")) {
+			for (m = 0; m < MODE_MAX && opts.nmodes < MAX_LIST; m++)
+				opts.modes[opts.nmodes++] = m;
+			continue;
+		}
+		for (m = 0; m < MODE_MAX; m++)
+			if (!strcmp(name, mode_names[m]))
+				break;
+		if (m == MODE_MAX || opts.nmodes == MAX_LIST) {
+			fprintf(stderr, "unknown mode %s\n", name);
+			return -1;
+		}
+		opts.modes[opts.nmodes++] = m;
+	}
+	return opts.nmodes ? 0 : -1;
+}
+
+static int parse_placements(char *arg)
+{
+	unsigned int p;
+	char *name;
+
+	opts.nplacements = 0;
+	for (name = strtok(arg, ","); name; name = strtok(NULL, ",")) {
+		for (p = 0; p < ARRAY_SIZE(placements); p++)
+			if (!strcmp(name, placements[p].name))
+				break;
+		if (p == ARRAY_SIZE(placements) || opts.nplacements == MAX_LIST) {
+			fprintf(stderr, "unknown placement %s\n", name);
+			return -1;
+		}
+		opts.placements[opts.nplacements++] = p;
+	}
+	return opts.nplacements ? 0 : -1;
+}
+
+static int parse_list(const char *arg, unsigned int *list, int *n, unsigned int max)
+{
+	int i;
+
+	*n = bench_parse_sizes(arg, list, MAX_LIST);
+	for (i = 0; i < *n; i++)
+		if (list[i] > max)
+			*n = -1;
+	if (*n <= 0) {
+		fprintf(stderr, "invalid list %s\n", arg);
+		return -1;
+	}
+	return 0;
+}
+
+static const struct option long_options[] = {
+	{ "alg", required_argument, NULL, 'a' },
+	{ "mode", required_argument, NULL, 'm' },
+	{ "size", required_argument, NULL, 's' },
+	{ "threads", required_argument, NULL, 't' },
+	{ "depth", required_argument, NULL, 'd' },
+	{ "affinity", required_argument, NULL, 'A' },
+	{ "offset", required_argument, NULL, 'o' },
+	{ "hugepages", no_argument, NULL, 'H' },
+	{ "time", required_argument, NULL, 'T' },
+	{ "warmup", required_argument, NULL, 'w' },
+	{ "reps", required_argument, NULL, 'r' },
+	{ "format", required_argument, NULL, 'f' },
+	{ "kib", no_argument, NULL, 'k' },
+	{ "list", no_argument, NULL, 'l' },
+	{ "help", no_argument, NULL, 'h' },
+	{ NULL, 0, NULL, 0 }
+};
+
+int main(int argc, char **argv)
+{
+	char algs[] = "null,aes-128-cbc", modes[] = "sync";
+	int a, m, s, t, d, p, c, failed = 0;
+
+	parse_algs(algs);
+	parse_modes(modes);
+	parse_list("512:65536", opts.sizes, &opts.nsizes, UINT32_MAX);
+	parse_list("1", opts.threads, &opts.nthreads, 1024);
+	parse_list("64", opts.depths, &opts.ndepths, MAX_DEPTH);
+	opts.duration = 5000000000ULL;
+	opts.reps = 1;
+	opts.si = 1;
+	opts.ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (opts.ncpus < 1)
+		opts.ncpus = 1;
+
+	while ((c = getopt_long(argc, argv, "a:m:s:t:d:A:o:HT:w:r:f:lh",
+				long_options, NULL)) != -1) {
+		switch (c) {
+		case 'a':
+			if (parse_algs(optarg))
+				return 1;
+			break;
+		case 'm':
+			if (parse_modes(optarg))
+				return 1;
+			break;
+		case 's':
+			if (parse_list(optarg, opts.sizes, &opts.nsizes, UINT32_MAX))
+				return 1;
+			break;
+		case 't':
+			if (parse_list(optarg, opts.threads, &opts.nthreads, 1024))
+				return 1;
+			break;
+		case 'd':
+			if (parse_list(optarg, opts.depths, &opts.ndepths, MAX_DEPTH))
+				return 1;
+			break;
+		case 'A':
+			if (parse_placements(optarg))
+				return 1;
+			break;
+		case 'o':
+			opts.offset = atoi(optarg);
+			if (opts.offset > 4096) {
+				fprintf(stderr, "invalid offset %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'H':
+			opts.huge = 1;
+			break;
+		case 'T':
+			opts.duration = atof(optarg) * 1e9;
+			break;
+		case 'w':
+			opts.warmup = atof(optarg) * 1e9;
+			break;
+		case 'r':
+			opts.reps = atoi(optarg);
+			if (opts.reps < 1) {
+				fprintf(stderr, "invalid repetitions %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'f':
+			if (bench_parse_format(optarg, &opts.format)) {
+				fprintf(stderr, "unknown format %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'k':
+			opts.si = 0;
+			break;
+		case 'l':
+			list_algs(stdout);
+			return 0;
+		case 'h':
+			usage(stdout);
+			return 0;
+		default:
+			usage(stderr);
+			return 1;
+		}
+	}
+
+	bench_report_begin(stdout, opts.format);
+	for (a = 0; a < opts.nalgs; a++) {
+		for (m = 0; m < opts.nmodes; m++) {
+			const struct bench_alg *alg = &opts.algs[a];
+			int keybits = opts.keybits[a];
+			int mode = opts.modes[m];
+			int ndepths = mode == MODE_ASYNC ? opts.ndepths : 1;
+			int nplacements = mode == MODE_ASYNC ? opts.nplacements : 0;
+			int nsizes = keybits ? 1 : opts.nsizes;
+
+#ifndef ENABLE_ASYNC
+			if (mode == MODE_ASYNC) {
+				fprintf(stderr, "async mode needs ENABLE_ASYNC\n");
+				continue;
+			}
+#endif
+			if ((alg->aead && mode != MODE_SYNC && mode != MODE_SESSION) ||
+			    (keybits && mode != MODE_SYNC && mode != MODE_OPENSSL) ||
+			    (!keybits && mode == MODE_OPENSSL)) {
+				fprintf(stderr, "%s has no %s mode, skipped\n",
+						alg->name, mode_names[mode]);
+				continue;
+			}
+			for (t = 0; t < opts.nthreads; t++)
+				for (d = 0; d < ndepths; d++)
+					for (p = 0; p < (nplacements ? nplacements : 1); p++)
+						for (s = 0; s < nsizes; s++)
+							if (run(alg, keybits, mode,
+							        keybits ? keybits / 8 : opts.sizes[s],
+							        opts.threads[t], opts.depths[d],
+							        nplacements ? opts.placements[p] : -1))
+								failed = 1;
+			/* the baseline next to CIOCKEY, unless asked for */
+			if (keybits && mode == MODE_SYNC && !mode_selected(MODE_OPENSSL))
+				for (t = 0; t < opts.nthreads; t++)
+					if (run(alg, keybits, MODE_OPENSSL, keybits / 8,
+					        opts.threads[t], 1, -1))
+						failed = 1;
+		}
+	}
+	bench_report_end(stdout, opts.format);
+
+	return failed;
+}
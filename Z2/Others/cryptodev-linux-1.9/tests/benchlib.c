@@ -0,0 +1,479 @@
+/*  cryptodev_test - helpers shared by the benchmarks
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/ioctl.h>
+#if defined(__x86_64__) || defined(__i386__)
+# include <x86intrin.h>
+#endif
+
+#include "benchlib.h"
+
+uint64_t bench_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+uint64_t bench_cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	return 0;
+#endif
+}
+
+void bench_hist_init(struct bench_hist *h)
+{
+	memset(h, 0, sizeof(*h));
+	h->min = UINT64_MAX;
+}
+
+static unsigned int hist_index(uint64_t v)
+{
+	unsigned int e;
+
+	if (v < BENCH_HIST_SUB)
+		return v;
+	e = 63 - __builtin_clzll(v);
+	return BENCH_HIST_SUB * (e - BENCH_HIST_SUB_BITS + 1) +
+		((v >> (e - BENCH_HIST_SUB_BITS)) & (BENCH_HIST_SUB - 1));
+}
+
+/* the middle of the values counted in bucket i */
+static uint64_t hist_value(unsigned int i)
+{
+	unsigned int e, sub;
+
+	if (i < BENCH_HIST_SUB)
+		return i;
+	e = i / BENCH_HIST_SUB + BENCH_HIST_SUB_BITS - 1;
+	sub = i % BENCH_HIST_SUB;
+	return ((uint64_t)(BENCH_HIST_SUB + sub) << (e - BENCH_HIST_SUB_BITS)) +
+		((1ULL << (e - BENCH_HIST_SUB_BITS)) >> 1);
+}
+
+void bench_hist_add(struct bench_hist *h, uint64_t ns)
+{
+	h->bucket[hist_index(ns)]++;
+	h->count++;
+	h->sum += ns;
+	if (ns < h->min)
+		h->min = ns;
+	if (ns > h->max)
+		h->max = ns;
+}
+
+void bench_hist_merge(struct bench_hist *dst, const struct bench_hist *src)
+{
+	unsigned int i;
+
+	if (!src->count)
+		return;
+	for (i = 0; i < BENCH_HIST_BUCKETS; i++)
+		dst->bucket[i] += src->bucket[i];
+	dst->count += src->count;
+	dst->sum += src->sum;
+	if (src->min < dst->min)
+		dst->min = src->min;
+	if (src->max > dst->max)
+		dst->max = src->max;
+}
+
+uint64_t bench_hist_percentile(const struct bench_hist *h, double pct)
+{
+	uint64_t seen = 0, want;
+	unsigned int i;
+
+	if (!h->count)
+		return 0;
+	want = (uint64_t)(pct / 100 * h->count + 0.5);
+	if (want < 1)
+		want = 1;
+	for (i = 0; i < BENCH_HIST_BUCKETS; i++) {
+		seen += h->bucket[i];
+		if (seen >= want)
+			break;
+	}
+	/* never beyond what was seen */
+	if (hist_value(i) > h->max)
+		return h->max;
+	if (hist_value(i) < h->min)
+		return h->min;
+	return hist_value(i);
+}
+
+void bench_hist_print(FILE *fp, const struct bench_hist *h, const char *label)
+{
+	uint64_t seen = 0;
+	unsigned int i;
+
+	fprintf(fp, "# %s\n# %12s %12s %12s\n", label, "value_ns",
+			"percentile", "count");
+	for (i = 0; i < BENCH_HIST_BUCKETS; i++) {
+		if (!h->bucket[i])
+			continue;
+		seen += h->bucket[i];
+		fprintf(fp, "  %12llu %12.6f %12llu\n",
+				(unsigned long long)hist_value(i),
+				(double)seen / h->count,
+				(unsigned long long)seen);
+	}
+}
+
+static char *units[] = { "", "Ki", "Mi", "Gi", "Ti", 0};
+static char *si_units[] = { "", "K", "M", "G", "T", 0};
+
+void value2human(int si, double bytes, double time, double *data,
+		double *speed, char *metric)
+{
+	int unit = 0;
+
+	*data = bytes;
+
+	if (si) {
+		while (*data > 1000 && si_units[unit + 1]) {
+			*data /= 1000;
+			unit++;
+		}
+		*speed = *data / time;
+		sprintf(metric, "%sB", si_units[unit]);
+	} else {
+		while (*data > 1024 && units[unit + 1]) {
+			*data /= 1024;
+			unit++;
+		}
+		*speed = *data / time;
+		sprintf(metric, "%sB", units[unit]);
+	}
+}
+
+/* everything crypto_create_session() of the module knows */
+const struct bench_alg bench_algs[] = {
+	{ "null", CRYPTO_NULL, 0, 0, 0, 0 },
+	{ "des-cbc", CRYPTO_DES_CBC, 0, 8, 0, 0 },
+	{ "3des-cbc", CRYPTO_3DES_CBC, 0, 24, 0, 0 },
+	{ "blowfish-cbc", CRYPTO_BLF_CBC, 0, 16, 0, 0 },
+	{ "aes-128-cbc", CRYPTO_AES_CBC, 0, 16, 0, 0 },
+	{ "aes-192-cbc", CRYPTO_AES_CBC, 0, 24, 0, 0 },
+	{ "aes-256-cbc", CRYPTO_AES_CBC, 0, 32, 0, 0 },
+	{ "aes-128-ecb", CRYPTO_AES_ECB, 0, 16, 0, 0 },
+	{ "aes-256-ecb", CRYPTO_AES_ECB, 0, 32, 0, 0 },
+	{ "camellia-128-cbc", CRYPTO_CAMELLIA_CBC, 0, 16, 0, 0 },
+	{ "camellia-256-cbc", CRYPTO_CAMELLIA_CBC, 0, 32, 0, 0 },
+	{ "aes-128-ctr", CRYPTO_AES_CTR, 0, 16, 0, 0 },
+	{ "aes-256-ctr", CRYPTO_AES_CTR, 0, 32, 0, 0 },
+	{ "aes-128-gcm", CRYPTO_AES_GCM, 0, 16, 0, 1 },
+	{ "aes-256-gcm", CRYPTO_AES_GCM, 0, 32, 0, 1 },
+	{ "md5", 0, CRYPTO_MD5, 0, 0, 0 },
+	{ "rmd160", 0, CRYPTO_RIPEMD160, 0, 0, 0 },
+	{ "sha1", 0, CRYPTO_SHA1, 0, 0, 0 },
+	{ "sha224", 0, CRYPTO_SHA2_224, 0, 0, 0 },
+	{ "sha256", 0, CRYPTO_SHA2_256, 0, 0, 0 },
+	{ "sha384", 0, CRYPTO_SHA2_384, 0, 0, 0 },
+	{ "sha512", 0, CRYPTO_SHA2_512, 0, 0, 0 },
+	{ "hmac-md5", 0, CRYPTO_MD5_HMAC, 0, 16, 0 },
+	{ "hmac-rmd160", 0, CRYPTO_RIPEMD160_HMAC, 0, 20, 0 },
+	{ "hmac-sha1", 0, CRYPTO_SHA1_HMAC, 0, 20, 0 },
+	{ "hmac-sha224", 0, CRYPTO_SHA2_224_HMAC, 0, 28, 0 },
+	{ "hmac-sha256", 0, CRYPTO_SHA2_256_HMAC, 0, 32, 0 },
+	{ "hmac-sha384", 0, CRYPTO_SHA2_384_HMAC, 0, 48, 0 },
+	{ "hmac-sha512", 0, CRYPTO_SHA2_512_HMAC, 0, 64, 0 },
+	{ NULL, 0, 0, 0, 0, 0 }
+};
+
+static const struct bench_alg *alg_find(const char *name, size_t len)
+{
+	const struct bench_alg *a;
+
+	for (a = bench_algs; a->name; a++)
+		if (strlen(a->name) == len && !strncmp(a->name, name, len))
+			return a;
+	return NULL;
+}
+
+int bench_alg_parse(const char *name, struct bench_alg *alg)
+{
+	const char *plus = strchr(name, '+');
+	const struct bench_alg *c, *h;
+
+	if (!plus) {
+		c = alg_find(name, strlen(name));
+		if (!c)
+			return -1;
+		*alg = *c;
+		return 0;
+	}
+
+	/* a cipher and a hash in one session */
+	c = alg_find(name, plus - name);
+	h = alg_find(plus + 1, strlen(plus + 1));
+	if (!c || !h || !c->cipher || c->aead || !h->mac)
+		return -1;
+	*alg = *c;
+	alg->name = name;
+	alg->mac = h->mac;
+	alg->mackeylen = h->mackeylen;
+	return 0;
+}
+
+void bench_alg_list(FILE *fp)
+{
+	const struct bench_alg *a;
+
+	for (a = bench_algs; a->name; a++)
+		fprintf(fp, "\t%s\n", a->name);
+	fprintf(fp, "\tcipher+hash, e.g. aes-128-cbc+sha1\n");
+}
+
+int bench_session(int fdc, const struct bench_alg *alg,
+		struct session_op *sess, int *alignmask)
+{
+	uint8_t key[CRYPTO_CIPHER_MAX_KEY_LEN], mackey[64];
+#ifdef CIOCGSESSINFO
+	struct session_info_op siop;
+#endif
+
+	memset(key, 0x42, sizeof(key));
+	memset(mackey, 0x23, sizeof(mackey));
+
+	memset(sess, 0, sizeof(*sess));
+	sess->cipher = alg->cipher;
+	sess->keylen = alg->keylen;
+	sess->key = key;
+	sess->mac = alg->mac;
+	sess->mackeylen = alg->mackeylen;
+	sess->mackey = mackey;
+	if (ioctl(fdc, CIOCGSESSION, sess)) {
+		perror("ioctl(CIOCGSESSION)");
+		return -1;
+	}
+
+	if (!alignmask)
+		return 0;
+	*alignmask = 0;
+#ifdef CIOCGSESSINFO
+	siop.ses = sess->ses;
+	if (ioctl(fdc, CIOCGSESSINFO, &siop)) {
+		perror("ioctl(CIOCGSESSINFO)");
+		ioctl(fdc, CIOCFSESSION, &sess->ses);
+		return -1;
+	}
+	*alignmask = siop.alignmask;
+#endif
+	return 0;
+}
+
+int bench_crypt(int fdc, const struct bench_alg *alg, uint32_t ses,
+		uint8_t *buf, uint8_t *mac, unsigned int len, int flags)
+{
+	uint8_t iv[EALG_MAX_BLOCK_LEN];
+	struct crypt_auth_op caop;
+	struct crypt_op cop;
+
+	memset(iv, 0x23, sizeof(iv));
+
+	if (alg->aead) {
+		memset(&caop, 0, sizeof(caop));
+		caop.ses = ses;
+		caop.op = COP_ENCRYPT;
+		caop.flags = flags;
+		caop.len = len;
+		caop.src = caop.dst = buf;
+		caop.iv = iv;
+		caop.iv_len = 12;
+		if (ioctl(fdc, CIOCAUTHCRYPT, &caop)) {
+			perror("ioctl(CIOCAUTHCRYPT)");
+			return -1;
+		}
+		return 0;
+	}
+
+	memset(&cop, 0, sizeof(cop));
+	cop.ses = ses;
+	cop.op = COP_ENCRYPT;
+	cop.flags = flags;
+	cop.len = len;
+	cop.src = buf;
+	if (alg->cipher) {
+		cop.dst = buf;
+		cop.iv = iv;
+	}
+	if (alg->mac)
+		cop.mac = mac;
+	if (ioctl(fdc, CIOCCRYPT, &cop)) {
+		perror("ioctl(CIOCCRYPT)");
+		return -1;
+	}
+	return 0;
+}
+
+#define CACHE_LINE	64
+
+void *bench_alloc(size_t len, unsigned int count, int alignmask,
+		size_t *stride)
+{
+	size_t align = alignmask + 1 > CACHE_LINE ? alignmask + 1 : CACHE_LINE;
+	void *p;
+
+	*stride = (len + align - 1) / align * align;
+	if (posix_memalign(&p, align, *stride * count)) {
+		fprintf(stderr, "posix_memalign() failed! (align %zu, size: %zu)\n",
+				align, *stride * count);
+		return NULL;
+	}
+	memset(p, 0x23, *stride * count);
+	return p;
+}
+
+int bench_parse_sizes(const char *arg, unsigned int *sizes, int max)
+{
+	unsigned long from, to;
+	char *end;
+	int n = 0;
+
+	from = strtoul(arg, &end, 0);
+	if (*end == ':') {
+		to = strtoul(end + 1, &end, 0);
+		if (*end || !from || to < from)
+			return -1;
+		for (; from <= to && n < max; from *= 2)
+			sizes[n++] = from;
+		return n;
+	}
+
+	for (;;) {
+		if (!from || from > UINT32_MAX || n == max)
+			return -1;
+		sizes[n++] = from;
+		if (!*end)
+			return n;
+		if (*end != ',')
+			return -1;
+		from = strtoul(end + 1, &end, 0);
+	}
+}
+
+int bench_parse_format(const char *arg, enum bench_format *format)
+{
+	if (!strcmp(arg, "text"))
+		*format = BENCH_TEXT;
+	else if (!strcmp(arg, "csv"))
+		*format = BENCH_CSV;
+	else if (!strcmp(arg, "json"))
+		*format = BENCH_JSON;
+	else
+		return -1;
+	return 0;
+}
+
+static int json_rows;
+
+void bench_report_begin(FILE *fp, enum bench_format format)
+{
+	switch (format) {
+	case BENCH_CSV:
+		fprintf(fp, "alg,mode,size,threads,depth,reps,secs,bytes,ops,"
+			"mb_per_sec,mb_per_sec_stddev,ops_per_sec,cycles_per_byte,"
+			"lat_mean_ns,lat_p50_ns,lat_p90_ns,lat_p99_ns,lat_p999_ns,"
+			"lat_max_ns\n");
+		break;
+	case BENCH_JSON:
+		fprintf(fp, "[");
+		json_rows = 0;
+		break;
+	default:
+		break;
+	}
+}
+
+void bench_report(FILE *fp, enum bench_format format, int si,
+		const struct bench_result *r)
+{
+	const struct bench_hist *h = &r->hist;
+	double cpb = r->cycles && r->bytes ? r->cycles / r->bytes : 0;
+	double mean = h->count ? h->sum / h->count : 0;
+	double ddata, dspeed;
+	char metric[16];
+
+	switch (format) {
+	case BENCH_TEXT:
+		value2human(si, r->bytes, r->secs, &ddata, &dspeed, metric);
+		fprintf(fp, "%-20s %-14s %7u B x%-3u: %9.2f %s/sec",
+			r->alg, r->mode, r->size, r->threads, dspeed, metric);
+		if (r->reps > 1)
+			fprintf(fp, " (+-%.1f%%)", r->mbps ?
+				100 * r->mbps_stddev / r->mbps : 0);
+		fprintf(fp, ", %9.0f ops/sec", r->ops / r->secs);
+		if (cpb)
+			fprintf(fp, ", %6.2f cycles/B", cpb);
+		fprintf(fp, ", p50 %.1f p99 %.1f p99.9 %.1f max %.1f us\n",
+			bench_hist_percentile(h, 50) / 1000.0,
+			bench_hist_percentile(h, 99) / 1000.0,
+			bench_hist_percentile(h, 99.9) / 1000.0,
+			h->max / 1000.0);
+		break;
+	case BENCH_CSV:
+		fprintf(fp, "%s,%s,%u,%u,%u,%u,%.6f,%.0f,%.0f,%.3f,%.3f,%.1f,%.4f,"
+			"%.0f,%llu,%llu,%llu,%llu,%llu\n",
+			r->alg, r->mode, r->size, r->threads, r->depth, r->reps,
+			r->secs, r->bytes, r->ops, r->mbps, r->mbps_stddev,
+			r->ops / r->secs, cpb, mean,
+			(unsigned long long)bench_hist_percentile(h, 50),
+			(unsigned long long)bench_hist_percentile(h, 90),
+			(unsigned long long)bench_hist_percentile(h, 99),
+			(unsigned long long)bench_hist_percentile(h, 99.9),
+			(unsigned long long)h->max);
+		break;
+	case BENCH_JSON:
+		fprintf(fp, "%s\n  {\"alg\": \"%s\", \"mode\": \"%s\", \"size\": %u, "
+			"\"threads\": %u, \"depth\": %u, \"reps\": %u, "
+			"\"secs\": %.6f, \"bytes\": %.0f, \"ops\": %.0f, "
+			"\"mb_per_sec\": %.3f, \"mb_per_sec_stddev\": %.3f, "
+			"\"ops_per_sec\": %.1f, ",
+			json_rows++ ? "," : "",
+			r->alg, r->mode, r->size, r->threads, r->depth, r->reps,
+			r->secs, r->bytes, r->ops, r->mbps, r->mbps_stddev,
+			r->ops / r->secs);
+		if (cpb)
+			fprintf(fp, "\"cycles_per_byte\": %.4f, ", cpb);
+		else
+			fprintf(fp, "\"cycles_per_byte\": null, ");
+		fprintf(fp, "\"latency_ns\": {\"mean\": %.0f, \"p50\": %llu, "
+			"\"p90\": %llu, \"p99\": %llu, \"p99.9\": %llu, "
+			"\"max\": %llu}}",
+			mean,
+			(unsigned long long)bench_hist_percentile(h, 50),
+			(unsigned long long)bench_hist_percentile(h, 90),
+			(unsigned long long)bench_hist_percentile(h, 99),
+			(unsigned long long)bench_hist_percentile(h, 99.9),
+			(unsigned long long)h->max);
+		break;
+	}
+	fflush(fp);
+}
+
+void bench_report_end(FILE *fp, enum bench_format format)
+{
+	if (format == BENCH_JSON)
+		fprintf(fp, "\n]\n");
+}
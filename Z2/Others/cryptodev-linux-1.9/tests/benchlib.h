@@ -0,0 +1,115 @@
+/*  cryptodev_test - helpers shared by the benchmarks
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#ifndef BENCHLIB_H
+# define BENCHLIB_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <crypto/cryptodev.h>
+
+/* monotonic nanoseconds */
+uint64_t bench_ns(void);
+
+/* the time stamp counter, 0 where there is none */
+uint64_t bench_cycles(void);
+
+/* Latency histogram: values below BENCH_HIST_SUB are exact, larger
+ * ones are kept with BENCH_HIST_SUB steps per power of two, i.e.
+ * within about 3%.
+ */
+#define BENCH_HIST_SUB_BITS	5
+#define BENCH_HIST_SUB		(1 << BENCH_HIST_SUB_BITS)
+#define BENCH_HIST_BUCKETS	(BENCH_HIST_SUB * (64 - BENCH_HIST_SUB_BITS + 1))
+
+struct bench_hist {
+	uint64_t count, min, max;
+	double sum;
+	uint64_t bucket[BENCH_HIST_BUCKETS];
+};
+
+void bench_hist_init(struct bench_hist *h);
+void bench_hist_add(struct bench_hist *h, uint64_t ns);
+void bench_hist_merge(struct bench_hist *dst, const struct bench_hist *src);
+/* the value below which pct percent of the samples are */
+uint64_t bench_hist_percentile(const struct bench_hist *h, double pct);
+/* the cumulative distribution, a line per bucket in use, for plotting */
+void bench_hist_print(FILE *fp, const struct bench_hist *h, const char *label);
+
+/* scale bytes to SI (si) or binary units for printing */
+void value2human(int si, double bytes, double time, double *data,
+		double *speed, char *metric);
+
+/* An algorithm, or a cipher and a hash, as accepted by CIOCGSESSION.
+ * aead ones run with CIOCAUTHCRYPT.
+ */
+struct bench_alg {
+	const char *name;
+	int cipher, mac;
+	int keylen, mackeylen;
+	int aead;
+};
+
+extern const struct bench_alg bench_algs[];
+
+/* look up name, or "cipher+hash" for a combined session, into alg */
+int bench_alg_parse(const char *name, struct bench_alg *alg);
+void bench_alg_list(FILE *fp);
+
+/* open a session for alg with fixed keys; the alignment mask is
+ * returned in alignmask if not NULL */
+int bench_session(int fdc, const struct bench_alg *alg,
+		struct session_op *sess, int *alignmask);
+
+/* one synchronous encryption of len bytes of buf in place, the digest
+ * going to mac, of AALG_MAX_RESULT_LEN bytes; aead ones need room for
+ * the tag after buf */
+int bench_crypt(int fdc, const struct bench_alg *alg, uint32_t ses,
+		uint8_t *buf, uint8_t *mac, unsigned int len, int flags);
+
+/* count buffers of len bytes, each aligned to alignmask and to the
+ * cache line, in one allocation; the stride between them is stored */
+void *bench_alloc(size_t len, unsigned int count, int alignmask,
+		size_t *stride);
+
+/* parse a list of sizes "512,4096" or a doubling range "512:65536" */
+int bench_parse_sizes(const char *arg, unsigned int *sizes, int max);
+
+/* One line of results. Throughput is in SI megabytes, the latencies
+ * are of single operations.
+ */
+struct bench_result {
+	const char *alg, *mode;
+	unsigned int size, threads, depth, reps;
+	double secs, bytes, ops;
+	double mbps, mbps_stddev;
+	double cycles; /* 0 if not known */
+	struct bench_hist hist;
+};
+
+enum bench_format {
+	BENCH_TEXT,
+	BENCH_CSV,
+	BENCH_JSON,
+};
+
+int bench_parse_format(const char *arg, enum bench_format *format);
+void bench_report_begin(FILE *fp, enum bench_format format);
+void bench_report(FILE *fp, enum bench_format format, int si,
+		const struct bench_result *r);
+void bench_report_end(FILE *fp, enum bench_format format);
+
+#endif /* BENCHLIB_H */
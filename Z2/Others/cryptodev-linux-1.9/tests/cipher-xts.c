@@ -0,0 +1,182 @@
+/*
+ * Check AES-XTS requests larger than the bounce buffer and the
+ * combined session slices against OpenSSL: xts does not carry its
+ * tweak from one piece of a request to the next, so a request that is
+ * split comes out wrong.
+ *
+ * Placed under public domain.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/ioctl.h>
+#include <openssl/evp.h>
+#include <crypto/cryptodev.h>
+
+static int debug = 0;
+
+/* more than the 64 KiB bounce buffer and the 16 KiB slices */
+#define	DATA_SIZE	(256 * 1024 + 48)
+#define	BLOCK_SIZE	16
+#define	KEY_SIZE	32
+
+static uint8_t key[KEY_SIZE], tweak[BLOCK_SIZE];
+
+static int
+openssl_xts(int enc, const uint8_t *in, uint8_t *out, int len)
+{
+	EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+	int outl = 0, ok;
+
+	ok = ctx && EVP_CipherInit_ex(ctx, EVP_aes_128_xts(), NULL, key,
+			tweak, enc) &&
+		EVP_CipherUpdate(ctx, out, &outl, in, len) && outl == len;
+	EVP_CIPHER_CTX_free(ctx);
+	return ok ? 0 : -1;
+}
+
+static int
+test_xts(int cfd, int mac, int flags)
+{
+	uint8_t *plaintext, *ciphertext, *expected, *decrypted;
+	uint8_t digest[EVP_MAX_MD_SIZE], mdexpected[EVP_MAX_MD_SIZE];
+	uint8_t iv[BLOCK_SIZE];
+	struct session_op sess;
+	struct crypt_op cryp;
+	int i, ret = 1;
+
+	plaintext = malloc(DATA_SIZE);
+	ciphertext = malloc(DATA_SIZE);
+	expected = malloc(DATA_SIZE);
+	decrypted = malloc(DATA_SIZE);
+	if (!plaintext || !ciphertext || !expected || !decrypted) {
+		fprintf(stderr, "malloc() failed\n");
+		goto out;
+	}
+	for (i = 0; i < DATA_SIZE; i++)
+		plaintext[i] = i * 7;
+
+	if (openssl_xts(1, plaintext, expected, DATA_SIZE)) {
+		fprintf(stderr, "OpenSSL xts failed\n");
+		goto out;
+	}
+
+	memset(&sess, 0, sizeof(sess));
+	sess.cipher = CRYPTO_AES_XTS;
+	sess.keylen = KEY_SIZE;
+	sess.key = key;
+	sess.mac = mac;
+	if (ioctl(cfd, CIOCGSESSION, &sess)) {
+		perror("ioctl(CIOCGSESSION)");
+		goto out;
+	}
+
+	memcpy(iv, tweak, sizeof(iv));
+	memset(&cryp, 0, sizeof(cryp));
+	cryp.ses = sess.ses;
+	cryp.len = DATA_SIZE;
+	cryp.src = plaintext;
+	cryp.dst = ciphertext;
+	cryp.iv = iv;
+	cryp.mac = digest;
+	cryp.op = COP_ENCRYPT;
+	cryp.flags = flags;
+	if (ioctl(cfd, CIOCCRYPT, &cryp)) {
+		perror("ioctl(CIOCCRYPT)");
+		goto out_sess;
+	}
+	if (memcmp(ciphertext, expected, DATA_SIZE) != 0) {
+		fprintf(stderr, "FAIL: xts ciphertext differs from OpenSSL's "
+				"(mac %d, flags %#x)\n", mac, flags);
+		goto out_sess;
+	}
+	if (mac) {
+		/* combined sessions hash the plaintext */
+		if (!EVP_Digest(plaintext, DATA_SIZE, mdexpected, NULL,
+				EVP_sha1(), NULL) ||
+		    memcmp(digest, mdexpected, 20) != 0) {
+			fprintf(stderr, "FAIL: digest differs from OpenSSL's\n");
+			goto out_sess;
+		}
+	}
+
+	memcpy(iv, tweak, sizeof(iv));
+	cryp.src = ciphertext;
+	cryp.dst = decrypted;
+	cryp.op = COP_DECRYPT;
+	if (ioctl(cfd, CIOCCRYPT, &cryp)) {
+		perror("ioctl(CIOCCRYPT)");
+		goto out_sess;
+	}
+	if (memcmp(decrypted, plaintext, DATA_SIZE) != 0) {
+		fprintf(stderr, "FAIL: decrypted data differ\n");
+		goto out_sess;
+	}
+
+	if (debug)
+		printf("%s (mac %d, flags %#x): Test passed\n", __func__, mac, flags);
+	ret = 0;
+
+out_sess:
+	if (ioctl(cfd, CIOCFSESSION, &sess.ses)) {
+		perror("ioctl(CIOCFSESSION)");
+		ret = 1;
+	}
+out:
+	free(plaintext);
+	free(ciphertext);
+	free(expected);
+	free(decrypted);
+	return ret;
+}
+
+int
+main(int argc, char** argv)
+{
+	int fd = -1, cfd = -1, i;
+
+	if (argc > 1) debug = 1;
+
+	for (i = 0; i < KEY_SIZE; i++)
+		key[i] = 0x40 + i;
+	memset(tweak, 0, sizeof(tweak));
+	tweak[0] = 0x11;
+
+	/* Open the crypto device */
+	fd = open("/dev/crypto", O_RDWR, 0);
+	if (fd < 0) {
+		perror("open(/dev/crypto)");
+		return 1;
+	}
+
+	/* Clone file descriptor */
+	if (ioctl(fd, CRIOGET, &cfd)) {
+		perror("ioctl(CRIOGET)");
+		return 1;
+	}
+
+	/* the bounce buffer path, zero copy, and a combined session */
+	if (test_xts(cfd, 0, COP_FLAG_NO_ZC) ||
+	    test_xts(cfd, 0, 0) ||
+	    test_xts(cfd, CRYPTO_SHA1, COP_FLAG_NO_ZC) ||
+	    test_xts(cfd, CRYPTO_SHA1, 0))
+		return 1;
+
+	/* Close cloned descriptor */
+	if (close(cfd)) {
+		perror("close(cfd)");
+		return 1;
+	}
+
+	/* Close the original descriptor */
+	if (close(fd)) {
+		perror("close(fd)");
+		return 1;
+	}
+
+	return 0;
+}
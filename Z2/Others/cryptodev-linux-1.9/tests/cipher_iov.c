@@ -0,0 +1,240 @@
+/*
+ * Demo on how to use /dev/crypto device for ciphering and hashing
+ * data that is scattered over several buffers.
+ *
+ * Placed under public domain.
+ *
+ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
+#include <crypto/cryptodev.h>
+
+static int debug = 0;
+
+#define	DATA_SIZE	(8 * 1024)
+#define	HDR_SIZE	16
+#define	BLOCK_SIZE	16
+#define	KEY_SIZE	16
+#define	SHA1_SIZE	20
+
+/* encrypt contiguous data with CIOCCRYPT for reference */
+static int
+crypt_ref(int cfd, uint32_t ses, uint8_t *src, uint8_t *dst, uint8_t *mac,
+		int len, uint8_t *iv)
+{
+	struct crypt_op cryp;
+
+	memset(&cryp, 0, sizeof(cryp));
+	cryp.ses = ses;
+	cryp.len = len;
+	cryp.src = src;
+	cryp.dst = dst;
+	cryp.mac = mac;
+	cryp.iv = iv;
+	cryp.op = COP_ENCRYPT;
+	if (ioctl(cfd, CIOCCRYPT, &cryp)) {
+		perror("ioctl(CIOCCRYPT)");
+		return 1;
+	}
+	return 0;
+}
+
+static int
+test_cipher_iov(int cfd)
+{
+	static uint8_t plaintext[DATA_SIZE], expected[DATA_SIZE];
+	static uint8_t out1[DATA_SIZE / 2], out2[DATA_SIZE / 2];
+	static uint8_t hdr[HDR_SIZE], payload[DATA_SIZE - HDR_SIZE];
+	uint8_t iv[BLOCK_SIZE], key[KEY_SIZE];
+	struct iovec src[3], dst[2];
+	struct session_op sess;
+	struct crypt_vec_op vop;
+
+	memset(key, 0x33, sizeof(key));
+	memset(iv, 0x03, sizeof(iv));
+	memset(hdr, 0x11, sizeof(hdr));
+	memset(payload, 0x22, sizeof(payload));
+	memcpy(plaintext, hdr, HDR_SIZE);
+	memcpy(plaintext + HDR_SIZE, payload, sizeof(payload));
+
+	memset(&sess, 0, sizeof(sess));
+	sess.cipher = CRYPTO_AES_CBC;
+	sess.keylen = KEY_SIZE;
+	sess.key = key;
+	if (ioctl(cfd, CIOCGSESSION, &sess)) {
+		perror("ioctl(CIOCGSESSION)");
+		return 1;
+	}
+
+	if (crypt_ref(cfd, sess.ses, plaintext, expected, NULL, DATA_SIZE, iv))
+		return 1;
+
+	/* header, the first part of the payload (not a whole block) and
+	 * the rest go to two output halves */
+	src[0].iov_base = hdr;
+	src[0].iov_len = HDR_SIZE;
+	src[1].iov_base = payload;
+	src[1].iov_len = 1001;
+	src[2].iov_base = payload + 1001;
+	src[2].iov_len = sizeof(payload) - 1001;
+	dst[0].iov_base = out1;
+	dst[0].iov_len = sizeof(out1);
+	dst[1].iov_base = out2;
+	dst[1].iov_len = sizeof(out2);
+
+	memset(&vop, 0, sizeof(vop));
+	vop.ses = sess.ses;
+	vop.op = COP_ENCRYPT;
+	vop.src = src;
+	vop.src_iovcnt = 3;
+	vop.dst = dst;
+	vop.dst_iovcnt = 2;
+	vop.iv = iv;
+	if (ioctl(cfd, CIOCCRYPTV, &vop)) {
+		perror("ioctl(CIOCCRYPTV)");
+		return 1;
+	}
+
+	if (memcmp(out1, expected, sizeof(out1)) != 0 ||
+	    memcmp(out2, expected + sizeof(out1), sizeof(out2)) != 0) {
+		fprintf(stderr, "FAIL: vectored encryption differs\n");
+		return 1;
+	}
+
+	/* in place */
+	vop.dst = NULL;
+	vop.dst_iovcnt = 0;
+	if (ioctl(cfd, CIOCCRYPTV, &vop)) {
+		perror("ioctl(CIOCCRYPTV)");
+		return 1;
+	}
+
+	if (memcmp(hdr, expected, HDR_SIZE) != 0 ||
+	    memcmp(payload, expected + HDR_SIZE, sizeof(payload)) != 0) {
+		fprintf(stderr, "FAIL: in place vectored encryption differs\n");
+		return 1;
+	}
+
+	/* mismatching lengths must be refused */
+	vop.dst = dst;
+	vop.dst_iovcnt = 1;
+	if (ioctl(cfd, CIOCCRYPTV, &vop) == 0) {
+		fprintf(stderr, "FAIL: accepted a shorter destination\n");
+		return 1;
+	}
+
+	if (ioctl(cfd, CIOCFSESSION, &sess.ses)) {
+		perror("ioctl(CIOCFSESSION)");
+		return 1;
+	}
+
+	if (debug)
+		printf("%s: Test passed\n", __func__);
+	return 0;
+}
+
+static int
+test_hash_iov(int cfd)
+{
+	static uint8_t data[DATA_SIZE];
+	uint8_t mac[SHA1_SIZE], expected[SHA1_SIZE];
+	struct iovec src[4];
+	struct session_op sess;
+	struct crypt_vec_op vop;
+	int i;
+
+	for (i = 0; i < DATA_SIZE; i++)
+		data[i] = i & 0xff;
+
+	memset(&sess, 0, sizeof(sess));
+	sess.mac = CRYPTO_SHA1;
+	if (ioctl(cfd, CIOCGSESSION, &sess)) {
+		perror("ioctl(CIOCGSESSION)");
+		return 1;
+	}
+
+	if (crypt_ref(cfd, sess.ses, data, NULL, expected, DATA_SIZE, NULL))
+		return 1;
+
+	/* uneven segments, one of them empty */
+	src[0].iov_base = data;
+	src[0].iov_len = 7;
+	src[1].iov_base = data + 7;
+	src[1].iov_len = 0;
+	src[2].iov_base = data + 7;
+	src[2].iov_len = 4096;
+	src[3].iov_base = data + 7 + 4096;
+	src[3].iov_len = DATA_SIZE - 7 - 4096;
+
+	memset(&vop, 0, sizeof(vop));
+	vop.ses = sess.ses;
+	vop.op = COP_ENCRYPT;
+	vop.src = src;
+	vop.src_iovcnt = 4;
+	vop.mac = mac;
+	if (ioctl(cfd, CIOCCRYPTV, &vop)) {
+		perror("ioctl(CIOCCRYPTV)");
+		return 1;
+	}
+
+	if (memcmp(mac, expected, SHA1_SIZE) != 0) {
+		fprintf(stderr, "FAIL: vectored hash differs\n");
+		return 1;
+	}
+
+	if (ioctl(cfd, CIOCFSESSION, &sess.ses)) {
+		perror("ioctl(CIOCFSESSION)");
+		return 1;
+	}
+
+	if (debug)
+		printf("%s: Test passed\n", __func__);
+	return 0;
+}
+
+int
+main(int argc, char** argv)
+{
+	int fd = -1, cfd = -1;
+
+	if (argc > 1) debug = 1;
+
+	/* Open the crypto device */
+	fd = open("/dev/crypto", O_RDWR, 0);
+	if (fd < 0) {
+		perror("open(/dev/crypto)");
+		return 1;
+	}
+
+	/* Clone file descriptor */
+	if (ioctl(fd, CRIOGET, &cfd)) {
+		perror("ioctl(CRIOGET)");
+		return 1;
+	}
+
+	/* Run the test itself */
+	if (test_cipher_iov(cfd))
+		return 1;
+
+	if (test_hash_iov(cfd))
+		return 1;
+
+	/* Close cloned descriptor */
+	if (close(cfd)) {
+		perror("close(cfd)");
+		return 1;
+	}
+
+	/* Close the original descriptor */
+	if (close(fd)) {
+		perror("close(fd)");
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,427 @@
+/*  cryptodev_test - scaling of cryptodev over threads
+ *
+ *  Runs N threads of synchronous operations in three topologies:
+ *  all on one descriptor and one session, on one descriptor with a
+ *  session each, and on a descriptor each. The first contends on the
+ *  session's lock, the first two on the descriptor's session list;
+ *  the last shows what is left once neither is shared. Throughput and
+ *  latency are printed per thread count, in CSV or JSON for plotting.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <fcntl.h>
+#include <getopt.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <crypto/cryptodev.h>
+
+#include "benchlib.h"
+
+#define MAX_LIST	64
+#define MAX_THREADS	1024
+/* room after the buffer for an aead tag */
+#define TAG_ROOM	64
+
+enum topology {
+	SHARED_SESSION,	/* one descriptor, one session */
+	SHARED_FD,	/* one descriptor, a session per thread */
+	PER_FD,		/* a descriptor and a session per thread */
+	TOPOLOGY_MAX
+};
+
+static const char *topology_names[TOPOLOGY_MAX] = {
+	"shared-session", "shared-fd", "per-fd"
+};
+
+static struct {
+	struct bench_alg algs[MAX_LIST];
+	int nalgs;
+	int topologies[MAX_LIST];
+	int ntopologies;
+	unsigned int sizes[MAX_LIST], threads[MAX_LIST];
+	int nsizes, nthreads;
+	uint64_t duration, warmup; /* ns */
+	unsigned int reps;
+	enum bench_format format;
+	int si;
+} opts;
+
+struct worker {
+	pthread_t thread;
+	pthread_barrier_t *barrier;
+	const struct bench_alg *alg;
+	enum topology topology;
+	unsigned int size;
+
+	/* the descriptor and session, either shared or the thread's */
+	int fd;
+	struct session_op sess;
+	int alignmask;
+	uint8_t *buf;
+	uint8_t mac[AALG_MAX_RESULT_LEN];
+	size_t stride;
+
+	int ret;
+	double bytes, ops;
+	uint64_t ns, cycles;
+	struct bench_hist hist;
+};
+
+static int worker_setup(struct worker *w)
+{
+	if (w->topology == PER_FD) {
+		w->fd = open("/dev/crypto", O_RDWR, 0);
+		if (w->fd < 0) {
+			perror("open(/dev/crypto)");
+			return -1;
+		}
+	}
+
+	if (w->topology != SHARED_SESSION &&
+	    bench_session(w->fd, w->alg, &w->sess, &w->alignmask)) {
+		w->sess.ses = 0;
+		return -1;
+	}
+
+	w->buf = bench_alloc(w->size + TAG_ROOM, 1, w->alignmask, &w->stride);
+	return w->buf ? 0 : -1;
+}
+
+static int worker_loop(struct worker *w, uint64_t until, int record)
+{
+	uint64_t start, end;
+
+	do {
+		start = bench_ns();
+		if (bench_crypt(w->fd, w->alg, w->sess.ses, w->buf, w->mac,
+				w->size, 0))
+			return -1;
+		end = bench_ns();
+		if (record) {
+			bench_hist_add(&w->hist, end - start);
+			w->bytes += w->size;
+			w->ops++;
+		}
+	} while (end < until);
+	return 0;
+}
+
+static void *worker_routine(void *arg)
+{
+	struct worker *w = arg;
+	uint64_t start;
+
+	bench_hist_init(&w->hist);
+	w->ret = worker_setup(w);
+
+	/* a failed thread still takes part in the barriers */
+	pthread_barrier_wait(w->barrier);
+	if (!w->ret && opts.warmup)
+		w->ret = worker_loop(w, bench_ns() + opts.warmup, 0);
+
+	pthread_barrier_wait(w->barrier);
+	if (!w->ret) {
+		start = bench_ns();
+		w->cycles = bench_cycles();
+		w->ret = worker_loop(w, start + opts.duration, 1);
+		w->cycles = bench_cycles() - w->cycles;
+		w->ns = bench_ns() - start;
+	}
+
+	/* only what the thread opened itself */
+	if (w->topology == SHARED_FD && w->sess.ses)
+		ioctl(w->fd, CIOCFSESSION, &w->sess.ses);
+	if (w->topology == PER_FD && w->fd >= 0)
+		close(w->fd);
+	free(w->buf);
+	return NULL;
+}
+
+/* all repetitions of one thread count */
+static int run(const struct bench_alg *alg, enum topology topology,
+		unsigned int size, unsigned int nthreads)
+{
+	struct bench_result r;
+	pthread_barrier_t barrier;
+	struct session_op sess;
+	struct worker *w;
+	double sum = 0, sumsq = 0, bytes, secs, mbps;
+	unsigned int rep, i;
+	int fd = -1, alignmask = 0, ret = 0;
+
+	memset(&r, 0, sizeof(r));
+	r.alg = alg->name;
+	r.mode = topology_names[topology];
+	r.size = size;
+	r.threads = nthreads;
+	r.depth = 1;
+	bench_hist_init(&r.hist);
+
+	w = calloc(nthreads, sizeof(*w));
+	if (!w)
+		return -1;
+
+	memset(&sess, 0, sizeof(sess));
+	if (topology != PER_FD) {
+		fd = open("/dev/crypto", O_RDWR, 0);
+		if (fd < 0) {
+			perror("open(/dev/crypto)");
+			free(w);
+			return -1;
+		}
+		if (topology == SHARED_SESSION &&
+		    bench_session(fd, alg, &sess, &alignmask)) {
+			close(fd);
+			free(w);
+			return -1;
+		}
+	}
+
+	for (rep = 0; rep < opts.reps && !ret; rep++) {
+		pthread_barrier_init(&barrier, NULL, nthreads);
+		memset(w, 0, nthreads * sizeof(*w));
+		for (i = 0; i < nthreads; i++) {
+			w[i].barrier = &barrier;
+			w[i].alg = alg;
+			w[i].topology = topology;
+			w[i].size = size;
+			w[i].fd = fd;
+			w[i].sess = sess;
+			w[i].alignmask = alignmask;
+			if (pthread_create(&w[i].thread, NULL, worker_routine, &w[i])) {
+				perror("pthread_create()");
+				exit(1);
+			}
+		}
+
+		bytes = secs = 0;
+		for (i = 0; i < nthreads; i++) {
+			pthread_join(w[i].thread, NULL);
+			if (w[i].ret)
+				ret = -1;
+			bytes += w[i].bytes;
+			r.ops += w[i].ops;
+			r.cycles += w[i].cycles;
+			if (w[i].ns / 1e9 > secs)
+				secs = w[i].ns / 1e9;
+			bench_hist_merge(&r.hist, &w[i].hist);
+		}
+		pthread_barrier_destroy(&barrier);
+
+		r.bytes += bytes;
+		r.secs += secs;
+		if (secs) {
+			mbps = bytes / secs / 1e6;
+			sum += mbps;
+			sumsq += mbps * mbps;
+		}
+	}
+	free(w);
+
+	if (fd >= 0)
+		close(fd);
+
+	if (ret || !r.secs)
+		return -1;
+
+	r.reps = opts.reps;
+	r.mbps = sum / opts.reps;
+	if (opts.reps > 1)
+		r.mbps_stddev = sqrt(fabs(sumsq - sum * sum / opts.reps) /
+				(opts.reps - 1));
+	bench_report(stdout, opts.format, opts.si, &r);
+	return 0;
+}
+
+static void usage(FILE *fp)
+{
+	fprintf(fp, "Usage: contention [options]\n"
+		"  -a, --alg LIST       algorithms, or \"all\" (aes-128-cbc)\n"
+		"  -p, --topology LIST  shared-session, shared-fd, per-fd or \"all\" (all)\n"
+		"  -s, --size LIST      chunk sizes, as 64,4096 or 64:4096 (64,4096)\n"
+		"  -t, --threads LIST   thread counts, as 1,2,4 or 1:16 (1:CPUs)\n"
+		"  -T, --time SECS      measured time of a run (2)\n"
+		"  -w, --warmup SECS    unmeasured time before a run (0.5)\n"
+		"  -r, --reps N         repetitions of a run (1)\n"
+		"  -f, --format FMT     text, csv or json (text)\n"
+		"      --kib            binary units in text output\n"
+		"  -l, --list           list the algorithms\n");
+}
+
+static int parse_algs(char *arg)
+{
+	const struct bench_alg *a;
+	char *name;
+
+	opts.nalgs = 0;
+	for (name = strtok(arg, ","); name; name = strtok(NULL, ",")) {
+		if (!strcmp(name, "all")) {
+			for (a = bench_algs; a->name && opts.nalgs < MAX_LIST; a++)
+				opts.algs[opts.nalgs++] = *a;
+			continue;
+		}
+		if (opts.nalgs == MAX_LIST ||
+		    bench_alg_parse(name, &opts.algs[opts.nalgs])) {
+			fprintf(stderr, "unknown algorithm %s\n", name);
+			return -1;
+		}
+		opts.nalgs++;
+	}
+	return opts.nalgs ? 0 : -1;
+}
+
+static int parse_topologies(char *arg)
+{
+	char *name;
+	int t;
+
+	opts.ntopologies = 0;
+	for (name = strtok(arg, ","); name; name = strtok(NULL, ",")) {
+		if (!strcmp(name, "all")) {
+			for (t = 0; t < TOPOLOGY_MAX && opts.ntopologies < MAX_LIST; t++)
+				opts.topologies[opts.ntopologies++] = t;
+			continue;
+		}
+		for (t = 0; t < TOPOLOGY_MAX; t++)
+			if (!strcmp(name, topology_names[t]))
+				break;
+		if (t == TOPOLOGY_MAX || opts.ntopologies == MAX_LIST) {
+			fprintf(stderr, "unknown topology %s\n", name);
+			return -1;
+		}
+		opts.topologies[opts.ntopologies++] = t;
+	}
+	return opts.ntopologies ? 0 : -1;
+}
+
+static int parse_list(const char *arg, unsigned int *list, int *n,
+		unsigned int max)
+{
+	int i;
+
+	*n = bench_parse_sizes(arg, list, MAX_LIST);
+	for (i = 0; i < *n; i++)
+		if (!list[i] || list[i] > max)
+			*n = -1;
+	if (*n <= 0) {
+		fprintf(stderr, "invalid list %s\n", arg);
+		return -1;
+	}
+	return 0;
+}
+
+static const struct option long_options[] = {
+	{ "alg", required_argument, NULL, 'a' },
+	{ "topology", required_argument, NULL, 'p' },
+	{ "size", required_argument, NULL, 's' },
+	{ "threads", required_argument, NULL, 't' },
+	{ "time", required_argument, NULL, 'T' },
+	{ "warmup", required_argument, NULL, 'w' },
+	{ "reps", required_argument, NULL, 'r' },
+	{ "format", required_argument, NULL, 'f' },
+	{ "kib", no_argument, NULL, 'k' },
+	{ "list", no_argument, NULL, 'l' },
+	{ "help", no_argument, NULL, 'h' },
+	{ NULL, 0, NULL, 0 }
+};
+
+int main(int argc, char **argv)
+{
+	char algs[] = "aes-128-cbc", topologies[] = "all", threads[32];
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	int a, p, s, t, c, failed = 0;
+
+	snprintf(threads, sizeof(threads), "1:%ld", cpus > 0 ? cpus : 1);
+	parse_algs(algs);
+	parse_topologies(topologies);
+	parse_list("64,4096", opts.sizes, &opts.nsizes, UINT32_MAX);
+	parse_list(threads, opts.threads, &opts.nthreads, MAX_THREADS);
+	opts.duration = 2000000000ULL;
+	opts.warmup = 500000000ULL;
+	opts.reps = 1;
+	opts.si = 1;
+
+	while ((c = getopt_long(argc, argv, "a:p:s:t:T:w:r:f:lh",
+				long_options, NULL)) != -1) {
+		switch (c) {
+		case 'a':
+			if (parse_algs(optarg))
+				return 1;
+			break;
+		case 'p':
+			if (parse_topologies(optarg))
+				return 1;
+			break;
+		case 's':
+			if (parse_list(optarg, opts.sizes, &opts.nsizes, UINT32_MAX))
+				return 1;
+			break;
+		case 't':
+			if (parse_list(optarg, opts.threads, &opts.nthreads, MAX_THREADS))
+				return 1;
+			break;
+		case 'T':
+			opts.duration = atof(optarg) * 1e9;
+			break;
+		case 'w':
+			opts.warmup = atof(optarg) * 1e9;
+			break;
+		case 'r':
+			opts.reps = atoi(optarg);
+			if (opts.reps < 1) {
+				fprintf(stderr, "invalid repetitions %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'f':
+			if (bench_parse_format(optarg, &opts.format)) {
+				fprintf(stderr, "unknown format %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'k':
+			opts.si = 0;
+			break;
+		case 'l':
+			bench_alg_list(stdout);
+			return 0;
+		case 'h':
+			usage(stdout);
+			return 0;
+		default:
+			usage(stderr);
+			return 1;
+		}
+	}
+
+	/* thread counts vary fastest, so each topology makes a curve */
+	bench_report_begin(stdout, opts.format);
+	for (a = 0; a < opts.nalgs; a++)
+		for (s = 0; s < opts.nsizes; s++)
+			for (p = 0; p < opts.ntopologies; p++)
+				for (t = 0; t < opts.nthreads; t++)
+					if (run(&opts.algs[a], opts.topologies[p],
+					        opts.sizes[s], opts.threads[t]))
+						failed = 1;
+	bench_report_end(stdout, opts.format);
+
+	return failed;
+}
@@ -0,0 +1,595 @@
+/*  cryptodev_test - sha256sum through the module
+ *
+ *  Hashes whole files through one session with multi-update
+ *  operations (COP_FLAG_UPDATE, COP_FLAG_FINAL, COP_FLAG_RESET), the
+ *  files mapped into memory so that the module reads the page cache
+ *  directly, and several updates in flight. With --bench the same
+ *  files are hashed the way sha256sum does, read() and the OpenSSL
+ *  digest, and the two are timed against each other.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <math.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <crypto/cryptodev.h>
+#include <openssl/evp.h>
+
+#include "benchlib.h"
+
+#define MAX_DEPTH	64
+/* what coreutils reads at a time */
+#define USER_BLOCK	32768
+
+static struct {
+	struct bench_alg alg;
+	const EVP_MD *md;
+	unsigned int chunk, depth, reps;
+	int bench;
+	enum bench_format format;
+	int si;
+} opts;
+
+/* A file being hashed: mapped if it can be, otherwise read into a
+ * ring of buffers, one per update in flight.
+ */
+struct input {
+	int fd;
+	const char *name;
+	uint8_t *map;
+	uint64_t size, off;
+	uint8_t *ring;
+	size_t stride;
+	int eof;
+};
+
+static int input_open(struct input *in, const char *name)
+{
+	struct stat st;
+
+	memset(in, 0, sizeof(*in));
+	in->name = name;
+	if (!strcmp(name, "-")) {
+		in->fd = STDIN_FILENO;
+	} else if ((in->fd = open(name, O_RDONLY)) < 0) {
+		perror(name);
+		return -1;
+	}
+
+	if (fstat(in->fd, &st) == 0 && S_ISREG(st.st_mode)) {
+		in->size = st.st_size;
+		if (in->size == 0)
+			return 0;
+		in->map = mmap(NULL, in->size, PROT_READ, MAP_SHARED, in->fd, 0);
+		if (in->map != MAP_FAILED) {
+			madvise(in->map, in->size, MADV_SEQUENTIAL);
+			return 0;
+		}
+		in->map = NULL;
+	}
+
+	/* a pipe, or a file that cannot be mapped */
+	in->ring = bench_alloc(opts.chunk, opts.depth ? opts.depth : 1, 0,
+			&in->stride);
+	if (!in->ring) {
+		fprintf(stderr, "%s: cannot allocate buffers\n", name);
+		return -1;
+	}
+	return 0;
+}
+
+static void input_close(struct input *in)
+{
+	if (in->map)
+		munmap(in->map, in->size);
+	free(in->ring);
+	if (in->fd > STDIN_FILENO)
+		close(in->fd);
+}
+
+static int input_rewind(struct input *in)
+{
+	in->off = 0;
+	in->eof = 0;
+	if (in->map || in->size == 0)
+		return 0;
+	if (lseek(in->fd, 0, SEEK_SET) < 0) {
+		perror(in->name);
+		return -1;
+	}
+	return 0;
+}
+
+/* The next chunk, into ring slot slot when reading; len is 0 at the
+ * end. A mapped file has the module fault in the pages, the kernel
+ * being asked to read ahead of the updates in flight.
+ */
+static int input_next(struct input *in, unsigned int slot, uint8_t **data,
+		unsigned int *len)
+{
+	uint64_t ahead;
+	ssize_t n;
+
+	if (in->map) {
+		*len = in->size - in->off < opts.chunk ?
+			in->size - in->off : opts.chunk;
+		*data = in->map + in->off;
+		ahead = in->off + (uint64_t)opts.chunk * (opts.depth + 1);
+		if (ahead < in->size)
+			madvise(in->map + ahead, in->size - ahead < opts.chunk ?
+				in->size - ahead : opts.chunk, MADV_WILLNEED);
+		in->off += *len;
+		in->eof = in->off == in->size;
+		return 0;
+	}
+
+	*data = in->ring + slot * in->stride;
+	*len = 0;
+	while (*len < opts.chunk && !in->eof) {
+		n = read(in->fd, *data + *len, opts.chunk - *len);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			perror(in->name);
+			return -1;
+		}
+		if (n == 0)
+			in->eof = 1;
+		*len += n;
+	}
+	in->off += *len;
+	return 0;
+}
+
+/* The first update resets the session's hash, the last one finishes
+ * it; an empty input is a single plain operation.
+ */
+static int update_flags(uint64_t seq, int last)
+{
+	int flags = seq == 0 ? COP_FLAG_RESET : 0;
+
+	if (last)
+		return seq == 0 ? 0 : COP_FLAG_FINAL;
+	return flags | COP_FLAG_UPDATE;
+}
+
+static int kernel_sync(int fd, uint32_t ses, struct input *in, uint8_t *digest,
+		struct bench_hist *hist)
+{
+	struct crypt_op cop;
+	uint64_t seq, start;
+	unsigned int len;
+	uint8_t *data;
+
+	for (seq = 0; ; seq++) {
+		if (input_next(in, 0, &data, &len))
+			return -1;
+
+		memset(&cop, 0, sizeof(cop));
+		cop.ses = ses;
+		cop.op = COP_ENCRYPT;
+		cop.flags = update_flags(seq, in->eof);
+		cop.len = len;
+		cop.src = data;
+		cop.mac = digest;
+		start = bench_ns();
+		if (ioctl(fd, CIOCCRYPT, &cop)) {
+			perror("ioctl(CIOCCRYPT)");
+			return -1;
+		}
+		if (hist)
+			bench_hist_add(hist, bench_ns() - start);
+		if (in->eof)
+			return 0;
+	}
+}
+
+#ifdef ENABLE_ASYNC
+/* The handle's queue is worked in order, so the updates of a session
+ * can be in flight together: the module hashes one chunk while the
+ * next ones are faulted in or read.
+ */
+static int kernel_async(int fd, uint32_t ses, struct input *in,
+		uint8_t *digest, struct bench_hist *hist)
+{
+	struct crypt_op cop, done[MAX_DEPTH];
+	struct crypt_fetch_op fop;
+	uint64_t seq = 0, fetched = 0, stamp[MAX_DEPTH], now;
+	int32_t results[MAX_DEPTH];
+	struct pollfd pfd;
+	unsigned int len, i;
+	uint8_t *data;
+	int pending = 0, last = 0, submitted_last = 0;
+
+	while (!submitted_last || fetched < seq) {
+		while (!submitted_last && seq - fetched < opts.depth) {
+			/* a chunk the queue had no room for is kept */
+			if (!pending) {
+				if (input_next(in, seq % opts.depth, &data, &len))
+					return -1;
+				last = in->eof;
+
+				memset(&cop, 0, sizeof(cop));
+				cop.ses = ses;
+				cop.op = COP_ENCRYPT;
+				cop.flags = update_flags(seq, last);
+				cop.len = len;
+				cop.src = data;
+				cop.mac = digest;
+				pending = 1;
+			}
+			stamp[seq % opts.depth] = bench_ns();
+			if (ioctl(fd, CIOCASYNCCRYPT, &cop)) {
+				if (errno == EBUSY)
+					break;
+				perror("ioctl(CIOCASYNCCRYPT)");
+				return -1;
+			}
+			pending = 0;
+			submitted_last = last;
+			seq++;
+		}
+
+		memset(&fop, 0, sizeof(fop));
+		fop.count = seq - fetched;
+		fop.cops = done;
+		fop.results = results;
+		if (ioctl(fd, CIOCASYNCFETCHMANY, &fop)) {
+			if (errno != EBUSY) {
+				perror("ioctl(CIOCASYNCFETCHMANY)");
+				return -1;
+			}
+			pfd.fd = fd;
+			pfd.events = POLLIN;
+			if (poll(&pfd, 1, 1000) < 0 && errno != EINTR) {
+				perror("poll()");
+				return -1;
+			}
+			continue;
+		}
+
+		now = bench_ns();
+		for (i = 0; i < fop.count; i++, fetched++) {
+			if (results[i]) {
+				fprintf(stderr, "%s: update failed: %s\n",
+						in->name, strerror(-results[i]));
+				return -1;
+			}
+			if (hist)
+				bench_hist_add(hist, now - stamp[fetched % opts.depth]);
+		}
+	}
+	return 0;
+}
+#endif
+
+static int kernel_hash(int fd, uint32_t ses, struct input *in,
+		uint8_t *digest, struct bench_hist *hist)
+{
+#ifdef ENABLE_ASYNC
+	if (opts.depth)
+		return kernel_async(fd, ses, in, digest, hist);
+#endif
+	return kernel_sync(fd, ses, in, digest, hist);
+}
+
+/* as sha256sum: read() in small blocks into the library's digest */
+static int user_hash(EVP_MD_CTX *ctx, struct input *in, uint8_t *digest,
+		struct bench_hist *hist)
+{
+	static uint8_t block[USER_BLOCK];
+	uint64_t start;
+	ssize_t n;
+
+	if (!EVP_DigestInit_ex(ctx, opts.md, NULL))
+		return -1;
+	for (;;) {
+		start = bench_ns();
+		if (in->map) {
+			n = in->size - in->off < USER_BLOCK ?
+				in->size - in->off : USER_BLOCK;
+			n = pread(in->fd, block, n, in->off);
+		} else {
+			n = read(in->fd, block, USER_BLOCK);
+		}
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			perror(in->name);
+			return -1;
+		}
+		if (n == 0)
+			break;
+		in->off += n;
+		if (!EVP_DigestUpdate(ctx, block, n))
+			return -1;
+		if (hist)
+			bench_hist_add(hist, bench_ns() - start);
+	}
+	return EVP_DigestFinal_ex(ctx, digest, NULL) ? 0 : -1;
+}
+
+static void print_digest(const uint8_t *digest, unsigned int len,
+		const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < len; i++)
+		printf("%02x", digest[i]);
+	printf("  %s\n", name);
+}
+
+/* the passes of one way of hashing a file */
+struct passes {
+	double secs, sum, sumsq;
+	struct bench_hist hist;
+};
+
+static void pass_add(struct passes *p, uint64_t bytes, uint64_t ns)
+{
+	double mbps = ns ? bytes * 1e3 / ns : 0;
+
+	p->secs += ns / 1e9;
+	p->sum += mbps;
+	p->sumsq += mbps * mbps;
+}
+
+static void report(const char *mode, uint64_t size, const struct passes *p,
+		unsigned int chunk)
+{
+	struct bench_result r;
+
+	memset(&r, 0, sizeof(r));
+	r.alg = opts.alg.name;
+	r.mode = mode;
+	r.size = chunk;
+	r.threads = 1;
+	r.depth = 1;
+	r.reps = opts.reps;
+	r.secs = p->secs;
+	r.bytes = (double)size * opts.reps;
+	r.ops = p->hist.count;
+	r.mbps = p->sum / opts.reps;
+	if (opts.reps > 1)
+		r.mbps_stddev = sqrt(fabs(p->sumsq - p->sum * p->sum / opts.reps) /
+				(opts.reps - 1));
+	r.hist = p->hist;
+	bench_report(stderr, opts.format, opts.si, &r);
+}
+
+/* Time both ways over the file, after a pass that fills the page
+ * cache, and check that they agree.
+ */
+static int bench_file(int fd, uint32_t ses, EVP_MD_CTX *ctx, struct input *in,
+		uint8_t *digest, unsigned int digestlen)
+{
+	static struct passes kernel, user;
+	uint8_t udigest[EVP_MAX_MD_SIZE];
+	char mode[32];
+	uint64_t start;
+	unsigned int rep;
+
+	if (lseek(in->fd, 0, SEEK_CUR) < 0) {
+		fprintf(stderr, "%s: can only benchmark files\n", in->name);
+		return -1;
+	}
+
+	memset(&kernel, 0, sizeof(kernel));
+	memset(&user, 0, sizeof(user));
+	bench_hist_init(&kernel.hist);
+	bench_hist_init(&user.hist);
+	if (user_hash(ctx, in, udigest, NULL) || input_rewind(in))
+		return -1;
+
+	for (rep = 0; rep < opts.reps; rep++) {
+		start = bench_ns();
+		if (kernel_hash(fd, ses, in, digest, &kernel.hist))
+			return -1;
+		pass_add(&kernel, in->size, bench_ns() - start);
+		if (input_rewind(in))
+			return -1;
+
+		start = bench_ns();
+		if (user_hash(ctx, in, udigest, &user.hist))
+			return -1;
+		pass_add(&user, in->size, bench_ns() - start);
+		if (input_rewind(in))
+			return -1;
+	}
+
+	if (memcmp(digest, udigest, digestlen)) {
+		fprintf(stderr, "%s: the module and OpenSSL disagree\n", in->name);
+		return -1;
+	}
+
+	if (opts.depth)
+		snprintf(mode, sizeof(mode), "kernel-async%u", opts.depth);
+	else
+		snprintf(mode, sizeof(mode), "kernel-sync");
+	report(mode, in->size, &kernel, opts.chunk);
+	report("openssl-read", in->size, &user, USER_BLOCK);
+	if (opts.format == BENCH_TEXT && in->size)
+		fprintf(stderr, "%s: the module is %.2fx the speed of user space\n",
+				in->name, user.secs / kernel.secs);
+	return 0;
+}
+
+static void usage(FILE *fp)
+{
+	fprintf(fp, "Usage: hashsum [options] [FILE]...\n"
+		"Prints the digests of the files, or of standard input, as\n"
+		"sha256sum does, computed by the module.\n"
+		"  -a, --alg NAME      md5, rmd160, sha1, sha224, sha256, sha384\n"
+		"                      or sha512 (sha256)\n"
+		"  -c, --chunk BYTES   size of an update (1048576)\n"
+		"  -d, --depth N       updates in flight, 0 for one at a time (4)\n"
+		"  -b, --bench         also hash as sha256sum does, timing both\n"
+		"                      on standard error\n"
+		"  -r, --reps N        timed passes over each file (3)\n"
+		"  -f, --format FMT    text, csv or json (text)\n"
+		"      --kib           binary units in text output\n");
+}
+
+static const struct option long_options[] = {
+	{ "alg", required_argument, NULL, 'a' },
+	{ "chunk", required_argument, NULL, 'c' },
+	{ "depth", required_argument, NULL, 'd' },
+	{ "bench", no_argument, NULL, 'b' },
+	{ "reps", required_argument, NULL, 'r' },
+	{ "format", required_argument, NULL, 'f' },
+	{ "kib", no_argument, NULL, 'k' },
+	{ "help", no_argument, NULL, 'h' },
+	{ NULL, 0, NULL, 0 }
+};
+
+/* OpenSSL's names of the hashes of bench_algs */
+static const EVP_MD *alg_to_md(const char *name)
+{
+	if (!strcmp(name, "rmd160"))
+		name = "ripemd160";
+	return EVP_get_digestbyname(name);
+}
+
+int main(int argc, char **argv)
+{
+	static char *stdin_only[] = { "-" };
+	uint8_t digest[AALG_MAX_RESULT_LEN];
+	unsigned int digestlen;
+	struct session_op sess;
+	struct input in;
+	EVP_MD_CTX *ctx;
+	char **files;
+	int fd, c, i, nfiles, failed = 0;
+
+	bench_alg_parse("sha256", &opts.alg);
+	opts.chunk = 1024 * 1024;
+	opts.depth = 4;
+	opts.reps = 3;
+	opts.si = 1;
+
+	while ((c = getopt_long(argc, argv, "a:c:d:br:f:h",
+				long_options, NULL)) != -1) {
+		switch (c) {
+		case 'a':
+			if (bench_alg_parse(optarg, &opts.alg) ||
+			    opts.alg.cipher || opts.alg.mackeylen) {
+				fprintf(stderr, "unknown hash %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'c':
+			opts.chunk = strtoul(optarg, NULL, 0);
+			if (opts.chunk < 64 || opts.chunk % 64) {
+				fprintf(stderr, "the chunk must be a multiple of 64\n");
+				return 1;
+			}
+			break;
+		case 'd':
+			opts.depth = atoi(optarg);
+			if (opts.depth > MAX_DEPTH) {
+				fprintf(stderr, "at most %d updates in flight\n",
+						MAX_DEPTH);
+				return 1;
+			}
+			break;
+		case 'b':
+			opts.bench = 1;
+			break;
+		case 'r':
+			opts.reps = atoi(optarg);
+			if (opts.reps < 1) {
+				fprintf(stderr, "invalid repetitions %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'f':
+			if (bench_parse_format(optarg, &opts.format)) {
+				fprintf(stderr, "unknown format %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'k':
+			opts.si = 0;
+			break;
+		case 'h':
+			usage(stdout);
+			return 0;
+		default:
+			usage(stderr);
+			return 1;
+		}
+	}
+#ifndef ENABLE_ASYNC
+	opts.depth = 0;
+#endif
+
+	opts.md = alg_to_md(opts.alg.name);
+	ctx = EVP_MD_CTX_new();
+	if (!opts.md || !ctx) {
+		fprintf(stderr, "OpenSSL has no %s\n", opts.alg.name);
+		return 1;
+	}
+
+	if ((fd = open("/dev/crypto", O_RDWR, 0)) < 0) {
+		perror("open(/dev/crypto)");
+		return 1;
+	}
+	if (bench_session(fd, &opts.alg, &sess, NULL))
+		return 1;
+	if (opts.depth) {
+		uint32_t depth = opts.depth;
+
+		if (ioctl(fd, CIOCASYNCDEPTH, &depth)) {
+			perror("ioctl(CIOCASYNCDEPTH)");
+			return 1;
+		}
+	}
+	digestlen = EVP_MD_size(opts.md);
+
+	files = optind < argc ? argv + optind : stdin_only;
+	nfiles = optind < argc ? argc - optind : 1;
+
+	if (opts.bench)
+		bench_report_begin(stderr, opts.format);
+	for (i = 0; i < nfiles; i++) {
+		if (input_open(&in, files[i])) {
+			failed = 1;
+			continue;
+		}
+		if (opts.bench ? bench_file(fd, sess.ses, ctx, &in, digest, digestlen) :
+		    kernel_hash(fd, sess.ses, &in, digest, NULL))
+			failed = 1;
+		else
+			print_digest(digest, digestlen, files[i]);
+		input_close(&in);
+	}
+	if (opts.bench)
+		bench_report_end(stderr, opts.format);
+
+	ioctl(fd, CIOCFSESSION, &sess.ses);
+	close(fd);
+	EVP_MD_CTX_free(ctx);
+	return failed;
+}
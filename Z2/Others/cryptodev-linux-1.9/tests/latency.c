@@ -0,0 +1,665 @@
+/*  cryptodev_test - latency distribution of cryptodev operations
+ *
+ *  Times every operation on its own, synchronous ones around the
+ *  ioctl and asynchronous ones from submission to fetch, with the time
+ *  stamp counter or CLOCK_MONOTONIC_RAW, and prints the percentiles of
+ *  each chunk size. Threads hammering the module on their own
+ *  descriptors can run in the background to show the tail under load.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <crypto/cryptodev.h>
+
+#include "benchlib.h"
+
+#define MAX_LIST	64
+#define MAX_DEPTH	4096
+#define MAX_LOAD	1024
+/* room after each buffer for an aead tag */
+#define TAG_ROOM	64
+
+enum mode {
+	MODE_SYNC,
+	MODE_ASYNC,
+	MODE_MAX
+};
+
+static const char *mode_names[MODE_MAX] = { "sync", "async" };
+
+enum clock_source {
+	SOURCE_TSC,
+	SOURCE_RAW,
+};
+
+static struct {
+	struct bench_alg algs[MAX_LIST];
+	int nalgs;
+	int modes[MAX_LIST];
+	int nmodes;
+	unsigned int sizes[MAX_LIST];
+	int nsizes;
+	unsigned int count, warmup, depth;
+	unsigned int load, load_size;
+	int cpu;
+	enum clock_source clock;
+	enum bench_format format;
+	const char *hist_path;
+	int si;
+} opts;
+
+/* nanoseconds per tick of the time stamp counter */
+static double tsc_ns;
+
+static uint64_t raw_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static inline uint64_t stamp(void)
+{
+	return opts.clock == SOURCE_TSC ? bench_cycles() : raw_ns();
+}
+
+static inline uint64_t stamp_ns(uint64_t delta)
+{
+	return opts.clock == SOURCE_TSC ? (uint64_t)(delta * tsc_ns + 0.5) : delta;
+}
+
+/* the counter's rate against CLOCK_MONOTONIC_RAW over 100 ms */
+static int tsc_calibrate(void)
+{
+	uint64_t c0, c1, t0, t1;
+
+	if (!bench_cycles())
+		return -1;
+	t0 = raw_ns();
+	c0 = bench_cycles();
+	usleep(100000);
+	t1 = raw_ns();
+	c1 = bench_cycles();
+	if (c1 <= c0)
+		return -1;
+	tsc_ns = (double)(t1 - t0) / (c1 - c0);
+	return 0;
+}
+
+/* the least time two back to back stamps differ by */
+static uint64_t clock_overhead(void)
+{
+	uint64_t t, min = UINT64_MAX;
+	int i;
+
+	for (i = 0; i < 1000; i++) {
+		t = stamp();
+		t = stamp() - t;
+		if (t < min)
+			min = t;
+	}
+	return stamp_ns(min);
+}
+
+/* the descriptor, session and buffers of the measurement */
+struct target {
+	const struct bench_alg *alg;
+	int fd;
+	struct session_op sess;
+	int alignmask;
+	uint8_t *buf, *mac;
+	size_t stride;
+	unsigned int depth;
+};
+
+static int measure_sync(struct target *t, unsigned int size,
+		struct bench_hist *h)
+{
+	uint64_t start, end;
+	unsigned int i;
+
+	for (i = 0; i < opts.warmup + opts.count; i++) {
+		start = stamp();
+		if (bench_crypt(t->fd, t->alg, t->sess.ses, t->buf, t->mac, size, 0))
+			return -1;
+		end = stamp();
+		if (i >= opts.warmup)
+			bench_hist_add(h, stamp_ns(end - start));
+	}
+	return 0;
+}
+
+#ifdef ENABLE_ASYNC
+/* keep depth jobs in flight until count jobs past the warmup are
+ * back; each is timed from its submission to the fetch returning it */
+static int measure_async(struct target *t, unsigned int size,
+		struct bench_hist *h)
+{
+	unsigned int total = opts.warmup + opts.count;
+	unsigned int submitted = 0, done = 0, nfree = t->depth, i, slot;
+	uint64_t *stamps, now;
+	unsigned int *slots;
+	uint8_t iv[EALG_MAX_BLOCK_LEN];
+	struct crypt_op cop, fetched[64];
+	struct crypt_fetch_op fop;
+	int32_t results[64];
+	struct pollfd pfd;
+	int ret = -1;
+
+	stamps = calloc(t->depth, sizeof(*stamps));
+	slots = calloc(t->depth, sizeof(*slots));
+	if (!stamps || !slots)
+		goto out;
+	for (i = 0; i < t->depth; i++)
+		slots[i] = i;
+	memset(iv, 0x23, sizeof(iv));
+
+	while (done < total) {
+		while (nfree && submitted < total) {
+			slot = slots[--nfree];
+			memset(&cop, 0, sizeof(cop));
+			cop.ses = t->sess.ses;
+			cop.op = COP_ENCRYPT;
+			cop.len = size;
+			cop.src = t->buf + slot * t->stride;
+			if (t->alg->cipher) {
+				cop.dst = cop.src;
+				cop.iv = iv;
+			}
+			if (t->alg->mac)
+				cop.mac = t->mac + slot * AALG_MAX_RESULT_LEN;
+			stamps[slot] = stamp();
+			if (ioctl(t->fd, CIOCASYNCCRYPT, &cop)) {
+				nfree++;
+				if (errno == EBUSY)
+					break;
+				perror("ioctl(CIOCASYNCCRYPT)");
+				goto out;
+			}
+			submitted++;
+		}
+
+		memset(&fop, 0, sizeof(fop));
+		fop.count = submitted - done < 64 ? submitted - done : 64;
+		fop.cops = fetched;
+		fop.results = results;
+		if (ioctl(t->fd, CIOCASYNCFETCHMANY, &fop)) {
+			if (errno != EBUSY) {
+				perror("ioctl(CIOCASYNCFETCHMANY)");
+				goto out;
+			}
+			pfd.fd = t->fd;
+			pfd.events = POLLIN;
+			if (poll(&pfd, 1, 1000) < 0 && errno != EINTR) {
+				perror("poll()");
+				goto out;
+			}
+			continue;
+		}
+
+		now = stamp();
+		for (i = 0; i < fop.count; i++, done++) {
+			if (results[i]) {
+				fprintf(stderr, "job failed: %s\n", strerror(-results[i]));
+				goto out;
+			}
+			slot = (fetched[i].src - t->buf) / t->stride;
+			slots[nfree++] = slot;
+			if (done >= opts.warmup)
+				bench_hist_add(h, stamp_ns(now - stamps[slot]));
+		}
+	}
+	ret = 0;
+out:
+	free(stamps);
+	free(slots);
+	return ret;
+}
+#endif
+
+static int target_open(struct target *t, const struct bench_alg *alg,
+		enum mode mode)
+{
+	unsigned int size = opts.sizes[opts.nsizes - 1];
+	uint32_t depth;
+
+	memset(t, 0, sizeof(*t));
+	t->alg = alg;
+	t->depth = mode == MODE_ASYNC ? opts.depth : 1;
+
+	t->fd = open("/dev/crypto", O_RDWR, 0);
+	if (t->fd < 0) {
+		perror("open(/dev/crypto)");
+		return -1;
+	}
+	if (bench_session(t->fd, alg, &t->sess, &t->alignmask))
+		goto fail;
+
+	/* the largest size fits all */
+	t->buf = bench_alloc(size + TAG_ROOM, t->depth, t->alignmask, &t->stride);
+	t->mac = calloc(t->depth, AALG_MAX_RESULT_LEN);
+	if (!t->buf || !t->mac)
+		goto fail;
+	memset(t->buf, 0x42, t->stride * t->depth);
+
+	if (mode == MODE_ASYNC) {
+		depth = t->depth;
+		if (ioctl(t->fd, CIOCASYNCDEPTH, &depth)) {
+			perror("ioctl(CIOCASYNCDEPTH)");
+			goto fail;
+		}
+	}
+	return 0;
+fail:
+	free(t->buf);
+	free(t->mac);
+	close(t->fd);
+	return -1;
+}
+
+static void target_close(struct target *t)
+{
+	free(t->buf);
+	free(t->mac);
+	close(t->fd);
+}
+
+/* background load: synchronous operations on a descriptor each */
+static int load_stop;
+static pthread_barrier_t load_ready;
+
+struct load {
+	pthread_t thread;
+	const struct bench_alg *alg;
+	double ops;
+};
+
+static void *load_routine(void *arg)
+{
+	struct load *l = arg;
+	struct session_op sess;
+	uint8_t *buf = NULL, mac[AALG_MAX_RESULT_LEN];
+	size_t stride;
+	int fd, alignmask;
+
+	fd = open("/dev/crypto", O_RDWR, 0);
+	if (fd < 0)
+		perror("open(/dev/crypto)");
+	else if (bench_session(fd, l->alg, &sess, &alignmask) == 0)
+		buf = bench_alloc(opts.load_size + TAG_ROOM, 1, alignmask, &stride);
+
+	/* the measurement starts once every thread is loading */
+	pthread_barrier_wait(&load_ready);
+	while (buf && !__atomic_load_n(&load_stop, __ATOMIC_RELAXED) &&
+	       bench_crypt(fd, l->alg, sess.ses, buf, mac, opts.load_size, 0) == 0)
+		l->ops++;
+
+	free(buf);
+	if (fd >= 0)
+		close(fd);
+	return NULL;
+}
+
+static int run(const struct bench_alg *alg, enum mode mode)
+{
+	struct bench_result r;
+	struct target t;
+	char label[128], mode_name[32];
+	uint64_t start, cycles;
+	FILE *hist = NULL;
+	int s, ret = 0;
+
+	if (target_open(&t, alg, mode))
+		return -1;
+
+	if (opts.hist_path) {
+		hist = strcmp(opts.hist_path, "-") ? fopen(opts.hist_path, "a") : stdout;
+		if (hist == NULL) {
+			perror(opts.hist_path);
+			target_close(&t);
+			return -1;
+		}
+	}
+
+	if (opts.load)
+		snprintf(mode_name, sizeof(mode_name), "%s+load%u",
+				mode_names[mode], opts.load);
+	else
+		snprintf(mode_name, sizeof(mode_name), "%s", mode_names[mode]);
+
+	for (s = 0; s < opts.nsizes && !ret; s++) {
+		memset(&r, 0, sizeof(r));
+		r.alg = alg->name;
+		r.mode = mode_name;
+		r.size = opts.sizes[s];
+		r.threads = 1;
+		r.depth = t.depth;
+		r.reps = 1;
+		bench_hist_init(&r.hist);
+
+		start = bench_ns();
+		cycles = bench_cycles();
+#ifdef ENABLE_ASYNC
+		if (mode == MODE_ASYNC)
+			ret = measure_async(&t, r.size, &r.hist);
+		else
+#endif
+			ret = measure_sync(&t, r.size, &r.hist);
+		r.cycles = bench_cycles() - cycles;
+		r.secs = (bench_ns() - start) / 1e9;
+		if (ret)
+			break;
+
+		/* throughput is over the whole run, warmup included */
+		r.ops = opts.warmup + opts.count;
+		r.bytes = r.ops * r.size;
+		r.mbps = r.bytes / r.secs / 1e6;
+		bench_report(stdout, opts.format, opts.si, &r);
+
+		if (hist) {
+			snprintf(label, sizeof(label), "%s %s %u bytes",
+					alg->name, mode_name, r.size);
+			bench_hist_print(hist, &r.hist, label);
+		}
+	}
+
+	if (hist && hist != stdout)
+		fclose(hist);
+	target_close(&t);
+	return ret;
+}
+
+static void usage(FILE *fp)
+{
+	fprintf(fp, "Usage: latency [options]\n"
+		"  -a, --alg LIST       algorithms, or \"all\" (aes-128-cbc)\n"
+		"  -m, --mode LIST      sync, async or \"all\" (sync)\n"
+		"  -s, --size LIST      chunk sizes, as 64,4096 or 64:16384 (64:16384)\n"
+		"  -n, --count N        timed operations per size (100000)\n"
+		"  -w, --warmup N       untimed operations before them (1000)\n"
+		"  -d, --depth N        jobs in flight in async mode (1)\n"
+		"  -c, --clock SRC      tsc or raw (tsc where there is one)\n"
+		"  -L, --load N         background threads loading the module (0)\n"
+		"  -B, --load-size N    chunk size of the load (65536)\n"
+		"  -C, --cpu N          pin the measuring thread to a CPU\n"
+		"  -H, --hist FILE      append the full distributions to FILE, - for stdout\n"
+		"  -f, --format FMT     text, csv or json (text)\n"
+		"      --kib            binary units in text output\n"
+		"  -l, --list           list the algorithms\n");
+}
+
+static int parse_algs(char *arg)
+{
+	const struct bench_alg *a;
+	char *name;
+
+	opts.nalgs = 0;
+	for (name = strtok(arg, ","); name; name = strtok(NULL, ",")) {
+		if (!strcmp(name, "all")) {
+			for (a = bench_algs; a->name && opts.nalgs < MAX_LIST; a++)
+				opts.algs[opts.nalgs++] = *a;
+			continue;
+		}
+		if (opts.nalgs == MAX_LIST ||
+		    bench_alg_parse(name, &opts.algs[opts.nalgs])) {
+			fprintf(stderr, "unknown algorithm %s\n", name);
+			return -1;
+		}
+		opts.nalgs++;
+	}
+	return opts.nalgs ? 0 : -1;
+}
+
+static int parse_modes(char *arg)
+{
+	char *name;
+	int m;
+
+	opts.nmodes = 0;
+	for (name = strtok(arg, ","); name; name = strtok(NULL, ",")) {
+		if (!strcmp(name, "all")) {
+			for (m = 0; m < MODE_MAX && opts.nmodes < MAX_LIST; m++)
+				opts.modes[opts.nmodes++] = m;
+			continue;
+		}
+		for (m = 0; m < MODE_MAX; m++)
+			if (!strcmp(name, mode_names[m]))
+				break;
+		if (m == MODE_MAX || opts.nmodes == MAX_LIST) {
+			fprintf(stderr, "unknown mode %s\n", name);
+			return -1;
+		}
+		opts.modes[opts.nmodes++] = m;
+	}
+	return opts.nmodes ? 0 : -1;
+}
+
+/* a number between 1 and max */
+static int parse_uint(const char *arg, unsigned int *val, unsigned int max)
+{
+	char *end;
+	unsigned long v = strtoul(arg, &end, 0);
+
+	if (*end || !v || v > max) {
+		fprintf(stderr, "invalid number %s\n", arg);
+		return -1;
+	}
+	*val = v;
+	return 0;
+}
+
+static int cmp_uint(const void *a, const void *b)
+{
+	unsigned int x = *(const unsigned int *)a, y = *(const unsigned int *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static const struct option long_options[] = {
+	{ "alg", required_argument, NULL, 'a' },
+	{ "mode", required_argument, NULL, 'm' },
+	{ "size", required_argument, NULL, 's' },
+	{ "count", required_argument, NULL, 'n' },
+	{ "warmup", required_argument, NULL, 'w' },
+	{ "depth", required_argument, NULL, 'd' },
+	{ "clock", required_argument, NULL, 'c' },
+	{ "load", required_argument, NULL, 'L' },
+	{ "load-size", required_argument, NULL, 'B' },
+	{ "cpu", required_argument, NULL, 'C' },
+	{ "hist", required_argument, NULL, 'H' },
+	{ "format", required_argument, NULL, 'f' },
+	{ "kib", no_argument, NULL, 'k' },
+	{ "list", no_argument, NULL, 'l' },
+	{ "help", no_argument, NULL, 'h' },
+	{ NULL, 0, NULL, 0 }
+};
+
+int main(int argc, char **argv)
+{
+	char algs[] = "aes-128-cbc", modes[] = "sync";
+	const char *clock_name = NULL;
+	struct load *load = NULL;
+	double load_ops = 0;
+	cpu_set_t set;
+	unsigned int i;
+	int a, m, c, failed = 0;
+
+	parse_algs(algs);
+	parse_modes(modes);
+	opts.nsizes = bench_parse_sizes("64:16384", opts.sizes, MAX_LIST);
+	opts.count = 100000;
+	opts.warmup = 1000;
+	opts.depth = 1;
+	opts.load_size = 65536;
+	opts.cpu = -1;
+	opts.si = 1;
+
+	while ((c = getopt_long(argc, argv, "a:m:s:n:w:d:c:L:B:C:H:f:lh",
+				long_options, NULL)) != -1) {
+		switch (c) {
+		case 'a':
+			if (parse_algs(optarg))
+				return 1;
+			break;
+		case 'm':
+			if (parse_modes(optarg))
+				return 1;
+			break;
+		case 's':
+			opts.nsizes = bench_parse_sizes(optarg, opts.sizes, MAX_LIST);
+			if (opts.nsizes <= 0) {
+				fprintf(stderr, "invalid sizes %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'n':
+			if (parse_uint(optarg, &opts.count, UINT32_MAX / 2))
+				return 1;
+			break;
+		case 'w':
+			opts.warmup = strtoul(optarg, NULL, 0);
+			break;
+		case 'd':
+			if (parse_uint(optarg, &opts.depth, MAX_DEPTH))
+				return 1;
+			break;
+		case 'c':
+			clock_name = optarg;
+			break;
+		case 'L':
+			if (parse_uint(optarg, &opts.load, MAX_LOAD))
+				return 1;
+			break;
+		case 'B':
+			if (parse_uint(optarg, &opts.load_size, UINT32_MAX - TAG_ROOM))
+				return 1;
+			break;
+		case 'C':
+			opts.cpu = atoi(optarg);
+			break;
+		case 'H':
+			opts.hist_path = optarg;
+			break;
+		case 'f':
+			if (bench_parse_format(optarg, &opts.format)) {
+				fprintf(stderr, "unknown format %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'k':
+			opts.si = 0;
+			break;
+		case 'l':
+			bench_alg_list(stdout);
+			return 0;
+		case 'h':
+			usage(stdout);
+			return 0;
+		default:
+			usage(stderr);
+			return 1;
+		}
+	}
+	/* the buffers are sized for the last one */
+	qsort(opts.sizes, opts.nsizes, sizeof(opts.sizes[0]), cmp_uint);
+
+	if (clock_name && strcmp(clock_name, "tsc") && strcmp(clock_name, "raw")) {
+		fprintf(stderr, "unknown clock %s\n", clock_name);
+		return 1;
+	}
+	opts.clock = SOURCE_RAW;
+	if (!clock_name || !strcmp(clock_name, "tsc")) {
+		if (tsc_calibrate() == 0)
+			opts.clock = SOURCE_TSC;
+		else if (clock_name)
+			fprintf(stderr, "no usable time stamp counter, using CLOCK_MONOTONIC_RAW\n");
+	}
+	if (opts.clock == SOURCE_TSC)
+		fprintf(stderr, "clock: tsc at %.3f GHz, ", 1 / tsc_ns);
+	else
+		fprintf(stderr, "clock: CLOCK_MONOTONIC_RAW, ");
+	fprintf(stderr, "overhead %llu ns\n", (unsigned long long)clock_overhead());
+
+	if (opts.cpu >= 0) {
+		CPU_ZERO(&set);
+		CPU_SET(opts.cpu, &set);
+		if (sched_setaffinity(0, sizeof(set), &set)) {
+			perror("sched_setaffinity()");
+			return 1;
+		}
+	}
+
+	if (opts.load) {
+		load = calloc(opts.load, sizeof(*load));
+		if (!load)
+			return 1;
+		pthread_barrier_init(&load_ready, NULL, opts.load + 1);
+		for (i = 0; i < opts.load; i++) {
+			load[i].alg = &opts.algs[0];
+			if (pthread_create(&load[i].thread, NULL, load_routine, &load[i])) {
+				perror("pthread_create()");
+				return 1;
+			}
+		}
+		pthread_barrier_wait(&load_ready);
+	}
+
+	bench_report_begin(stdout, opts.format);
+	for (a = 0; a < opts.nalgs; a++) {
+		for (m = 0; m < opts.nmodes; m++) {
+#ifndef ENABLE_ASYNC
+			if (opts.modes[m] == MODE_ASYNC) {
+				fprintf(stderr, "async mode needs ENABLE_ASYNC\n");
+				continue;
+			}
+#endif
+			if (opts.algs[a].aead && opts.modes[m] == MODE_ASYNC) {
+				fprintf(stderr, "%s has no async mode, skipped\n",
+						opts.algs[a].name);
+				continue;
+			}
+			if (run(&opts.algs[a], opts.modes[m]))
+				failed = 1;
+		}
+	}
+	bench_report_end(stdout, opts.format);
+
+	if (opts.load) {
+		__atomic_store_n(&load_stop, 1, __ATOMIC_RELAXED);
+		for (i = 0; i < opts.load; i++) {
+			pthread_join(load[i].thread, NULL);
+			load_ops += load[i].ops;
+		}
+		fprintf(stderr, "load: %.0f operations of %u bytes\n", load_ops,
+				opts.load_size);
+		free(load);
+	}
+
+	return failed;
+}
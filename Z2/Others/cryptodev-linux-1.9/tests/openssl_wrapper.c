@@ -1,9 +1,33 @@
+/* the low level AES and HMAC calls are deprecated from OpenSSL 3.0 */
+#define OPENSSL_API_COMPAT 0x10100000L
+
 #include <crypto/cryptodev.h>
 #include <stdio.h>
 #include <string.h>
 #include <openssl/aes.h>
 #include <openssl/evp.h>
 #include <openssl/hmac.h>
+#include "openssl_wrapper.h"
+
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+static HMAC_CTX *HMAC_CTX_new(void)
+{
+	HMAC_CTX *ctx = OPENSSL_malloc(sizeof(*ctx));
+
+	if (ctx)
+		HMAC_CTX_init(ctx);
+	return ctx;
+}
+
+static void HMAC_CTX_free(HMAC_CTX *ctx)
+{
+	HMAC_CTX_cleanup(ctx);
+	OPENSSL_free(ctx);
+}
+
+#define EVP_MD_CTX_new EVP_MD_CTX_create
+#define EVP_MD_CTX_free EVP_MD_CTX_destroy
+#endif
 
 //#define DEBUG
 
@@ -21,11 +45,19 @@ enum ctx_type {
 	ctx_type_none = 0,
 	ctx_type_hmac,
 	ctx_type_md,
+	ctx_type_aead,
+};
+
+/* an authenc session keeps its keyed contexts until openssl_fsession() */
+struct aead_ctx {
+	EVP_CIPHER_CTX *cipher;
+	HMAC_CTX *hmac;
 };
 
 union openssl_ctx {
-	HMAC_CTX hmac;
-	EVP_MD_CTX md;
+	HMAC_CTX *hmac;
+	EVP_MD_CTX *md;
+	struct aead_ctx aead;
 };
 
 struct ctx_mapping {
@@ -64,12 +96,17 @@ static void remove_mapping(__u32 ses)
 	case ctx_type_none:
 		break;
 	case ctx_type_hmac:
-		dbgp("%s: calling HMAC_CTX_cleanup\n", __func__);
-		HMAC_CTX_cleanup(&mapping->ctx.hmac);
+		dbgp("%s: calling HMAC_CTX_free\n", __func__);
+		HMAC_CTX_free(mapping->ctx.hmac);
 		break;
 	case ctx_type_md:
-		dbgp("%s: calling EVP_MD_CTX_cleanup\n", __func__);
-		EVP_MD_CTX_cleanup(&mapping->ctx.md);
+		dbgp("%s: calling EVP_MD_CTX_free\n", __func__);
+		EVP_MD_CTX_free(mapping->ctx.md);
+		break;
+	case ctx_type_aead:
+		dbgp("%s: freeing the authenc contexts\n", __func__);
+		EVP_CIPHER_CTX_free(mapping->ctx.aead.cipher);
+		HMAC_CTX_free(mapping->ctx.aead.hmac);
 		break;
 	}
 	memset(mapping, 0, sizeof(*mapping));
@@ -84,8 +121,26 @@ static union openssl_ctx *__ses_to_ctx(__u32 ses)
 	return &mapping->ctx;
 }
 
-static HMAC_CTX *ses_to_hmac(__u32 ses) { return (HMAC_CTX *)__ses_to_ctx(ses); }
-static EVP_MD_CTX *ses_to_md(__u32 ses) { return (EVP_MD_CTX *)__ses_to_ctx(ses); }
+static HMAC_CTX *ses_to_hmac(__u32 ses)
+{
+	union openssl_ctx *ctx = __ses_to_ctx(ses);
+
+	return ctx ? ctx->hmac : NULL;
+}
+
+static EVP_MD_CTX *ses_to_md(__u32 ses)
+{
+	union openssl_ctx *ctx = __ses_to_ctx(ses);
+
+	return ctx ? ctx->md : NULL;
+}
+
+static struct aead_ctx *ses_to_aead(__u32 ses)
+{
+	union openssl_ctx *ctx = __ses_to_ctx(ses);
+
+	return ctx ? &ctx->aead : NULL;
+}
 
 static const EVP_MD *sess_to_evp_md(struct session_op *sess)
 {
@@ -125,12 +180,16 @@ static int openssl_hmac(struct session_op *sess, struct crypt_op *cop)
 			return 1;
 		}
 
+		dbgp("calling HMAC_CTX_new");
+		ctx = HMAC_CTX_new();
+		if (!ctx) {
+			printf("%s: HMAC_CTX_new failed\n", __func__);
+			return 1;
+		}
 		mapping->ses = sess->ses;
 		mapping->type = ctx_type_hmac;
-		ctx = &mapping->ctx.hmac;
+		mapping->ctx.hmac = ctx;
 
-		dbgp("calling HMAC_CTX_init");
-		HMAC_CTX_init(ctx);
 		dbgp("calling HMAC_Init_ex");
 		if (!HMAC_Init_ex(ctx, sess->mackey, sess->mackeylen,
 				sess_to_evp_md(sess), NULL)) {
@@ -170,12 +229,16 @@ static int openssl_md(struct session_op *sess, struct crypt_op *cop)
 			return 1;
 		}
 
+		dbgp("calling EVP_MD_CTX_new");
+		ctx = EVP_MD_CTX_new();
+		if (!ctx) {
+			printf("%s: EVP_MD_CTX_new failed\n", __func__);
+			return 1;
+		}
 		mapping->ses = sess->ses;
 		mapping->type = ctx_type_md;
-		ctx = &mapping->ctx.md;
+		mapping->ctx.md = ctx;
 
-		dbgp("calling EVP_MD_CTX_init");
-		EVP_MD_CTX_init(ctx);
 		dbgp("calling EVP_DigestInit");
 		EVP_DigestInit(ctx, sess_to_evp_md(sess));
 	}
@@ -265,3 +328,208 @@ int openssl_cioccrypt(struct session_op *sess, struct crypt_op *cop)
 
 	return 0;
 }
+
+static const EVP_CIPHER *sess_to_evp_cipher(struct session_op *sess)
+{
+	switch (sess->cipher) {
+	case CRYPTO_AES_CBC:
+		switch (sess->keylen) {
+		case 16: return EVP_aes_128_cbc();
+		case 24: return EVP_aes_192_cbc();
+		case 32: return EVP_aes_256_cbc();
+		}
+		break;
+	case CRYPTO_AES_CTR:
+		switch (sess->keylen) {
+		case 16: return EVP_aes_128_ctr();
+		case 24: return EVP_aes_192_ctr();
+		case 32: return EVP_aes_256_ctr();
+		}
+		break;
+	case CRYPTO_AES_GCM:
+		switch (sess->keylen) {
+		case 16: return EVP_aes_128_gcm();
+		case 24: return EVP_aes_192_gcm();
+		case 32: return EVP_aes_256_gcm();
+		}
+		break;
+	}
+	printf("%s: failed to get an EVP cipher, things will be broken!\n", __func__);
+	return NULL;
+}
+
+/* Keys the contexts of an authenc session once, so that an operation
+ * only sets the IV, as the module's sessions do.
+ */
+static struct aead_ctx *aead_setup(struct session_op *sess)
+{
+	struct ctx_mapping *mapping;
+	struct aead_ctx *ctx = ses_to_aead(sess->ses);
+	const EVP_CIPHER *cipher;
+
+	if (ctx)
+		return ctx;
+
+	cipher = sess_to_evp_cipher(sess);
+	if (!cipher)
+		return NULL;
+
+	if (!(mapping = new_mapping())) {
+		printf("%s: failed to get new mapping\n", __func__);
+		return NULL;
+	}
+	mapping->ses = sess->ses;
+	mapping->type = ctx_type_aead;
+	ctx = &mapping->ctx.aead;
+
+	ctx->cipher = EVP_CIPHER_CTX_new();
+	if (!ctx->cipher ||
+	    !EVP_EncryptInit_ex(ctx->cipher, cipher, NULL, sess->key, NULL)) {
+		printf("%s: EVP_EncryptInit_ex failed\n", __func__);
+		goto fail;
+	}
+	EVP_CIPHER_CTX_set_padding(ctx->cipher, 0);
+
+	if (sess->mac) {
+		ctx->hmac = HMAC_CTX_new();
+		if (!ctx->hmac ||
+		    !HMAC_Init_ex(ctx->hmac, sess->mackey, sess->mackeylen,
+				sess_to_evp_md(sess), NULL)) {
+			printf("%s: HMAC_Init_ex failed\n", __func__);
+			goto fail;
+		}
+	}
+	return ctx;
+
+fail:
+	remove_mapping(sess->ses);
+	return NULL;
+}
+
+static int aead_gcm(struct aead_ctx *ctx, struct crypt_auth_op *caop)
+{
+	int outl;
+
+	if (caop->tag_len == 0)
+		caop->tag_len = 16;
+
+	if (!EVP_CIPHER_CTX_ctrl(ctx->cipher, EVP_CTRL_GCM_SET_IVLEN,
+				caop->iv_len, NULL) ||
+	    !EVP_EncryptInit_ex(ctx->cipher, NULL, NULL, NULL, caop->iv) ||
+	    (caop->auth_len && !EVP_EncryptUpdate(ctx->cipher, NULL, &outl,
+				caop->auth_src, caop->auth_len)) ||
+	    !EVP_EncryptUpdate(ctx->cipher, caop->dst, &outl,
+				caop->src, caop->len) ||
+	    !EVP_EncryptFinal_ex(ctx->cipher, caop->dst + outl, &outl) ||
+	    !EVP_CIPHER_CTX_ctrl(ctx->cipher, EVP_CTRL_GCM_GET_TAG,
+				caop->tag_len, caop->dst + caop->len)) {
+		printf("%s: GCM encryption failed\n", __func__);
+		return 1;
+	}
+	caop->len += caop->tag_len;
+	return 0;
+}
+
+/* MAC, pad and encrypt the TLS 1.0 way, as tls_auth_n_crypt() */
+static int aead_tls(struct aead_ctx *ctx, struct crypt_auth_op *caop)
+{
+	int bs = EVP_CIPHER_CTX_block_size(ctx->cipher);
+	unsigned char hash[EVP_MAX_MD_SIZE];
+	unsigned int hash_len, len = caop->len, pad, i;
+	int outl;
+
+	if (caop->src != caop->dst)
+		memmove(caop->dst, caop->src, len);
+
+	if (!HMAC_Init_ex(ctx->hmac, NULL, 0, NULL, NULL) ||
+	    (caop->auth_len &&
+	     !HMAC_Update(ctx->hmac, caop->auth_src, caop->auth_len)) ||
+	    !HMAC_Update(ctx->hmac, caop->dst, len) ||
+	    !HMAC_Final(ctx->hmac, hash, &hash_len)) {
+		printf("%s: HMAC failed\n", __func__);
+		return 1;
+	}
+	if (caop->tag_len == 0 || caop->tag_len > hash_len)
+		caop->tag_len = hash_len;
+	memcpy(caop->dst + len, hash, caop->tag_len);
+	len += caop->tag_len;
+
+	pad = bs - len % bs;
+	for (i = 0; i < pad; i++)
+		caop->dst[len + i] = pad - 1;
+	len += pad;
+
+	if (!EVP_EncryptInit_ex(ctx->cipher, NULL, NULL, NULL, caop->iv) ||
+	    !EVP_EncryptUpdate(ctx->cipher, caop->dst, &outl, caop->dst, len)) {
+		printf("%s: CBC encryption failed\n", __func__);
+		return 1;
+	}
+	caop->len = len;
+	return 0;
+}
+
+/* encrypt dst in place, then MAC auth_src which covers it, as
+ * srtp_auth_n_crypt() */
+static int aead_srtp(struct aead_ctx *ctx, struct crypt_auth_op *caop)
+{
+	unsigned char hash[EVP_MAX_MD_SIZE];
+	unsigned int hash_len;
+	int outl;
+
+	if (!EVP_EncryptInit_ex(ctx->cipher, NULL, NULL, NULL, caop->iv) ||
+	    !EVP_EncryptUpdate(ctx->cipher, caop->dst, &outl,
+				caop->dst, caop->len)) {
+		printf("%s: CTR encryption failed\n", __func__);
+		return 1;
+	}
+
+	if (!HMAC_Init_ex(ctx->hmac, NULL, 0, NULL, NULL) ||
+	    !HMAC_Update(ctx->hmac, caop->auth_src, caop->auth_len) ||
+	    !HMAC_Final(ctx->hmac, hash, &hash_len)) {
+		printf("%s: HMAC failed\n", __func__);
+		return 1;
+	}
+	if (caop->tag_len == 0 || caop->tag_len > hash_len)
+		caop->tag_len = hash_len;
+	memcpy(caop->tag, hash, caop->tag_len);
+	return 0;
+}
+
+int openssl_ciocauthcrypt(struct session_op *sess, struct crypt_auth_op *caop)
+{
+	struct aead_ctx *ctx;
+
+	if (caop->op != COP_ENCRYPT) {
+		printf("%s: only encryption is supported\n", __func__);
+		return 1;
+	}
+
+	if (!(ctx = aead_setup(sess)))
+		return 1;
+
+	if (caop->flags & COP_FLAG_AEAD_SRTP_TYPE) {
+		if (!ctx->hmac || sess->cipher != CRYPTO_AES_CTR) {
+			printf("%s: SRTP needs a CTR cipher and a MAC\n", __func__);
+			return 1;
+		}
+		return aead_srtp(ctx, caop);
+	}
+	if (caop->flags & COP_FLAG_AEAD_TLS_TYPE) {
+		if (!ctx->hmac || sess->cipher != CRYPTO_AES_CBC) {
+			printf("%s: TLS needs a CBC cipher and a MAC\n", __func__);
+			return 1;
+		}
+		return aead_tls(ctx, caop);
+	}
+	if (sess->cipher != CRYPTO_AES_GCM) {
+		printf("%s: unknown authenc operation\n", __func__);
+		return 1;
+	}
+	return aead_gcm(ctx, caop);
+}
+
+void openssl_fsession(__u32 ses)
+{
+	if (find_mapping(ses))
+		remove_mapping(ses);
+}
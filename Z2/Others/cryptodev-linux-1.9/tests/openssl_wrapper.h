@@ -2,5 +2,9 @@
 #define __OPENSSL_WRAPPER_H
 
 int openssl_cioccrypt(struct session_op *, struct crypt_op *);
+/* encryption only; the keys of sess must stay valid until
+ * openssl_fsession() */
+int openssl_ciocauthcrypt(struct session_op *, struct crypt_auth_op *);
+void openssl_fsession(__u32 ses);
 
 #endif /* __OPENSSL_WRAPPER_H */
@@ -0,0 +1,319 @@
+/*
+ * Check the RSA operations of CIOCKEY against OpenSSL: the private key
+ * operation of CRK_MOD_EXP_CRT, synchronously and through the async
+ * queue, the public one of CRK_MOD_EXP and the refusal of a modulus
+ * size the kernel's rsa does not take.
+ *
+ * Placed under public domain.
+ *
+ */
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/ioctl.h>
+#include <openssl/bn.h>
+#include <openssl/core_names.h>
+#include <openssl/evp.h>
+#include <openssl/rsa.h>
+#include <crypto/cryptodev.h>
+
+static int debug = 0;
+
+#define	KEY_BITS	2048
+#define	KEY_SIZE	(KEY_BITS / 8)
+#define	ASYNC_JOBS	8
+
+/* the key, as little endian CIOCKEY parameters */
+enum { P, Q, DP, DQ, QINV, N, E, NPARTS };
+static const char *part_names[NPARTS] = {
+	OSSL_PKEY_PARAM_RSA_FACTOR1, OSSL_PKEY_PARAM_RSA_FACTOR2,
+	OSSL_PKEY_PARAM_RSA_EXPONENT1, OSSL_PKEY_PARAM_RSA_EXPONENT2,
+	OSSL_PKEY_PARAM_RSA_COEFFICIENT1, OSSL_PKEY_PARAM_RSA_N,
+	OSSL_PKEY_PARAM_RSA_E
+};
+static uint8_t part[NPARTS][KEY_SIZE];
+
+static EVP_PKEY *pkey;
+
+static int
+key_setup(void)
+{
+	EVP_PKEY_CTX *ctx;
+	BIGNUM *bn = NULL;
+	int i, ok;
+
+	ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_RSA, NULL);
+	ok = ctx && EVP_PKEY_keygen_init(ctx) > 0 &&
+		EVP_PKEY_CTX_set_rsa_keygen_bits(ctx, KEY_BITS) > 0 &&
+		EVP_PKEY_keygen(ctx, &pkey) > 0;
+	EVP_PKEY_CTX_free(ctx);
+
+	for (i = 0; ok && i < NPARTS; i++) {
+		ok = EVP_PKEY_get_bn_param(pkey, part_names[i], &bn) &&
+			BN_bn2lebinpad(bn, part[i], KEY_SIZE) == KEY_SIZE;
+		BN_clear_free(bn);
+		bn = NULL;
+	}
+	if (!ok)
+		fprintf(stderr, "OpenSSL key generation failed\n");
+	return ok ? 0 : -1;
+}
+
+/* x^d mod n by OpenSSL, little endian like x */
+static int
+openssl_private(const uint8_t *x, uint8_t *y)
+{
+	EVP_PKEY_CTX *ctx = EVP_PKEY_CTX_new(pkey, NULL);
+	uint8_t in[KEY_SIZE], out[KEY_SIZE];
+	size_t outlen = sizeof(out);
+	int i, ok;
+
+	for (i = 0; i < KEY_SIZE; i++)
+		in[i] = x[KEY_SIZE - 1 - i];
+	ok = ctx && EVP_PKEY_decrypt_init(ctx) > 0 &&
+		EVP_PKEY_CTX_set_rsa_padding(ctx, RSA_NO_PADDING) > 0 &&
+		EVP_PKEY_decrypt(ctx, out, &outlen, in, sizeof(in)) > 0 &&
+		outlen == KEY_SIZE;
+	EVP_PKEY_CTX_free(ctx);
+	for (i = 0; i < KEY_SIZE; i++)
+		y[i] = out[KEY_SIZE - 1 - i];
+	return ok ? 0 : -1;
+}
+
+static void
+set_param(struct crypt_kop *kop, int i, uint8_t *p, int nbits)
+{
+	kop->crk_param[i].crp_p = p;
+	kop->crk_param[i].crp_nbits = nbits;
+}
+
+/* p, q, x, dp, dq, qinv and e in, x^d mod pq out */
+static void
+crt_kop(struct crypt_kop *kop, uint8_t *x, uint8_t *y)
+{
+	memset(kop, 0, sizeof(*kop));
+	kop->crk_op = CRK_MOD_EXP_CRT;
+	kop->crk_iparams = 7;
+	kop->crk_oparams = 1;
+	set_param(kop, 0, part[P], KEY_BITS);
+	set_param(kop, 1, part[Q], KEY_BITS);
+	set_param(kop, 2, x, KEY_BITS);
+	set_param(kop, 3, part[DP], KEY_BITS);
+	set_param(kop, 4, part[DQ], KEY_BITS);
+	set_param(kop, 5, part[QINV], KEY_BITS);
+	set_param(kop, 6, part[E], KEY_BITS);
+	set_param(kop, 7, y, KEY_BITS);
+}
+
+static void
+message(uint8_t *x, unsigned int seed)
+{
+	int i;
+
+	for (i = 0; i < KEY_SIZE; i++)
+		x[i] = rand_r(&seed);
+	/* below the modulus */
+	x[KEY_SIZE - 1] &= 0x7f;
+}
+
+static int
+test_sync(int cfd)
+{
+	uint8_t x[KEY_SIZE], y[KEY_SIZE], expected[KEY_SIZE], back[KEY_SIZE];
+	struct crypt_kop kop;
+
+	message(x, 1);
+	if (openssl_private(x, expected))
+		return 1;
+
+	crt_kop(&kop, x, y);
+	if (ioctl(cfd, CIOCKEY, &kop)) {
+		perror("ioctl(CIOCKEY)");
+		return 1;
+	}
+	if (memcmp(y, expected, KEY_SIZE) != 0) {
+		fprintf(stderr, "FAIL: CRK_MOD_EXP_CRT differs from OpenSSL\n");
+		return 1;
+	}
+
+	/* and back with the public key */
+	memset(&kop, 0, sizeof(kop));
+	kop.crk_op = CRK_MOD_EXP;
+	kop.crk_iparams = 3;
+	kop.crk_oparams = 1;
+	set_param(&kop, 0, y, KEY_BITS);
+	set_param(&kop, 1, part[E], KEY_BITS);
+	set_param(&kop, 2, part[N], KEY_BITS);
+	set_param(&kop, 3, back, KEY_BITS);
+	if (ioctl(cfd, CIOCKEY, &kop)) {
+		perror("ioctl(CIOCKEY)");
+		return 1;
+	}
+	if (memcmp(back, x, KEY_SIZE) != 0) {
+		fprintf(stderr, "FAIL: CRK_MOD_EXP does not invert CRK_MOD_EXP_CRT\n");
+		return 1;
+	}
+
+	if (debug)
+		printf("%s: Test passed\n", __func__);
+	return 0;
+}
+
+static int
+test_modulus_size(int cfd)
+{
+	static uint8_t n[8192 / 8], base[8192 / 8], out[8192 / 8];
+	uint8_t e[1] = { 3 };
+	struct crypt_kop kop;
+
+	/* an odd 8192 bit modulus, within the parameter limit but beyond
+	 * the sizes of the kernel's rsa */
+	memset(n, 0xa5, sizeof(n));
+	n[0] |= 1;
+	n[sizeof(n) - 1] |= 0x80;
+	base[0] = 2;
+
+	memset(&kop, 0, sizeof(kop));
+	kop.crk_op = CRK_MOD_EXP;
+	kop.crk_iparams = 3;
+	kop.crk_oparams = 1;
+	set_param(&kop, 0, base, 8192);
+	set_param(&kop, 1, e, 8);
+	set_param(&kop, 2, n, 8192);
+	set_param(&kop, 3, out, 8192);
+	if (ioctl(cfd, CIOCKEY, &kop) == 0 || errno != EOPNOTSUPP) {
+		fprintf(stderr, "FAIL: an 8192 bit modulus was not refused "
+				"with EOPNOTSUPP\n");
+		return 1;
+	}
+
+	if (debug)
+		printf("%s: Test passed\n", __func__);
+	return 0;
+}
+
+#ifdef ENABLE_ASYNC
+static int
+test_async(int cfd)
+{
+	static uint8_t x[ASYNC_JOBS][KEY_SIZE], y[ASYNC_JOBS][KEY_SIZE];
+	uint8_t expected[KEY_SIZE];
+	struct crypt_kop kop;
+	struct crypt_op cryp;
+	struct pollfd pfd;
+	int i, fetched = 0, seen[ASYNC_JOBS] = { 0 };
+
+	for (i = 0; i < ASYNC_JOBS; i++) {
+		message(x[i], i + 2);
+		crt_kop(&kop, x[i], y[i]);
+		if (ioctl(cfd, CIOCASYNCKEY, &kop)) {
+			perror("ioctl(CIOCASYNCKEY)");
+			return 1;
+		}
+	}
+
+	pfd.fd = cfd;
+	pfd.events = POLLIN;
+	while (fetched < ASYNC_JOBS) {
+		if (poll(&pfd, 1, 10000) < 1) {
+			fprintf(stderr, "FAIL: key jobs did not complete\n");
+			return 1;
+		}
+		/* not a key operation's to take */
+		memset(&cryp, 0, sizeof(cryp));
+		if (ioctl(cfd, CIOCASYNCFETCH, &cryp) == 0 || errno != EBUSY) {
+			fprintf(stderr, "FAIL: CIOCASYNCFETCH took a key job\n");
+			return 1;
+		}
+
+		if (ioctl(cfd, CIOCASYNCFETCHKEY, &kop)) {
+			if (errno == EBUSY)
+				continue;
+			perror("ioctl(CIOCASYNCFETCHKEY)");
+			return 1;
+		}
+		i = (kop.crk_param[7].crp_p - y[0]) / KEY_SIZE;
+		if (i < 0 || i >= ASYNC_JOBS || seen[i]++) {
+			fprintf(stderr, "FAIL: fetched an unknown key job\n");
+			return 1;
+		}
+		fetched++;
+	}
+
+	for (i = 0; i < ASYNC_JOBS; i++) {
+		if (openssl_private(x[i], expected))
+			return 1;
+		if (memcmp(y[i], expected, KEY_SIZE) != 0) {
+			fprintf(stderr, "FAIL: async job %d differs from OpenSSL\n", i);
+			return 1;
+		}
+	}
+
+	if (debug)
+		printf("%s: Test passed\n", __func__);
+	return 0;
+}
+#endif
+
+int
+main(int argc, char** argv)
+{
+	int fd = -1, cfd = -1;
+	uint32_t features;
+
+	if (argc > 1) debug = 1;
+
+	/* Open the crypto device */
+	fd = open("/dev/crypto", O_RDWR, 0);
+	if (fd < 0) {
+		perror("open(/dev/crypto)");
+		return 1;
+	}
+
+	/* Clone file descriptor */
+	if (ioctl(fd, CRIOGET, &cfd)) {
+		perror("ioctl(CRIOGET)");
+		return 1;
+	}
+
+	if (ioctl(cfd, CIOCASYMFEAT, &features)) {
+		perror("ioctl(CIOCASYMFEAT)");
+		return 1;
+	}
+	if ((features & (CRF_MOD_EXP | CRF_MOD_EXP_CRT)) !=
+	    (CRF_MOD_EXP | CRF_MOD_EXP_CRT)) {
+		/* no rsa in this kernel */
+		printf("rsa operations not supported, skipped\n");
+		return 0;
+	}
+
+	if (key_setup())
+		return 1;
+
+	if (test_sync(cfd) || test_modulus_size(cfd))
+		return 1;
+#ifdef ENABLE_ASYNC
+	if (test_async(cfd))
+		return 1;
+#endif
+	EVP_PKEY_free(pkey);
+
+	/* Close cloned descriptor */
+	if (close(cfd)) {
+		perror("close(cfd)");
+		return 1;
+	}
+
+	/* Close the original descriptor */
+	if (close(fd)) {
+		perror("close(fd)");
+		return 1;
+	}
+
+	return 0;
+}
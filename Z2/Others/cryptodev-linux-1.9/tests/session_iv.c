@@ -0,0 +1,338 @@
+/*
+ * Demo on how to let the kernel keep the IV of a session, for CTR
+ * streams and GCM nonces; CBC sessions are refused.
+ *
+ * Placed under public domain.
+ *
+ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/ioctl.h>
+#include <crypto/cryptodev.h>
+
+static int debug = 0;
+
+#define	CHUNK_SIZE	4096
+#define	CHUNKS		3
+#define	BLOCK_SIZE	16
+#define	KEY_SIZE	16
+#define	NONCE_SIZE	12
+#define	TAG_SIZE	16
+
+/* add n to the big endian number ctr */
+static void ctr_add(uint8_t *ctr, int size, unsigned int n)
+{
+	int i;
+
+	for (i = size - 1; i >= 0 && n; i--) {
+		n += ctr[i];
+		ctr[i] = n & 0xff;
+		n >>= 8;
+	}
+}
+
+static int set_session_iv(int cfd, uint32_t ses, uint8_t *iv, int len)
+{
+	struct crypt_sessiv_op sivop;
+
+	memset(&sivop, 0, sizeof(sivop));
+	sivop.ses = ses;
+	sivop.iv_len = len;
+	sivop.iv = iv;
+	if (ioctl(cfd, CIOCSESSIV, &sivop)) {
+		perror("ioctl(CIOCSESSIV)");
+		return 1;
+	}
+	return 0;
+}
+
+static int
+test_ctr(int cfd)
+{
+	static uint8_t plaintext[CHUNKS * CHUNK_SIZE], expected[CHUNKS * CHUNK_SIZE];
+	static uint8_t out[CHUNK_SIZE];
+	uint8_t key[KEY_SIZE], iv[BLOCK_SIZE], used[BLOCK_SIZE];
+	struct session_op sess;
+	struct crypt_op cryp;
+	int i;
+
+	memset(key, 0x33, sizeof(key));
+	memset(iv, 0x03, sizeof(iv));
+	for (i = 0; i < sizeof(plaintext); i++)
+		plaintext[i] = i & 0xff;
+
+	memset(&sess, 0, sizeof(sess));
+	sess.cipher = CRYPTO_AES_CTR;
+	sess.keylen = KEY_SIZE;
+	sess.key = key;
+	if (ioctl(cfd, CIOCGSESSION, &sess)) {
+		perror("ioctl(CIOCGSESSION)");
+		return 1;
+	}
+
+	/* without a session IV the kernel has nothing to use */
+	memset(&cryp, 0, sizeof(cryp));
+	cryp.ses = sess.ses;
+	cryp.len = CHUNK_SIZE;
+	cryp.src = plaintext;
+	cryp.dst = out;
+	cryp.op = COP_ENCRYPT;
+	cryp.flags = COP_FLAG_KERNEL_IV;
+	if (ioctl(cfd, CIOCCRYPT, &cryp) == 0) {
+		fprintf(stderr, "FAIL: kernel IV used before it was set\n");
+		return 1;
+	}
+
+	/* the whole stream at once, as reference */
+	memset(&cryp, 0, sizeof(cryp));
+	cryp.ses = sess.ses;
+	cryp.len = sizeof(plaintext);
+	cryp.src = plaintext;
+	cryp.dst = expected;
+	cryp.iv = iv;
+	cryp.op = COP_ENCRYPT;
+	if (ioctl(cfd, CIOCCRYPT, &cryp)) {
+		perror("ioctl(CIOCCRYPT)");
+		return 1;
+	}
+
+	if (set_session_iv(cfd, sess.ses, iv, sizeof(iv)))
+		return 1;
+
+	/* chunk by chunk, the counter kept by the kernel */
+	for (i = 0; i < CHUNKS; i++) {
+		memset(&cryp, 0, sizeof(cryp));
+		cryp.ses = sess.ses;
+		cryp.len = CHUNK_SIZE;
+		cryp.src = plaintext + i * CHUNK_SIZE;
+		cryp.dst = out;
+		cryp.iv = used;
+		cryp.op = COP_ENCRYPT;
+		cryp.flags = COP_FLAG_KERNEL_IV;
+		if (ioctl(cfd, CIOCCRYPT, &cryp)) {
+			perror("ioctl(CIOCCRYPT)");
+			return 1;
+		}
+
+		if (memcmp(out, expected + i * CHUNK_SIZE, CHUNK_SIZE) != 0) {
+			fprintf(stderr, "FAIL: chunk %d differs from the stream\n", i);
+			return 1;
+		}
+		if (memcmp(used, iv, sizeof(iv)) != 0) {
+			fprintf(stderr, "FAIL: chunk %d used an unexpected counter\n", i);
+			return 1;
+		}
+		ctr_add(iv, sizeof(iv), CHUNK_SIZE / BLOCK_SIZE);
+	}
+
+	if (ioctl(cfd, CIOCFSESSION, &sess.ses)) {
+		perror("ioctl(CIOCFSESSION)");
+		return 1;
+	}
+
+	if (debug)
+		printf("%s: Test passed\n", __func__);
+	return 0;
+}
+
+static int
+test_gcm(int cfd)
+{
+	static uint8_t plaintext[CHUNK_SIZE], decrypted[CHUNK_SIZE + TAG_SIZE];
+	static uint8_t ciphertext[CHUNK_SIZE + TAG_SIZE];
+	uint8_t key[KEY_SIZE], nonce[NONCE_SIZE], used[NONCE_SIZE];
+	uint8_t next[NONCE_SIZE];
+	struct session_op sess;
+	struct crypt_auth_op cao;
+	int i;
+
+	memset(key, 0x44, sizeof(key));
+	memset(plaintext, 0x15, sizeof(plaintext));
+	/* the counter must carry over the low byte */
+	memset(nonce, 0x04, sizeof(nonce));
+	nonce[NONCE_SIZE - 1] = 0xff;
+
+	memset(&sess, 0, sizeof(sess));
+	sess.cipher = CRYPTO_AES_GCM;
+	sess.keylen = KEY_SIZE;
+	sess.key = key;
+	if (ioctl(cfd, CIOCGSESSION, &sess)) {
+		perror("ioctl(CIOCGSESSION)");
+		return 1;
+	}
+
+	if (set_session_iv(cfd, sess.ses, nonce, sizeof(nonce)))
+		return 1;
+
+	for (i = 0; i < 2; i++) {
+		memset(&cao, 0, sizeof(cao));
+		cao.ses = sess.ses;
+		cao.len = sizeof(plaintext);
+		cao.src = plaintext;
+		cao.dst = ciphertext;
+		cao.iv = used;
+		cao.iv_len = NONCE_SIZE;
+		cao.op = COP_ENCRYPT;
+		cao.flags = COP_FLAG_KERNEL_IV;
+		if (ioctl(cfd, CIOCAUTHCRYPT, &cao)) {
+			perror("ioctl(CIOCAUTHCRYPT)");
+			return 1;
+		}
+
+		if (memcmp(used, nonce, sizeof(nonce)) != 0) {
+			fprintf(stderr, "FAIL: operation %d used an unexpected nonce\n", i);
+			return 1;
+		}
+		ctr_add(nonce, sizeof(nonce), 1);
+	}
+
+	/* an operation that fails uses its nonce up all the same: this
+	 * one runs with the nonce after the ciphertext's and cannot
+	 * authenticate it */
+	memset(&cao, 0, sizeof(cao));
+	cao.ses = sess.ses;
+	cao.len = sizeof(ciphertext);
+	cao.src = ciphertext;
+	cao.dst = decrypted;
+	cao.iv_len = NONCE_SIZE;
+	cao.op = COP_DECRYPT;
+	cao.flags = COP_FLAG_KERNEL_IV;
+	if (ioctl(cfd, CIOCAUTHCRYPT, &cao) == 0) {
+		fprintf(stderr, "FAIL: decrypted with the wrong nonce\n");
+		return 1;
+	}
+	ctr_add(nonce, sizeof(nonce), 1);
+
+	memset(&cao, 0, sizeof(cao));
+	cao.ses = sess.ses;
+	cao.len = sizeof(plaintext);
+	cao.src = plaintext;
+	cao.dst = decrypted;
+	cao.iv = next;
+	cao.iv_len = NONCE_SIZE;
+	cao.op = COP_ENCRYPT;
+	cao.flags = COP_FLAG_KERNEL_IV;
+	if (ioctl(cfd, CIOCAUTHCRYPT, &cao)) {
+		perror("ioctl(CIOCAUTHCRYPT)");
+		return 1;
+	}
+	if (memcmp(next, nonce, sizeof(nonce)) != 0) {
+		fprintf(stderr, "FAIL: the nonce of a failed operation was reused\n");
+		return 1;
+	}
+
+	/* the last ciphertext decrypts with the nonce reported for it */
+	memset(&cao, 0, sizeof(cao));
+	cao.ses = sess.ses;
+	cao.len = sizeof(ciphertext);
+	cao.src = ciphertext;
+	cao.dst = decrypted;
+	cao.iv = used;
+	cao.iv_len = NONCE_SIZE;
+	cao.op = COP_DECRYPT;
+	if (ioctl(cfd, CIOCAUTHCRYPT, &cao)) {
+		perror("ioctl(CIOCAUTHCRYPT)");
+		return 1;
+	}
+	if (memcmp(decrypted, plaintext, sizeof(plaintext)) != 0) {
+		fprintf(stderr, "FAIL: decrypted data differ\n");
+		return 1;
+	}
+
+	if (ioctl(cfd, CIOCFSESSION, &sess.ses)) {
+		perror("ioctl(CIOCFSESSION)");
+		return 1;
+	}
+
+	if (debug)
+		printf("%s: Test passed\n", __func__);
+	return 0;
+}
+
+/* a CBC session would chain its IV from the last ciphertext block,
+ * which the sender of the next plaintext knows in advance */
+static int
+test_cbc(int cfd)
+{
+	uint8_t key[KEY_SIZE], iv[BLOCK_SIZE];
+	struct crypt_sessiv_op sivop;
+	struct session_op sess;
+
+	memset(key, 0x55, sizeof(key));
+	memset(iv, 0x05, sizeof(iv));
+
+	memset(&sess, 0, sizeof(sess));
+	sess.cipher = CRYPTO_AES_CBC;
+	sess.keylen = KEY_SIZE;
+	sess.key = key;
+	if (ioctl(cfd, CIOCGSESSION, &sess)) {
+		perror("ioctl(CIOCGSESSION)");
+		return 1;
+	}
+
+	memset(&sivop, 0, sizeof(sivop));
+	sivop.ses = sess.ses;
+	sivop.iv_len = sizeof(iv);
+	sivop.iv = iv;
+	if (ioctl(cfd, CIOCSESSIV, &sivop) == 0) {
+		fprintf(stderr, "FAIL: CBC session took a kernel IV\n");
+		return 1;
+	}
+
+	if (ioctl(cfd, CIOCFSESSION, &sess.ses)) {
+		perror("ioctl(CIOCFSESSION)");
+		return 1;
+	}
+
+	if (debug)
+		printf("%s: Test passed\n", __func__);
+	return 0;
+}
+
+int
+main(int argc, char** argv)
+{
+	int fd = -1, cfd = -1;
+
+	if (argc > 1) debug = 1;
+
+	/* Open the crypto device */
+	fd = open("/dev/crypto", O_RDWR, 0);
+	if (fd < 0) {
+		perror("open(/dev/crypto)");
+		return 1;
+	}
+
+	/* Clone file descriptor */
+	if (ioctl(fd, CRIOGET, &cfd)) {
+		perror("ioctl(CRIOGET)");
+		return 1;
+	}
+
+	/* Run the test itself */
+	if (test_ctr(cfd))
+		return 1;
+
+	if (test_gcm(cfd))
+		return 1;
+
+	if (test_cbc(cfd))
+		return 1;
+
+	/* Close cloned descriptor */
+	if (close(cfd)) {
+		perror("close(cfd)");
+		return 1;
+	}
+
+	/* Close the original descriptor */
+	if (close(fd)) {
+		perror("close(fd)");
+		return 1;
+	}
+
+	return 0;
+}
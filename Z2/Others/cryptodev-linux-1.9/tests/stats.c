@@ -0,0 +1,141 @@
+/*
+ * Demo on how to read the performance counters of a /dev/crypto handle.
+ *
+ * Placed under public domain.
+ *
+ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/ioctl.h>
+#include <crypto/cryptodev.h>
+
+static int debug = 0;
+
+#define	DATA_SIZE	4096
+#define	BLOCK_SIZE	16
+#define	KEY_SIZE	16
+#define	NOPS		10
+
+static int
+test_stats(int cfd)
+{
+	uint8_t data[DATA_SIZE];
+	uint8_t iv[BLOCK_SIZE];
+	uint8_t key[KEY_SIZE];
+	struct session_op sess;
+	struct crypt_op cryp;
+	struct crypt_stats_op stats;
+	uint64_t timed = 0;
+	int i;
+
+	memset(&sess, 0, sizeof(sess));
+	memset(key, 0x33,  sizeof(key));
+	memset(iv, 0x03,  sizeof(iv));
+	memset(data, 0x15, sizeof(data));
+
+	/* Get crypto session for AES128 */
+	sess.cipher = CRYPTO_AES_CBC;
+	sess.keylen = KEY_SIZE;
+	sess.key = key;
+	if (ioctl(cfd, CIOCGSESSION, &sess)) {
+		perror("ioctl(CIOCGSESSION)");
+		return 1;
+	}
+
+	for (i = 0; i < NOPS; i++) {
+		memset(&cryp, 0, sizeof(cryp));
+		cryp.ses = sess.ses;
+		cryp.len = sizeof(data);
+		cryp.src = data;
+		cryp.dst = data;
+		cryp.iv = iv;
+		cryp.op = COP_ENCRYPT;
+		if (ioctl(cfd, CIOCCRYPT, &cryp)) {
+			perror("ioctl(CIOCCRYPT)");
+			return 1;
+		}
+	}
+
+	/* Finish crypto session */
+	if (ioctl(cfd, CIOCFSESSION, &sess.ses)) {
+		perror("ioctl(CIOCFSESSION)");
+		return 1;
+	}
+
+	if (ioctl(cfd, CIOCGSTATS, &stats)) {
+		perror("ioctl(CIOCGSTATS)");
+		return 1;
+	}
+
+	for (i = 0; i < CRYPTODEV_LAT_BUCKETS; i++)
+		timed += stats.run_latency[i];
+
+	if (debug) {
+		printf("ops: %llu, bytes: %llu, zero-copy: %llu, bounced: %llu\n",
+			(unsigned long long)stats.ops,
+			(unsigned long long)stats.bytes,
+			(unsigned long long)stats.zc_ops,
+			(unsigned long long)stats.bounce_ops);
+		printf("sessions: %llu created, %llu destroyed\n",
+			(unsigned long long)stats.sessions_created,
+			(unsigned long long)stats.sessions_destroyed);
+	}
+
+	if (stats.ops != NOPS || stats.bytes != NOPS * sizeof(data) ||
+	    stats.zc_ops + stats.bounce_ops != NOPS || timed != NOPS ||
+	    stats.errors != 0) {
+		fprintf(stderr, "FAIL: unexpected operation counters\n");
+		return 1;
+	}
+	if (stats.sessions_created != 1 || stats.sessions_destroyed != 1) {
+		fprintf(stderr, "FAIL: unexpected session counters\n");
+		return 1;
+	}
+
+	if (debug)
+		printf("Test passed\n");
+
+	return 0;
+}
+
+int
+main(int argc, char** argv)
+{
+	int fd = -1, cfd = -1;
+
+	if (argc > 1) debug = 1;
+
+	/* Open the crypto device */
+	fd = open("/dev/crypto", O_RDWR, 0);
+	if (fd < 0) {
+		perror("open(/dev/crypto)");
+		return 1;
+	}
+
+	/* Clone file descriptor */
+	if (ioctl(fd, CRIOGET, &cfd)) {
+		perror("ioctl(CRIOGET)");
+		return 1;
+	}
+
+	/* Run the test itself */
+	if (test_stats(cfd))
+		return 1;
+
+	/* Close cloned descriptor */
+	if (close(cfd)) {
+		perror("close(cfd)");
+		return 1;
+	}
+
+	/* Close the original descriptor */
+	if (close(fd)) {
+		perror("close(fd)");
+		return 1;
+	}
+
+	return 0;
+}
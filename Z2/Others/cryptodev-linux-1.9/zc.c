@@ -32,10 +32,17 @@
 #include <linux/syscalls.h>
 #include <linux/pagemap.h>
 #include <linux/uaccess.h>
+#include <linux/capability.h>
+#include <linux/version.h>
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(4, 11, 0))
+#include <linux/sched/mm.h>
+#include <linux/sched/signal.h>
+#endif
 #include <crypto/scatterwalk.h>
 #include <linux/scatterlist.h>
 #include "cryptodev_int.h"
 #include "zc.h"
+#include "cryptodev_trace.h"
 #include "version.h"
 
 /* Helper functions to assist zero copy.
@@ -45,13 +52,50 @@
 /* offset of buf in it's first page */
 #define PAGEOFFSET(buf) ((unsigned long)buf & ~PAGE_MASK)
 
-/* fetch the pages addr resides in into pg and initialise sg with them */
+/* Physically contiguous pages, as those of a transparent or hugetlbfs
+ * huge page, can share a scatterlist entry. The struct pages must be
+ * adjacent as well, as the crypto API walks an entry with page + n.
+ */
+static inline int pages_contiguous(struct page *prev, struct page *next)
+{
+	return next == prev + 1 && page_to_pfn(next) == page_to_pfn(prev) + 1;
+}
+
+/* initialise sg with len bytes of the pages pg, starting at offset in
+ * the first one, merging contiguous pages into one entry. Returns the
+ * number of entries used, the last of them is marked as the end. */
+static unsigned int sg_set_pages(struct scatterlist *sg, struct page **pg,
+		unsigned int pgcount, unsigned int offset, uint32_t len)
+{
+	unsigned int i, nents = 1;
+	uint32_t pglen;
+
+	for (i = 1; i < pgcount; i++)
+		if (!pages_contiguous(pg[i - 1], pg[i]))
+			nents++;
+	sg_init_table(sg, nents);
+
+	pglen = min((uint32_t)(PAGE_SIZE - offset), len);
+	sg_set_page(sg, pg[0], pglen, offset);
+	len -= pglen;
+	for (i = 1; i < pgcount; i++) {
+		pglen = min((uint32_t)PAGE_SIZE, len);
+		if (pages_contiguous(pg[i - 1], pg[i]))
+			sg->length += pglen;
+		else
+			sg_set_page(++sg, pg[i], pglen, 0);
+		len -= pglen;
+	}
+	return nents;
+}
+
+/* fetch the pages addr resides in into pg and initialise sg with them.
+ * Returns the number of scatterlist entries used or a negative error. */
 int __get_userbuf(uint8_t __user *addr, uint32_t len, int write,
 		unsigned int pgcount, struct page **pg, struct scatterlist *sg,
 		struct task_struct *task, struct mm_struct *mm)
 {
-	int ret, pglen, i = 0;
-	struct scatterlist *sgp;
+	int ret, i;
 
 	if (unlikely(!pgcount || !len || !addr)) {
 		sg_mark_end(sg);
@@ -75,22 +119,15 @@ int __get_userbuf(uint8_t __user *addr, uint32_t len, int write,
 			pg, NULL, NULL);
 #endif
 	up_read(&mm->mmap_sem);
-	if (ret != pgcount)
+	trace_cryptodev_pin_pages(addr, len, pgcount, ret);
+	if (ret != pgcount) {
+		/* drop whatever was pinned before the failure */
+		for (i = 0; i < ret; i++)
+			put_page(pg[i]);
 		return -EINVAL;
-
-	sg_init_table(sg, pgcount);
-
-	pglen = min((ptrdiff_t)(PAGE_SIZE - PAGEOFFSET(addr)), (ptrdiff_t)len);
-	sg_set_page(sg, pg[i++], pglen, PAGEOFFSET(addr));
-
-	len -= pglen;
-	for (sgp = sg_next(sg); len; sgp = sg_next(sgp)) {
-		pglen = min((uint32_t)PAGE_SIZE, len);
-		sg_set_page(sgp, pg[i++], pglen, 0);
-		len -= pglen;
 	}
-	sg_mark_end(sg_last(sg, pgcount));
-	return 0;
+
+	return sg_set_pages(sg, pg, pgcount, PAGEOFFSET(addr), len);
 }
 
 int adjust_sg_array(struct csession *ses, int pagecount)
@@ -119,10 +156,21 @@ int adjust_sg_array(struct csession *ses, int pagecount)
 	return 0;
 }
 
+/* drop the pages of a buffer that was only read from */
+static void __release_userbuf(struct page **pg, unsigned int pgcount)
+{
+	unsigned int i;
+
+	for (i = 0; i < pgcount; i++)
+		put_page(pg[i]);
+}
+
 void release_user_pages(struct csession *ses)
 {
 	unsigned int i;
 
+	if (ses->used_pages)
+		trace_cryptodev_unpin_pages(ses->used_pages);
 	for (i = 0; i < ses->used_pages; i++) {
 		if (!PageReserved(ses->pages[i]))
 			SetPageDirty(ses->pages[i]);
@@ -181,7 +229,7 @@ int get_userbuf(struct csession *ses,
 			src_len = dst_len;
 		rc = __get_userbuf(src, src_len, 1, ses->used_pages,
 			               ses->pages, ses->sg, task, mm);
-		if (unlikely(rc)) {
+		if (unlikely(rc < 0)) {
 			derr(1, "failed to get user pages for data IO");
 			return rc;
 		}
@@ -195,7 +243,7 @@ int get_userbuf(struct csession *ses,
 	if (likely(src)) {
 		rc = __get_userbuf(src, src_len, 0, ses->readonly_pages,
 					   ses->pages, ses->sg, task, mm);
-		if (unlikely(rc)) {
+		if (unlikely(rc < 0)) {
 			derr(1, "failed to get user pages for data input");
 			return rc;
 		}
@@ -210,11 +258,355 @@ int get_userbuf(struct csession *ses,
 
 		rc = __get_userbuf(dst, dst_len, 1, writable_pages,
 					   dst_pages, *dst_sg, task, mm);
-		if (unlikely(rc)) {
+		if (unlikely(rc < 0)) {
 			derr(1, "failed to get user pages for data output");
-			release_user_pages(ses);  /* FIXME: use __release_userbuf(src, ...) */
+			/* __get_userbuf() dropped the dst pages it got */
+			__release_userbuf(ses->pages, ses->readonly_pages);
+			ses->used_pages = 0;
+			return rc;
+		}
+	}
+	return 0;
+}
+
+static unsigned int iov_pagecount(const struct iovec *iov,
+		unsigned int iovcnt)
+{
+	unsigned int i, pagecount = 0;
+
+	for (i = 0; i < iovcnt; i++)
+		pagecount += PAGECOUNT(iov[i].iov_base, iov[i].iov_len);
+	return pagecount;
+}
+
+/* pin the pages of all segments of iov into the session's page array
+ * starting at ses->used_pages, and link their scatterlists into one
+ * starting at sg. Returns the number of entries used. */
+static int __get_userbuf_iov(struct csession *ses,
+		const struct iovec *iov, unsigned int iovcnt, int write,
+		struct scatterlist *sg,
+		struct task_struct *task, struct mm_struct *mm)
+{
+	unsigned int i, pgcount, nents = 0;
+	int rc;
+
+	for (i = 0; i < iovcnt; i++) {
+		if (!iov[i].iov_len)
+			continue;
+
+		pgcount = PAGECOUNT(iov[i].iov_base, iov[i].iov_len);
+		rc = __get_userbuf(iov[i].iov_base, iov[i].iov_len, write,
+				pgcount, ses->pages + ses->used_pages,
+				sg + nents, task, mm);
+		if (unlikely(rc < 0))
 			return rc;
+
+		if (nents)
+			sg_unmark_end(sg + nents - 1);
+		ses->used_pages += pgcount;
+		nents += rc;
+	}
+
+	return nents;
+}
+
+/* make the data in the src and dst iovecs available in scatterlists,
+ * each spanning all segments. When dst is NULL the operation happens
+ * in place. The total lengths have been checked to be equal.
+ */
+int get_userbuf_iov(struct csession *ses,
+		const struct iovec *src, unsigned int src_iovcnt,
+		const struct iovec *dst, unsigned int dst_iovcnt,
+		struct task_struct *task, struct mm_struct *mm,
+		struct scatterlist **src_sg, struct scatterlist **dst_sg)
+{
+	unsigned int src_pagecount, dst_pagecount = 0;
+	int rc;
+
+	src_pagecount = iov_pagecount(src, src_iovcnt);
+	if (dst)
+		dst_pagecount = iov_pagecount(dst, dst_iovcnt);
+
+	if (src_pagecount + dst_pagecount > ses->array_size) {
+		rc = adjust_sg_array(ses, src_pagecount + dst_pagecount);
+		if (rc)
+			return rc;
+	}
+
+	ses->used_pages = 0;
+	ses->readonly_pages = dst ? src_pagecount : 0;
+
+	/* in place operation writes to the source, unless it is only hashed */
+	rc = __get_userbuf_iov(ses, src, src_iovcnt,
+			!dst && ses->cdata.init, ses->sg, task, mm);
+	if (unlikely(rc < 0))
+		goto err;
+	*src_sg = *dst_sg = ses->sg;
+
+	if (dst) {
+		*dst_sg = ses->sg + rc;
+		rc = __get_userbuf_iov(ses, dst, dst_iovcnt, 1, *dst_sg,
+				task, mm);
+		if (unlikely(rc < 0))
+			goto err;
+	}
+
+	return 0;
+
+err:
+	derr(1, "failed to get user pages for data IO");
+	release_user_pages(ses);
+	return rc;
+}
+
+/* Registered buffers are pinned once by CIOCREGBUF and stay pinned
+ * until CIOCUNREGBUF or until the handle is closed. Operations with
+ * COP_FLAG_REGBUF build their scatterlists straight from the pinned
+ * pages, skipping get_user_pages() and mmap_sem. The scatterlists are
+ * built per operation in the session's array rather than shared, as
+ * drivers store DMA addresses in them.
+ */
+
+/* Charge or uncharge pages to the locked memory of mm, as mlock()
+ * would. Charging fails with -ENOMEM beyond RLIMIT_MEMLOCK unless the
+ * caller has CAP_IPC_LOCK, so that handles, which anyone may open,
+ * cannot pin memory without bounds.
+ */
+static int regbuf_account(struct mm_struct *mm, unsigned long pages, bool inc)
+{
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(5, 2, 0))
+	return account_locked_vm(mm, pages, inc);
+#else
+	unsigned long limit;
+	int ret = 0;
+
+	down_write(&mm->mmap_sem);
+	if (inc) {
+		limit = rlimit(RLIMIT_MEMLOCK) >> PAGE_SHIFT;
+		if (mm->locked_vm + pages > limit && !capable(CAP_IPC_LOCK))
+			ret = -ENOMEM;
+		else
+			mm->locked_vm += pages;
+	} else {
+		mm->locked_vm -= min(pages, mm->locked_vm);
+	}
+	up_write(&mm->mmap_sem);
+
+	return ret;
+#endif
+}
+
+static void regbuf_release(struct kref *ref)
+{
+	struct regbuf *rb = container_of(ref, struct regbuf, ref);
+	unsigned int i;
+
+	ddebug(2, "releasing %u pinned pages at %p", rb->pagecount, rb->addr);
+	for (i = 0; i < rb->pagecount; i++) {
+		if (!PageReserved(rb->pages[i]))
+			SetPageDirty(rb->pages[i]);
+		put_page(rb->pages[i]);
+	}
+	regbuf_account(rb->mm, rb->pagecount, false);
+	mmdrop(rb->mm);
+	kfree(rb->pages);
+	kfree(rb);
+}
+
+int crypto_register_buf(struct fcrypt *fcr, struct crypt_regbuf_op *rop)
+{
+	struct scatterlist *sg;
+	struct regbuf *rb;
+	int i, rc;
+
+	if (unlikely(!rop->addr || !rop->len ||
+	             rop->len > CRYPTODEV_MAX_REGBUF_LEN)) {
+		derr(1, "invalid buffer %p of %u bytes", rop->addr, rop->len);
+		return -EINVAL;
+	}
+
+	rb = kzalloc(sizeof(*rb), GFP_KERNEL);
+	if (unlikely(!rb))
+		return -ENOMEM;
+
+	kref_init(&rb->ref);
+	rb->addr = rop->addr;
+	rb->len = rop->len;
+	rb->pagecount = PAGECOUNT(rop->addr, rop->len);
+	rb->pages = kcalloc(rb->pagecount, sizeof(struct page *), GFP_KERNEL);
+	/* __get_userbuf wants a scatterlist, only needed while pinning */
+	sg = kcalloc(rb->pagecount, sizeof(struct scatterlist), GFP_KERNEL);
+	if (unlikely(!rb->pages || !sg)) {
+		rc = -ENOMEM;
+		goto err_free;
+	}
+
+	rc = regbuf_account(current->mm, rb->pagecount, true);
+	if (unlikely(rc)) {
+		derr(1, "pinning %u pages would exceed RLIMIT_MEMLOCK",
+				rb->pagecount);
+		goto err_free;
+	}
+
+	rc = __get_userbuf(rb->addr, rb->len, 1, rb->pagecount,
+	                   rb->pages, sg, current, current->mm);
+	kfree(sg);
+	sg = NULL;
+	if (unlikely(rc < 0)) {
+		derr(1, "failed to pin %u pages at %p", rb->pagecount, rb->addr);
+		regbuf_account(current->mm, rb->pagecount, false);
+		goto err_free;
+	}
+
+	/* the pages are uncharged from this mm when released, which may
+	 * happen from another task once the handle is shared */
+	rb->mm = current->mm;
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(4, 11, 0))
+	mmgrab(rb->mm);
+#else
+	atomic_inc(&rb->mm->mm_count);
+#endif
+
+	spin_lock(&fcr->reglock);
+	for (i = 0; i < CRYPTODEV_MAX_REGBUFS; i++) {
+		if (!fcr->regbufs[i]) {
+			fcr->regbufs[i] = rb;
+			break;
+		}
+	}
+	spin_unlock(&fcr->reglock);
+
+	if (unlikely(i == CRYPTODEV_MAX_REGBUFS)) {
+		dwarning(1, "all %d buffer slots are in use", CRYPTODEV_MAX_REGBUFS);
+		kref_put(&rb->ref, regbuf_release);
+		return -ENOSPC;
+	}
+
+	ddebug(2, "registered buffer %d: %u pages at %p", i, rb->pagecount, rb->addr);
+	rop->index = i;
+	return 0;
+
+err_free:
+	kfree(sg);
+	kfree(rb->pages);
+	kfree(rb);
+	return rc;
+}
+
+int crypto_unregister_buf(struct fcrypt *fcr, uint32_t index)
+{
+	struct regbuf *rb;
+
+	if (unlikely(index >= CRYPTODEV_MAX_REGBUFS))
+		return -EINVAL;
+
+	spin_lock(&fcr->reglock);
+	rb = fcr->regbufs[index];
+	fcr->regbufs[index] = NULL;
+	spin_unlock(&fcr->reglock);
+
+	if (unlikely(!rb)) {
+		derr(1, "buffer %u is not registered", index);
+		return -ENOENT;
+	}
+
+	/* operations still using the buffer hold their own reference */
+	kref_put(&rb->ref, regbuf_release);
+	return 0;
+}
+
+void crypto_unregister_all_bufs(struct fcrypt *fcr)
+{
+	uint32_t i;
+
+	for (i = 0; i < CRYPTODEV_MAX_REGBUFS; i++)
+		if (fcr->regbufs[i])
+			crypto_unregister_buf(fcr, i);
+}
+
+/* Look up the registered buffer that contains [addr, addr + len).
+ * The returned buffer is referenced, release it with crypto_put_regbuf. */
+struct regbuf *crypto_get_regbuf(struct fcrypt *fcr,
+		void __user *addr, unsigned int len)
+{
+	struct regbuf *rb, *retval = NULL;
+	int i;
+
+	spin_lock(&fcr->reglock);
+	for (i = 0; i < CRYPTODEV_MAX_REGBUFS; i++) {
+		rb = fcr->regbufs[i];
+		if (rb && (uint8_t __user *)addr >= rb->addr &&
+		    (uint8_t __user *)addr + len <= rb->addr + rb->len) {
+			kref_get(&rb->ref);
+			retval = rb;
+			break;
 		}
 	}
+	spin_unlock(&fcr->reglock);
+
+	return retval;
+}
+
+void crypto_put_regbuf(struct regbuf *rb)
+{
+	kref_put(&rb->ref, regbuf_release);
+}
+
+/* initialise sg with the pinned pages [addr, addr + len) resides in */
+static void __get_regbuf(struct regbuf *rb, uint8_t __user *addr,
+		uint32_t len, struct scatterlist *sg)
+{
+	unsigned long offset = PAGEOFFSET(rb->addr) + (addr - rb->addr);
+
+	sg_set_pages(sg, rb->pages + (offset >> PAGE_SHIFT),
+			PAGECOUNT(addr, len), offset & ~PAGE_MASK, len);
+}
+
+/* make src and dst, both within registered buffers, available in
+ * scatterlists. dst might be the same as src, or NULL.
+ */
+int get_regbuf(struct csession *ses,
+		struct regbuf *src_rb, void __user *src,
+		struct regbuf *dst_rb, void __user *dst, unsigned int len,
+		struct scatterlist **src_sg, struct scatterlist **dst_sg)
+{
+	unsigned int src_pagecount = PAGECOUNT(src, len);
+	unsigned int pagecount = src_pagecount;
+	int rc;
+
+	if (dst && dst != src)
+		pagecount += PAGECOUNT(dst, len);
+	if (pagecount > ses->array_size) {
+		rc = adjust_sg_array(ses, pagecount);
+		if (rc)
+			return rc;
+	}
+
+	/* nothing is pinned here, so there is nothing to release */
+	ses->used_pages = 0;
+	ses->readonly_pages = 0;
+
+	__get_regbuf(src_rb, src, len, ses->sg);
+	*src_sg = ses->sg;
+
+	if (src == dst) {
+		*dst_sg = *src_sg;
+	} else if (dst) {
+		*dst_sg = ses->sg + src_pagecount;
+		__get_regbuf(dst_rb, dst, len, *dst_sg);
+	} else {
+		*dst_sg = NULL;
+	}
 	return 0;
 }
+
+/* the kernel wrote to [addr, addr + len) of a registered buffer */
+void flush_regbuf(struct regbuf *rb, void __user *addr, unsigned int len)
+{
+	unsigned long offset = PAGEOFFSET(rb->addr) +
+		((uint8_t __user *)addr - rb->addr);
+	unsigned int i, first = offset >> PAGE_SHIFT;
+
+	for (i = 0; i < PAGECOUNT(addr, len); i++)
+		flush_dcache_page(rb->pages[first + i]);
+}
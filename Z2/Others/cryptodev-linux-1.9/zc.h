@@ -16,6 +16,25 @@ int get_userbuf(struct csession *ses,
                 struct scatterlist **src_sg,
                 struct scatterlist **dst_sg);
 
+int get_userbuf_iov(struct csession *ses,
+		const struct iovec *src, unsigned int src_iovcnt,
+		const struct iovec *dst, unsigned int dst_iovcnt,
+		struct task_struct *task, struct mm_struct *mm,
+		struct scatterlist **src_sg, struct scatterlist **dst_sg);
+
+/* For registered buffers */
+int crypto_register_buf(struct fcrypt *fcr, struct crypt_regbuf_op *rop);
+int crypto_unregister_buf(struct fcrypt *fcr, uint32_t index);
+void crypto_unregister_all_bufs(struct fcrypt *fcr);
+struct regbuf *crypto_get_regbuf(struct fcrypt *fcr,
+		void __user *addr, unsigned int len);
+void crypto_put_regbuf(struct regbuf *rb);
+int get_regbuf(struct csession *ses,
+		struct regbuf *src_rb, void __user *src,
+		struct regbuf *dst_rb, void __user *dst, unsigned int len,
+		struct scatterlist **src_sg, struct scatterlist **dst_sg);
+void flush_regbuf(struct regbuf *rb, void __user *addr, unsigned int len);
+
 /* buflen ? (last page - first page + 1) : 0 */
 #define PAGECOUNT(buf, buflen) ((buflen) \
 	? ((((unsigned long)(buf + buflen - 1)) >> PAGE_SHIFT) - \